@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <uthash.h>
+
+#include "tj_error.h"
+#include "tj_alloc.h"
+
+#define TJ_ALLOC_HUGE_SIZE ((size_t) 2 << 20)
+
+// The least each first touch thread is given to fault
+#define TJ_ALLOC_TOUCH_MIN ((size_t) 8 << 20)
+#define TJ_ALLOC_TOUCH_MAX 64
+
+// From linux/mempolicy.h, which is not always installed
+#define TJ_ALLOC_MPOL_PREFERRED 1
+#define TJ_ALLOC_MPOL_INTERLEAVE 3
+
+#define TJ_ALLOC_MAX_NODES 1024
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+typedef struct {
+  void *m_ptr;
+  size_t m_length;           // Bytes mapped
+  size_t m_touched;          // Bytes handed out, and faulted if asked
+  UT_hash_handle hh;
+} tj_alloc_mapping;
+
+typedef struct {
+  char *m_start;
+  size_t m_length;
+  size_t m_page;
+} tj_alloc_touchRange;
+
+static pthread_mutex_t tj_alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tj_alloc_once = PTHREAD_ONCE_INIT;
+static tj_alloc_mapping *tj_alloc_mappings = 0;
+static size_t tj_alloc_mapped = 0;
+static uintptr_t tj_alloc_low = UINTPTR_MAX;  // Bounds of every mapping,
+static uintptr_t tj_alloc_high = 0;           // widened under tj_alloc_lock
+static tj_alloc_policy tj_alloc_default = { 0 };
+
+static size_t tj_alloc_pageSize = 4096;
+static unsigned long tj_alloc_nodes[TJ_ALLOC_MAX_NODES / (8*sizeof(long))];
+static int tj_alloc_haveNodes = 0;
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static void
+tj_alloc_init(void)
+{
+  unsigned int a, b;
+  FILE *fp;
+  int c;
+
+  tj_alloc_pageSize = sysconf(_SC_PAGESIZE);
+
+  //-- Online nodes are listed as ranges, such as "0-1,4"
+  if ((fp = fopen("/sys/devices/system/node/online", "r")) == 0)
+    return;
+  while (fscanf(fp, "%u", &a) == 1) {
+    b = a;
+    if ((c = fgetc(fp)) == '-') {
+      if (fscanf(fp, "%u", &b) != 1)
+        break;
+      c = fgetc(fp);
+    }
+    for (; a <= b && a < TJ_ALLOC_MAX_NODES; a++) {
+      tj_alloc_nodes[a / (8*sizeof(long))] |= 1UL << (a % (8*sizeof(long)));
+      tj_alloc_haveNodes = 1;
+    }
+    if (c != ',')
+      break;
+  }
+  fclose(fp);
+  // end tj_alloc_init
+}
+
+/*
+ * Fill in the policy to follow, returning 0 if n is too small for it.
+ */
+static int
+tj_alloc_getPolicy(size_t n, const tj_alloc_policy *policy,
+                   tj_alloc_policy *into)
+{
+  memset(into, 0, sizeof(*into));
+
+  if (policy != 0) {
+    *into = *policy;
+  } else {
+    //-- Checked first so that allocations below it take no lock
+    if (__atomic_load_n(&tj_alloc_default.m_threshold, __ATOMIC_RELAXED) == 0)
+      return 0;
+    pthread_mutex_lock(&tj_alloc_lock);
+    *into = tj_alloc_default;
+    pthread_mutex_unlock(&tj_alloc_lock);
+  }
+
+  return into->m_threshold != 0 && n >= into->m_threshold;
+  // end tj_alloc_getPolicy
+}
+
+static size_t
+tj_alloc_round(size_t n, const tj_alloc_policy *policy)
+{
+  size_t unit = (policy->m_pages == TJ_ALLOC_PAGES_DEFAULT) ?
+    tj_alloc_pageSize : TJ_ALLOC_HUGE_SIZE;
+  return (n + unit - 1) / unit * unit;
+  // end tj_alloc_round
+}
+
+/*
+ * Widen the bounds to cover a mapping, with tj_alloc_lock held.  They
+ * only shrink when the last mapping goes, so that tj_alloc_find() can
+ * read them without the lock.
+ */
+static void
+tj_alloc_widen(const void *p, size_t length)
+{
+  uintptr_t low = (uintptr_t) p, high = (uintptr_t) p + length;
+
+  if (low < tj_alloc_low)
+    __atomic_store_n(&tj_alloc_low, low, __ATOMIC_RELEASE);
+  if (high > tj_alloc_high)
+    __atomic_store_n(&tj_alloc_high, high, __ATOMIC_RELEASE);
+  // end tj_alloc_widen
+}
+
+static tj_alloc_mapping *
+tj_alloc_find(const void *p)
+{
+  tj_alloc_mapping *m;
+
+  //-- Most pointers are malloc'd, and fall outside every mapping
+  if (__atomic_load_n(&tj_alloc_mapped, __ATOMIC_ACQUIRE) == 0 ||
+      ((uintptr_t) p & (tj_alloc_pageSize-1)) != 0 ||
+      (uintptr_t) p < __atomic_load_n(&tj_alloc_low, __ATOMIC_ACQUIRE) ||
+      (uintptr_t) p >= __atomic_load_n(&tj_alloc_high, __ATOMIC_ACQUIRE))
+    return 0;
+
+  pthread_mutex_lock(&tj_alloc_lock);
+  HASH_FIND_PTR(tj_alloc_mappings, &p, m);
+  pthread_mutex_unlock(&tj_alloc_lock);
+  return m;
+  // end tj_alloc_find
+}
+
+//----------------------------------------------------------------------
+/*
+ * Apply the page and placement parts of a policy to a mapping.  Pages
+ * already faulted keep their placement.
+ */
+static void
+tj_alloc_advise(void *p, size_t length, const tj_alloc_policy *policy)
+{
+  unsigned long mask[TJ_ALLOC_MAX_NODES / (8*sizeof(long))];
+  unsigned int cpu, node;
+
+  if (policy->m_pages != TJ_ALLOC_PAGES_DEFAULT)
+    madvise(p, length, MADV_HUGEPAGE);
+
+  switch (policy->m_placement) {
+  case TJ_ALLOC_NODE_LOCAL:
+    if (syscall(SYS_getcpu, &cpu, &node, 0) == -1 ||
+        node >= TJ_ALLOC_MAX_NODES)
+      break;
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8*sizeof(long))] = 1UL << (node % (8*sizeof(long)));
+    syscall(SYS_mbind, p, length, TJ_ALLOC_MPOL_PREFERRED, mask,
+            8*sizeof(mask), 0);
+    break;
+
+  case TJ_ALLOC_NODE_INTERLEAVE:
+    if (tj_alloc_haveNodes)
+      syscall(SYS_mbind, p, length, TJ_ALLOC_MPOL_INTERLEAVE, tj_alloc_nodes,
+              8*sizeof(tj_alloc_nodes), 0);
+    break;
+
+  default:
+    break;
+  }
+  // end tj_alloc_advise
+}
+
+static void *
+tj_alloc_touchThread(void *arg)
+{
+  tj_alloc_touchRange *r = arg;
+  volatile char *c;
+
+  for (c = r->m_start; c < r->m_start + r->m_length; c += r->m_page)
+    *c = 0;
+  return 0;
+  // end tj_alloc_touchThread
+}
+
+/*
+ * Fault in fresh, never handed out, memory from several threads at
+ * once, so that it is zeroed and placed in parallel.
+ */
+static void
+tj_alloc_touch(char *start, size_t length, unsigned int threads)
+{
+  tj_alloc_touchRange ranges[TJ_ALLOC_TOUCH_MAX];
+  pthread_t ids[TJ_ALLOC_TOUCH_MAX];
+  int started[TJ_ALLOC_TOUCH_MAX];
+  size_t slice;
+  unsigned int i;
+
+  if (threads > TJ_ALLOC_TOUCH_MAX)
+    threads = TJ_ALLOC_TOUCH_MAX;
+  if (threads > length / TJ_ALLOC_TOUCH_MIN)
+    threads = length / TJ_ALLOC_TOUCH_MIN;
+  if (threads < 2)
+    return;
+
+  slice = (length / threads + tj_alloc_pageSize - 1) &
+    ~(tj_alloc_pageSize - 1);
+  for (i = 0; i < threads; i++) {
+    ranges[i].m_start = start + i * slice;
+    ranges[i].m_length = (i == threads-1) ? length - i * slice : slice;
+    ranges[i].m_page = tj_alloc_pageSize;
+    started[i] = (i > 0 && pthread_create(&ids[i], 0, &tj_alloc_touchThread,
+                                          &ranges[i]) == 0);
+  }
+
+  //-- This thread takes the first slice and any that failed to start
+  for (i = 0; i < threads; i++) {
+    if (!started[i])
+      tj_alloc_touchThread(&ranges[i]);
+  }
+  for (i = 1; i < threads; i++) {
+    if (started[i])
+      pthread_join(ids[i], 0);
+  }
+  // end tj_alloc_touch
+}
+
+static void *
+tj_alloc_map(size_t n, const tj_alloc_policy *policy)
+{
+  tj_alloc_mapping *m;
+  size_t length = tj_alloc_round(n, policy);
+  void *p = MAP_FAILED;
+
+  //-- Reserved up front, as a fault without a huge page free is SIGBUS
+  if (policy->m_pages == TJ_ALLOC_PAGES_HUGETLB)
+    p = mmap(0, length, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p == MAP_FAILED &&
+      (p = mmap(0, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0))
+      == MAP_FAILED) {
+    TJ_ERROR("Could not map %zu bytes.", length);
+    return 0;
+  }
+
+  if ((m = malloc(sizeof(tj_alloc_mapping))) == 0) {
+    TJ_ERROR("No memory for tj_alloc_mapping.");
+    munmap(p, length);
+    return 0;
+  }
+
+  tj_alloc_advise(p, length, policy);
+  if (policy->m_touchThreads > 1)
+    tj_alloc_touch(p, n, policy->m_touchThreads);
+
+  m->m_ptr = p;
+  m->m_length = length;
+  m->m_touched = n;
+
+  pthread_mutex_lock(&tj_alloc_lock);
+  HASH_ADD_PTR(tj_alloc_mappings, m_ptr, m);
+  tj_alloc_widen(p, length);
+  __atomic_add_fetch(&tj_alloc_mapped, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&tj_alloc_lock);
+
+  return p;
+  // end tj_alloc_map
+}
+
+static void *
+tj_alloc_remap(tj_alloc_mapping *m, size_t n, const tj_alloc_policy *policy)
+{
+  size_t length;
+  void *p;
+
+  if (n > m->m_length) {
+    //-- Reserve address space generously so growth rarely remaps
+    length = tj_alloc_round((n > 2*m->m_length) ? n : 2*m->m_length, policy);
+    //-- Older kernels cannot remap huge pages, so copy instead
+    if ((p = mremap(m->m_ptr, m->m_length, length, MREMAP_MAYMOVE))
+        == MAP_FAILED) {
+      if ((p = tj_alloc_map(n, policy)) == 0)
+        return 0;
+      memcpy(p, m->m_ptr, m->m_touched);
+      tj_alloc_free(m->m_ptr);
+      return p;
+    }
+
+    pthread_mutex_lock(&tj_alloc_lock);
+    HASH_DEL(tj_alloc_mappings, m);
+    m->m_ptr = p;
+    m->m_length = length;
+    HASH_ADD_PTR(tj_alloc_mappings, m_ptr, m);
+    tj_alloc_widen(p, length);
+    pthread_mutex_unlock(&tj_alloc_lock);
+
+    tj_alloc_advise(p, length, policy);
+  }
+
+  if (n > m->m_touched) {
+    if (policy->m_touchThreads > 1)
+      tj_alloc_touch((char *) m->m_ptr + m->m_touched, n - m->m_touched,
+                     policy->m_touchThreads);
+    m->m_touched = n;
+  }
+
+  return m->m_ptr;
+  // end tj_alloc_remap
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+void
+tj_alloc_setDefaultPolicy(const tj_alloc_policy *policy)
+{
+  pthread_once(&tj_alloc_once, &tj_alloc_init);
+
+  pthread_mutex_lock(&tj_alloc_lock);
+  if (policy != 0)
+    tj_alloc_default = *policy;
+  else
+    memset(&tj_alloc_default, 0, sizeof(tj_alloc_default));
+  pthread_mutex_unlock(&tj_alloc_lock);
+  // end tj_alloc_setDefaultPolicy
+}
+
+void *
+tj_alloc_malloc(size_t n, const tj_alloc_policy *policy)
+{
+  tj_alloc_policy p;
+
+  if (!tj_alloc_getPolicy(n, policy, &p))
+    return malloc(n);
+
+  pthread_once(&tj_alloc_once, &tj_alloc_init);
+  return tj_alloc_map(n, &p);
+  // end tj_alloc_malloc
+}
+
+void *
+tj_alloc_realloc(void *ptr, size_t n, const tj_alloc_policy *policy)
+{
+  tj_alloc_mapping *m;
+  tj_alloc_policy p;
+  size_t old;
+  void *q;
+
+  if (ptr == 0)
+    return tj_alloc_malloc(n, policy);
+
+  //-- Mappings stay mapped, even if shrunk below the threshold
+  if ((m = tj_alloc_find(ptr)) != 0) {
+    tj_alloc_getPolicy(n, policy, &p);
+    return tj_alloc_remap(m, n, &p);
+  }
+
+  if (!tj_alloc_getPolicy(n, policy, &p))
+    return realloc(ptr, n);
+
+  pthread_once(&tj_alloc_once, &tj_alloc_init);
+  if ((q = tj_alloc_map(n, &p)) == 0)
+    return 0;
+  old = malloc_usable_size(ptr);
+  memcpy(q, ptr, (old < n) ? old : n);
+  free(ptr);
+  return q;
+  // end tj_alloc_realloc
+}
+
+void
+tj_alloc_free(void *p)
+{
+  tj_alloc_mapping *m;
+
+  if (p == 0)
+    return;
+
+  if ((m = tj_alloc_find(p)) == 0) {
+    free(p);
+    return;
+  }
+
+  pthread_mutex_lock(&tj_alloc_lock);
+  HASH_DEL(tj_alloc_mappings, m);
+  if (__atomic_sub_fetch(&tj_alloc_mapped, 1, __ATOMIC_RELEASE) == 0) {
+    __atomic_store_n(&tj_alloc_low, UINTPTR_MAX, __ATOMIC_RELAXED);
+    __atomic_store_n(&tj_alloc_high, 0, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&tj_alloc_lock);
+
+  munmap(m->m_ptr, m->m_length);
+  free(m);
+  // end tj_alloc_free
+}
+
+int
+tj_alloc_isMapped(const void *p)
+{
+  return tj_alloc_find(p) != 0;
+  // end tj_alloc_isMapped
+}
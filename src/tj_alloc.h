@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __tj_alloc_h__
+#define __tj_alloc_h__
+
+#include <stddef.h>
+
+/*
+ * tj_alloc places large allocations according to a policy: on huge
+ * pages, and on the local NUMA node or interleaved across all nodes.
+ * Allocations below a policy's threshold, or made without a policy,
+ * come from malloc() as usual.  Larger ones are mapped directly, with
+ * room to grow, so that they can be advised and bound as a whole.
+ * Page and placement requests are advisory; a kernel or machine
+ * without huge pages or NUMA simply gets ordinary memory.
+ */
+typedef enum {
+  TJ_ALLOC_PAGES_DEFAULT,      // Ordinary pages
+  TJ_ALLOC_PAGES_HUGE,         // Transparent huge pages, via madvise()
+  TJ_ALLOC_PAGES_HUGETLB,      // Reserved huge pages, else as HUGE
+} tj_alloc_pages;
+
+typedef enum {
+  TJ_ALLOC_NODE_DEFAULT,       // Wherever each page is first touched
+  TJ_ALLOC_NODE_LOCAL,         // The node of the allocating thread
+  TJ_ALLOC_NODE_INTERLEAVE,    // Round robin across all nodes
+} tj_alloc_placement;
+
+typedef struct {
+  size_t m_threshold;          // Smallest size the policy applies to
+  tj_alloc_pages m_pages;
+  tj_alloc_placement m_placement;
+  unsigned int m_touchThreads; // Fault new pages in up to 64 threads
+} tj_alloc_policy;
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/**
+ * Set the policy for allocations made without one of their own, such
+ * as by tj_buffers and tj_arrays not given a policy.  The default
+ * default has a threshold of 0, applying to nothing.
+ *
+ * \param policy The policy to copy, or 0 to restore the default.
+ */
+void
+tj_alloc_setDefaultPolicy(const tj_alloc_policy *policy);
+
+/**
+ * Allocate memory.
+ *
+ * \param n The number of bytes.
+ * \param policy The policy to follow, or 0 for the default policy.
+ * \return The memory, or 0 on failure.
+ */
+void *
+tj_alloc_malloc(size_t n, const tj_alloc_policy *policy);
+
+/**
+ * Resize memory from tj_alloc_malloc, or from malloc(), as realloc()
+ * does.  Memory which grows past the policy's threshold is moved into
+ * a mapping following the policy.  Mappings are grown in place when
+ * possible, and otherwise moved without copying.
+ *
+ * \param p The memory to resize, or 0.
+ * \param n The new size in bytes.
+ * \param policy The policy to follow, or 0 for the default policy.
+ * \return The memory, or 0 on failure, in which case p is unchanged.
+ */
+void *
+tj_alloc_realloc(void *p, size_t n, const tj_alloc_policy *policy);
+
+/**
+ * Free memory from tj_alloc_malloc or tj_alloc_realloc, or from
+ * malloc().
+ */
+void
+tj_alloc_free(void *p);
+
+/**
+ * Whether memory was mapped by tj_alloc rather than from malloc().
+ */
+int
+tj_alloc_isMapped(const void *p);
+
+#endif // __tj_alloc_h__
@@ -28,6 +28,7 @@
 #include <sys/types.h>
 
 #include "tj_array.h"
+#include "tj_sort.h"
 
 #ifdef UNIT_TESTING
 #   undef assert
@@ -39,10 +40,23 @@ struct tj_array {
     size_t capacity;
 
     void **array;
+    const tj_alloc_policy *policy;
 };
 
 static const size_t DEFAULT_LIST_SIZE = 5;
 
+/* Items are sorted paired with their keys, so each key is extracted once. */
+typedef struct {
+    uint64_t key;
+    void *item;
+} tj_array_keyed;
+
+static uint64_t tj_array_keyedKey(const tj_array_keyed *e) {
+    return e->key;
+}
+
+TJ_SORT_DECL(tj_array_keyed, tj_array_keyed, uint64_t, tj_array_keyedKey)
+
 tj_array *tj_array_create(size_t capacity) {
     tj_array *array = malloc(sizeof(*array));
     if (array == NULL) {
@@ -52,9 +66,10 @@ tj_array *tj_array_create(size_t capacity) {
     array->count = 0;
     array->capacity = capacity;
     array->array = NULL;
+    array->policy = NULL;
 
     if (array->capacity > 0) {
-        array->array = malloc(capacity * sizeof(void*));
+        array->array = tj_alloc_malloc(capacity * sizeof(void*), NULL);
         if (array->array == NULL) {
             free(array);
             return NULL;
@@ -66,11 +81,15 @@ tj_array *tj_array_create(size_t capacity) {
 
 void tj_array_finalize(tj_array *array) {
     if (array->array != NULL) {
-        free(array->array);
+        tj_alloc_free(array->array);
     }
     free(array);
 }
 
+void tj_array_setAllocPolicy(tj_array *array, const tj_alloc_policy *policy) {
+    array->policy = policy;
+}
+
 size_t tj_array_count(const tj_array *array) {
     return array->count;
 }
@@ -92,8 +111,8 @@ int tj_array_append(tj_array *array, void *item) {
             array->capacity = (array->capacity) * 2;
         }
 
-        void **new_array = realloc(array->array,
-                array->capacity * sizeof(void*));
+        void **new_array = tj_alloc_realloc(array->array,
+                array->capacity * sizeof(void*), array->policy);
         if (new_array == NULL) {
             return 0;
         }
@@ -131,3 +150,35 @@ ssize_t tj_array_find(const tj_array *array, void *item) {
     }
     return -1;
 }
+
+int tj_array_sortByKey(tj_array *array, uint64_t (*key)(const void *item),
+                       int threads) {
+    tj_array_keyed *keyed;
+    size_t i;
+
+    if (array->count < 2) {
+        return 1;
+    }
+
+    keyed = tj_alloc_malloc(array->count * sizeof(*keyed), array->policy);
+    if (keyed == NULL) {
+        return 0;
+    }
+
+    for (i = 0; i < array->count; i++) {
+        keyed[i].key = key(array->array[i]);
+        keyed[i].item = array->array[i];
+    }
+
+    if (!tj_array_keyed_radixThreaded(keyed, array->count, threads)) {
+        tj_alloc_free(keyed);
+        return 0;
+    }
+
+    for (i = 0; i < array->count; i++) {
+        array->array[i] = keyed[i].item;
+    }
+
+    tj_alloc_free(keyed);
+    return 1;
+}
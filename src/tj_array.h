@@ -32,6 +32,10 @@
 
 #pragma once
 
+#include <stdint.h>
+
+#include "tj_alloc.h"
+
 typedef struct tj_array tj_array;
 
 /**
@@ -44,6 +48,14 @@ tj_array *tj_array_create(size_t capacity);
 /** Frees a dynamic array. */
 void tj_array_finalize(tj_array *array);
 
+/**
+ * Set the policy the array's storage is allocated under as it grows.
+ *
+ * \param policy The policy, which must outlive the array, or NULL for
+ * the default tj_alloc policy.
+ */
+void tj_array_setAllocPolicy(tj_array *array, const tj_alloc_policy *policy);
+
 /** Returns the number of elements in the array. */
 size_t tj_array_count(const tj_array *array);
 
@@ -85,3 +97,14 @@ void tj_array_clear(tj_array *array);
  * \return -1 if item not found.
  */
 ssize_t tj_array_find(const tj_array *array, void *item);
+
+/**
+ * Sort the items by an unsigned integer key extracted from each, with
+ * a radix sort.  The sort is stable.
+ *
+ * \param key Returns the key of an item.
+ * \param threads The number of threads to sort with, or 1.
+ * \return 0 on failure, leaving the order unchanged, 1 otherwise.
+ */
+int tj_array_sortByKey(tj_array *array, uint64_t (*key)(const void *item),
+                       int threads);
@@ -0,0 +1,487 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#include "tj_alloc.h"
+#include "tj_bitset.h"
+#include "tj_error.h"
+
+#ifdef UNIT_TESTING
+#   undef assert
+#   define assert(x) mock_assert((int)(x), #x, __FILE__, __LINE__)
+#endif /* UNIT_TESTING */
+
+#define TJ_BITSET_WORDS(n) (((n) + 63) / 64)
+
+// The rank index counts bits before each superblock of 64 words, and
+// within that before each block of 8 words
+#define TJ_BITSET_SUPER 64
+#define TJ_BITSET_BLOCK 8
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * Bits past m_n in the last word are always clear, so whole words can
+ * be counted and searched.
+ */
+struct tj_bitset {
+  uint64_t *m_words;
+  size_t m_n;
+
+  uint64_t *m_super;
+  uint16_t *m_block;
+  size_t m_total;
+  char m_indexed;
+};
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+tj_bitset *
+tj_bitset_create(size_t n)
+{
+  tj_bitset *b;
+
+  if ((b = calloc(1, sizeof(tj_bitset))) == 0) {
+    TJ_ERROR("No memory for tj_bitset.");
+    return 0;
+  }
+
+  if (!tj_bitset_resize(b, n)) {
+    free(b);
+    return 0;
+  }
+
+  return b;
+  // end tj_bitset_create
+}
+
+void
+tj_bitset_finalize(tj_bitset *b)
+{
+  tj_alloc_free(b->m_words);
+  free(b->m_super);
+  free(b->m_block);
+  free(b);
+  // end tj_bitset_finalize
+}
+
+size_t
+tj_bitset_getSize(const tj_bitset *b)
+{
+  return b->m_n;
+  // end tj_bitset_getSize
+}
+
+int
+tj_bitset_resize(tj_bitset *b, size_t n)
+{
+  size_t old = TJ_BITSET_WORDS(b->m_n), words = TJ_BITSET_WORDS(n);
+  uint64_t *t;
+
+  if (words != old) {
+    if (words > SIZE_MAX / sizeof(uint64_t)) {
+      TJ_ERROR("Bitset of %zu bits is too large.", n);
+      return 0;
+    }
+    //-- At least one word, so the set always has storage
+    if ((t = tj_alloc_realloc(b->m_words,
+                              (words ? words : 1) * sizeof(uint64_t),
+                              0)) == 0) {
+      TJ_ERROR("Could not resize bitset from %zu to %zu bits.", b->m_n, n);
+      return 0;
+    }
+    b->m_words = t;
+    if (words > old)
+      memset(&b->m_words[old], 0, (words - old) * sizeof(uint64_t));
+  } else if (b->m_words == 0) {
+    if ((b->m_words = tj_alloc_malloc(sizeof(uint64_t), 0)) == 0) {
+      TJ_ERROR("No memory for tj_bitset.");
+      return 0;
+    }
+    b->m_words[0] = 0;
+  }
+
+  if (n < b->m_n && n % 64)
+    b->m_words[n / 64] &= (1ULL << (n % 64)) - 1;
+
+  b->m_n = n;
+  b->m_indexed = 0;
+  return 1;
+  // end tj_bitset_resize
+}
+
+//----------------------------------------------------------------------
+void
+tj_bitset_set(tj_bitset *b, size_t i)
+{
+  assert(i < b->m_n);
+  b->m_words[i / 64] |= 1ULL << (i % 64);
+  b->m_indexed = 0;
+  // end tj_bitset_set
+}
+
+void
+tj_bitset_clear(tj_bitset *b, size_t i)
+{
+  assert(i < b->m_n);
+  b->m_words[i / 64] &= ~(1ULL << (i % 64));
+  b->m_indexed = 0;
+  // end tj_bitset_clear
+}
+
+int
+tj_bitset_test(const tj_bitset *b, size_t i)
+{
+  assert(i < b->m_n);
+  return (b->m_words[i / 64] >> (i % 64)) & 1;
+  // end tj_bitset_test
+}
+
+/*
+ * Applies a mask to the words covering n bits from bit i, setting or
+ * clearing them.
+ */
+static void
+tj_bitset_maskRange(tj_bitset *b, size_t i, size_t n, int set)
+{
+  size_t w, last;
+  uint64_t head, tail;
+
+  assert(i <= b->m_n && n <= b->m_n - i);
+  if (n == 0)
+    return;
+
+  w = i / 64;
+  last = (i + n - 1) / 64;
+  head = ~0ULL << (i % 64);
+  tail = ~0ULL >> (63 - (i + n - 1) % 64);
+
+  if (w == last) {
+    head &= tail;
+    tail = 0;
+  } else if (last > w + 1) {
+    memset(&b->m_words[w + 1], set ? 0xff : 0,
+           (last - w - 1) * sizeof(uint64_t));
+  }
+
+  if (set) {
+    b->m_words[w] |= head;
+    b->m_words[last] |= tail;
+  } else {
+    b->m_words[w] &= ~head;
+    b->m_words[last] &= ~tail;
+  }
+
+  b->m_indexed = 0;
+  // end tj_bitset_maskRange
+}
+
+void
+tj_bitset_setRange(tj_bitset *b, size_t i, size_t n)
+{
+  tj_bitset_maskRange(b, i, n, 1);
+  // end tj_bitset_setRange
+}
+
+void
+tj_bitset_clearRange(tj_bitset *b, size_t i, size_t n)
+{
+  tj_bitset_maskRange(b, i, n, 0);
+  // end tj_bitset_clearRange
+}
+
+//----------------------------------------------------------------------
+/*
+ * Each operation combines two words at a time with SSE2 where
+ * available, and the remaining word on its own.
+ */
+#ifdef __SSE2__
+#define TJ_BITSET_VECTOR(VOP)                                           \
+  for (; w+2 <= words; w += 2) {                                        \
+    __m128i x = _mm_loadu_si128((const __m128i *) &dest->m_words[w]);   \
+    __m128i y = _mm_loadu_si128((const __m128i *) &src->m_words[w]);    \
+    _mm_storeu_si128((__m128i *) &dest->m_words[w], VOP);               \
+  }
+#else
+#define TJ_BITSET_VECTOR(VOP)
+#endif
+
+#define TJ_BITSET_BINARY(NAME, VOP, OP)                                 \
+  int                                                                   \
+  tj_bitset_##NAME(tj_bitset *dest, const tj_bitset *src)               \
+  {                                                                     \
+    size_t w = 0, words = TJ_BITSET_WORDS(dest->m_n);                   \
+                                                                        \
+    if (dest->m_n != src->m_n) {                                        \
+      TJ_ERROR("Bitsets differ in size, %zu and %zu.",                  \
+               dest->m_n, src->m_n);                                    \
+      return 0;                                                         \
+    }                                                                   \
+                                                                        \
+    TJ_BITSET_VECTOR(VOP)                                               \
+    for (; w < words; w++)                                              \
+      dest->m_words[w] = OP;                                            \
+                                                                        \
+    dest->m_indexed = 0;                                                \
+    return 1;                                                           \
+  }
+
+TJ_BITSET_BINARY(and, _mm_and_si128(x, y),
+                 dest->m_words[w] & src->m_words[w])
+TJ_BITSET_BINARY(or, _mm_or_si128(x, y),
+                 dest->m_words[w] | src->m_words[w])
+TJ_BITSET_BINARY(xor, _mm_xor_si128(x, y),
+                 dest->m_words[w] ^ src->m_words[w])
+TJ_BITSET_BINARY(andNot, _mm_andnot_si128(y, x),
+                 dest->m_words[w] & ~src->m_words[w])
+
+//----------------------------------------------------------------------
+static size_t
+tj_bitset_countWords(const uint64_t *words, size_t n)
+{
+  size_t c0 = 0, c1 = 0, c2 = 0, c3 = 0, w = 0;
+
+  //-- Independent sums, so several popcounts are in flight at once
+  for (; w+4 <= n; w += 4) {
+    c0 += __builtin_popcountll(words[w]);
+    c1 += __builtin_popcountll(words[w+1]);
+    c2 += __builtin_popcountll(words[w+2]);
+    c3 += __builtin_popcountll(words[w+3]);
+  }
+  for (; w < n; w++)
+    c0 += __builtin_popcountll(words[w]);
+
+  return c0 + c1 + c2 + c3;
+  // end tj_bitset_countWords
+}
+
+size_t
+tj_bitset_count(const tj_bitset *b)
+{
+  if (b->m_indexed)
+    return b->m_total;
+  return tj_bitset_countWords(b->m_words, TJ_BITSET_WORDS(b->m_n));
+  // end tj_bitset_count
+}
+
+size_t
+tj_bitset_findNext(const tj_bitset *b, size_t i)
+{
+  size_t w, words = TJ_BITSET_WORDS(b->m_n);
+  uint64_t x;
+
+  if (i >= b->m_n)
+    return b->m_n;
+
+  w = i / 64;
+  if ((x = b->m_words[w] & (~0ULL << (i % 64))) != 0)
+    return w*64 + __builtin_ctzll(x);
+
+  w++;
+#ifdef __SSE2__
+  //-- Skip runs of clear words four at a time
+  for (; w+4 <= words; w += 4) {
+    __m128i v = _mm_or_si128(
+      _mm_loadu_si128((const __m128i *) &b->m_words[w]),
+      _mm_loadu_si128((const __m128i *) &b->m_words[w+2]));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff)
+      break;
+  }
+#endif
+  for (; w < words; w++) {
+    if (b->m_words[w] != 0)
+      return w*64 + __builtin_ctzll(b->m_words[w]);
+  }
+
+  return b->m_n;
+  // end tj_bitset_findNext
+}
+
+size_t
+tj_bitset_getSetBits(const tj_bitset *b, size_t *from, size_t *out,
+                     size_t n)
+{
+  size_t w, words = TJ_BITSET_WORDS(b->m_n), count = 0;
+  uint64_t x;
+
+  if (n == 0 || *from >= b->m_n)
+    return 0;
+
+  w = *from / 64;
+  x = b->m_words[w] & (~0ULL << (*from % 64));
+  for (;;) {
+    while (x == 0) {
+      if (++w == words) {
+        *from = b->m_n;
+        return count;
+      }
+      x = b->m_words[w];
+    }
+
+    out[count++] = w*64 + __builtin_ctzll(x);
+    if (count == n)
+      break;
+    x &= x - 1;
+  }
+
+  *from = out[count-1] + 1;
+  return count;
+  // end tj_bitset_getSetBits
+}
+
+//----------------------------------------------------------------------
+int
+tj_bitset_buildIndex(tj_bitset *b)
+{
+  size_t words = TJ_BITSET_WORDS(b->m_n), w, total = 0, inSuper = 0;
+  size_t supers = words / TJ_BITSET_SUPER + 1;
+  size_t blocks = words / TJ_BITSET_BLOCK + 1;
+  uint64_t *s;
+  uint16_t *k;
+
+  if (b->m_indexed)
+    return 1;
+
+  if ((s = realloc(b->m_super, supers * sizeof(uint64_t))) == 0) {
+    TJ_ERROR("No memory for bitset index.");
+    return 0;
+  }
+  b->m_super = s;
+  if ((k = realloc(b->m_block, blocks * sizeof(uint16_t))) == 0) {
+    TJ_ERROR("No memory for bitset index.");
+    return 0;
+  }
+  b->m_block = k;
+
+  for (w = 0; w < words; w++) {
+    if (w % TJ_BITSET_SUPER == 0) {
+      s[w / TJ_BITSET_SUPER] = total;
+      inSuper = 0;
+    }
+    if (w % TJ_BITSET_BLOCK == 0)
+      k[w / TJ_BITSET_BLOCK] = inSuper;
+    inSuper += __builtin_popcountll(b->m_words[w]);
+    total += __builtin_popcountll(b->m_words[w]);
+  }
+
+  b->m_total = total;
+  b->m_indexed = 1;
+  return 1;
+  // end tj_bitset_buildIndex
+}
+
+size_t
+tj_bitset_rank(tj_bitset *b, size_t i)
+{
+  size_t w, start, r;
+
+  if (i >= b->m_n)
+    return tj_bitset_count(b);
+
+  w = i / 64;
+  if (tj_bitset_buildIndex(b)) {
+    start = w / TJ_BITSET_BLOCK * TJ_BITSET_BLOCK;
+    r = b->m_super[w / TJ_BITSET_SUPER] + b->m_block[w / TJ_BITSET_BLOCK];
+  } else {
+    start = 0;
+    r = 0;
+  }
+
+  r += tj_bitset_countWords(&b->m_words[start], w - start);
+  return r + __builtin_popcountll(b->m_words[w] &
+                                  ((1ULL << (i % 64)) - 1));
+  // end tj_bitset_rank
+}
+
+/*
+ * The position of the k-th set bit of a word, which has more than k.
+ */
+static int
+tj_bitset_selectWord(uint64_t x, size_t k)
+{
+#ifdef __BMI2__
+  return __builtin_ctzll(_pdep_u64(1ULL << k, x));
+#else
+  for (; k > 0; k--)
+    x &= x - 1;
+  return __builtin_ctzll(x);
+#endif
+  // end tj_bitset_selectWord
+}
+
+int
+tj_bitset_select(tj_bitset *b, size_t k, size_t *i)
+{
+  size_t words = TJ_BITSET_WORDS(b->m_n), w = 0, lo, hi, mid, end, c;
+
+  if (tj_bitset_buildIndex(b)) {
+    if (k >= b->m_total)
+      return 0;
+
+    //-- The last superblock starting at or before the k-th bit
+    lo = 0;
+    hi = (words - 1) / TJ_BITSET_SUPER;
+    while (lo < hi) {
+      mid = (lo + hi + 1) / 2;
+      if (b->m_super[mid] <= k)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+    k -= b->m_super[lo];
+
+    w = lo * TJ_BITSET_SUPER;
+    end = w + TJ_BITSET_SUPER;
+    for (mid = w / TJ_BITSET_BLOCK + 1;
+         mid * TJ_BITSET_BLOCK < end && mid * TJ_BITSET_BLOCK < words &&
+           b->m_block[mid] <= k;
+         mid++)
+      ;
+    w = (mid - 1) * TJ_BITSET_BLOCK;
+    k -= b->m_block[mid - 1];
+  }
+
+  for (; w < words; w++) {
+    if ((c = __builtin_popcountll(b->m_words[w])) > k) {
+      *i = w*64 + tj_bitset_selectWord(b->m_words[w], k);
+      return 1;
+    }
+    k -= c;
+  }
+
+  return 0;
+  // end tj_bitset_select
+}
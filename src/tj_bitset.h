@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __tj_bitset_h__
+#define __tj_bitset_h__
+
+#include <stddef.h>
+
+/*
+ * A tj_bitset is a fixed size array of bits, stored as 64 bit words.
+ * Combining sets, counting, and searching work a word or a vector of
+ * words at a time.
+ *
+ * Rank and select use a small index, about 5% the size of the set,
+ * built on first use after the set is modified.  A set which is only
+ * read may be shared between threads once its index has been built
+ * with tj_bitset_buildIndex().
+ */
+typedef struct tj_bitset tj_bitset;
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/**
+ * Create a bitset with every bit clear.
+ *
+ * \param n The number of bits.
+ * \return The bitset, or 0 on failure.
+ */
+tj_bitset *
+tj_bitset_create(size_t n);
+
+void
+tj_bitset_finalize(tj_bitset *b);
+
+size_t
+tj_bitset_getSize(const tj_bitset *b);
+
+/**
+ * Change the number of bits.  Bits added are clear.
+ *
+ * \return 0 on failure, in which case the set is unchanged, 1
+ * otherwise.
+ */
+int
+tj_bitset_resize(tj_bitset *b, size_t n);
+
+//----------------------------------------------------------------------
+void
+tj_bitset_set(tj_bitset *b, size_t i);
+
+void
+tj_bitset_clear(tj_bitset *b, size_t i);
+
+int
+tj_bitset_test(const tj_bitset *b, size_t i);
+
+/**
+ * Set n bits from bit i.
+ */
+void
+tj_bitset_setRange(tj_bitset *b, size_t i, size_t n);
+
+/**
+ * Clear n bits from bit i.
+ */
+void
+tj_bitset_clearRange(tj_bitset *b, size_t i, size_t n);
+
+//----------------------------------------------------------------------
+/**
+ * Combine another bitset of the same size into this one: dest & src,
+ * dest | src, dest ^ src, and dest & ~src respectively.
+ *
+ * \return 0 if the sizes differ, 1 otherwise.
+ */
+int
+tj_bitset_and(tj_bitset *dest, const tj_bitset *src);
+
+int
+tj_bitset_or(tj_bitset *dest, const tj_bitset *src);
+
+int
+tj_bitset_xor(tj_bitset *dest, const tj_bitset *src);
+
+int
+tj_bitset_andNot(tj_bitset *dest, const tj_bitset *src);
+
+//----------------------------------------------------------------------
+/**
+ * The number of set bits.
+ */
+size_t
+tj_bitset_count(const tj_bitset *b);
+
+/**
+ * Find the first set bit at or after bit i.
+ *
+ * \return Its index, or the size of the set if there is none.
+ */
+size_t
+tj_bitset_findNext(const tj_bitset *b, size_t i);
+
+/**
+ * List set bits in bulk.
+ *
+ * \param b The bitset.
+ * \param from The bit to start from, updated to where to continue.
+ * \param out Filled in with the indices of set bits, in order.
+ * \param n The most indices to fill in.
+ * \return The number of indices filled in; 0 once none remain.
+ */
+size_t
+tj_bitset_getSetBits(const tj_bitset *b, size_t *from, size_t *out,
+                     size_t n);
+
+//----------------------------------------------------------------------
+/**
+ * Build the index used by rank and select, if the set has changed
+ * since it was last built.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_bitset_buildIndex(tj_bitset *b);
+
+/**
+ * The number of set bits before bit i.
+ */
+size_t
+tj_bitset_rank(tj_bitset *b, size_t i);
+
+/**
+ * Find the k-th set bit, counting from 0.
+ *
+ * \param b The bitset.
+ * \param k Which set bit to find.
+ * \param i Set to the bit's index.
+ * \return 1 if it was found, 0 if there are k or fewer set bits.
+ */
+int
+tj_bitset_select(tj_bitset *b, size_t k, size_t *i);
+
+#endif // __tj_bitset_h__
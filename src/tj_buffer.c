@@ -23,11 +23,13 @@
  */
 
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "tj_buffer.h"
+#include "tj_trace.h"
 
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
@@ -55,6 +57,23 @@
 #define TJ_PAGE_SIZE (size_t) 1024
 #endif
 
+// Pooled buffers are 2^TJ_BUFFER_POOL_MIN_SHIFT to 2^TJ_BUFFER_POOL_MAX_SHIFT
+// bytes, with up to TJ_BUFFER_POOL_THREAD per class cached by each thread
+#ifndef TJ_BUFFER_POOL_MIN_SHIFT
+#define TJ_BUFFER_POOL_MIN_SHIFT 6
+#endif
+
+#ifndef TJ_BUFFER_POOL_MAX_SHIFT
+#define TJ_BUFFER_POOL_MAX_SHIFT 24
+#endif
+
+#ifndef TJ_BUFFER_POOL_THREAD
+#define TJ_BUFFER_POOL_THREAD 8
+#endif
+
+#define TJ_BUFFER_POOL_CLASSES \
+  (TJ_BUFFER_POOL_MAX_SHIFT - TJ_BUFFER_POOL_MIN_SHIFT + 1)
+
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
 struct tj_buffer {
@@ -62,21 +81,293 @@ struct tj_buffer {
   size_t m_used;
   size_t m_n;
   char m_own;
+  const tj_alloc_policy *m_policy;
+  size_t m_gap;               // Start of the gap, while open
+  char m_gapMode;
+  char m_gapOpen;
+  tj_buffer *m_next;          // While held by the pool
 };
 
+/*
+ * Pooled buffers are kept by size class, the floor of the log2 of
+ * their allocation, first in a cache private to the finalizing thread
+ * and then in a shared overflow.  m_cached counts the bytes held in
+ * both, and is never allowed past m_highWater.
+ */
+typedef struct {
+  tj_buffer *m_free[TJ_BUFFER_POOL_CLASSES];
+  int m_count[TJ_BUFFER_POOL_CLASSES];
+} tj_buffer_poolCache;
+
+static struct {
+  pthread_mutex_t m_lock;
+  pthread_once_t m_once;
+  pthread_key_t m_key;
+  tj_buffer *m_free[TJ_BUFFER_POOL_CLASSES];
+  size_t m_highWater;
+  size_t m_cached;
+} tj_buffer_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_ONCE_INIT };
+
+static __thread tj_buffer_poolCache *tj_buffer_poolCache__ = 0;
+
+/*
+ * The memory of frozen buffers is held by a tj_buffer_memory, which
+ * counts one reference for each shared buffer or slice viewing it.
+ */
+typedef struct {
+  int m_refs;
+  tj_buffer_byte *m_buff;
+} tj_buffer_memory;
+
+struct tj_buffer_shared {
+  int m_refs;
+  tj_buffer_memory *m_memory;
+  const tj_buffer_byte *m_bytes;
+  size_t m_used;
+};
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static void
+tj_buffer_pool_exited(void *data)
+{
+  tj_buffer_poolCache *cache = data;
+  tj_buffer *b;
+  int c;
+
+  //-- Hand the exiting thread's buffers to the shared overflow
+  pthread_mutex_lock(&tj_buffer_pool.m_lock);
+  for (c = 0; c < TJ_BUFFER_POOL_CLASSES; c++) {
+    while ((b = cache->m_free[c]) != 0) {
+      cache->m_free[c] = b->m_next;
+      b->m_next = tj_buffer_pool.m_free[c];
+      tj_buffer_pool.m_free[c] = b;
+    }
+  }
+  pthread_mutex_unlock(&tj_buffer_pool.m_lock);
+
+  //-- Later thread destructors may still finalize buffers
+  tj_buffer_poolCache__ = 0;
+  free(cache);
+  // end tj_buffer_pool_exited
+}
+
+static void
+tj_buffer_pool_init(void)
+{
+  if (pthread_key_create(&tj_buffer_pool.m_key, &tj_buffer_pool_exited) != 0)
+    TJ_ERROR("Could not create buffer pool thread key.");
+  // end tj_buffer_pool_init
+}
+
+static tj_buffer_poolCache *
+tj_buffer_pool_getCache(void)
+{
+  tj_buffer_poolCache *cache;
+
+  if ((cache = tj_buffer_poolCache__) != 0)
+    return cache;
+
+  if ((cache = calloc(1, sizeof(tj_buffer_poolCache))) == 0) {
+    TJ_ERROR("No memory for buffer pool cache.");
+    return 0;
+  }
+
+  pthread_once(&tj_buffer_pool.m_once, &tj_buffer_pool_init);
+  pthread_setspecific(tj_buffer_pool.m_key, cache);
+
+  return (tj_buffer_poolCache__ = cache);
+  // end tj_buffer_pool_getCache
+}
+
+static int
+tj_buffer_pool_shift(size_t n)
+{
+  return 63 - __builtin_clzll(n);
+  // end tj_buffer_pool_shift
+}
+
+/*
+ * Take a pooled buffer with at least n bytes allocated, if there is
+ * one.  Its own class is the only one certain to fit, but the head of
+ * the class below is tried as well, as it often does.
+ */
+static tj_buffer *
+tj_buffer_pool_get(size_t n)
+{
+  tj_buffer_poolCache *cache;
+  tj_buffer *b;
+  int c, low;
+
+  low = tj_buffer_pool_shift(n);
+  c = (n & (n-1)) ? low+1 : low;
+  low = (low < TJ_BUFFER_POOL_MIN_SHIFT) ? 0 : low - TJ_BUFFER_POOL_MIN_SHIFT;
+  c = (c < TJ_BUFFER_POOL_MIN_SHIFT) ? 0 : c - TJ_BUFFER_POOL_MIN_SHIFT;
+  if (c >= TJ_BUFFER_POOL_CLASSES)
+    return 0;
+
+  if ((cache = tj_buffer_pool_getCache()) == 0)
+    return 0;
+
+  if ((b = cache->m_free[c]) != 0) {
+    cache->m_free[c] = b->m_next;
+    cache->m_count[c]--;
+  } else if ((b = cache->m_free[low]) != 0 && b->m_n >= n) {
+    cache->m_free[low] = b->m_next;
+    cache->m_count[low]--;
+  } else {
+    pthread_mutex_lock(&tj_buffer_pool.m_lock);
+    if ((b = tj_buffer_pool.m_free[c]) != 0)
+      tj_buffer_pool.m_free[c] = b->m_next;
+    pthread_mutex_unlock(&tj_buffer_pool.m_lock);
+    if (b == 0)
+      return 0;
+  }
+
+  __atomic_sub_fetch(&tj_buffer_pool.m_cached, b->m_n, __ATOMIC_RELAXED);
+  return b;
+  // end tj_buffer_pool_get
+}
+
+/*
+ * Keep a finalized buffer for reuse, returning 0 if it should be
+ * freed instead.
+ */
+static int
+tj_buffer_pool_put(tj_buffer *b)
+{
+  tj_buffer_poolCache *cache;
+  int c;
+
+  if (!b->m_own || b->m_buff == 0 ||
+      b->m_n < ((size_t) 1 << TJ_BUFFER_POOL_MIN_SHIFT) ||
+      b->m_n >= ((size_t) 2 << TJ_BUFFER_POOL_MAX_SHIFT))
+    return 0;
+
+  if (__atomic_add_fetch(&tj_buffer_pool.m_cached, b->m_n, __ATOMIC_RELAXED) >
+      __atomic_load_n(&tj_buffer_pool.m_highWater, __ATOMIC_RELAXED) ||
+      (cache = tj_buffer_pool_getCache()) == 0) {
+    __atomic_sub_fetch(&tj_buffer_pool.m_cached, b->m_n, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  c = tj_buffer_pool_shift(b->m_n) - TJ_BUFFER_POOL_MIN_SHIFT;
+  if (cache->m_count[c] < TJ_BUFFER_POOL_THREAD) {
+    b->m_next = cache->m_free[c];
+    cache->m_free[c] = b;
+    cache->m_count[c]++;
+  } else {
+    pthread_mutex_lock(&tj_buffer_pool.m_lock);
+    b->m_next = tj_buffer_pool.m_free[c];
+    tj_buffer_pool.m_free[c] = b;
+    pthread_mutex_unlock(&tj_buffer_pool.m_lock);
+  }
+
+  return 1;
+  // end tj_buffer_pool_put
+}
+
+static void
+tj_buffer_pool_release(tj_buffer **list)
+{
+  tj_buffer *b;
+
+  while ((b = *list) != 0) {
+    *list = b->m_next;
+    __atomic_sub_fetch(&tj_buffer_pool.m_cached, b->m_n, __ATOMIC_RELAXED);
+    tj_alloc_free(b->m_buff);
+    free(b);
+  }
+  // end tj_buffer_pool_release
+}
+
+void
+tj_buffer_pool_enable(size_t highWater)
+{
+  __atomic_store_n(&tj_buffer_pool.m_highWater, highWater, __ATOMIC_RELAXED);
+  if (highWater == 0)
+    tj_buffer_pool_trim();
+  // end tj_buffer_pool_enable
+}
+
+void
+tj_buffer_pool_trim(void)
+{
+  tj_buffer_poolCache *cache;
+  int c;
+
+  if ((cache = tj_buffer_poolCache__) != 0) {
+    for (c = 0; c < TJ_BUFFER_POOL_CLASSES; c++) {
+      tj_buffer_pool_release(&cache->m_free[c]);
+      cache->m_count[c] = 0;
+    }
+  }
+
+  pthread_mutex_lock(&tj_buffer_pool.m_lock);
+  for (c = 0; c < TJ_BUFFER_POOL_CLASSES; c++)
+    tj_buffer_pool_release(&tj_buffer_pool.m_free[c]);
+  pthread_mutex_unlock(&tj_buffer_pool.m_lock);
+  // end tj_buffer_pool_trim
+}
+
+size_t
+tj_buffer_pool_getCached(void)
+{
+  return __atomic_load_n(&tj_buffer_pool.m_cached, __ATOMIC_RELAXED);
+  // end tj_buffer_pool_getCached
+}
+
+/*
+ * In gap mode, edits leave the spare capacity as a gap at the last
+ * edit point rather than at the end, so that nearby edits move only
+ * the bytes between them.  Anything else needing the contents
+ * contiguous first closes the gap, moving the bytes after it down.
+ */
+static void
+tj_buffer_closeGap(tj_buffer *b)
+{
+  if (!b->m_gapOpen)
+    return;
+
+  memmove(b->m_buff + b->m_gap, b->m_buff + b->m_gap + (b->m_n - b->m_used),
+          b->m_used - b->m_gap);
+  b->m_gapOpen = 0;
+  // end tj_buffer_closeGap
+}
+
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
 tj_buffer *
 tj_buffer_create(size_t initial)
 {
   tj_buffer *b;
+
+  //-- Pooled allocations are rounded up to their size class
+  if (initial > 0 &&
+      __atomic_load_n(&tj_buffer_pool.m_highWater, __ATOMIC_RELAXED) > 0) {
+    if ((b = tj_buffer_pool_get(initial)) != 0) {
+      b->m_used = 0;
+      b->m_policy = 0;
+      b->m_gapMode = 0;
+      b->m_gapOpen = 0;
+      TJ_LOG("Buffer[%zu/%zu] recycled.", initial, b->m_n);
+      return b;
+    }
+    if (initial >= ((size_t) 1 << TJ_BUFFER_POOL_MIN_SHIFT) &&
+        initial <= ((size_t) 1 << TJ_BUFFER_POOL_MAX_SHIFT) &&
+        (initial & (initial-1)))
+      initial = (size_t) 2 << tj_buffer_pool_shift(initial);
+  }
+
   if ((b = malloc(sizeof(tj_buffer))) == 0) {
     TJ_ERROR("No memory for tj_buffer [%zu bytes].", sizeof(tj_buffer));
     return 0;
   }
 
   if (initial > 0) {
-    if ((b->m_buff = (tj_buffer_byte *) malloc(initial)) == 0) {
+    if ((b->m_buff = (tj_buffer_byte *) tj_alloc_malloc(initial, 0)) == 0) {
       TJ_ERROR("No memory for tj_buffer_byte[%zu bytes].", initial);
       b->m_n = 0;
     } else {
@@ -89,6 +380,10 @@ tj_buffer_create(size_t initial)
 
   b->m_own = 1;
   b->m_used = 0;
+  b->m_policy = 0;
+  b->m_gapMode = 0;
+  b->m_gapOpen = 0;
+  b->m_next = 0;
 
   TJ_LOG("Buffer[%zu] created.", initial);
   return b;
@@ -98,8 +393,14 @@ tj_buffer_create(size_t initial)
 void
 tj_buffer_finalize(tj_buffer *x)
 {
+  if (__atomic_load_n(&tj_buffer_pool.m_highWater, __ATOMIC_RELAXED) > 0 &&
+      tj_buffer_pool_put(x)) {
+    TJ_LOG("Buffer[%zu] pooled.", x->m_n);
+    return;
+  }
+
   if (x->m_own && x->m_buff != 0)
-    free(x->m_buff);
+    tj_alloc_free(x->m_buff);
 
   TJ_LOG("Buffer[%zu] finalized.", x->m_n);
   free(x);
@@ -113,14 +414,52 @@ tj_buffer_setOwnership(tj_buffer *b, char own)
   // end tj_buffer_setOwnership
 }
 
+void
+tj_buffer_setAllocPolicy(tj_buffer *b, const tj_alloc_policy *policy)
+{
+  b->m_policy = policy;
+  // end tj_buffer_setAllocPolicy
+}
+
 void
 tj_buffer_reset(tj_buffer *b)
 {
   b->m_used = 0;
+  b->m_gapOpen = 0;
   TJ_LOG("Reset; buffer[%zu/%zu].", b->m_used, b->m_n);
   // end tj_buffer_reset
 }
 
+int
+tj_buffer_reserve(tj_buffer *b, size_t n)
+{
+  tj_buffer_byte *ot;
+  tj_buffer_closeGap(b);
+  if (b->m_used + n > b->m_n) {
+    if ((b->m_buff = (tj_buffer_byte *) tj_alloc_realloc(ot=b->m_buff,
+                                                         b->m_used+n,
+                                                         b->m_policy)) == 0) {
+      TJ_ERROR("Could not increase buffer from %zu to %zu.", b->m_n, b->m_used+n);
+      b->m_buff = ot;
+      return 0;
+    }
+    b->m_n = b->m_used + n;
+  }
+
+  TJ_LOG("Reserved %zu bytes; buffer[%zu/%zu].", n, b->m_used, b->m_n);
+  return 1;
+  // end tj_buffer_reserve
+}
+
+void
+tj_buffer_commit(tj_buffer *b, size_t n)
+{
+  tj_buffer_closeGap(b);
+  b->m_used += n;
+  TJ_LOG("Committed %zu bytes; buffer[%zu/%zu].", n, b->m_used, b->m_n);
+  // end tj_buffer_commit
+}
+
 inline
 size_t
 tj_buffer_getUsed(tj_buffer *b)
@@ -141,6 +480,7 @@ inline
 tj_buffer_byte *
 tj_buffer_getBytes(tj_buffer *b)
 {
+  tj_buffer_closeGap(b);
   return b->m_buff;
   // end tj_buffer_getBytes
 }
@@ -149,6 +489,7 @@ inline
 char *
 tj_buffer_getAsString(tj_buffer *b)
 {
+  tj_buffer_closeGap(b);
   return (char *) b->m_buff;
   // end tj_buffer_getBytes
 }
@@ -157,6 +498,7 @@ inline
 tj_buffer_byte *
 tj_buffer_getBytesAtIndex(tj_buffer *b, size_t i)
 {
+  tj_buffer_closeGap(b);
   return b->m_buff+i;
   // end tj_buffer_getBytesAtIndex
 }
@@ -165,9 +507,11 @@ int
 tj_buffer_append(tj_buffer *b, const tj_buffer_byte *data, size_t n)
 {
   tj_buffer_byte *ot;
+  tj_buffer_closeGap(b);
   if (b->m_used + n > b->m_n) {
-    if ((b->m_buff = (tj_buffer_byte *) realloc(ot=b->m_buff,
-                                               b->m_used+n)) == 0) {
+    if ((b->m_buff = (tj_buffer_byte *) tj_alloc_realloc(ot=b->m_buff,
+                                                         b->m_used+n,
+                                                         b->m_policy)) == 0) {
       TJ_ERROR("Could not increase buffer from %zu to %zu.", b->m_n, b->m_used+n);
       b->m_buff = ot;
       return 0;
@@ -186,6 +530,7 @@ tj_buffer_append(tj_buffer *b, const tj_buffer_byte *data, size_t n)
 int
 tj_buffer_appendBuffer(tj_buffer *b, const tj_buffer *s)
 {
+  tj_buffer_closeGap((tj_buffer *) s);
   return tj_buffer_append(b, s->m_buff, s->m_used);
   // end tj_buffer_appendBuffer
 }
@@ -196,9 +541,11 @@ tj_buffer_appendString(tj_buffer *b, const char *str)
   int n = strlen(str)+1;
 
   tj_buffer_byte *ot;
+  tj_buffer_closeGap(b);
   if (b->m_used + n > b->m_n) {
-    if ((b->m_buff = (tj_buffer_byte *) realloc(ot=b->m_buff,
-                                               b->m_used+n)) == 0) {
+    if ((b->m_buff = (tj_buffer_byte *) tj_alloc_realloc(ot=b->m_buff,
+                                                         b->m_used+n,
+                                                         b->m_policy)) == 0) {
       TJ_ERROR("Could not increase buffer from %zu to %zu.", b->m_n, b->m_used+n);
       b->m_buff = ot;
       return 0;
@@ -219,6 +566,7 @@ tj_buffer_appendString(tj_buffer *b, const char *str)
 int
 tj_buffer_appendAsStringN(tj_buffer *b, const char *str, size_t n)
 {
+  tj_buffer_closeGap(b);
 
   // Buffer is empty, so add space for null, otherwise replace
   if (b->m_used == 0)
@@ -226,8 +574,9 @@ tj_buffer_appendAsStringN(tj_buffer *b, const char *str, size_t n)
 
   tj_buffer_byte *ot;
   if (b->m_used + n > b->m_n) {
-    if ((b->m_buff = (tj_buffer_byte *) realloc(ot=b->m_buff,
-                                                b->m_used+n)) == 0) {
+    if ((b->m_buff = (tj_buffer_byte *) tj_alloc_realloc(ot=b->m_buff,
+                                                         b->m_used+n,
+                                                         b->m_policy)) == 0) {
       TJ_ERROR("Could not increase buffer from %zu to %zu.",
                b->m_n, b->m_used+n);
       b->m_buff = ot;
@@ -324,6 +673,8 @@ tj_buffer_vaprintf(tj_buffer *b, const char *fmt, va_list ap)
   int err = 1;
   tj_buffer_byte *ot;
 
+  tj_buffer_closeGap(b);
+
   while (1) {
     va_copy(cp, ap); // Don't do on Windows?  See utstring.
 
@@ -348,8 +699,9 @@ tj_buffer_vaprintf(tj_buffer *b, const char *fmt, va_list ap)
     if (n > -1) {
 
       //-- Reallocate for the calculated length
-      if ((b->m_buff = (tj_buffer_byte *) realloc(ot=b->m_buff,
-                                                  b->m_used + n + ((b->m_used)?0:1))) == 0) {
+      if ((b->m_buff = (tj_buffer_byte *) tj_alloc_realloc(ot=b->m_buff,
+                                                           b->m_used + n + ((b->m_used)?0:1),
+                                                           b->m_policy)) == 0) {
         TJ_ERROR("Could not increase buffer from %zu to %zu.",
                  b->m_n, b->m_used+n);
         b->m_buff = ot;
@@ -395,9 +747,12 @@ tj_buffer_appendFileStream(tj_buffer *b, FILE *fh)
 int
 tj_buffer_appendFile(tj_buffer *b, const char *filename)
 {
+  TJ_TRACE_SCOPE("tj_buffer_appendFile");
+
   FILE *fp;
   if ((fp = fopen(filename, "rb")) == 0) {
     TJ_ERROR("Could not open file %s for read.", filename);
+    return 0;
   }
 
   if (!tj_buffer_appendFileStream(b, fp)) {
@@ -415,6 +770,7 @@ tj_buffer_appendFile(tj_buffer *b, const char *filename)
 void
 tj_buffer_popFront(tj_buffer *b, size_t n)
 {
+    tj_buffer_closeGap(b);
     if (n >= b->m_used) {
         b->m_used = 0;
     } else {
@@ -426,6 +782,7 @@ tj_buffer_popFront(tj_buffer *b, size_t n)
 void
 tj_buffer_popBack(tj_buffer *b, size_t n)
 {
+    tj_buffer_closeGap(b);
     if (n >= b->m_used) {
         b->m_used = 0;
     } else {
@@ -436,6 +793,7 @@ tj_buffer_popBack(tj_buffer *b, size_t n)
 void
 tj_buffer_strip(tj_buffer *b, int (*func)(int c))
 {
+    tj_buffer_closeGap(b);
     if (b->m_used == 0) {
         return;
     }
@@ -462,3 +820,221 @@ tj_buffer_strip(tj_buffer *b, int (*func)(int c))
 
     tj_buffer_popBack(b, b->m_used - trailing - 1);
 }
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+void
+tj_buffer_setGapMode(tj_buffer *b, char on)
+{
+  if (!on)
+    tj_buffer_closeGap(b);
+  b->m_gapMode = on;
+  // end tj_buffer_setGapMode
+}
+
+static int
+tj_buffer_replaceGap(tj_buffer *b, size_t i, size_t len,
+                     const tj_buffer_byte *data, size_t n)
+{
+  size_t gap, want, tail;
+  tj_buffer_byte *ot;
+
+  if (!b->m_gapOpen) {
+    b->m_gap = b->m_used;
+    b->m_gapOpen = 1;
+  }
+
+  //-- Grow geometrically, keeping the bytes after the gap at the end
+  if (b->m_used - len + n > b->m_n) {
+    want = (b->m_used - len + n > 2*b->m_n) ? b->m_used - len + n : 2*b->m_n;
+    tail = b->m_used - b->m_gap;
+    if ((b->m_buff = (tj_buffer_byte *) tj_alloc_realloc(ot=b->m_buff, want,
+                                                         b->m_policy)) == 0) {
+      TJ_ERROR("Could not increase buffer from %zu to %zu.", b->m_n, want);
+      b->m_buff = ot;
+      return 0;
+    }
+    memmove(b->m_buff + want - tail, b->m_buff + b->m_n - tail, tail);
+    b->m_n = want;
+  }
+
+  //-- Move the gap to the edit, then deleted bytes simply join it
+  gap = b->m_n - b->m_used;
+  if (i < b->m_gap)
+    memmove(b->m_buff + i + gap, b->m_buff + i, b->m_gap - i);
+  else if (i > b->m_gap)
+    memmove(b->m_buff + b->m_gap, b->m_buff + b->m_gap + gap, i - b->m_gap);
+  b->m_gap = i;
+  b->m_used -= len;
+
+  if (n > 0)
+    memcpy(b->m_buff + b->m_gap, data, n);
+  b->m_gap += n;
+  b->m_used += n;
+
+  TJ_LOG("Replaced %zu bytes at %zu with %zu; gap buffer[%zu/%zu].",
+         len, i, n, b->m_used, b->m_n);
+  return 1;
+  // end tj_buffer_replaceGap
+}
+
+int
+tj_buffer_replaceRange(tj_buffer *b, size_t i, size_t len,
+                       const tj_buffer_byte *data, size_t n)
+{
+  if (i > b->m_used)
+    i = b->m_used;
+  if (len > b->m_used - i)
+    len = b->m_used - i;
+
+  if (b->m_gapMode)
+    return tj_buffer_replaceGap(b, i, len, data, n);
+
+  if (n > len && !tj_buffer_reserve(b, n - len))
+    return 0;
+
+  if (b->m_used - i - len > 0)
+    memmove(b->m_buff + i + n, b->m_buff + i + len, b->m_used - i - len);
+  if (n > 0)
+    memcpy(b->m_buff + i, data, n);
+  b->m_used = b->m_used - len + n;
+
+  TJ_LOG("Replaced %zu bytes at %zu with %zu; buffer[%zu/%zu].",
+         len, i, n, b->m_used, b->m_n);
+  return 1;
+  // end tj_buffer_replaceRange
+}
+
+int
+tj_buffer_insert(tj_buffer *b, size_t i, const tj_buffer_byte *data, size_t n)
+{
+  return tj_buffer_replaceRange(b, i, 0, data, n);
+  // end tj_buffer_insert
+}
+
+void
+tj_buffer_erase(tj_buffer *b, size_t i, size_t n)
+{
+  tj_buffer_replaceRange(b, i, n, 0, 0);
+  // end tj_buffer_erase
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static tj_buffer_shared *
+tj_buffer_shared_create(tj_buffer_memory *m, const tj_buffer_byte *bytes,
+                        size_t n)
+{
+  tj_buffer_shared *s;
+  if ((s = malloc(sizeof(tj_buffer_shared))) == 0) {
+    TJ_ERROR("No memory for tj_buffer_shared [%zu bytes].",
+             sizeof(tj_buffer_shared));
+    return 0;
+  }
+
+  s->m_refs = 1;
+  s->m_memory = m;
+  s->m_bytes = bytes;
+  s->m_used = n;
+  return s;
+  // end tj_buffer_shared_create
+}
+
+tj_buffer_shared *
+tj_buffer_freeze(tj_buffer *b)
+{
+  tj_buffer_memory *m;
+  tj_buffer_shared *s;
+  tj_buffer_byte *bytes;
+
+  tj_buffer_closeGap(b);
+  bytes = b->m_buff;
+
+  if ((m = malloc(sizeof(tj_buffer_memory))) == 0) {
+    TJ_ERROR("No memory for tj_buffer_memory [%zu bytes].",
+             sizeof(tj_buffer_memory));
+    return 0;
+  }
+
+  //-- Memory the buffer does not own may be released by its owner
+  if (!b->m_own && b->m_used > 0) {
+    if ((bytes = malloc(b->m_used)) == 0) {
+      TJ_ERROR("No memory to copy frozen buffer [%zu bytes].", b->m_used);
+      free(m);
+      return 0;
+    }
+    memcpy(bytes, b->m_buff, b->m_used);
+  } else if (!b->m_own) {
+    bytes = 0;
+  }
+
+  m->m_refs = 1;
+  m->m_buff = bytes;
+
+  if ((s = tj_buffer_shared_create(m, bytes, b->m_used)) == 0) {
+    if (bytes != b->m_buff)
+      free(bytes);
+    free(m);
+    return 0;
+  }
+
+  TJ_LOG("Buffer[%zu/%zu] frozen.", b->m_used, b->m_n);
+  free(b);
+  return s;
+  // end tj_buffer_freeze
+}
+
+tj_buffer_shared *
+tj_buffer_shared_retain(tj_buffer_shared *s)
+{
+  __atomic_add_fetch(&s->m_refs, 1, __ATOMIC_RELAXED);
+  return s;
+  // end tj_buffer_shared_retain
+}
+
+void
+tj_buffer_shared_release(tj_buffer_shared *s)
+{
+  tj_buffer_memory *m = s->m_memory;
+
+  if (__atomic_sub_fetch(&s->m_refs, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+  free(s);
+
+  if (__atomic_sub_fetch(&m->m_refs, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+  tj_alloc_free(m->m_buff);
+  free(m);
+  // end tj_buffer_shared_release
+}
+
+tj_buffer_shared *
+tj_buffer_shared_slice(tj_buffer_shared *s, size_t offset, size_t n)
+{
+  tj_buffer_shared *v;
+
+  if (offset > s->m_used)
+    offset = s->m_used;
+  if (n > s->m_used - offset)
+    n = s->m_used - offset;
+
+  __atomic_add_fetch(&s->m_memory->m_refs, 1, __ATOMIC_RELAXED);
+  if ((v = tj_buffer_shared_create(s->m_memory, s->m_bytes+offset, n)) == 0)
+    __atomic_sub_fetch(&s->m_memory->m_refs, 1, __ATOMIC_RELAXED);
+  return v;
+  // end tj_buffer_shared_slice
+}
+
+const tj_buffer_byte *
+tj_buffer_shared_getBytes(const tj_buffer_shared *s)
+{
+  return s->m_bytes;
+  // end tj_buffer_shared_getBytes
+}
+
+size_t
+tj_buffer_shared_getUsed(const tj_buffer_shared *s)
+{
+  return s->m_used;
+  // end tj_buffer_shared_getUsed
+}
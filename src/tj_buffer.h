@@ -28,10 +28,13 @@
 #include <stdio.h>
 #include <stdarg.h>
 
+#include "tj_alloc.h"
+
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
 typedef unsigned char           tj_buffer_byte;
 typedef struct tj_buffer        tj_buffer;
+typedef struct tj_buffer_shared tj_buffer_shared;
 
 /**
  * Create a tj_buffer.  Data can be added to a tj_buffer and it will
@@ -57,6 +60,36 @@ tj_buffer_create(size_t initial);
 void
 tj_buffer_finalize(tj_buffer *x);
 
+/**
+ * Enable or disable recycling of finalized buffers.  When enabled,
+ * buffers finalized with between 64 bytes and 32MB allocated are
+ * kept, memory and all, by power of two size class, and
+ * tj_buffer_create hands them back out for requests they can hold.
+ * Allocations by tj_buffer_create in that range are rounded up to a
+ * power of two, so tj_buffer_getAllocated may exceed the initial size
+ * requested.  Each thread caches a few buffers per class without
+ * locking; the rest are shared.  Disabled by default.
+ *
+ * \param highWater The most bytes to hold in the pool, beyond which
+ * finalized buffers are freed; 0 disables the pool and trims it.
+ */
+void
+tj_buffer_pool_enable(size_t highWater);
+
+/**
+ * Free the pooled buffers shared between threads and those cached by
+ * the calling thread.  Buffers cached by other threads are freed only
+ * when they trim, or are handed to the shared pool when they exit.
+ */
+void
+tj_buffer_pool_trim(void);
+
+/**
+ * The number of bytes held in the pool.
+ */
+size_t
+tj_buffer_pool_getCached(void);
+
 /**
  * Set whether or not the buffer owns its data and should free it when
  * the tj_buffer is finalized.
@@ -68,6 +101,19 @@ tj_buffer_finalize(tj_buffer *x);
 void
 tj_buffer_setOwnership(tj_buffer *b, char own);
 
+/**
+ * Set the policy the buffer's memory is allocated under as it grows,
+ * in place of the default tj_alloc policy.  Memory mapped under a
+ * policy must be released with tj_alloc_free() rather than free() if
+ * the buffer is made to give up ownership of it.
+ *
+ * \param b The buffer to operate on.
+ * \param policy The policy, which must outlive the buffer, or 0 for the
+ * default.
+ */
+void
+tj_buffer_setAllocPolicy(tj_buffer *b, const tj_alloc_policy *policy);
+
 /**
  * Reset the buffer but do not release the memory.  Future calls to
  * tj_buffer_append() overwrite previous contents but reuse the
@@ -78,6 +124,32 @@ tj_buffer_setOwnership(tj_buffer *b, char own);
 void
 tj_buffer_reset(tj_buffer *b);
 
+/**
+ * Ensure the buffer has room for at least n more bytes beyond its
+ * currently used extent, growing its memory allocation if necessary.
+ * The used extent and contents are not changed.  This may be used to
+ * size a buffer once before a series of appends.
+ *
+ * \param b The buffer to operate on.
+ * \param n The number of additional bytes to make room for.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_buffer_reserve(tj_buffer *b, size_t n);
+
+/**
+ * Extend the used extent of the buffer by n bytes which have been
+ * written directly into the memory following it, e.g., at
+ * tj_buffer_getBytesAtIndex(b, tj_buffer_getUsed(b)).  That space
+ * must first be made available with tj_buffer_reserve().
+ *
+ * \param b The buffer to operate on.
+ * \param n The number of bytes written past the used extent.
+ */
+void
+tj_buffer_commit(tj_buffer *b, size_t n);
+
 /**
  * Get the currently used extent of the buffer.
  *
@@ -287,4 +359,107 @@ tj_buffer_popBack(tj_buffer *b, size_t n);
 void
 tj_buffer_strip(tj_buffer *b, int (*func)(int c));
 
+/**
+ * Replace a range of the buffer with new data, growing the buffer
+ * allocation if necessary.  The bytes after the range are moved to
+ * follow the new data.  If the allocation cannot be grown, nothing is
+ * changed.
+ *
+ * \param b The buffer to operate on.
+ * \param i The start of the range; clipped to the used extent.
+ * \param len The length of the range; clipped to the used extent.
+ * \param data A byte array of at least length n.
+ * \param n The number of bytes from data to put in place of the range.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_buffer_replaceRange(tj_buffer *b, size_t i, size_t len,
+                       const tj_buffer_byte *data, size_t n);
+
+/**
+ * Insert data at a position in the buffer.  Same as
+ * tj_buffer_replaceRange(b, i, 0, data, n).
+ */
+int
+tj_buffer_insert(tj_buffer *b, size_t i, const tj_buffer_byte *data,
+                 size_t n);
+
+/**
+ * Remove n bytes at a position in the buffer.  Same as
+ * tj_buffer_replaceRange(b, i, n, 0, 0).
+ */
+void
+tj_buffer_erase(tj_buffer *b, size_t i, size_t n);
+
+/**
+ * Set whether edits keep the buffer's spare capacity as a gap at the
+ * last edit, as in a text editor.  A run of tj_buffer_replaceRange,
+ * tj_buffer_insert and tj_buffer_erase calls then costs the size of
+ * the edits and the distance between them, rather than moving
+ * everything after each edit.  The gap is closed, at the cost of one
+ * move, by the next call needing the contents contiguous, such as
+ * tj_buffer_getBytes or any append.  Gap mode also grows the
+ * allocation geometrically.  Off by default.
+ *
+ * \param b The buffer to operate on.
+ * \param on 1 for gap mode, 0 otherwise.
+ */
+void
+tj_buffer_setGapMode(tj_buffer *b, char on);
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/**
+ * Turn a buffer into an immutable, reference counted shared buffer.
+ * The buffer's memory is taken over rather than copied, unless the
+ * buffer does not own it.  The tj_buffer itself is finalized.  Shared
+ * buffers may be retained and released from any thread.
+ *
+ * \param b The buffer to freeze; not usable afterwards.
+ *
+ * \return A shared buffer holding one reference, or 0 on failure, in
+ * which case b is left as it was.
+ */
+tj_buffer_shared *
+tj_buffer_freeze(tj_buffer *b);
+
+/**
+ * Add a reference to a shared buffer.
+ *
+ * \param s The shared buffer.
+ *
+ * \return s.
+ */
+tj_buffer_shared *
+tj_buffer_shared_retain(tj_buffer_shared *s);
+
+/**
+ * Drop a reference to a shared buffer, freeing it with the last one.
+ * The memory is freed once no slice of it remains either.
+ *
+ * \param s The shared buffer.
+ */
+void
+tj_buffer_shared_release(tj_buffer_shared *s);
+
+/**
+ * Create a view of part of a shared buffer.  The view shares the
+ * memory, keeping it alive, and has its own reference count.
+ *
+ * \param s The shared buffer.
+ * \param offset The start of the view within s.
+ * \param n The length of the view, clipped to the end of s.
+ *
+ * \return A view holding one reference, or 0 on failure.
+ */
+tj_buffer_shared *
+tj_buffer_shared_slice(tj_buffer_shared *s, size_t offset, size_t n);
+
+const tj_buffer_byte *
+tj_buffer_shared_getBytes(const tj_buffer_shared *s);
+
+size_t
+tj_buffer_shared_getUsed(const tj_buffer_shared *s);
+
 #endif // __tj_buffer_h__
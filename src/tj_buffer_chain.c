@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "tj_error.h"
+#include "tj_buffer_chain.h"
+
+#define TJ_BUFFER_CHAIN_IOV 64
+
+#ifndef TJ_PAGE_SIZE
+#define TJ_PAGE_SIZE (size_t) 1024
+#endif
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+typedef struct tj_buffer_chain_segment tj_buffer_chain_segment;
+struct tj_buffer_chain_segment {
+  tj_buffer *m_buffer;
+  tj_buffer_shared *m_shared;
+  int m_fd;                  // -1 unless a file range
+  char m_own;
+  off_t m_offset;            // Next byte to write, in the buffer or file
+  size_t m_length;           // Bytes left to write
+  tj_buffer_chain_segment *m_next;
+};
+
+struct tj_buffer_chain {
+  tj_buffer_chain_segment *m_head;
+  tj_buffer_chain_segment *m_tail;
+  size_t m_length;
+};
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static void
+tj_buffer_chain_segment_finalize(tj_buffer_chain_segment *s)
+{
+  if (s->m_shared != 0)
+    tj_buffer_shared_release(s->m_shared);
+  if (s->m_own) {
+    if (s->m_buffer != 0)
+      tj_buffer_finalize(s->m_buffer);
+    else
+      close(s->m_fd);
+  }
+  free(s);
+  // end tj_buffer_chain_segment_finalize
+}
+
+static const tj_buffer_byte *
+tj_buffer_chain_bytes(tj_buffer_chain_segment *s)
+{
+  if (s->m_shared != 0)
+    return tj_buffer_shared_getBytes(s->m_shared) + s->m_offset;
+  return tj_buffer_getBytesAtIndex(s->m_buffer, s->m_offset);
+  // end tj_buffer_chain_bytes
+}
+
+static int
+tj_buffer_chain_add(tj_buffer_chain *c, tj_buffer *b, int fd, char own,
+                    off_t offset, size_t length)
+{
+  tj_buffer_chain_segment *s;
+
+  if ((s = malloc(sizeof(tj_buffer_chain_segment))) == 0) {
+    TJ_ERROR("No memory for tj_buffer_chain_segment.");
+    return 0;
+  }
+
+  s->m_buffer = b;
+  s->m_shared = 0;
+  s->m_fd = fd;
+  s->m_own = own;
+  s->m_offset = offset;
+  s->m_length = length;
+  s->m_next = 0;
+
+  if (c->m_tail != 0)
+    c->m_tail->m_next = s;
+  else
+    c->m_head = s;
+  c->m_tail = s;
+  c->m_length += length;
+
+  return 1;
+  // end tj_buffer_chain_add
+}
+
+/*
+ * Remove n written bytes from the front of the chain.
+ */
+static void
+tj_buffer_chain_consume(tj_buffer_chain *c, size_t n)
+{
+  tj_buffer_chain_segment *s;
+
+  c->m_length -= n;
+  while ((s = c->m_head) != 0 && n >= s->m_length) {
+    n -= s->m_length;
+    if ((c->m_head = s->m_next) == 0)
+      c->m_tail = 0;
+    tj_buffer_chain_segment_finalize(s);
+  }
+
+  if (s != 0) {
+    s->m_offset += n;
+    s->m_length -= n;
+  }
+  // end tj_buffer_chain_consume
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+tj_buffer_chain *
+tj_buffer_chain_create(void)
+{
+  tj_buffer_chain *c;
+
+  if ((c = calloc(1, sizeof(tj_buffer_chain))) == 0) {
+    TJ_ERROR("No memory for tj_buffer_chain.");
+    return 0;
+  }
+
+  return c;
+  // end tj_buffer_chain_create
+}
+
+void
+tj_buffer_chain_finalize(tj_buffer_chain *c)
+{
+  tj_buffer_chain_segment *s;
+
+  while ((s = c->m_head) != 0) {
+    c->m_head = s->m_next;
+    tj_buffer_chain_segment_finalize(s);
+  }
+  free(c);
+  // end tj_buffer_chain_finalize
+}
+
+int
+tj_buffer_chain_appendBuffer(tj_buffer_chain *c, tj_buffer *b, char own)
+{
+  //-- Empty buffers are never written, so are done with now
+  if (tj_buffer_getUsed(b) == 0) {
+    if (own)
+      tj_buffer_finalize(b);
+    return 1;
+  }
+
+  return tj_buffer_chain_add(c, b, -1, own, 0, tj_buffer_getUsed(b));
+  // end tj_buffer_chain_appendBuffer
+}
+
+int
+tj_buffer_chain_appendShared(tj_buffer_chain *c, tj_buffer_shared *s)
+{
+  if (tj_buffer_shared_getUsed(s) == 0)
+    return 1;
+
+  if (!tj_buffer_chain_add(c, 0, -1, 0, 0, tj_buffer_shared_getUsed(s)))
+    return 0;
+  c->m_tail->m_shared = tj_buffer_shared_retain(s);
+
+  return 1;
+  // end tj_buffer_chain_appendShared
+}
+
+int
+tj_buffer_chain_appendFileRange(tj_buffer_chain *c, int fd, off_t offset,
+                                size_t length)
+{
+  if (length == 0)
+    return 1;
+
+  return tj_buffer_chain_add(c, 0, fd, 0, offset, length);
+  // end tj_buffer_chain_appendFileRange
+}
+
+int
+tj_buffer_chain_appendFile(tj_buffer_chain *c, const char *filename)
+{
+  struct stat st;
+  int fd;
+
+  if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) == -1) {
+    TJ_ERROR("Could not open file %s for read.", filename);
+    return 0;
+  }
+
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+    TJ_ERROR("Could not add %s; not a regular file.", filename);
+    close(fd);
+    return 0;
+  }
+
+  if (st.st_size == 0) {
+    close(fd);
+    return 1;
+  }
+
+  if (!tj_buffer_chain_add(c, 0, fd, 1, 0, st.st_size)) {
+    close(fd);
+    return 0;
+  }
+
+  return 1;
+  // end tj_buffer_chain_appendFile
+}
+
+size_t
+tj_buffer_chain_getLength(tj_buffer_chain *c)
+{
+  return c->m_length;
+  // end tj_buffer_chain_getLength
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * Copy a file range through user memory, for descriptors the kernel
+ * cannot copy between directly.
+ */
+static ssize_t
+tj_buffer_chain_copy(tj_buffer_chain_segment *s, int fd)
+{
+  tj_buffer_byte input[TJ_PAGE_SIZE];
+  ssize_t n, w;
+
+  n = pread(s->m_fd, input,
+            (s->m_length < TJ_PAGE_SIZE) ? s->m_length : TJ_PAGE_SIZE,
+            s->m_offset);
+  if (n <= 0) {
+    if (n == 0)
+      errno = EIO;
+    return -1;
+  }
+
+  while ((w = write(fd, input, n)) == -1 && errno == EINTR)
+    ;
+  return w;
+  // end tj_buffer_chain_copy
+}
+
+static ssize_t
+tj_buffer_chain_sendFile(tj_buffer_chain_segment *s, int fd, int *direct,
+                         int toFile)
+{
+  loff_t in;
+  off_t off;
+  ssize_t n;
+
+  if (*direct) {
+    if (toFile) {
+      in = s->m_offset;
+      n = copy_file_range(s->m_fd, &in, fd, 0, s->m_length, 0);
+    } else {
+      off = s->m_offset;
+      n = sendfile(fd, s->m_fd, &off, s->m_length);
+    }
+
+    //-- The range extends past the end of the file
+    if (n == 0) {
+      errno = EIO;
+      return -1;
+    }
+
+    if (n != -1 || (errno != EINVAL && errno != ENOSYS &&
+                    errno != EXDEV && errno != EOPNOTSUPP))
+      return n;
+    *direct = 0;
+  }
+
+  return tj_buffer_chain_copy(s, fd);
+  // end tj_buffer_chain_sendFile
+}
+
+ssize_t
+tj_buffer_chain_write(tj_buffer_chain *c, int fd)
+{
+  struct iovec iov[TJ_BUFFER_CHAIN_IOV];
+  tj_buffer_chain_segment *s;
+  int i, direct = 1, toFile;
+  size_t total = 0;
+  struct stat st;
+  ssize_t n;
+
+  toFile = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode));
+
+  while ((s = c->m_head) != 0) {
+    if (s->m_fd == -1) {
+      for (i = 0; s != 0 && s->m_fd == -1 && i < TJ_BUFFER_CHAIN_IOV;
+           s = s->m_next, i++) {
+        iov[i].iov_base = (void *) tj_buffer_chain_bytes(s);
+        iov[i].iov_len = s->m_length;
+      }
+      n = writev(fd, iov, i);
+    } else {
+      n = tj_buffer_chain_sendFile(s, fd, &direct, toFile);
+    }
+
+    if (n > 0) {
+      tj_buffer_chain_consume(c, n);
+      total += n;
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      TJ_ERROR("Could not write tj_buffer_chain: %d.", errno);
+      return -1;
+    }
+  }
+
+  return total;
+  // end tj_buffer_chain_write
+}
+
+int
+tj_buffer_chain_appendTo(tj_buffer_chain *c, tj_buffer *b)
+{
+  tj_buffer_chain_segment *s;
+  size_t done;
+  ssize_t n;
+
+  if (!tj_buffer_reserve(b, c->m_length))
+    return 0;
+
+  for (s = c->m_head; s != 0; s = s->m_next) {
+    if (s->m_fd == -1) {
+      tj_buffer_append(b, tj_buffer_chain_bytes(s), s->m_length);
+      continue;
+    }
+
+    for (done = 0; done < s->m_length; done += n) {
+      n = pread(s->m_fd, tj_buffer_getBytesAtIndex(b, tj_buffer_getUsed(b)),
+                s->m_length - done, s->m_offset + done);
+      if (n == -1 && errno == EINTR) {
+        n = 0;
+        continue;
+      }
+      if (n <= 0) {
+        TJ_ERROR("Could not read file range into buffer.");
+        return 0;
+      }
+      tj_buffer_commit(b, n);
+    }
+  }
+
+  return 1;
+  // end tj_buffer_chain_appendTo
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __tj_buffer_chain_h__
+#define __tj_buffer_chain_h__
+
+#include <sys/types.h>
+
+#include "tj_buffer.h"
+
+/*
+ * A tj_buffer_chain is a queue of segments to be written out in
+ * order.  A segment is either the used extent of a tj_buffer or
+ * shared buffer, which is referenced rather than copied, or a range
+ * of an open file.  File ranges are written with sendfile(), or
+ * copy_file_range() when the destination is itself a regular file, so
+ * their bytes are copied within the kernel and never read into user
+ * memory.
+ */
+typedef struct tj_buffer_chain tj_buffer_chain;
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+tj_buffer_chain *
+tj_buffer_chain_create(void);
+
+/**
+ * Destroy a chain, finalizing the buffers and closing the files it
+ * was given ownership of, including any not yet written.
+ */
+void
+tj_buffer_chain_finalize(tj_buffer_chain *c);
+
+/**
+ * Add the used extent of a buffer to the chain.  The buffer is not
+ * copied, and must not be changed until it has been written.
+ *
+ * \param c The chain to operate on.
+ * \param b The buffer to add.
+ * \param own 1 to finalize b once it has been written or the chain is
+ * finalized, 0 otherwise.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_buffer_chain_appendBuffer(tj_buffer_chain *c, tj_buffer *b, char own);
+
+/**
+ * Add a shared buffer to the chain, which holds a reference to it
+ * until it has been written.  The same shared buffer may be queued on
+ * any number of chains without copying it.
+ *
+ * \param c The chain to operate on.
+ * \param s The shared buffer to add.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_buffer_chain_appendShared(tj_buffer_chain *c, tj_buffer_shared *s);
+
+/**
+ * Add a range of an open file to the chain.  The descriptor is not
+ * closed by the chain, and its file offset is not used or changed.
+ *
+ * \param c The chain to operate on.
+ * \param fd A descriptor open for reading.
+ * \param offset Where in the file the range starts.
+ * \param length The number of bytes in the range.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_buffer_chain_appendFileRange(tj_buffer_chain *c, int fd, off_t offset,
+                                size_t length);
+
+/**
+ * Open a file and add all of it to the chain.  The file is closed
+ * once it has been written or the chain is finalized.
+ *
+ * \param c The chain to operate on.
+ * \param filename The file to add.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_buffer_chain_appendFile(tj_buffer_chain *c, const char *filename);
+
+/**
+ * The number of bytes remaining to be written.
+ */
+size_t
+tj_buffer_chain_getLength(tj_buffer_chain *c);
+
+/**
+ * Write the chain to a descriptor until it is empty or, for a
+ * non-blocking descriptor, until it would block.  Written segments
+ * are removed from the chain.  Consecutive buffers are written
+ * together with writev().
+ *
+ * \param c The chain to operate on.
+ * \param fd The descriptor to write to, such as a socket, pipe or
+ * regular file.
+ * \return The number of bytes written, or -1 on error.
+ */
+ssize_t
+tj_buffer_chain_write(tj_buffer_chain *c, int fd);
+
+/**
+ * Append the contents of the chain to a buffer, reading file ranges
+ * into memory.  The chain is not changed.
+ *
+ * \param c The chain to read.
+ * \param b The buffer to append to.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_buffer_chain_appendTo(tj_buffer_chain *c, tj_buffer *b);
+
+#endif // __tj_buffer_chain_h__
@@ -0,0 +1,450 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "tj_alloc.h"
+#include "tj_error.h"
+#include "tj_filter.h"
+#include "tj_hash.h"
+
+#define TJ_FILTER_BLOCK_BITS 512
+#define TJ_FILTER_BLOCK_WORDS 8
+#define TJ_FILTER_MAX_BITS_PER_KEY 64
+
+#define TJ_FILTER_BUCKET 4
+#define TJ_FILTER_MAX_LOAD 0.95
+#define TJ_FILTER_MAX_KICKS 500
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+struct tj_filter_bloom {
+  void *m_memory;
+  uint64_t *m_blocks;
+  size_t m_n;
+};
+
+/*
+ * Odd constants multiplied by the hash to choose the bit in each word
+ * of a block, as in Parquet's split block Bloom filter.
+ */
+static const uint32_t k_tj_filter_salt[TJ_FILTER_BLOCK_WORDS] = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+};
+
+/*
+ * The block is chosen by the high half of the hash, and the bits by
+ * the low half.
+ */
+static uint64_t *
+tj_filter_bloom_mask(const tj_filter_bloom *f, uint64_t hash, uint64_t *mask)
+{
+  uint32_t h = (uint32_t) hash;
+  int i;
+
+  for (i = 0; i < TJ_FILTER_BLOCK_WORDS; i++)
+    mask[i] = 1ULL << ((h * k_tj_filter_salt[i]) >> 26);
+
+  return &f->m_blocks[((hash >> 32) * f->m_n >> 32) * TJ_FILTER_BLOCK_WORDS];
+  // end tj_filter_bloom_mask
+}
+
+/*
+ * The keys in a block are Poisson distributed.  Given x keys, a word
+ * has a given bit set with probability 1 - (63/64)^x, and a false
+ * positive needs that of all eight words.  The Poisson weights are
+ * summed unnormalized from x = 0 and normalized at the end, avoiding
+ * exp() for underflowing at large means.
+ */
+double
+tj_filter_bloom_estimate(double bitsPerKey)
+{
+  double mean = TJ_FILTER_BLOCK_BITS / bitsPerKey, weight = 1, total = 0;
+  double sum = 0, clear = 1, p;
+  int x, i;
+
+  for (x = 0; x < mean * 4 + 64; x++) {
+    p = 1 - clear;
+    for (i = 1; i < TJ_FILTER_BLOCK_WORDS; i++)
+      p *= 1 - clear;
+    sum += weight * p;
+    total += weight;
+    weight *= mean / (x + 1);
+    clear *= 63.0 / 64.0;
+  }
+
+  return sum / total;
+  // end tj_filter_bloom_estimate
+}
+
+size_t
+tj_filter_bloom_sizeFor(size_t n, double fpRate)
+{
+  double bits;
+  size_t blocks;
+
+  for (bits = 2; bits < TJ_FILTER_MAX_BITS_PER_KEY; bits += 0.25) {
+    if (tj_filter_bloom_estimate(bits) <= fpRate)
+      break;
+  }
+
+  blocks = (size_t) (n * bits / TJ_FILTER_BLOCK_BITS) + 1;
+  return blocks * TJ_FILTER_BLOCK_BITS / 8;
+  // end tj_filter_bloom_sizeFor
+}
+
+tj_filter_bloom *
+tj_filter_bloom_create(size_t n, double fpRate)
+{
+  size_t size = tj_filter_bloom_sizeFor(n, fpRate);
+  tj_filter_bloom *f;
+
+  if ((f = calloc(1, sizeof(tj_filter_bloom))) == 0) {
+    TJ_ERROR("No memory for tj_filter_bloom.");
+    return 0;
+  }
+
+  //-- Over allocated to align the blocks with cache lines
+  if ((f->m_memory = tj_alloc_malloc(size + 63, 0)) == 0) {
+    TJ_ERROR("No memory for %zu byte Bloom filter.", size);
+    free(f);
+    return 0;
+  }
+
+  f->m_blocks = (uint64_t *) (((uintptr_t) f->m_memory + 63) & ~(uintptr_t) 63);
+  f->m_n = size / (TJ_FILTER_BLOCK_BITS / 8);
+  memset(f->m_blocks, 0, size);
+
+  TJ_LOG("Created Bloom filter of %zu blocks for %zu keys.", f->m_n, n);
+  return f;
+  // end tj_filter_bloom_create
+}
+
+void
+tj_filter_bloom_finalize(tj_filter_bloom *f)
+{
+  tj_alloc_free(f->m_memory);
+  free(f);
+  // end tj_filter_bloom_finalize
+}
+
+size_t
+tj_filter_bloom_getSize(const tj_filter_bloom *f)
+{
+  return f->m_n * (TJ_FILTER_BLOCK_BITS / 8);
+  // end tj_filter_bloom_getSize
+}
+
+void
+tj_filter_bloom_addHash(tj_filter_bloom *f, uint64_t hash)
+{
+  uint64_t mask[TJ_FILTER_BLOCK_WORDS], *block;
+  int i;
+
+  block = tj_filter_bloom_mask(f, hash, mask);
+  for (i = 0; i < TJ_FILTER_BLOCK_WORDS; i++)
+    block[i] |= mask[i];
+  // end tj_filter_bloom_addHash
+}
+
+int
+tj_filter_bloom_containsHash(const tj_filter_bloom *f, uint64_t hash)
+{
+  uint64_t mask[TJ_FILTER_BLOCK_WORDS], *block;
+  int i;
+
+  block = tj_filter_bloom_mask(f, hash, mask);
+
+#ifdef __SSE2__
+  __m128i missing = _mm_setzero_si128();
+  for (i = 0; i < TJ_FILTER_BLOCK_WORDS; i += 2)
+    missing = _mm_or_si128(missing,
+      _mm_andnot_si128(_mm_load_si128((const __m128i *) &block[i]),
+                       _mm_loadu_si128((const __m128i *) &mask[i])));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(missing,
+                                          _mm_setzero_si128())) == 0xffff;
+#else
+  uint64_t missing = 0;
+  for (i = 0; i < TJ_FILTER_BLOCK_WORDS; i++)
+    missing |= mask[i] & ~block[i];
+  return missing == 0;
+#endif
+  // end tj_filter_bloom_containsHash
+}
+
+void
+tj_filter_bloom_add(tj_filter_bloom *f, const void *key, size_t n)
+{
+  tj_filter_bloom_addHash(f, tj_hash_bytes(key, n, 0));
+  // end tj_filter_bloom_add
+}
+
+int
+tj_filter_bloom_contains(const tj_filter_bloom *f, const void *key,
+                         size_t n)
+{
+  return tj_filter_bloom_containsHash(f, tj_hash_bytes(key, n, 0));
+  // end tj_filter_bloom_contains
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * Each bucket is four 16 bit fingerprints packed into a word, 0 where
+ * empty, and searched a whole bucket at a time.  A key's buckets are
+ * i and i ^ hash(fingerprint), so either can be found from the other
+ * when its fingerprint is moved.  When a key cannot be placed, the
+ * fingerprint left over is held aside and the filter is full.
+ */
+struct tj_filter_cuckoo {
+  uint64_t *m_buckets;
+  size_t m_mask;
+  size_t m_count;
+  uint64_t m_random;
+
+  size_t m_victimIndex;
+  uint16_t m_victim;
+};
+
+#define TJ_FILTER_LANES 0x0001000100010001ULL
+#define TJ_FILTER_HIGHS 0x8000800080008000ULL
+
+// The lanes of a bucket equal to a fingerprint, marked by their high bit
+#define TJ_FILTER_MATCH(bucket, fp)                                     \
+  ((((bucket) ^ ((fp) * TJ_FILTER_LANES)) - TJ_FILTER_LANES) &          \
+   ~((bucket) ^ ((fp) * TJ_FILTER_LANES)) & TJ_FILTER_HIGHS)
+
+static uint16_t
+tj_filter_cuckoo_fingerprint(uint64_t hash)
+{
+  uint16_t fp = hash >> 48;
+  return fp ? fp : 1;
+  // end tj_filter_cuckoo_fingerprint
+}
+
+static size_t
+tj_filter_cuckoo_alternate(const tj_filter_cuckoo *f, size_t i, uint16_t fp)
+{
+  return (i ^ tj_hash_uint64(fp)) & f->m_mask;
+  // end tj_filter_cuckoo_alternate
+}
+
+static int
+tj_filter_cuckoo_place(tj_filter_cuckoo *f, size_t i, uint16_t fp)
+{
+  uint64_t empty = TJ_FILTER_MATCH(f->m_buckets[i], 0);
+
+  if (empty == 0)
+    return 0;
+  f->m_buckets[i] |= (uint64_t) fp << (__builtin_ctzll(empty) - 15);
+  return 1;
+  // end tj_filter_cuckoo_place
+}
+
+static int
+tj_filter_cuckoo_unplace(tj_filter_cuckoo *f, size_t i, uint16_t fp)
+{
+  uint64_t match = TJ_FILTER_MATCH(f->m_buckets[i], fp);
+
+  if (match == 0)
+    return 0;
+  f->m_buckets[i] &= ~(0xffffULL << (__builtin_ctzll(match) - 15));
+  return 1;
+  // end tj_filter_cuckoo_unplace
+}
+
+/*
+ * Place a fingerprint in bucket i or its alternate, evicting others to
+ * their alternates to make room as needed.
+ */
+static void
+tj_filter_cuckoo_insert(tj_filter_cuckoo *f, size_t i, uint16_t fp)
+{
+  uint16_t evicted;
+  int kicks, shift;
+
+  if (tj_filter_cuckoo_place(f, i, fp) ||
+      tj_filter_cuckoo_place(f, i = tj_filter_cuckoo_alternate(f, i, fp), fp))
+    return;
+
+  for (kicks = 0; kicks < TJ_FILTER_MAX_KICKS; kicks++) {
+    f->m_random ^= f->m_random << 13;
+    f->m_random ^= f->m_random >> 7;
+    f->m_random ^= f->m_random << 17;
+
+    shift = (f->m_random & (TJ_FILTER_BUCKET - 1)) * 16;
+    evicted = f->m_buckets[i] >> shift;
+    f->m_buckets[i] &= ~(0xffffULL << shift);
+    f->m_buckets[i] |= (uint64_t) fp << shift;
+
+    fp = evicted;
+    i = tj_filter_cuckoo_alternate(f, i, fp);
+    if (tj_filter_cuckoo_place(f, i, fp))
+      return;
+  }
+
+  f->m_victim = fp;
+  f->m_victimIndex = i;
+  // end tj_filter_cuckoo_insert
+}
+
+//----------------------------------------------------------------------
+size_t
+tj_filter_cuckoo_sizeFor(size_t n)
+{
+  size_t buckets = 1;
+
+  while (buckets * TJ_FILTER_BUCKET * TJ_FILTER_MAX_LOAD < n)
+    buckets *= 2;
+  return buckets * sizeof(uint64_t);
+  // end tj_filter_cuckoo_sizeFor
+}
+
+tj_filter_cuckoo *
+tj_filter_cuckoo_create(size_t n)
+{
+  size_t size = tj_filter_cuckoo_sizeFor(n);
+  tj_filter_cuckoo *f;
+
+  if ((f = calloc(1, sizeof(tj_filter_cuckoo))) == 0) {
+    TJ_ERROR("No memory for tj_filter_cuckoo.");
+    return 0;
+  }
+
+  if ((f->m_buckets = tj_alloc_malloc(size, 0)) == 0) {
+    TJ_ERROR("No memory for %zu byte cuckoo filter.", size);
+    free(f);
+    return 0;
+  }
+
+  memset(f->m_buckets, 0, size);
+  f->m_mask = size / sizeof(uint64_t) - 1;
+  f->m_random = 0x2545f4914f6cdd1dULL;
+
+  TJ_LOG("Created cuckoo filter of %zu buckets for %zu keys.",
+         f->m_mask + 1, n);
+  return f;
+  // end tj_filter_cuckoo_create
+}
+
+void
+tj_filter_cuckoo_finalize(tj_filter_cuckoo *f)
+{
+  tj_alloc_free(f->m_buckets);
+  free(f);
+  // end tj_filter_cuckoo_finalize
+}
+
+size_t
+tj_filter_cuckoo_getSize(const tj_filter_cuckoo *f)
+{
+  return (f->m_mask + 1) * sizeof(uint64_t);
+  // end tj_filter_cuckoo_getSize
+}
+
+size_t
+tj_filter_cuckoo_getCount(const tj_filter_cuckoo *f)
+{
+  return f->m_count;
+  // end tj_filter_cuckoo_getCount
+}
+
+int
+tj_filter_cuckoo_addHash(tj_filter_cuckoo *f, uint64_t hash)
+{
+  if (f->m_victim != 0)
+    return 0;
+
+  tj_filter_cuckoo_insert(f, hash & f->m_mask,
+                          tj_filter_cuckoo_fingerprint(hash));
+  f->m_count++;
+  return 1;
+  // end tj_filter_cuckoo_addHash
+}
+
+int
+tj_filter_cuckoo_containsHash(const tj_filter_cuckoo *f, uint64_t hash)
+{
+  uint16_t fp = tj_filter_cuckoo_fingerprint(hash);
+  size_t i = hash & f->m_mask, j = tj_filter_cuckoo_alternate(f, i, fp);
+
+  return (TJ_FILTER_MATCH(f->m_buckets[i] , fp) |
+          TJ_FILTER_MATCH(f->m_buckets[j], fp)) != 0 ||
+    (f->m_victim == fp &&
+     (f->m_victimIndex == i || f->m_victimIndex == j));
+  // end tj_filter_cuckoo_containsHash
+}
+
+int
+tj_filter_cuckoo_removeHash(tj_filter_cuckoo *f, uint64_t hash)
+{
+  uint16_t fp = tj_filter_cuckoo_fingerprint(hash), victim;
+  size_t i = hash & f->m_mask, j = tj_filter_cuckoo_alternate(f, i, fp);
+
+  if (f->m_victim == fp &&
+      (f->m_victimIndex == i || f->m_victimIndex == j)) {
+    f->m_victim = 0;
+  } else if (!tj_filter_cuckoo_unplace(f, i, fp) &&
+             !tj_filter_cuckoo_unplace(f, j, fp)) {
+    return 0;
+  } else if (f->m_victim != 0) {
+    //-- There is room again for the fingerprint held aside
+    victim = f->m_victim;
+    f->m_victim = 0;
+    tj_filter_cuckoo_insert(f, f->m_victimIndex, victim);
+  }
+
+  f->m_count--;
+  return 1;
+  // end tj_filter_cuckoo_removeHash
+}
+
+int
+tj_filter_cuckoo_add(tj_filter_cuckoo *f, const void *key, size_t n)
+{
+  return tj_filter_cuckoo_addHash(f, tj_hash_bytes(key, n, 0));
+  // end tj_filter_cuckoo_add
+}
+
+int
+tj_filter_cuckoo_contains(const tj_filter_cuckoo *f, const void *key,
+                          size_t n)
+{
+  return tj_filter_cuckoo_containsHash(f, tj_hash_bytes(key, n, 0));
+  // end tj_filter_cuckoo_contains
+}
+
+int
+tj_filter_cuckoo_remove(tj_filter_cuckoo *f, const void *key, size_t n)
+{
+  return tj_filter_cuckoo_removeHash(f, tj_hash_bytes(key, n, 0));
+  // end tj_filter_cuckoo_remove
+}
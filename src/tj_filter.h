@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __tj_filter_h__
+#define __tj_filter_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Approximate set membership, for skipping expensive lookups of keys
+ * which are usually absent.  A filter may report a key it was never
+ * given, at a small false positive rate, but never misses one it was.
+ *
+ * Keys are hashed with tj_hash_bytes(), or callers holding a hash
+ * already, as from tj_hash_bytes() with seed 0, may pass that instead.
+ * Filters are not synchronized; concurrent lookups are safe only while
+ * nothing is added or removed.
+ */
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * A blocked Bloom filter confines each key to one 64 byte, cache line
+ * aligned block, setting one bit in each of its eight words, so a
+ * lookup touches a single cache line.  It cannot remove keys.
+ */
+typedef struct tj_filter_bloom tj_filter_bloom;
+
+/**
+ * The expected false positive rate of a blocked Bloom filter with the
+ * given number of bits for each key it holds.
+ */
+double
+tj_filter_bloom_estimate(double bitsPerKey);
+
+/**
+ * The size in bytes of a blocked Bloom filter for n keys at a target
+ * false positive rate.  Rates below about 3e-7 are not reached; the
+ * filter is sized for 64 bits a key.
+ */
+size_t
+tj_filter_bloom_sizeFor(size_t n, double fpRate);
+
+/**
+ * Create an empty blocked Bloom filter.
+ *
+ * \param n The number of keys it is to hold.
+ * \param fpRate The target false positive rate once it holds them.
+ * \return The filter, or 0 on failure.
+ */
+tj_filter_bloom *
+tj_filter_bloom_create(size_t n, double fpRate);
+
+void
+tj_filter_bloom_finalize(tj_filter_bloom *f);
+
+size_t
+tj_filter_bloom_getSize(const tj_filter_bloom *f);
+
+void
+tj_filter_bloom_addHash(tj_filter_bloom *f, uint64_t hash);
+
+int
+tj_filter_bloom_containsHash(const tj_filter_bloom *f, uint64_t hash);
+
+void
+tj_filter_bloom_add(tj_filter_bloom *f, const void *key, size_t n);
+
+/**
+ * \return 0 if the key was certainly never added, 1 if it probably
+ * was.
+ */
+int
+tj_filter_bloom_contains(const tj_filter_bloom *f, const void *key,
+                         size_t n);
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * A cuckoo filter stores a 16 bit fingerprint of each key in one of
+ * two buckets of four, so keys can also be removed.  Its false
+ * positive rate is at most about 1.2e-4.  A key added k times is
+ * held until removed k times; removing a key never added may remove
+ * another sharing its fingerprint.
+ */
+typedef struct tj_filter_cuckoo tj_filter_cuckoo;
+
+/**
+ * The size in bytes of a cuckoo filter for n keys, loaded to at most
+ * 95%.
+ */
+size_t
+tj_filter_cuckoo_sizeFor(size_t n);
+
+/**
+ * Create an empty cuckoo filter.
+ *
+ * \param n The number of keys it is to hold.
+ * \return The filter, or 0 on failure.
+ */
+tj_filter_cuckoo *
+tj_filter_cuckoo_create(size_t n);
+
+void
+tj_filter_cuckoo_finalize(tj_filter_cuckoo *f);
+
+size_t
+tj_filter_cuckoo_getSize(const tj_filter_cuckoo *f);
+
+/**
+ * The number of keys held.
+ */
+size_t
+tj_filter_cuckoo_getCount(const tj_filter_cuckoo *f);
+
+/**
+ * \return 0 if the filter is full, 1 otherwise.
+ */
+int
+tj_filter_cuckoo_addHash(tj_filter_cuckoo *f, uint64_t hash);
+
+int
+tj_filter_cuckoo_containsHash(const tj_filter_cuckoo *f, uint64_t hash);
+
+/**
+ * \return 1 if a matching fingerprint was removed, 0 otherwise.
+ */
+int
+tj_filter_cuckoo_removeHash(tj_filter_cuckoo *f, uint64_t hash);
+
+int
+tj_filter_cuckoo_add(tj_filter_cuckoo *f, const void *key, size_t n);
+
+int
+tj_filter_cuckoo_contains(const tj_filter_cuckoo *f, const void *key,
+                          size_t n);
+
+int
+tj_filter_cuckoo_remove(tj_filter_cuckoo *f, const void *key, size_t n);
+
+#endif // __tj_filter_h__
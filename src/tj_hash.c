@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "tj_hash.h"
+
+#define TJ_HASH_P1 0x9e3779b185ebca87ULL
+#define TJ_HASH_P2 0xc2b2ae3d27d4eb4fULL
+#define TJ_HASH_P3 0x165667b19e3779f9ULL
+
+#define TJ_HASH_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+uint64_t
+tj_hash_uint64(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+  // end tj_hash_uint64
+}
+
+/*
+ * Each 8 byte word, and the zero padded tail, is multiplied into the
+ * state as in xxHash, and the state finally mixed as in MurmurHash3.
+ * Words are read with memcpy(), so the data need not be aligned.
+ */
+uint64_t
+tj_hash_bytes(const void *data, size_t n, uint64_t seed)
+{
+  const unsigned char *p = data;
+  uint64_t h = seed + TJ_HASH_P3 + n * TJ_HASH_P1, w;
+
+  for (; n >= 8; n -= 8, p += 8) {
+    memcpy(&w, p, 8);
+    w *= TJ_HASH_P2;
+    h ^= TJ_HASH_ROTL(w, 31) * TJ_HASH_P1;
+    h = TJ_HASH_ROTL(h, 27) * TJ_HASH_P1 + TJ_HASH_P3;
+  }
+
+  if (n > 0) {
+    w = 0;
+    memcpy(&w, p, n);
+    w *= TJ_HASH_P2;
+    h ^= TJ_HASH_ROTL(w, 31) * TJ_HASH_P1;
+    h = TJ_HASH_ROTL(h, 27) * TJ_HASH_P1 + TJ_HASH_P3;
+  }
+
+  return tj_hash_uint64(h);
+  // end tj_hash_bytes
+}
+
+uint64_t
+tj_hash_string(const char *str)
+{
+  return tj_hash_bytes(str, strlen(str), 0);
+  // end tj_hash_string
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __tj_hash_h__
+#define __tj_hash_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * General purpose 64 bit hashing, for hash tables and filters.  These
+ * are fast and mix well, but are not cryptographic and should not be
+ * exposed to keys chosen to collide.  Hashes are the same across runs
+ * and processes on a given platform.
+ */
+
+/**
+ * Hash a byte array.
+ *
+ * \param data A byte array of at least length n.
+ * \param n The number of bytes.
+ * \param seed Selects one of a family of independent hashes.
+ */
+uint64_t
+tj_hash_bytes(const void *data, size_t n, uint64_t seed);
+
+/**
+ * Hash a null terminated string, without its terminator.
+ */
+uint64_t
+tj_hash_string(const char *str);
+
+/**
+ * Mix a 64 bit integer, every input bit affecting every output bit.
+ * This is a bijection, so distinct integers never collide.
+ */
+uint64_t
+tj_hash_uint64(uint64_t x);
+
+#endif // __tj_hash_h__
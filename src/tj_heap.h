@@ -106,12 +106,12 @@
       }                                                                 \
       h->m_n *= 2;                                                      \
     }                                                                   \
-    size_t newindex = h->m_used, parentindex = h->m_used/2;             \
+    size_t newindex = h->m_used, parentindex = (h->m_used-1)/2;         \
     while (newindex>0 && type##_cmp(k,h->m_array[parentindex].m_key)) { \
       h->m_array[newindex].m_key = h->m_array[parentindex].m_key;       \
       h->m_array[newindex].m_value = h->m_array[parentindex].m_value;   \
       newindex = parentindex;                                           \
-      parentindex = newindex/2;                                         \
+      parentindex = (newindex-1)/2;                                     \
     }                                                                   \
     h->m_array[newindex].m_key = k;                                     \
     h->m_array[newindex].m_value = v;                                   \
@@ -22,6 +22,8 @@
  * SOFTWARE.
  */
 
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -34,6 +36,8 @@
 #include "tj_log.h"
 #include "tj_error.h"
 #include "tj_buffer.h"
+#include "tj_heap.h"
+#include "tj_metrics.h"
 
 const char *tj_log_level_labels[] =
   {
@@ -44,14 +48,135 @@ const char *tj_log_level_labels[] =
     "OUTPUT",
   };
 
+/*
+ * Published through tj_metrics, registered when the library loads.
+ */
+static tj_metrics_counter *tj_log_messageCount = 0;
+static tj_metrics_counter *tj_log_droppedCount = 0;
+
+static void __attribute__((constructor))
+tj_log_registerMetrics(void)
+{
+  tj_log_messageCount =
+    tj_metrics_counter_create("tj_log_messages_total",
+                              "Messages logged through tj_log.");
+  tj_log_droppedCount =
+    tj_metrics_counter_create("tj_log_dropped_total",
+                              "Messages dropped by queued or thread "
+                              "buffered channels.");
+  // end tj_log_registerMetrics
+}
+
+static inline void
+tj_log_count(tj_metrics_counter *c)
+{
+  if (c != 0)
+    tj_metrics_counter_add(c, 1);
+  // end tj_log_count
+}
+
+typedef struct tj_log_record tj_log_record;
+struct tj_log_record {
+  tj_log_site m_site;
+  const tj_log_site *m_static;
+  char *m_strings;
+  tj_error *m_error;
+  char *m_msg;
+};
+
+typedef struct tj_log_queue tj_log_queue;
+struct tj_log_queue {
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_notEmpty;
+  pthread_cond_t m_notFull;
+  pthread_t m_thread;
+
+  tj_log_record *m_records;
+  size_t m_capacity;
+  size_t m_head;
+  size_t m_count;
+
+  tj_log_queuePolicy m_policy;
+  unsigned long m_dropped;
+  int m_busy;
+  int m_stopping;
+};
+
+/*
+ * Each thread logging to a channel with thread buffers writes into
+ * its own ring, read only by the channel's merger.  Records are 8
+ * byte aligned and never wrap; a tail too short for a record is
+ * skipped, marked by a padding record if there is room for one.
+ */
+typedef struct tj_log_threadRecord tj_log_threadRecord;
+struct tj_log_threadRecord {
+  uint64_t m_time;
+  uint32_t m_size;
+  uint32_t m_pad;
+
+  const tj_log_site *m_static;
+  tj_log_level m_level;
+  int m_line;
+  int m_error;
+  tj_error_code m_errorCode;
+  uint32_t m_componentLen;
+  uint32_t m_fileLen;
+  uint32_t m_funcLen;
+  uint32_t m_msgLen;
+};
+
+#define TJ_LOG_THREADS_MINRECORD 16
+
+typedef struct tj_log_threadRing tj_log_threadRing;
+struct tj_log_threadRing {
+  tj_buffer_byte *m_data;
+  size_t m_size;
+  uint64_t m_head;
+  uint64_t m_tail;
+  unsigned long m_dropped;
+  int m_orphaned;
+  tj_log_threadRing *m_next;
+};
+
+static int
+tj_log_threads_before(uint64_t a, uint64_t b)
+{
+  return a < b;
+}
+
+TJ_HEAP_DECL(tj_log_mergeheap, uint64_t, tj_log_threadRing *,
+             tj_log_threads_before)
+
+typedef struct tj_log_threads tj_log_threads;
+struct tj_log_threads {
+  pthread_key_t m_key;
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_wake;
+  pthread_cond_t m_flushed;
+  pthread_t m_thread;
+
+  tj_log_threadRing *m_rings;
+  size_t m_ringSize;
+  uint64_t m_slack;
+  tj_log_mergeheap *m_heap;
+
+  unsigned long m_dropped;
+  int m_flushing;
+  int m_stopping;
+};
+
 struct tj_log_outchannel {
   int m_allocated;
 
   void *m_data;
 
   tj_log_logFunction log;
+  tj_log_siteFunction logSite;
   tj_log_finalizeFunction finalize;
 
+  tj_log_queue *m_queue;
+  tj_log_threads *m_threads;
+
   tj_log_outchannel *m_next;
 
   // end tj_log_outchannel
@@ -81,7 +206,10 @@ tj_log_outchannel tj_log_fprintfChannel =
     .m_allocated = 0,
     .m_data = 0,
     .log = &tj_log_fprintfLog,
+    .logSite = 0,
     .finalize = &tj_log_fprintfLogFinalize,
+    .m_queue = 0,
+    .m_threads = 0,
     .m_next = 0
   };
 
@@ -98,7 +226,10 @@ tj_log_outchannel tj_log_logcatChannel =
     .m_allocated = 0,
     .m_data = 0,
     .log = &tj_log_logcatLog,
+    .logSite = 0,
     .finalize = 0,
+    .m_queue = 0,
+    .m_threads = 0,
     .m_next = &tj_log_fprintfChannel,
   };
 
@@ -110,6 +241,10 @@ tj_log_outchannel *tj_log_channelStack = &tj_log_fprintfChannel;
 
 int tj_log_atexit = 0;
 
+tj_log_site *tj_log_siteList = 0;
+unsigned int tj_log_siteCount = 0;
+pthread_mutex_t tj_log_siteLock = PTHREAD_MUTEX_INITIALIZER;
+
 
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
@@ -127,17 +262,58 @@ tj_log_outchannel_create(void *data,
   x->m_allocated = 1;
   x->m_data = data;
   x->log = log;
+  x->logSite = 0;
   x->finalize = finalize;
+  x->m_queue = 0;
+  x->m_threads = 0;
   x->m_next = 0;
 
   return x;
 
-  // end tj_log_outchannel_finalize
+  // end tj_log_outchannel_create
 }
 
+tj_log_outchannel *
+tj_log_outchannel_createSite(void *data,
+                             tj_log_siteFunction log,
+                             tj_log_finalizeFunction finalize)
+{
+  tj_log_outchannel *x;
+  if ((x = tj_log_outchannel_create(data, 0, finalize)) == 0)
+    return 0;
+
+  x->logSite = log;
+  return x;
+  // end tj_log_outchannel_createSite
+}
+
+static void
+tj_log_threads_finalize(tj_log_outchannel *out);
+
 void
 tj_log_outchannel_finalize(tj_log_outchannel *x)
 {
+  tj_log_queue *q = x->m_queue;
+
+  if (x->m_threads != 0)
+    tj_log_threads_finalize(x);
+
+  //-- Drain the queue before the channel goes away
+  if (q != 0) {
+    pthread_mutex_lock(&q->m_lock);
+    q->m_stopping = 1;
+    pthread_cond_signal(&q->m_notEmpty);
+    pthread_mutex_unlock(&q->m_lock);
+
+    pthread_join(q->m_thread, 0);
+    pthread_cond_destroy(&q->m_notFull);
+    pthread_cond_destroy(&q->m_notEmpty);
+    pthread_mutex_destroy(&q->m_lock);
+    free(q->m_records);
+    free(q);
+    x->m_queue = 0;
+  }
+
   if (x->finalize != 0)
     x->finalize(x->m_data);
 
@@ -147,6 +323,610 @@ tj_log_outchannel_finalize(tj_log_outchannel *x)
 }
 
 
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static void
+tj_log_outchannel_deliver(tj_log_outchannel *out, const tj_log_site *site,
+                          tj_error *error, const char *msg)
+{
+  if (out->logSite != 0)
+    out->logSite(out->m_data, site, error, msg);
+  else
+    out->log(out->m_data, site->m_level, site->m_component,
+             site->m_file, site->m_func, site->m_line, error, msg);
+  // end tj_log_outchannel_deliver
+}
+
+static void
+tj_log_record_clear(tj_log_record *r)
+{
+  if (r->m_error != 0)
+    tj_error_finalize(r->m_error);
+  free(r->m_strings);
+  free(r->m_msg);
+  memset(r, 0, sizeof(tj_log_record));
+  // end tj_log_record_clear
+}
+
+/*
+ * Copies everything a message refers to, as the caller's strings and
+ * error are gone by the time the consumer runs.  Registered sites are
+ * static and referred to directly.
+ */
+static int
+tj_log_record_set(tj_log_record *r, const tj_log_site *site,
+                  tj_error *error, const char *msg)
+{
+  size_t nc, nf;
+
+  memset(r, 0, sizeof(tj_log_record));
+  r->m_site = *site;
+  r->m_site.m_next = 0;
+
+  if (site->m_id != 0) {
+    r->m_static = site;
+  } else {
+    nc = strlen(site->m_component)+1;
+    nf = strlen(site->m_file)+1;
+    if ((r->m_strings = malloc(nc + nf + strlen(site->m_func)+1)) == 0)
+      goto error;
+    r->m_site.m_component = memcpy(r->m_strings, site->m_component, nc);
+    r->m_site.m_file = memcpy(r->m_strings + nc, site->m_file, nf);
+    r->m_site.m_func = strcpy(r->m_strings + nc + nf, site->m_func);
+  }
+
+  if (error != 0 &&
+      (r->m_error = tj_error_create(tj_error_getCode(error), "%s",
+                                    tj_error_getMessage(error))) == 0)
+    goto error;
+
+  if ((r->m_msg = strdup(msg)) == 0)
+    goto error;
+
+  return 1;
+
+ error:
+  TJ_ERROR("No memory for queued log message.");
+  tj_log_record_clear(r);
+  return 0;
+  // end tj_log_record_set
+}
+
+/*
+ * Set on queue consumer threads.  A channel which itself logs would
+ * otherwise wait on its own full queue, so such messages never block.
+ */
+static __thread int tj_log_queue_consuming = 0;
+
+static void *
+tj_log_queue_consume(void *arg)
+{
+  tj_log_outchannel *out = arg;
+  tj_log_queue *q = out->m_queue;
+  tj_log_record r;
+
+  tj_log_queue_consuming = 1;
+
+  pthread_mutex_lock(&q->m_lock);
+  for (;;) {
+    while (q->m_count == 0 && !q->m_stopping)
+      pthread_cond_wait(&q->m_notEmpty, &q->m_lock);
+    if (q->m_count == 0)
+      break;
+
+    r = q->m_records[q->m_head];
+    q->m_head = (q->m_head + 1) % q->m_capacity;
+    q->m_count--;
+    q->m_busy = 1;
+    pthread_mutex_unlock(&q->m_lock);
+
+    tj_log_outchannel_deliver(out, r.m_static ? r.m_static : &r.m_site,
+                              r.m_error, r.m_msg);
+    tj_log_record_clear(&r);
+
+    pthread_mutex_lock(&q->m_lock);
+    q->m_busy = 0;
+    pthread_cond_broadcast(&q->m_notFull);
+  }
+  pthread_mutex_unlock(&q->m_lock);
+
+  return 0;
+  // end tj_log_queue_consume
+}
+
+static void
+tj_log_queue_push(tj_log_queue *q, const tj_log_site *site,
+                  tj_error *error, const char *msg)
+{
+  tj_log_record r, *slot;
+
+  if (!tj_log_record_set(&r, site, error, msg))
+    return;
+
+  pthread_mutex_lock(&q->m_lock);
+  if (q->m_count == q->m_capacity) {
+    switch (q->m_policy) {
+    case TJ_LOG_QUEUE_BLOCK:
+      while (q->m_count == q->m_capacity && !q->m_stopping &&
+             !tj_log_queue_consuming)
+        pthread_cond_wait(&q->m_notFull, &q->m_lock);
+      break;
+
+    case TJ_LOG_QUEUE_DROPOLDEST:
+      tj_log_record_clear(&q->m_records[q->m_head]);
+      q->m_head = (q->m_head + 1) % q->m_capacity;
+      q->m_count--;
+      q->m_dropped++;
+      tj_log_count(tj_log_droppedCount);
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  if (q->m_count == q->m_capacity || q->m_stopping) {
+    q->m_dropped++;
+    tj_log_count(tj_log_droppedCount);
+    pthread_mutex_unlock(&q->m_lock);
+    tj_log_record_clear(&r);
+    return;
+  }
+
+  slot = &q->m_records[(q->m_head + q->m_count) % q->m_capacity];
+  *slot = r;
+  q->m_count++;
+  pthread_cond_signal(&q->m_notEmpty);
+  pthread_mutex_unlock(&q->m_lock);
+  // end tj_log_queue_push
+}
+
+int
+tj_log_outchannel_setQueue(tj_log_outchannel *out, size_t capacity,
+                           tj_log_queuePolicy policy)
+{
+  tj_log_queue *q;
+
+  if (out->m_queue != 0 || out->m_threads != 0 || capacity == 0) {
+    TJ_ERROR("Channel already has a queue, or capacity is 0.");
+    return 1;
+  }
+
+  if ((q = calloc(1, sizeof(tj_log_queue))) == 0 ||
+      (q->m_records = calloc(capacity, sizeof(tj_log_record))) == 0) {
+    TJ_ERROR("No memory for tj_log_queue.");
+    free(q);
+    return 1;
+  }
+
+  q->m_capacity = capacity;
+  q->m_policy = policy;
+  pthread_mutex_init(&q->m_lock, 0);
+  pthread_cond_init(&q->m_notEmpty, 0);
+  pthread_cond_init(&q->m_notFull, 0);
+
+  out->m_queue = q;
+  if (pthread_create(&q->m_thread, 0, &tj_log_queue_consume, out) != 0) {
+    TJ_ERROR("Could not start log queue consumer.");
+    out->m_queue = 0;
+    pthread_cond_destroy(&q->m_notFull);
+    pthread_cond_destroy(&q->m_notEmpty);
+    pthread_mutex_destroy(&q->m_lock);
+    free(q->m_records);
+    free(q);
+    return 1;
+  }
+
+  return 0;
+  // end tj_log_outchannel_setQueue
+}
+
+void
+tj_log_outchannel_flush(tj_log_outchannel *out)
+{
+  tj_log_queue *q = out->m_queue;
+  tj_log_threads *t = out->m_threads;
+
+  if (t != 0) {
+    pthread_mutex_lock(&t->m_lock);
+    t->m_flushing = 1;
+    pthread_cond_signal(&t->m_wake);
+    while (t->m_flushing)
+      pthread_cond_wait(&t->m_flushed, &t->m_lock);
+    pthread_mutex_unlock(&t->m_lock);
+  }
+
+  if (q == 0)
+    return;
+
+  pthread_mutex_lock(&q->m_lock);
+  while (q->m_count > 0 || q->m_busy)
+    pthread_cond_wait(&q->m_notFull, &q->m_lock);
+  pthread_mutex_unlock(&q->m_lock);
+  // end tj_log_outchannel_flush
+}
+
+unsigned long
+tj_log_outchannel_getDropped(tj_log_outchannel *out)
+{
+  unsigned long n = 0;
+  tj_log_queue *q = out->m_queue;
+  tj_log_threads *t = out->m_threads;
+  tj_log_threadRing *r;
+
+  if (q != 0) {
+    pthread_mutex_lock(&q->m_lock);
+    n = q->m_dropped;
+    pthread_mutex_unlock(&q->m_lock);
+  }
+
+  if (t != 0) {
+    pthread_mutex_lock(&t->m_lock);
+    n += t->m_dropped;
+    for (r = t->m_rings; r != 0; r = r->m_next)
+      n += __atomic_load_n(&r->m_dropped, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&t->m_lock);
+  }
+
+  return n;
+  // end tj_log_outchannel_getDropped
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static uint64_t
+tj_log_threads_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  // end tj_log_threads_now
+}
+
+static void
+tj_log_threads_orphan(void *ring)
+{
+  __atomic_store_n(&((tj_log_threadRing *) ring)->m_orphaned, 1,
+                   __ATOMIC_RELEASE);
+  // end tj_log_threads_orphan
+}
+
+static tj_log_threadRing *
+tj_log_threads_ring(tj_log_threads *t)
+{
+  tj_log_threadRing *r;
+
+  if ((r = pthread_getspecific(t->m_key)) != 0)
+    return r;
+
+  if ((r = calloc(1, sizeof(tj_log_threadRing))) == 0 ||
+      (r->m_data = malloc(t->m_ringSize)) == 0) {
+    TJ_ERROR("No memory for thread log buffer.");
+    free(r);
+    return 0;
+  }
+  r->m_size = t->m_ringSize;
+
+  pthread_mutex_lock(&t->m_lock);
+  r->m_next = t->m_rings;
+  t->m_rings = r;
+  pthread_mutex_unlock(&t->m_lock);
+
+  pthread_setspecific(t->m_key, r);
+  return r;
+  // end tj_log_threads_ring
+}
+
+/*
+ * Appends to the calling thread's ring.  Only this thread writes
+ * m_tail and only the merger writes m_head, so no lock is taken and
+ * nothing is written that another core is also writing.
+ */
+static void
+tj_log_threads_push(tj_log_threads *t, const tj_log_site *site,
+                    tj_error *error, const char *msg)
+{
+  tj_log_threadRing *ring;
+  tj_log_threadRecord *x;
+  const char *errorMsg = (error != 0) ? tj_error_getMessage(error) : "";
+  uint32_t nc = 0, nf = 0, nu = 0, nm = strlen(msg), ne = strlen(errorMsg);
+  uint64_t head, tail, room, n;
+  char *s;
+
+  if ((ring = tj_log_threads_ring(t)) == 0)
+    return;
+
+  if (site->m_id == 0) {
+    nc = strlen(site->m_component)+1;
+    nf = strlen(site->m_file)+1;
+    nu = strlen(site->m_func)+1;
+  }
+
+  //-- Overlong messages are truncated to keep a ring from stalling
+  n = sizeof(tj_log_threadRecord) + nc + nf + nu + ne + 2;
+  if (n + nm > ring->m_size / 4) {
+    if (n + 64 > ring->m_size / 4) {
+      __atomic_add_fetch(&ring->m_dropped, 1, __ATOMIC_RELAXED);
+      tj_log_count(tj_log_droppedCount);
+      return;
+    }
+    nm = ring->m_size / 4 - n;
+  }
+  n = (n + nm + 7) & ~((uint64_t) 7);
+
+  head = __atomic_load_n(&ring->m_head, __ATOMIC_ACQUIRE);
+  tail = ring->m_tail;
+  room = ring->m_size - tail % ring->m_size;
+  if (tail + (room < n ? room : 0) + n - head > ring->m_size) {
+    __atomic_add_fetch(&ring->m_dropped, 1, __ATOMIC_RELAXED);
+    tj_log_count(tj_log_droppedCount);
+    return;
+  }
+
+  if (room < n) {
+    if (room >= TJ_LOG_THREADS_MINRECORD) {
+      x = (tj_log_threadRecord *) &ring->m_data[tail % ring->m_size];
+      x->m_size = room;
+      x->m_pad = 1;
+    }
+    tail += room;
+  }
+
+  x = (tj_log_threadRecord *) &ring->m_data[tail % ring->m_size];
+  x->m_time = tj_log_threads_now();
+  x->m_size = n;
+  x->m_pad = 0;
+  x->m_static = (site->m_id != 0) ? site : 0;
+  x->m_level = site->m_level;
+  x->m_line = site->m_line;
+  x->m_error = (error != 0);
+  x->m_errorCode = (error != 0) ? tj_error_getCode(error) : 0;
+  x->m_componentLen = nc;
+  x->m_fileLen = nf;
+  x->m_funcLen = nu;
+  x->m_msgLen = nm;
+
+  s = (char *) (x + 1);
+  if (site->m_id == 0) {
+    memcpy(s, site->m_component, nc);
+    memcpy(s += nc, site->m_file, nf);
+    memcpy(s += nf, site->m_func, nu);
+    s += nu;
+  }
+  memcpy(s, msg, nm);
+  s[nm] = 0;
+  memcpy(s + nm + 1, errorMsg, ne+1);
+
+  __atomic_store_n(&ring->m_tail, tail + n, __ATOMIC_RELEASE);
+  // end tj_log_threads_push
+}
+
+/*
+ * The oldest record in a ring, skipping padding, or 0 if it is empty.
+ */
+static tj_log_threadRecord *
+tj_log_threads_peek(tj_log_threadRing *ring)
+{
+  uint64_t head = ring->m_head, room;
+  uint64_t tail = __atomic_load_n(&ring->m_tail, __ATOMIC_ACQUIRE);
+  tj_log_threadRecord *x = 0;
+
+  while (head < tail) {
+    room = ring->m_size - head % ring->m_size;
+    if (room < TJ_LOG_THREADS_MINRECORD) {
+      head += room;
+      continue;
+    }
+    x = (tj_log_threadRecord *) &ring->m_data[head % ring->m_size];
+    if (!x->m_pad)
+      break;
+    head += x->m_size;
+    x = 0;
+  }
+
+  __atomic_store_n(&ring->m_head, head, __ATOMIC_RELEASE);
+  return x;
+  // end tj_log_threads_peek
+}
+
+static void
+tj_log_threads_deliver(tj_log_outchannel *out, tj_log_threadRing *ring,
+                       tj_log_threadRecord *x)
+{
+  tj_log_site site;
+  tj_error *error = 0;
+  const char *s = (const char *) (x + 1), *msg;
+
+  if (x->m_static == 0) {
+    memset(&site, 0, sizeof(site));
+    site.m_level = x->m_level;
+    site.m_line = x->m_line;
+    site.m_component = s;
+    site.m_file = (s += x->m_componentLen);
+    site.m_func = (s += x->m_fileLen);
+    s += x->m_funcLen;
+    site.m_format = s;
+    site.m_enabled = 1;
+  }
+  msg = s;
+
+  if (x->m_error)
+    error = tj_error_create(x->m_errorCode, "%s", msg + x->m_msgLen + 1);
+
+  tj_log_outchannel_deliver(out, x->m_static ? x->m_static : &site,
+                            error, msg);
+
+  if (error != 0)
+    tj_error_finalize(error);
+
+  __atomic_store_n(&ring->m_head, ring->m_head + x->m_size,
+                   __ATOMIC_RELEASE);
+  // end tj_log_threads_deliver
+}
+
+/*
+ * Merges the rings in time order with a heap keyed on the oldest
+ * record of each, emitting everything older than the watermark.
+ * Records newer than it are held back in case a slower thread still
+ * has older ones to publish.  Returns with the lock held.
+ */
+static void
+tj_log_threads_merge(tj_log_outchannel *out, uint64_t watermark)
+{
+  tj_log_threads *t = out->m_threads;
+  tj_log_threadRing *ring, **prev;
+  tj_log_threadRecord *x;
+  uint64_t key;
+
+  t->m_heap->m_used = 0;
+  for (prev = &t->m_rings; (ring = *prev) != 0; ) {
+    if ((x = tj_log_threads_peek(ring)) != 0) {
+      tj_log_mergeheap_add(t->m_heap, x->m_time, ring);
+    } else if (__atomic_load_n(&ring->m_orphaned, __ATOMIC_ACQUIRE) &&
+               tj_log_threads_peek(ring) == 0) {
+      *prev = ring->m_next;
+      t->m_dropped += ring->m_dropped;
+      free(ring->m_data);
+      free(ring);
+      continue;
+    }
+    prev = &ring->m_next;
+  }
+  pthread_mutex_unlock(&t->m_lock);
+
+  while (tj_log_mergeheap_peek(t->m_heap, &key, &ring) && key <= watermark) {
+    tj_log_mergeheap_pop(t->m_heap, &key, &ring);
+    tj_log_threads_deliver(out, ring, tj_log_threads_peek(ring));
+    if ((x = tj_log_threads_peek(ring)) != 0)
+      tj_log_mergeheap_add(t->m_heap, x->m_time, ring);
+  }
+
+  pthread_mutex_lock(&t->m_lock);
+  // end tj_log_threads_merge
+}
+
+static void *
+tj_log_threads_run(void *arg)
+{
+  tj_log_outchannel *out = arg;
+  tj_log_threads *t = out->m_threads;
+  uint64_t interval = t->m_slack / 2, now;
+  struct timespec wake;
+  int flushing;
+
+  if (interval < 1000000)
+    interval = 1000000;
+
+  pthread_mutex_lock(&t->m_lock);
+  while (!t->m_stopping) {
+    flushing = t->m_flushing;
+    now = tj_log_threads_now();
+    tj_log_threads_merge(out, flushing ? UINT64_MAX :
+                         (now > t->m_slack ? now - t->m_slack : 0));
+
+    if (flushing) {
+      t->m_flushing = 0;
+      pthread_cond_broadcast(&t->m_flushed);
+    }
+
+    if (t->m_flushing || t->m_stopping)
+      continue;
+
+    now += interval;
+    wake.tv_sec = now / 1000000000;
+    wake.tv_nsec = now % 1000000000;
+    pthread_cond_timedwait(&t->m_wake, &t->m_lock, &wake);
+  }
+
+  tj_log_threads_merge(out, UINT64_MAX);
+  pthread_mutex_unlock(&t->m_lock);
+
+  return 0;
+  // end tj_log_threads_run
+}
+
+int
+tj_log_outchannel_setThreadBuffers(tj_log_outchannel *out, size_t bytes,
+                                   unsigned int slackMillis)
+{
+  tj_log_threads *t;
+  pthread_condattr_t attr;
+
+  if (out->m_queue != 0 || out->m_threads != 0) {
+    TJ_ERROR("Channel already has a queue or thread buffers.");
+    return 1;
+  }
+
+  if ((t = calloc(1, sizeof(tj_log_threads))) == 0 ||
+      (t->m_heap = tj_log_mergeheap_create(16)) == 0) {
+    TJ_ERROR("No memory for tj_log_threads.");
+    free(t);
+    return 1;
+  }
+
+  bytes = (bytes + 7) & ~((size_t) 7);
+  t->m_ringSize = (bytes < 4096) ? 4096 : bytes;
+  t->m_slack = (uint64_t) slackMillis * 1000000;
+
+  if (pthread_key_create(&t->m_key, &tj_log_threads_orphan) != 0) {
+    TJ_ERROR("Could not create thread log buffer key.");
+    tj_log_mergeheap_finalize(t->m_heap);
+    free(t);
+    return 1;
+  }
+
+  pthread_mutex_init(&t->m_lock, 0);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&t->m_wake, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&t->m_flushed, 0);
+
+  out->m_threads = t;
+  if (pthread_create(&t->m_thread, 0, &tj_log_threads_run, out) != 0) {
+    TJ_ERROR("Could not start thread log buffer merger.");
+    out->m_threads = 0;
+    pthread_key_delete(t->m_key);
+    pthread_cond_destroy(&t->m_flushed);
+    pthread_cond_destroy(&t->m_wake);
+    pthread_mutex_destroy(&t->m_lock);
+    tj_log_mergeheap_finalize(t->m_heap);
+    free(t);
+    return 1;
+  }
+
+  return 0;
+  // end tj_log_outchannel_setThreadBuffers
+}
+
+static void
+tj_log_threads_finalize(tj_log_outchannel *out)
+{
+  tj_log_threads *t = out->m_threads;
+  tj_log_threadRing *ring;
+
+  pthread_mutex_lock(&t->m_lock);
+  t->m_stopping = 1;
+  pthread_cond_signal(&t->m_wake);
+  pthread_mutex_unlock(&t->m_lock);
+  pthread_join(t->m_thread, 0);
+
+  pthread_key_delete(t->m_key);
+  while ((ring = t->m_rings) != 0) {
+    t->m_rings = ring->m_next;
+    free(ring->m_data);
+    free(ring);
+  }
+
+  pthread_cond_destroy(&t->m_flushed);
+  pthread_cond_destroy(&t->m_wake);
+  pthread_mutex_destroy(&t->m_lock);
+  tj_log_mergeheap_finalize(t->m_heap);
+  free(t);
+  out->m_threads = 0;
+  // end tj_log_threads_finalize
+}
+
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
 int
@@ -181,6 +961,8 @@ tj_log_removeOutChannel(tj_log_outchannel *out)
 
   if (prev != 0)
     prev->m_next = top->m_next;
+  else
+    tj_log_channelStack = top->m_next;
 
   tj_log_outchannel_finalize(out);
 
@@ -234,34 +1016,161 @@ tj_log_finalize(void)
 
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
+unsigned int
+tj_log_registerSite(tj_log_site *site)
+{
+  pthread_mutex_lock(&tj_log_siteLock);
+  if (site->m_id == 0) {
+    site->m_next = tj_log_siteList;
+    __atomic_store_n(&tj_log_siteList, site, __ATOMIC_RELEASE);
+    site->m_id = ++tj_log_siteCount;
+  }
+  pthread_mutex_unlock(&tj_log_siteLock);
+
+  return site->m_id;
+  // end tj_log_registerSite
+}
+
 void
-tj_log_log(tj_log_level level, const char *component,
-           const char *file, const char *func, int line,
-           tj_error *error, const char *m, ...)
+tj_log_registerSites(tj_log_site *start, tj_log_site *stop)
 {
-  tj_buffer *msg = 0;
+  if (start == 0)
+    return;
 
-  va_list ap;
-  va_start(ap, m);
+  for (; start < stop; start++) {
+    if (start->m_id == 0)
+      tj_log_registerSite(start);
+  }
+  // end tj_log_registerSites
+}
+
+void
+tj_log_unregisterSites(tj_log_site *start, tj_log_site *stop)
+{
+  tj_log_outchannel *out;
+  tj_log_site **p;
+
+  if (start == 0)
+    return;
+
+  //-- Queued records may point at the sites.  Once tj_log_finalize
+  //-- has run, at exit, the channels are gone and so are the records.
+  if (tj_log_atexit) {
+    for (out = tj_log_channelStack; out != 0; out = out->m_next) {
+      if (out->m_queue != 0 || out->m_threads != 0)
+        tj_log_outchannel_flush(out);
+    }
+  }
+
+  pthread_mutex_lock(&tj_log_siteLock);
+  for (p = &tj_log_siteList; *p != 0; ) {
+    if (*p >= start && *p < stop)
+      *p = (*p)->m_next;
+    else
+      p = &(*p)->m_next;
+  }
+  pthread_mutex_unlock(&tj_log_siteLock);
+  // end tj_log_unregisterSites
+}
+
+tj_log_site *
+tj_log_getSites(void)
+{
+  return __atomic_load_n(&tj_log_siteList, __ATOMIC_ACQUIRE);
+  // end tj_log_getSites
+}
+
+size_t
+tj_log_setSitesEnabled(const char *component, tj_log_level level,
+                       int enabled)
+{
+  tj_log_site *site;
+  size_t n = 0;
+
+  pthread_mutex_lock(&tj_log_siteLock);
+  for (site = tj_log_siteList; site != 0; site = site->m_next) {
+    if (site->m_level <= level && site->m_enabled != enabled &&
+        (component == 0 || !strcmp(component, site->m_component))) {
+      site->m_enabled = enabled;
+      n++;
+    }
+  }
+  pthread_mutex_unlock(&tj_log_siteLock);
+
+  return n;
+  // end tj_log_setSitesEnabled
+}
+
+//----------------------------------------------------------------------
+static void
+tj_log_dispatch(const tj_log_site *site, tj_error *error,
+                const char *m, va_list ap)
+{
+  tj_buffer *msg = 0;
 
   if ((msg = tj_buffer_create(128)) == 0) {
     TJ_ERROR("No memory for tj_log_log buffer.");
-    goto done;
+    return;
   }
 
   tj_buffer_vaprintf(msg, m, ap);
+  tj_log_count(tj_log_messageCount);
 
   tj_log_outchannel *out = tj_log_channelStack;
   while (out != 0) {
-    out->log(out->m_data, level, component, file, func, line, error,
-             tj_buffer_getAsString(msg));
+    if (out->m_threads != 0)
+      tj_log_threads_push(out->m_threads, site, error,
+                          tj_buffer_getAsString(msg));
+    else if (out->m_queue != 0)
+      tj_log_queue_push(out->m_queue, site, error,
+                        tj_buffer_getAsString(msg));
+    else
+      tj_log_outchannel_deliver(out, site, error,
+                                tj_buffer_getAsString(msg));
     out = out->m_next;
   }
 
- done:
-  if (msg)
-    tj_buffer_finalize(msg);
+  tj_buffer_finalize(msg);
+  // end tj_log_dispatch
+}
+
+void
+tj_log_logSite(tj_log_site *site, tj_error *error, const char *m, ...)
+{
+  va_list ap;
+
+  if (!site->m_enabled)
+    return;
+
+  if (site->m_id == 0)
+    tj_log_registerSite(site);
 
+  va_start(ap, m);
+  tj_log_dispatch(site, error, m, ap);
+  va_end(ap);
+  // end tj_log_logSite
+}
+
+void
+tj_log_log(tj_log_level level, const char *component,
+           const char *file, const char *func, int line,
+           tj_error *error, const char *m, ...)
+{
+  tj_log_site site = {
+    .m_level = level,
+    .m_component = component,
+    .m_file = file,
+    .m_func = func,
+    .m_line = line,
+    .m_format = m,
+    .m_enabled = 1,
+    .m_id = 0,
+    .m_next = 0
+  };
+
+  va_list ap;
+  va_start(ap, m);
+  tj_log_dispatch(&site, error, m, ap);
   va_end(ap);
 
   // end tj_log_log
@@ -271,6 +1180,10 @@ void tj_log_setData(tj_log_outchannel *out, void *data) {
   out->m_data = data;
 }
 
+void *tj_log_getData(tj_log_outchannel *out) {
+  return out->m_data;
+}
+
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
 void
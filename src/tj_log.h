@@ -44,6 +44,31 @@ typedef enum {
   TJ_LOG_LEVEL_OUTPUT,
 } tj_log_level;
 
+/**
+ * Static description of a single logging call site.  Each expansion
+ * of TJ_LOG_SITE_LOG defines one, placed in the tj_log_sites linker
+ * section, such that its metadata is passed to channels as a single
+ * pointer and tooling can enumerate and enable sites at runtime.
+ * Messages logged through tj_log_log(), and so TJ_LOG_LOG, are given
+ * a transient site without an id.
+ */
+typedef struct tj_log_site tj_log_site;
+struct tj_log_site {
+  tj_log_level m_level;
+  const char *m_component;
+  const char *m_file;
+  const char *m_func;
+  int m_line;
+  const char *m_format;
+
+  // Cleared to suppress the site without formatting its message
+  volatile int m_enabled;
+
+  // Assigned once the site is registered, starting from 1
+  volatile unsigned int m_id;
+  tj_log_site *m_next;
+};
+
 #ifndef TJ_LOG_LOG
 #define TJ_LOG_LOG(level, component, e, msg, ...)                      \
   tj_log_log(level, component,                                         \
@@ -51,6 +76,47 @@ typedef enum {
              e, msg, ##__VA_ARGS__)
 #endif
 
+/**
+ * As TJ_LOG_LOG, but through a static call site, which may be
+ * enumerated and disabled at runtime, and which channels may refer to
+ * by id.  As the site is statically initialized, level, component and
+ * msg must be compile time constants, e.g. string literals.
+ */
+#ifndef TJ_LOG_SITE_LOG
+#define TJ_LOG_SITE_LOG(level, component, e, msg, ...)                 \
+  ({                                                                   \
+    static tj_log_site tj_log_site__                                   \
+      __attribute__((section("tj_log_sites"), used, aligned(8))) =     \
+      { level, component, __FILE__, __FUNCTION__, __LINE__, msg,       \
+        1, 0, 0 };                                                     \
+    tj_log_logSite(&tj_log_site__, e, msg, ##__VA_ARGS__);             \
+  })
+#endif
+
+/**
+ * Register every call site in the linking module, executable or
+ * shared library, when it is loaded, and unregister them when it is
+ * unloaded.  Sites not registered this way are registered the first
+ * time they log, and never unregistered, so a module which may be
+ * unloaded must use this.  Use at file scope in one source file of
+ * the module.
+ */
+#define TJ_LOG_SITES_REGISTER()                                        \
+  extern tj_log_site __start_tj_log_sites[]                            \
+    __attribute__((weak, visibility("hidden")));                       \
+  extern tj_log_site __stop_tj_log_sites[]                             \
+    __attribute__((weak, visibility("hidden")));                       \
+  static void __attribute__((constructor))                             \
+  tj_log_sites_register__(void)                                        \
+  {                                                                    \
+    tj_log_registerSites(__start_tj_log_sites, __stop_tj_log_sites);   \
+  }                                                                    \
+  static void __attribute__((destructor))                              \
+  tj_log_sites_unregister__(void)                                      \
+  {                                                                    \
+    tj_log_unregisterSites(__start_tj_log_sites, __stop_tj_log_sites); \
+  }
+
 #ifndef TJ_LOG_CRITICAL
 #define TJ_LOG_CRITICAL(component, msg, ...)                           \
   TJ_LOG_LOG(TJ_LOG_LEVEL_CRITICAL, component, 0, msg, ##__VA_ARGS__)
@@ -98,6 +164,26 @@ typedef enum {
 // end !NDEBUG
 #endif
 
+#define TJ_LOG_SITE_CRITICAL(component, msg, ...)                      \
+  TJ_LOG_SITE_LOG(TJ_LOG_LEVEL_CRITICAL, component, 0, msg, ##__VA_ARGS__)
+#define TJ_LOG_SITE_ERROR(component, e, msg, ...)                      \
+  TJ_LOG_SITE_LOG(TJ_LOG_LEVEL_CRITICAL, component, e, msg, ##__VA_ARGS__)
+#define TJ_LOG_SITE_OUTPUT(component, msg, ...)                        \
+  TJ_LOG_SITE_LOG(TJ_LOG_LEVEL_OUTPUT, component, 0, msg, ##__VA_ARGS__)
+
+#ifdef NDEBUG
+#define TJ_LOG_SITE_VERBOSE(component, msg, ...)
+#define TJ_LOG_SITE_LOGIC(component, msg, ...)
+#define TJ_LOG_SITE_COMPONENT(component, msg, ...)
+#else
+#define TJ_LOG_SITE_VERBOSE(component, msg, ...)                       \
+  TJ_LOG_SITE_LOG(TJ_LOG_LEVEL_VERBOSE, component, 0, msg, ##__VA_ARGS__)
+#define TJ_LOG_SITE_LOGIC(component, msg, ...)                         \
+  TJ_LOG_SITE_LOG(TJ_LOG_LEVEL_LOGIC, component, 0, msg, ##__VA_ARGS__)
+#define TJ_LOG_SITE_COMPONENT(component, msg, ...)                     \
+  TJ_LOG_SITE_LOG(TJ_LOG_LEVEL_COMPONENT, component, 0, msg, ##__VA_ARGS__)
+#endif
+
 
 #ifdef TAG
 #define VERBOSE(msg, ...) TJ_LOG_VERBOSE(TAG, msg, ##__VA_ARGS__)
@@ -123,10 +209,23 @@ typedef void (*tj_log_logFunction)(void *,
                                    tj_log_level, const char *,
                                    const char *, const char *, int,
                                    tj_error *, const char *);
+typedef void (*tj_log_siteFunction)(void *, const tj_log_site *,
+                                    tj_error *, const char *);
 typedef void (*tj_log_finalizeFunction)(void *);
 
 typedef struct tj_log_outchannel tj_log_outchannel;
 
+/**
+ * What a queued channel does with a message when its queue is full.
+ * Messages logged from a consumer thread, e.g. by a channel reporting
+ * its own failure, are dropped rather than wait.
+ */
+typedef enum {
+  TJ_LOG_QUEUE_BLOCK,          // Wait for the consumer to catch up
+  TJ_LOG_QUEUE_DROPNEWEST,     // Discard the new message
+  TJ_LOG_QUEUE_DROPOLDEST,     // Discard the oldest queued message
+} tj_log_queuePolicy;
+
 extern tj_log_outchannel tj_log_fprintfChannel;
 
 #ifdef __ANDROID__
@@ -141,6 +240,66 @@ tj_log_outchannel_create(void *data,
                          tj_log_logFunction log,
                          tj_log_finalizeFunction finalize);
 
+/**
+ * Create a channel which receives the call site of each message,
+ * rather than its metadata as separate arguments.  Sites are static,
+ * so channels may keep pointers to them or refer to them by id, until
+ * their module is unloaded.
+ */
+tj_log_outchannel *
+tj_log_outchannel_createSite(void *data,
+                             tj_log_siteFunction log,
+                             tj_log_finalizeFunction finalize);
+
+/**
+ * Give a channel its own bounded queue, drained by a dedicated
+ * consumer thread, such that a slow channel does not delay the caller
+ * or any other channel.  Messages are copied into the queue; for the
+ * channel callback, sites without an id are copies valid only for the
+ * duration of the call.  Must be called before the channel is added.
+ *
+ * \param out The channel to make asynchronous.
+ * \param capacity The number of messages the queue holds.
+ * \param policy What to do when the queue is full.
+ * \return 0 on success, 1 otherwise.
+ */
+int
+tj_log_outchannel_setQueue(tj_log_outchannel *out, size_t capacity,
+                           tj_log_queuePolicy policy);
+
+/**
+ * Give a channel a buffer per logging thread instead of a shared
+ * queue.  Each message is stamped with a monotonic time and appended
+ * to the calling thread's buffer without taking a lock; a merger
+ * thread outputs them in time order across all threads.  Messages are
+ * held for slackMillis before being merged, so a message published
+ * later than that by a preempted thread may appear out of order.
+ * Messages which do not fit in a thread's buffer are dropped.  Must be
+ * called before the channel is added, and not with a queue.
+ *
+ * \param out The channel to buffer.
+ * \param bytes The size of each thread's buffer, at least 4096.
+ * \param slackMillis How long messages are held before merging.
+ * \return 0 on success, 1 otherwise.
+ */
+int
+tj_log_outchannel_setThreadBuffers(tj_log_outchannel *out, size_t bytes,
+                                   unsigned int slackMillis);
+
+/**
+ * Wait until every message queued for a channel has been output.
+ * Returns immediately for channels without a queue.
+ */
+void
+tj_log_outchannel_flush(tj_log_outchannel *out);
+
+/**
+ * The number of messages a queued or thread buffered channel has
+ * discarded since it was created.
+ */
+unsigned long
+tj_log_outchannel_getDropped(tj_log_outchannel *out);
+
 /**
  * Add a channel through which log messages are output.  Channels
  * stack up, such that the most recently added is the first to be
@@ -182,8 +341,64 @@ void tj_log_log(tj_log_level level, const char *component,
                 const char *file, const char *func, int line,
                 tj_error *error, const char *m, ...);
 
+/**
+ * Log through a static call site, as done by TJ_LOG_SITE_LOG.  Nothing is
+ * formatted if the site is disabled.
+ */
+void tj_log_logSite(tj_log_site *site, tj_error *error, const char *m, ...)
+  __attribute__((format(printf, 3, 4)));
+
 void tj_log_setData(tj_log_outchannel *out, void *data);
 
+void *tj_log_getData(tj_log_outchannel *out);
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/**
+ * Register the call sites within [start, stop), assigning each an id.
+ * Sites already registered are skipped.  Normally done through
+ * TJ_LOG_SITES_REGISTER.
+ */
+void
+tj_log_registerSites(tj_log_site *start, tj_log_site *stop);
+
+/**
+ * Register a single call site, returning its id.
+ */
+unsigned int
+tj_log_registerSite(tj_log_site *site);
+
+/**
+ * Unregister the call sites within [start, stop), as their module is
+ * about to be unloaded.  Channels with a queue or thread buffers are
+ * flushed first, such that no record still refers to the sites.
+ * Channels which keep pointers to sites must drop those within the
+ * range.  Normally done through TJ_LOG_SITES_REGISTER.
+ */
+void
+tj_log_unregisterSites(tj_log_site *start, tj_log_site *stop);
+
+/**
+ * The most recently registered call site; follow m_next for the
+ * others.  Sites may be registered concurrently with a traversal, but
+ * must not be unregistered, i.e. no module unloaded, during one.
+ */
+tj_log_site *
+tj_log_getSites(void);
+
+/**
+ * Enable or disable every registered site matching a component and
+ * level.
+ *
+ * \param component The component to match, or 0 for any.
+ * \param level The highest level affected; sites above it are not.
+ * \param enabled Whether matching sites should log.
+ * \return The number of sites changed.
+ */
+size_t
+tj_log_setSitesEnabled(const char *component, tj_log_level level,
+                       int enabled);
+
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
 
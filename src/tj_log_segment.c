@@ -0,0 +1,803 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tj_buffer.h"
+#include "tj_log_segment.h"
+
+
+#define TJ_LOG_SEGMENT_COMPONENT "tj_log_segment"
+
+#define TJ_LOG_SEGMENT_ALIGN(n) (((n) + 7) & ~((uint64_t) 7))
+
+/*
+ * Sites with ids below this are interned; any others are written
+ * inline with each entry.
+ */
+#define TJ_LOG_SEGMENT_SITES 4096
+
+#define TJ_LOG_SEGMENT_SITE_NONE 0
+#define TJ_LOG_SEGMENT_SITE_CLAIMED 1
+#define TJ_LOG_SEGMENT_SITE_WRITTEN 2
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * m_users counts the writers inside a segment, plus one for it being
+ * current.  Whoever drops it to zero seals and unmaps the segment.
+ * The structure itself is kept until the channel is finalized, so a
+ * writer holding a stale pointer can still safely find it retired.
+ */
+typedef struct tj_log_segment_file tj_log_segment_file;
+struct tj_log_segment_file {
+  tj_log_segment_header *m_header;
+  tj_buffer_byte *m_records;
+  size_t m_size;
+  int m_fd;
+  int m_users;
+
+  uint8_t m_sites[TJ_LOG_SEGMENT_SITES];
+  tj_log_segment_file *m_next;
+};
+
+typedef struct tj_log_segment tj_log_segment;
+struct tj_log_segment {
+  char *m_base;
+  size_t m_capacity;
+  uint64_t m_pid;
+  uint64_t m_start;
+  uint64_t m_sequence;
+
+  pthread_mutex_t m_lock;
+  tj_log_segment_file *m_current;
+  tj_log_segment_file *m_files;
+};
+
+struct tj_log_segment_reader {
+  char *m_base;
+  char *m_path;
+  uint64_t m_sequence;
+  uint64_t m_pid;
+  uint64_t m_start;
+  int m_stopped;
+
+  tj_log_segment_header *m_header;
+  const tj_buffer_byte *m_records;
+  size_t m_size;
+  uint64_t m_read;
+  int m_abandoned;
+  unsigned long m_lost;
+
+  char *m_sites[TJ_LOG_SEGMENT_SITES];
+  tj_buffer *m_msg;
+};
+
+void
+tj_log_segment_finalize(void *x);
+
+void
+tj_log_segment_log(void *data, const tj_log_site *site,
+                   tj_error *error, const char *msg);
+
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static char *
+tj_log_segment_path(const char *base, uint64_t sequence)
+{
+  size_t n = strlen(base) + 24;
+  char *path;
+
+  if ((path = malloc(n)) != 0)
+    snprintf(path, n, "%s.%06llu", base, (unsigned long long) sequence);
+
+  return path;
+  // end tj_log_segment_path
+}
+
+/*
+ * Creates and maps the first unused segment at or after m_sequence.
+ */
+static tj_log_segment_file *
+tj_log_segment_file_create(tj_log_segment *seg)
+{
+  tj_log_segment_file *f;
+  char *path = 0;
+  int tries;
+
+  if ((f = calloc(1, sizeof(tj_log_segment_file))) == 0)
+    return 0;
+  f->m_size = sizeof(tj_log_segment_header) + seg->m_capacity;
+  f->m_users = 1;
+  f->m_fd = -1;
+
+  for (tries = 0; f->m_fd == -1 && tries < 1000; tries++) {
+    free(path);
+    if ((path = tj_log_segment_path(seg->m_base, seg->m_sequence)) == 0)
+      break;
+    if ((f->m_fd = open(path, O_CREAT | O_EXCL | O_RDWR, 0644)) == -1) {
+      if (errno != EEXIST)
+        break;
+      seg->m_sequence++;
+    }
+  }
+  free(path);
+  if (f->m_fd == -1) {
+    free(f);
+    return 0;
+  }
+
+  //-- Allocate the blocks up front so page faults never hit ENOSPC
+  if (posix_fallocate(f->m_fd, 0, f->m_size) != 0 &&
+      ftruncate(f->m_fd, f->m_size) == -1)
+    goto error;
+
+  f->m_header = mmap(0, f->m_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, f->m_fd, 0);
+  if (f->m_header == MAP_FAILED) {
+    f->m_header = 0;
+    goto error;
+  }
+
+  f->m_records = (tj_buffer_byte *) (f->m_header + 1);
+  f->m_header->m_version = TJ_LOG_SEGMENT_VERSION;
+  f->m_header->m_headerSize = sizeof(tj_log_segment_header);
+  f->m_header->m_capacity = seg->m_capacity;
+  f->m_header->m_sequence = seg->m_sequence++;
+  f->m_header->m_pid = seg->m_pid;
+  f->m_header->m_start = seg->m_start;
+
+  //-- Readers check the magic last
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(f->m_header->m_magic, TJ_LOG_SEGMENT_MAGIC, 8);
+
+  f->m_next = seg->m_files;
+  seg->m_files = f;
+  return f;
+
+ error:
+  close(f->m_fd);
+  free(f);
+  return 0;
+  // end tj_log_segment_file_create
+}
+
+static int
+tj_log_segment_file_acquire(tj_log_segment_file *f)
+{
+  int users = __atomic_load_n(&f->m_users, __ATOMIC_ACQUIRE);
+
+  do {
+    if (users == 0)
+      return 0;
+  } while (!__atomic_compare_exchange_n(&f->m_users, &users, users + 1, 1,
+                                        __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE));
+
+  return 1;
+  // end tj_log_segment_file_acquire
+}
+
+static void
+tj_log_segment_file_release(tj_log_segment_file *f)
+{
+  uint64_t used;
+
+  if (__atomic_sub_fetch(&f->m_users, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+
+  //-- Give back the unused preallocation, then tell readers it is done
+  used = __atomic_load_n(&f->m_header->m_write, __ATOMIC_ACQUIRE);
+  if (ftruncate(f->m_fd, sizeof(tj_log_segment_header) + used) == -1) {
+    // Harmless; the segment is just left at full size
+  }
+  __atomic_store_n(&f->m_header->m_sealed, 1, __ATOMIC_RELEASE);
+
+  munmap(f->m_header, f->m_size);
+  close(f->m_fd);
+  f->m_header = 0;
+  f->m_fd = -1;
+  // end tj_log_segment_file_release
+}
+
+/*
+ * Moves on from a segment found full, unless another writer already
+ * has.  If no new segment can be made the full one stays current.
+ */
+static void
+tj_log_segment_rotate(tj_log_segment *seg, tj_log_segment_file *full)
+{
+  tj_log_segment_file *f;
+
+  pthread_mutex_lock(&seg->m_lock);
+  if (seg->m_current != full) {
+    pthread_mutex_unlock(&seg->m_lock);
+    return;
+  }
+
+  if ((f = tj_log_segment_file_create(seg)) == 0) {
+    pthread_mutex_unlock(&seg->m_lock);
+    return;
+  }
+  __atomic_store_n(&seg->m_current, f, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&seg->m_lock);
+
+  tj_log_segment_file_release(full);
+  // end tj_log_segment_rotate
+}
+
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+tj_log_outchannel *
+tj_log_segment_create(const char *base, size_t segmentSize)
+{
+  tj_log_outchannel *channel;
+  tj_log_segment *seg;
+  struct timespec now;
+
+  if ((seg = calloc(1, sizeof(tj_log_segment))) == 0 ||
+      (seg->m_base = strdup(base)) == 0) {
+    TJ_LOG_CRITICAL(TJ_LOG_SEGMENT_COMPONENT,
+                    "No memory to allocate tj_log_segment.");
+    free(seg);
+    return 0;
+  }
+
+  segmentSize = TJ_LOG_SEGMENT_ALIGN(segmentSize);
+  seg->m_capacity = (segmentSize < 4096) ? 4096 : segmentSize;
+  seg->m_pid = getpid();
+  clock_gettime(CLOCK_REALTIME, &now);
+  seg->m_start = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  pthread_mutex_init(&seg->m_lock, 0);
+
+  if ((seg->m_current = tj_log_segment_file_create(seg)) == 0) {
+    TJ_LOG_ERRNO(TJ_LOG_SEGMENT_COMPONENT,
+                 "Could not create a segment for %s", base);
+    goto error;
+  }
+
+  if ((channel = tj_log_outchannel_createSite(seg, &tj_log_segment_log,
+                                              &tj_log_segment_finalize)) != 0)
+    return channel;
+
+ error:
+  tj_log_segment_finalize(seg);
+  return 0;
+  // end tj_log_segment_create
+}
+
+void
+tj_log_segment_finalize(void *x)
+{
+  tj_log_segment *seg = (tj_log_segment *) x;
+  tj_log_segment_file *f;
+
+  if (seg->m_current != 0)
+    tj_log_segment_file_release(seg->m_current);
+
+  while ((f = seg->m_files) != 0) {
+    seg->m_files = f->m_next;
+    free(f);
+  }
+
+  pthread_mutex_destroy(&seg->m_lock);
+  free(seg->m_base);
+  free(seg);
+  // end tj_log_segment_finalize
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * Reserves n bytes in a segment, returning 0 if they do not fit.
+ */
+static tj_log_segment_record *
+tj_log_segment_reserve(tj_log_segment_file *f, uint64_t n)
+{
+  tj_log_segment_header *h = f->m_header;
+  uint64_t w = __atomic_load_n(&h->m_write, __ATOMIC_RELAXED);
+
+  do {
+    if (w + n > h->m_capacity)
+      return 0;
+  } while (!__atomic_compare_exchange_n(&h->m_write, &w, w + n, 1,
+                                        __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED));
+
+  return (tj_log_segment_record *) &f->m_records[w];
+  // end tj_log_segment_reserve
+}
+
+/*
+ * Writes a site record, or an entry with its site inline when msg is
+ * given, into a segment.  Returns 0 if there is no room.
+ */
+static int
+tj_log_segment_writeSite(tj_log_segment_file *f, const tj_log_site *site,
+                         uint64_t time, const char *msg, uint32_t nm)
+{
+  uint32_t nc = strlen(site->m_component)+1, nf = strlen(site->m_file)+1,
+    nu = strlen(site->m_func)+1, length;
+  const char *text = (msg != 0) ? msg : site->m_format;
+  uint32_t nt = (msg != 0) ? nm : strlen(text)+1;
+  tj_log_segment_record *r;
+  char *s;
+
+  length = 8 + nc + nf + nu + nt;
+
+  if ((r = tj_log_segment_reserve(f, sizeof(tj_log_segment_record) +
+                                  TJ_LOG_SEGMENT_ALIGN(length))) == 0)
+    return 0;
+
+  r->m_type = (msg != 0) ? TJ_LOG_SEGMENT_ENTRY : TJ_LOG_SEGMENT_SITE;
+  r->m_level = site->m_level;
+  r->m_site = (msg != 0) ? 0 : site->m_id;
+  r->m_length = length;
+  r->m_time = time;
+
+  s = (char *) (r + 1);
+  ((uint32_t *) s)[0] = site->m_line;
+  ((uint32_t *) s)[1] = 0;
+  memcpy(s += 8, site->m_component, nc);
+  memcpy(s += nc, site->m_file, nf);
+  memcpy(s += nf, site->m_func, nu);
+  memcpy(s + nu, text, nt);
+
+  __atomic_store_n(&r->m_size, sizeof(tj_log_segment_record) +
+                   TJ_LOG_SEGMENT_ALIGN(length), __ATOMIC_RELEASE);
+  return 1;
+  // end tj_log_segment_writeSite
+}
+
+/*
+ * Writes an entry, interning its site in the segment if this is the
+ * first use.  An interned id is only referred to once the site record
+ * has been reserved, so it always comes first; writers racing the
+ * one defining it fall back to inline sites.
+ */
+static int
+tj_log_segment_write(tj_log_segment_file *f, const tj_log_site *site,
+                     uint64_t time, const char *msg, uint32_t nm)
+{
+  uint8_t *state = 0, expected = TJ_LOG_SEGMENT_SITE_NONE;
+  tj_log_segment_record *r;
+
+  if (site->m_id != 0 && site->m_id < TJ_LOG_SEGMENT_SITES) {
+    state = &f->m_sites[site->m_id];
+    if (__atomic_compare_exchange_n(state, &expected,
+                                    TJ_LOG_SEGMENT_SITE_CLAIMED, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      if (!tj_log_segment_writeSite(f, site, time, 0, 0))
+        return 0;
+      __atomic_store_n(state, TJ_LOG_SEGMENT_SITE_WRITTEN, __ATOMIC_RELEASE);
+    } else if (expected != TJ_LOG_SEGMENT_SITE_WRITTEN) {
+      state = 0;
+    }
+  }
+
+  if (state == 0)
+    return tj_log_segment_writeSite(f, site, time, msg, nm);
+
+  if ((r = tj_log_segment_reserve(f, sizeof(tj_log_segment_record) +
+                                  TJ_LOG_SEGMENT_ALIGN(nm))) == 0)
+    return 0;
+
+  r->m_type = TJ_LOG_SEGMENT_ENTRY;
+  r->m_level = site->m_level;
+  r->m_site = site->m_id;
+  r->m_length = nm;
+  r->m_time = time;
+  memcpy(r + 1, msg, nm);
+
+  __atomic_store_n(&r->m_size, sizeof(tj_log_segment_record) +
+                   TJ_LOG_SEGMENT_ALIGN(nm), __ATOMIC_RELEASE);
+  return 1;
+  // end tj_log_segment_write
+}
+
+void
+tj_log_segment_log(void *data, const tj_log_site *site,
+                   tj_error *error, const char *msg)
+{
+  tj_log_segment *seg = (tj_log_segment *) data;
+  tj_log_segment_file *f;
+  struct timespec now;
+  uint64_t n, time;
+  uint32_t nm = strlen(msg);
+  int drop = 0;
+
+  //-- Overlong messages are truncated so a record always fits
+  n = 2*sizeof(tj_log_segment_record) + 8 + strlen(site->m_component) +
+    strlen(site->m_file) + strlen(site->m_func) + strlen(site->m_format) + 4;
+  if (n + nm > seg->m_capacity / 4) {
+    if (n + 64 > seg->m_capacity / 4)
+      drop = 1;
+    else
+      nm = seg->m_capacity / 4 - n;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  time = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+  for (;;) {
+    f = __atomic_load_n(&seg->m_current, __ATOMIC_ACQUIRE);
+    if (!tj_log_segment_file_acquire(f))
+      continue;
+
+    if (drop) {
+      __atomic_add_fetch(&f->m_header->m_dropped, 1, __ATOMIC_RELAXED);
+      tj_log_segment_file_release(f);
+      return;
+    }
+
+    if (tj_log_segment_write(f, site, time, msg, nm)) {
+      tj_log_segment_file_release(f);
+      return;
+    }
+
+    tj_log_segment_rotate(seg, f);
+    if (__atomic_load_n(&seg->m_current, __ATOMIC_ACQUIRE) == f) {
+      __atomic_add_fetch(&f->m_header->m_dropped, 1, __ATOMIC_RELAXED);
+      tj_log_segment_file_release(f);
+      return;
+    }
+    tj_log_segment_file_release(f);
+  }
+
+  // end tj_log_segment_log
+}
+
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static void
+tj_log_segment_reader_unmap(tj_log_segment_reader *r)
+{
+  size_t i;
+
+  if (r->m_header != 0) {
+    r->m_lost += r->m_header->m_dropped;
+    munmap(r->m_header, r->m_size);
+    r->m_header = 0;
+  }
+
+  for (i = 0; i < TJ_LOG_SEGMENT_SITES; i++) {
+    free(r->m_sites[i]);
+    r->m_sites[i] = 0;
+  }
+  // end tj_log_segment_reader_unmap
+}
+
+/*
+ * Maps a segment in place of the current one.  Returns 0, quietly,
+ * if it does not exist or is not yet fully created.
+ */
+static int
+tj_log_segment_reader_map(tj_log_segment_reader *r, const char *path)
+{
+  tj_log_segment_header *h;
+  struct stat st;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1)
+    return 0;
+
+  if (fstat(fd, &st) == -1 || st.st_size < sizeof(tj_log_segment_header)) {
+    close(fd);
+    return 0;
+  }
+
+  h = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (h == MAP_FAILED)
+    return 0;
+
+  if (memcmp(h->m_magic, TJ_LOG_SEGMENT_MAGIC, 8) ||
+      h->m_version != TJ_LOG_SEGMENT_VERSION ||
+      h->m_headerSize != sizeof(tj_log_segment_header) ||
+      __atomic_load_n(&h->m_write, __ATOMIC_ACQUIRE) >
+      st.st_size - sizeof(tj_log_segment_header)) {
+    munmap(h, st.st_size);
+    return 0;
+  }
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+  //-- Another writer's segments are not a continuation of this one
+  if (r->m_header != 0 &&
+      (h->m_pid != r->m_pid || h->m_start != r->m_start)) {
+    TJ_LOG_CRITICAL(TJ_LOG_SEGMENT_COMPONENT,
+                    "%s is from another writer than %s; stopping.",
+                    path, r->m_path);
+    munmap(h, st.st_size);
+    r->m_stopped = 1;
+    return 0;
+  }
+
+  tj_log_segment_reader_unmap(r);
+  r->m_header = h;
+  r->m_records = (const tj_buffer_byte *) (h + 1);
+  r->m_size = st.st_size;
+  r->m_sequence = h->m_sequence;
+  r->m_pid = h->m_pid;
+  r->m_start = h->m_start;
+  r->m_read = 0;
+  r->m_abandoned = 0;
+  return 1;
+  // end tj_log_segment_reader_map
+}
+
+static int
+tj_log_segment_reader_advance(tj_log_segment_reader *r)
+{
+  char *path;
+
+  if (r->m_stopped ||
+      (path = tj_log_segment_path(r->m_base, r->m_sequence+1)) == 0)
+    return 0;
+
+  if (!tj_log_segment_reader_map(r, path)) {
+    free(path);
+    return 0;
+  }
+
+  free(r->m_path);
+  r->m_path = path;
+  return 1;
+  // end tj_log_segment_reader_advance
+}
+
+tj_log_segment_reader *
+tj_log_segment_reader_open(const char *path)
+{
+  tj_log_segment_reader *r;
+  char *dot;
+
+  if ((r = calloc(1, sizeof(tj_log_segment_reader))) == 0 ||
+      (r->m_path = strdup(path)) == 0 ||
+      (r->m_base = strdup(path)) == 0 ||
+      (r->m_msg = tj_buffer_create(256)) == 0) {
+    TJ_LOG_CRITICAL(TJ_LOG_SEGMENT_COMPONENT,
+                    "No memory to allocate tj_log_segment_reader.");
+    if (r != 0) {
+      free(r->m_path);
+      free(r->m_base);
+    }
+    free(r);
+    return 0;
+  }
+
+  //-- Following segments are found by the sequence number in the name
+  if ((dot = strrchr(r->m_base, '.')) == 0 ||
+      strspn(dot+1, "0123456789") != strlen(dot+1) || dot[1] == 0) {
+    TJ_LOG_CRITICAL(TJ_LOG_SEGMENT_COMPONENT,
+                    "%s is not named as a log segment.", path);
+    goto error;
+  }
+  *dot = 0;
+
+  if (!tj_log_segment_reader_map(r, path)) {
+    TJ_LOG_CRITICAL(TJ_LOG_SEGMENT_COMPONENT,
+                    "%s is not a log segment.", path);
+    goto error;
+  }
+
+  return r;
+
+ error:
+  tj_log_segment_reader_finalize(r);
+  return 0;
+  // end tj_log_segment_reader_open
+}
+
+void
+tj_log_segment_reader_finalize(tj_log_segment_reader *r)
+{
+  tj_log_segment_reader_unmap(r);
+  tj_buffer_finalize(r->m_msg);
+  free(r->m_path);
+  free(r->m_base);
+  free(r);
+  // end tj_log_segment_reader_finalize
+}
+
+//----------------------------------------------------------------------
+/*
+ * Splits a site payload into its line, the given number of strings,
+ * and whatever follows them.  Returns 0 if the strings are not all
+ * terminated within n bytes.
+ */
+static int
+tj_log_segment_reader_parseSite(const char *s, size_t n, int strings,
+                                int *line, const char **out)
+{
+  const char *end = s + n, *z;
+  int i;
+
+  if (n < 8)
+    return 0;
+  *line = *((const uint32_t *) s);
+  s += 8;
+
+  for (i = 0; i < strings; i++) {
+    if ((z = memchr(s, 0, end - s)) == 0)
+      return 0;
+    out[i] = s;
+    s = z + 1;
+  }
+  out[i] = s;
+
+  return 1;
+  // end tj_log_segment_reader_parseSite
+}
+
+static int
+tj_log_segment_reader_record(tj_log_segment_reader *r,
+                             const tj_log_segment_record *x,
+                             tj_log_segment_entry *entry)
+{
+  const char *s = (const char *) (x + 1), *strings[4];
+  const uint32_t *site;
+  size_t n;
+  int line;
+
+  if (x->m_type == TJ_LOG_SEGMENT_SITE) {
+    if (x->m_site == 0 || x->m_site >= TJ_LOG_SEGMENT_SITES ||
+        !tj_log_segment_reader_parseSite(s, x->m_length, 3, &line, strings) ||
+        memchr(strings[3], 0, s + x->m_length - strings[3]) == 0)
+      return -1;
+
+    free(r->m_sites[x->m_site]);
+    if ((r->m_sites[x->m_site] = malloc(x->m_length + 4)) == 0)
+      return -1;
+    memcpy(r->m_sites[x->m_site] + 4, s, x->m_length);
+    ((uint32_t *) r->m_sites[x->m_site])[0] = x->m_length;
+    return 0;
+  }
+
+  if (x->m_type != TJ_LOG_SEGMENT_ENTRY)
+    return -1;
+
+  entry->m_time = x->m_time;
+  entry->m_pid = r->m_header->m_pid;
+  entry->m_level = (x->m_level > TJ_LOG_LEVEL_OUTPUT) ?
+    TJ_LOG_LEVEL_CRITICAL : x->m_level;
+
+  if (x->m_site == 0) {
+    if (!tj_log_segment_reader_parseSite(s, x->m_length, 3, &line, strings))
+      return -1;
+    n = s + x->m_length - strings[3];
+  } else {
+    if (x->m_site >= TJ_LOG_SEGMENT_SITES ||
+        (site = (const uint32_t *) r->m_sites[x->m_site]) == 0)
+      return -1;
+    tj_log_segment_reader_parseSite((const char *) (site + 1), site[0], 3,
+                                    &line, strings);
+    strings[3] = s;
+    n = x->m_length;
+  }
+
+  //-- Messages are stored without a terminator
+  tj_buffer_reset(r->m_msg);
+  if (!tj_buffer_append(r->m_msg, (const tj_buffer_byte *) strings[3], n) ||
+      !tj_buffer_append(r->m_msg, (const tj_buffer_byte *) "", 1))
+    return -1;
+
+  entry->m_line = line;
+  entry->m_component = strings[0];
+  entry->m_file = strings[1];
+  entry->m_func = strings[2];
+  entry->m_msg = tj_buffer_getAsString(r->m_msg);
+  return 1;
+  // end tj_log_segment_reader_record
+}
+
+int
+tj_log_segment_reader_next(tj_log_segment_reader *r,
+                           tj_log_segment_entry *entry)
+{
+  const tj_log_segment_record *x;
+  uint64_t w;
+  uint32_t size;
+  int sealed, res;
+
+  for (;;) {
+    //-- The seal is read first; once set, m_write is final
+    sealed = __atomic_load_n(&r->m_header->m_sealed, __ATOMIC_ACQUIRE);
+    w = __atomic_load_n(&r->m_header->m_write, __ATOMIC_ACQUIRE);
+
+    if (r->m_read < w && !r->m_abandoned) {
+      x = (const tj_log_segment_record *) &r->m_records[r->m_read];
+      size = __atomic_load_n(&x->m_size, __ATOMIC_ACQUIRE);
+
+      if (size != 0) {
+        if (size < sizeof(tj_log_segment_record) || size % 8 ||
+            r->m_read + size > w ||
+            x->m_length > size - sizeof(tj_log_segment_record)) {
+          //-- Nothing after a damaged record can be trusted
+          r->m_lost++;
+          r->m_abandoned = 1;
+        } else {
+          r->m_read += size;
+          if ((res = tj_log_segment_reader_record(r, x, entry)) > 0)
+            return 1;
+          if (res < 0)
+            r->m_lost++;
+          continue;
+        }
+      } else if (sealed ||
+                 (kill(r->m_header->m_pid, 0) == -1 && errno == ESRCH)) {
+        //-- The writer died partway through this record
+        r->m_lost++;
+        r->m_abandoned = 1;
+      }
+    }
+
+    if (r->m_read < w && !r->m_abandoned)
+      return 0;
+
+    //-- A finished segment, or one abandoned by a crash, leads on
+    if (!sealed && !r->m_abandoned &&
+        !(kill(r->m_header->m_pid, 0) == -1 && errno == ESRCH))
+      return 0;
+    if (!tj_log_segment_reader_advance(r))
+      return 0;
+  }
+
+  // end tj_log_segment_reader_next
+}
+
+int
+tj_log_segment_reader_isStopped(tj_log_segment_reader *r)
+{
+  return r->m_stopped;
+  // end tj_log_segment_reader_isStopped
+}
+
+const char *
+tj_log_segment_reader_getPath(tj_log_segment_reader *r)
+{
+  return r->m_path;
+  // end tj_log_segment_reader_getPath
+}
+
+unsigned long
+tj_log_segment_reader_getLost(tj_log_segment_reader *r)
+{
+  return r->m_lost + __atomic_load_n(&r->m_header->m_dropped,
+                                     __ATOMIC_RELAXED);
+  // end tj_log_segment_reader_getLost
+}
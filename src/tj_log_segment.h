@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __tj_log_segment_h__
+#define __tj_log_segment_h__
+
+#include <stdint.h>
+
+#include "tj_log.h"
+
+/*
+ * A segment is a preallocated file laid out as follows, in native
+ * byte order:
+ *
+ *   tj_log_segment_header, 72 bytes
+ *   m_capacity bytes of records
+ *
+ * Segments are named by a base path and a sequence number, as in
+ * "app.log.000003".  A writer fills one segment and then moves on to
+ * the next number.  m_write counts the bytes reserved in the segment;
+ * each record is a tj_log_segment_record followed by m_length bytes of
+ * payload, padded to a multiple of 8.  Writers reserve space by
+ * advancing m_write, fill in the record, and finally store its size,
+ * which commits it; a zero size is a record still being written.
+ * m_sealed is set once every writer has finished with the segment and
+ * the file has been truncated to its contents.
+ *
+ * A site record gives the strings for a tj_log_site id, and precedes
+ * every entry referring to that id within the same segment, so each
+ * segment can be read on its own.  Its payload is the line as a
+ * uint32_t, 4 bytes of padding, then the component, file, function
+ * and format, each null terminated.  An entry for a site id is just
+ * the formatted message.  An entry with site id 0 carries its site
+ * inline: the site payload layout, with the message in place of the
+ * format and without its terminator.
+ *
+ * A segment whose writer crashed is read up to its first uncommitted
+ * record; everything before that is intact.
+ *
+ * Each writer is identified by m_pid and m_start, the time its
+ * channel was created.  Processes sharing a base path interleave
+ * their segments, so readers only move on to a following segment
+ * from the same writer.
+ */
+#define TJ_LOG_SEGMENT_MAGIC "tjlogseg"
+#define TJ_LOG_SEGMENT_VERSION 2
+
+#define TJ_LOG_SEGMENT_ENTRY 1
+#define TJ_LOG_SEGMENT_SITE 2
+
+typedef struct {
+  char m_magic[8];
+  uint32_t m_version;
+  uint32_t m_headerSize;
+  uint64_t m_capacity;
+  uint64_t m_sequence;
+  uint64_t m_pid;
+  uint64_t m_start;          // Nanoseconds since the epoch
+  uint64_t m_write;
+  uint32_t m_sealed;
+  uint32_t m_reserved;
+  uint64_t m_dropped;
+} tj_log_segment_header;
+
+typedef struct {
+  uint32_t m_size;
+  uint16_t m_type;
+  uint16_t m_level;
+  uint32_t m_site;
+  uint32_t m_length;
+  uint64_t m_time;           // Nanoseconds since the epoch
+} tj_log_segment_record;
+
+/**
+ * A record as returned by a reader.  The strings are owned by the
+ * reader and valid until its next call.
+ */
+typedef struct {
+  uint64_t m_time;
+  uint64_t m_pid;
+  tj_log_level m_level;
+  int m_line;
+  const char *m_component;
+  const char *m_file;
+  const char *m_func;
+  const char *m_msg;
+} tj_log_segment_entry;
+
+typedef struct tj_log_segment_reader tj_log_segment_reader;
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/**
+ * Create a channel appending to memory mapped segment files.  Logging
+ * is a copy into the mapping, with no system call; the kernel writes
+ * the pages back, so records survive the process crashing.  Call
+ * sites registered with tj_log are written once per segment and then
+ * referred to by id.  Attached tj_error details are not recorded.
+ *
+ * \param base The path segments are named from.  The first sequence
+ * number not already in use is taken, so earlier runs are kept.
+ * \param segmentSize The size of each segment in bytes, rounded up to
+ * a multiple of 8 and at least 4096.
+ */
+tj_log_outchannel *
+tj_log_segment_create(const char *base, size_t segmentSize);
+
+//----------------------------------------------------------------------
+/**
+ * Open a segment for reading.  The reader moves on to following
+ * segments as each is finished, and stops, reporting an error, at one
+ * written by another writer.
+ *
+ * \param path The segment file to start from.
+ * \return The reader, or 0 on failure.
+ */
+tj_log_segment_reader *
+tj_log_segment_reader_open(const char *path);
+
+void
+tj_log_segment_reader_finalize(tj_log_segment_reader *r);
+
+/**
+ * Read the next committed record.
+ *
+ * \param r The reader.
+ * \param entry Filled in with the record.
+ * \return 1 if a record was read, 0 if there are no more for now.
+ */
+int
+tj_log_segment_reader_next(tj_log_segment_reader *r,
+                           tj_log_segment_entry *entry);
+
+/**
+ * Whether the reader has stopped at a segment from another writer.
+ */
+int
+tj_log_segment_reader_isStopped(tj_log_segment_reader *r);
+
+/**
+ * The path of the segment being read.
+ */
+const char *
+tj_log_segment_reader_getPath(tj_log_segment_reader *r);
+
+/**
+ * The number of records lost to corruption, or dropped by the writer
+ * as too large for a segment or for want of a new one.
+ */
+unsigned long
+tj_log_segment_reader_getLost(tj_log_segment_reader *r);
+
+#endif // __tj_log_segment_h__
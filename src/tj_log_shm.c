@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tj_buffer.h"
+#include "tj_log_shm.h"
+
+
+#define TJ_LOG_SHM_COMPONENT "tj_log_shm"
+
+#define TJ_LOG_SHM_ALIGN(n) (((n) + 7) & ~((uint64_t) 7))
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+typedef struct tj_log_shm tj_log_shm;
+struct tj_log_shm {
+  tj_log_shm_header *m_header;
+  tj_buffer_byte *m_records;
+  size_t m_size;
+  uint32_t m_pid;
+};
+
+struct tj_log_shm_reader {
+  tj_log_shm_header *m_header;
+  const tj_buffer_byte *m_records;
+  size_t m_size;
+
+  uint64_t m_read;
+  unsigned long m_lost;
+  tj_buffer *m_copy;
+};
+
+static __thread uint32_t tj_log_shm_tid = 0;
+
+static void
+tj_log_shm_reader_seek(tj_log_shm_reader *r, uint64_t p);
+
+void
+tj_log_shm_finalize(void *x);
+
+void
+tj_log_shm_log(void *data, const tj_log_site *site,
+               tj_error *error, const char *msg);
+
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+tj_log_outchannel *
+tj_log_shm_create(const char *name, size_t capacity)
+{
+  tj_log_outchannel *channel;
+  tj_log_shm *shm;
+  char defaultName[32];
+  int fd;
+
+  if (name == 0) {
+    snprintf(defaultName, sizeof(defaultName), "/tj_log.%d", getpid());
+    name = defaultName;
+  }
+
+  capacity = TJ_LOG_SHM_ALIGN(capacity);
+  if (capacity < 4096)
+    capacity = 4096;
+
+  if ((shm = calloc(1, sizeof(tj_log_shm))) == 0) {
+    TJ_LOG_CRITICAL(TJ_LOG_SHM_COMPONENT,
+                    "No memory to allocate tj_log_shm.");
+    return 0;
+  }
+  shm->m_size = sizeof(tj_log_shm_header) + capacity;
+  shm->m_pid = getpid();
+
+  if ((fd = shm_open(name, O_CREAT | O_TRUNC | O_RDWR, 0600)) == -1) {
+    TJ_LOG_ERRNO(TJ_LOG_SHM_COMPONENT,
+                 "Could not create shared memory %s", name);
+    goto error;
+  }
+
+  if (ftruncate(fd, shm->m_size) == -1) {
+    TJ_LOG_ERRNO(TJ_LOG_SHM_COMPONENT, "Could not size %s", name);
+    close(fd);
+    goto error;
+  }
+
+  shm->m_header = mmap(0, shm->m_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm->m_header == MAP_FAILED) {
+    shm->m_header = 0;
+    TJ_LOG_ERRNO(TJ_LOG_SHM_COMPONENT, "Could not map %s", name);
+    goto error;
+  }
+
+  shm->m_records = (tj_buffer_byte *) (shm->m_header + 1);
+  shm->m_header->m_version = TJ_LOG_SHM_VERSION;
+  shm->m_header->m_headerSize = sizeof(tj_log_shm_header);
+  shm->m_header->m_capacity = capacity;
+  shm->m_header->m_pid = shm->m_pid;
+
+  //-- Readers check the magic last
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(shm->m_header->m_magic, TJ_LOG_SHM_MAGIC, 8);
+
+  if ((channel = tj_log_outchannel_createSite(shm, &tj_log_shm_log,
+                                              &tj_log_shm_finalize)) != 0)
+    return channel;
+
+ error:
+  tj_log_shm_finalize(shm);
+  return 0;
+  // end tj_log_shm_create
+}
+
+void
+tj_log_shm_finalize(void *x)
+{
+  tj_log_shm *shm = (tj_log_shm *) x;
+
+  if (shm->m_header != 0)
+    munmap(shm->m_header, shm->m_size);
+
+  free(shm);
+  // end tj_log_shm_finalize
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * Reserves n bytes at the returned position, skipping to the start
+ * of the ring when they do not fit before its end.  The skipped tail
+ * is covered with a padding record if it has room for one.
+ */
+static uint64_t
+tj_log_shm_reserve(tj_log_shm *shm, uint32_t n)
+{
+  tj_log_shm_header *h = shm->m_header;
+  tj_log_shm_record *pad;
+  uint64_t w, p, tail;
+
+  w = __atomic_load_n(&h->m_write, __ATOMIC_RELAXED);
+  do {
+    tail = h->m_capacity - w % h->m_capacity;
+    p = (tail < n) ? w + tail : w;
+  } while (!__atomic_compare_exchange_n(&h->m_write, &w, p + n, 1,
+                                        __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED));
+
+  if (p != w && tail >= sizeof(tj_log_shm_record)) {
+    pad = (tj_log_shm_record *) &shm->m_records[w % h->m_capacity];
+    pad->m_size = tail;
+    pad->m_level = TJ_LOG_SHM_PAD;
+    __atomic_store_n(&pad->m_pos, w, __ATOMIC_RELEASE);
+  }
+
+  return p;
+  // end tj_log_shm_reserve
+}
+
+void
+tj_log_shm_log(void *data, const tj_log_site *site,
+               tj_error *error, const char *msg)
+{
+  tj_log_shm *shm = (tj_log_shm *) data;
+  tj_log_shm_record *r;
+  struct timespec now;
+  uint32_t nc, nf, nu, nm;
+  uint64_t n, p;
+  char *s;
+
+  nc = strlen(site->m_component);
+  nf = strlen(site->m_file);
+  nu = strlen(site->m_func);
+  nm = strlen(msg);
+
+  //-- Overlong messages are truncated to keep records small
+  n = sizeof(tj_log_shm_record) + nc + nf + nu + 4;
+  if (n + nm > shm->m_header->m_capacity / 4) {
+    if (n + 64 > shm->m_header->m_capacity / 4) {
+      __atomic_add_fetch(&shm->m_header->m_dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+    nm = shm->m_header->m_capacity / 4 - n;
+  }
+  n = TJ_LOG_SHM_ALIGN(n + nm);
+
+  if (tj_log_shm_tid == 0)
+    tj_log_shm_tid = syscall(SYS_gettid);
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  p = tj_log_shm_reserve(shm, n);
+  r = (tj_log_shm_record *) &shm->m_records[p % shm->m_header->m_capacity];
+
+  r->m_size = n;
+  r->m_level = site->m_level;
+  r->m_time = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  r->m_pid = shm->m_pid;
+  r->m_tid = tj_log_shm_tid;
+  r->m_line = site->m_line;
+  r->m_componentLen = nc;
+  r->m_fileLen = nf;
+  r->m_funcLen = nu;
+  r->m_msgLen = nm;
+  r->m_reserved = 0;
+
+  s = (char *) (r + 1);
+  memcpy(s, site->m_component, nc+1);
+  s += nc+1;
+  memcpy(s, site->m_file, nf+1);
+  s += nf+1;
+  memcpy(s, site->m_func, nu+1);
+  s += nu+1;
+  memcpy(s, msg, nm);
+  s[nm] = 0;
+
+  __atomic_store_n(&r->m_pos, p, __ATOMIC_RELEASE);
+
+  // end tj_log_shm_log
+}
+
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+tj_log_shm_reader *
+tj_log_shm_reader_open(const char *name)
+{
+  tj_log_shm_reader *r;
+  struct stat st;
+  uint64_t w;
+  int fd;
+
+  if ((r = calloc(1, sizeof(tj_log_shm_reader))) == 0 ||
+      (r->m_copy = tj_buffer_create(256)) == 0) {
+    TJ_LOG_CRITICAL(TJ_LOG_SHM_COMPONENT,
+                    "No memory to allocate tj_log_shm_reader.");
+    free(r);
+    return 0;
+  }
+
+  if ((fd = shm_open(name, O_RDONLY, 0)) == -1) {
+    TJ_LOG_ERRNO(TJ_LOG_SHM_COMPONENT, "Could not open %s", name);
+    goto error;
+  }
+
+  if (fstat(fd, &st) == -1 || st.st_size < sizeof(tj_log_shm_header)) {
+    TJ_LOG_CRITICAL(TJ_LOG_SHM_COMPONENT, "%s is not a log ring.", name);
+    close(fd);
+    goto error;
+  }
+
+  r->m_size = st.st_size;
+  r->m_header = mmap(0, r->m_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (r->m_header == MAP_FAILED) {
+    r->m_header = 0;
+    TJ_LOG_ERRNO(TJ_LOG_SHM_COMPONENT, "Could not map %s", name);
+    goto error;
+  }
+
+  if (memcmp(r->m_header->m_magic, TJ_LOG_SHM_MAGIC, 8) ||
+      r->m_header->m_version != TJ_LOG_SHM_VERSION ||
+      r->m_header->m_headerSize != sizeof(tj_log_shm_header) ||
+      r->m_header->m_capacity % 8 ||
+      r->m_header->m_capacity >
+      r->m_size - sizeof(tj_log_shm_header)) {
+    TJ_LOG_CRITICAL(TJ_LOG_SHM_COMPONENT, "%s is not a log ring.", name);
+    goto error;
+  }
+  r->m_records = (const tj_buffer_byte *) (r->m_header + 1);
+
+  //-- Start from the oldest record that may still be intact
+  w = __atomic_load_n(&r->m_header->m_write, __ATOMIC_ACQUIRE);
+  if (w > r->m_header->m_capacity) {
+    r->m_read = w - r->m_header->m_capacity;
+    tj_log_shm_reader_seek(r, r->m_read);
+    r->m_lost = 0;
+  }
+
+  return r;
+
+ error:
+  tj_log_shm_reader_finalize(r);
+  return 0;
+  // end tj_log_shm_reader_open
+}
+
+void
+tj_log_shm_reader_finalize(tj_log_shm_reader *r)
+{
+  if (r->m_header != 0)
+    munmap(r->m_header, r->m_size);
+  tj_buffer_finalize(r->m_copy);
+  free(r);
+  // end tj_log_shm_reader_finalize
+}
+
+//----------------------------------------------------------------------
+static int
+tj_log_shm_reader_valid(tj_log_shm_reader *r, const tj_log_shm_record *x,
+                        uint64_t p)
+{
+  uint64_t cap = r->m_header->m_capacity;
+
+  if (x->m_size < sizeof(tj_log_shm_record) || x->m_size % 8 ||
+      p % cap + x->m_size > cap)
+    return 0;
+
+  return x->m_level == TJ_LOG_SHM_PAD ||
+    ((uint64_t) x->m_componentLen + x->m_fileLen + x->m_funcLen +
+     x->m_msgLen + 4 <= x->m_size - sizeof(tj_log_shm_record));
+  // end tj_log_shm_reader_valid
+}
+
+/*
+ * Scans forward from p, or the oldest position not yet overwritten if
+ * that is later, for the next committed record.  The bytes passed
+ * over are counted as lost.
+ */
+static void
+tj_log_shm_reader_seek(tj_log_shm_reader *r, uint64_t p)
+{
+  uint64_t cap = r->m_header->m_capacity, w;
+  const tj_log_shm_record *x;
+
+  w = __atomic_load_n(&r->m_header->m_write, __ATOMIC_ACQUIRE);
+  if (w > cap && p < w - cap)
+    p = w - cap;
+
+  for (p = TJ_LOG_SHM_ALIGN(p); p < w; p += 8) {
+    if (cap - p % cap < sizeof(tj_log_shm_record)) {
+      p += cap - p % cap - 8;
+      continue;
+    }
+    x = (const tj_log_shm_record *) &r->m_records[p % cap];
+    if (__atomic_load_n(&x->m_pos, __ATOMIC_ACQUIRE) == p &&
+        tj_log_shm_reader_valid(r, x, p))
+      break;
+  }
+
+  if (p > w)
+    p = w;
+  r->m_lost += p - r->m_read;
+  r->m_read = p;
+  // end tj_log_shm_reader_seek
+}
+
+void
+tj_log_shm_reader_skip(tj_log_shm_reader *r)
+{
+  tj_log_shm_reader_seek(r, r->m_read + 8);
+  // end tj_log_shm_reader_skip
+}
+
+int
+tj_log_shm_reader_next(tj_log_shm_reader *r, tj_log_shm_entry *entry)
+{
+  uint64_t cap = r->m_header->m_capacity, w, p;
+  const tj_log_shm_record *x;
+  tj_log_shm_record *c;
+  const char *s;
+
+  for (;;) {
+    p = r->m_read;
+    w = __atomic_load_n(&r->m_header->m_write, __ATOMIC_ACQUIRE);
+    if (p >= w)
+      return 0;
+
+    if (w - p > cap) {
+      tj_log_shm_reader_seek(r, p);
+      continue;
+    }
+
+    if (cap - p % cap < sizeof(tj_log_shm_record)) {
+      r->m_read += cap - p % cap;
+      continue;
+    }
+
+    x = (const tj_log_shm_record *) &r->m_records[p % cap];
+    if (__atomic_load_n(&x->m_pos, __ATOMIC_ACQUIRE) != p)
+      return 0;
+
+    //-- Copy the record out, then check it was not overwritten meanwhile
+    tj_buffer_reset(r->m_copy);
+    if (!tj_log_shm_reader_valid(r, x, p) ||
+        !tj_buffer_append(r->m_copy, (const tj_buffer_byte *) x,
+                          x->m_size)) {
+      tj_log_shm_reader_skip(r);
+      continue;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    w = __atomic_load_n(&r->m_header->m_write, __ATOMIC_ACQUIRE);
+    c = (tj_log_shm_record *) tj_buffer_getBytes(r->m_copy);
+    if (w - p > cap) {
+      tj_log_shm_reader_seek(r, p);
+      continue;
+    }
+    if (c->m_pos != p || !tj_log_shm_reader_valid(r, c, p)) {
+      tj_log_shm_reader_skip(r);
+      continue;
+    }
+
+    r->m_read = p + c->m_size;
+    if (c->m_level == TJ_LOG_SHM_PAD)
+      continue;
+
+    s = (const char *) (c + 1);
+    entry->m_time = c->m_time;
+    entry->m_level = c->m_level;
+    entry->m_pid = c->m_pid;
+    entry->m_tid = c->m_tid;
+    entry->m_line = c->m_line;
+    entry->m_component = s;
+    entry->m_file = (s += c->m_componentLen + 1);
+    entry->m_func = (s += c->m_fileLen + 1);
+    entry->m_msg = (s += c->m_funcLen + 1);
+
+    //-- Terminators are enforced rather than trusted
+    ((char *) entry->m_component)[c->m_componentLen] = 0;
+    ((char *) entry->m_file)[c->m_fileLen] = 0;
+    ((char *) entry->m_func)[c->m_funcLen] = 0;
+    ((char *) entry->m_msg)[c->m_msgLen] = 0;
+
+    if (entry->m_level > TJ_LOG_LEVEL_OUTPUT)
+      entry->m_level = TJ_LOG_LEVEL_CRITICAL;
+
+    return 1;
+  }
+
+  // end tj_log_shm_reader_next
+}
+
+uint64_t
+tj_log_shm_reader_getPid(tj_log_shm_reader *r)
+{
+  return r->m_header->m_pid;
+  // end tj_log_shm_reader_getPid
+}
+
+unsigned long
+tj_log_shm_reader_getLost(tj_log_shm_reader *r)
+{
+  return r->m_lost + __atomic_load_n(&r->m_header->m_dropped,
+                                     __ATOMIC_RELAXED);
+  // end tj_log_shm_reader_getLost
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __tj_log_shm_h__
+#define __tj_log_shm_h__
+
+#include <stdint.h>
+
+#include "tj_log.h"
+
+/*
+ * A shared memory ring is a POSIX shared memory object laid out as
+ * follows, in native byte order:
+ *
+ *   tj_log_shm_header, 64 bytes
+ *   m_capacity bytes of records
+ *
+ * m_write counts every byte ever reserved in the ring.  A record at
+ * absolute position p lives at offset p % m_capacity within the
+ * records, is 8 byte aligned, and never wraps around the end.  It is
+ * a tj_log_shm_record followed by its component, file, function and
+ * message, each null terminated, padded to a multiple of 8 bytes.
+ *
+ * Writers reserve space by advancing m_write, fill in the record, and
+ * finally store p into m_pos, which commits it; a reader at p only
+ * accepts a record whose m_pos is p.  When a record does not fit
+ * before the end of the ring the remainder is skipped, covered by a
+ * padding record when there is room for one.  Readers detect records
+ * overwritten while they were reading by m_write having moved more
+ * than m_capacity past them.
+ *
+ * The ring survives its writer, so the most recent records of a
+ * crashed process can still be collected.
+ */
+#define TJ_LOG_SHM_MAGIC "tjlogshm"
+#define TJ_LOG_SHM_VERSION 1
+#define TJ_LOG_SHM_PAD 0xffffffff
+
+typedef struct {
+  char m_magic[8];
+  uint32_t m_version;
+  uint32_t m_headerSize;
+  uint64_t m_capacity;
+  uint64_t m_pid;
+  uint64_t m_write;
+  uint64_t m_dropped;
+  uint64_t m_reserved[2];
+} tj_log_shm_header;
+
+typedef struct {
+  uint64_t m_pos;
+  uint32_t m_size;
+  uint32_t m_level;          // TJ_LOG_SHM_PAD for padding
+  uint64_t m_time;           // Nanoseconds since the epoch
+  uint32_t m_pid;
+  uint32_t m_tid;
+  uint32_t m_line;
+  uint32_t m_componentLen;
+  uint32_t m_fileLen;
+  uint32_t m_funcLen;
+  uint32_t m_msgLen;
+  uint32_t m_reserved;
+} tj_log_shm_record;
+
+/**
+ * A record as returned by a reader.  The strings are owned by the
+ * reader and valid until its next call.
+ */
+typedef struct {
+  uint64_t m_time;
+  tj_log_level m_level;
+  uint32_t m_pid;
+  uint32_t m_tid;
+  int m_line;
+  const char *m_component;
+  const char *m_file;
+  const char *m_func;
+  const char *m_msg;
+} tj_log_shm_entry;
+
+typedef struct tj_log_shm_reader tj_log_shm_reader;
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/**
+ * Create a channel writing into a shared memory ring.  Logging is a
+ * copy into the mapping, with no system call.  The ring is left in
+ * place when the channel is finalized, for a collector to drain and
+ * remove.  Attached tj_error details are not recorded.
+ *
+ * \param name The shared memory object to create, such as
+ * "/tj_log.1234".  May be null to use "/tj_log." and the process id.
+ * \param capacity The size of the ring in bytes, rounded up to a
+ * multiple of 8 and at least 4096.
+ */
+tj_log_outchannel *
+tj_log_shm_create(const char *name, size_t capacity);
+
+//----------------------------------------------------------------------
+/**
+ * Open a ring for reading, positioned at its oldest record still
+ * intact.
+ *
+ * \param name The shared memory object to open.
+ * \return The reader, or 0 on failure.
+ */
+tj_log_shm_reader *
+tj_log_shm_reader_open(const char *name);
+
+void
+tj_log_shm_reader_finalize(tj_log_shm_reader *r);
+
+/**
+ * Read the next committed record.
+ *
+ * \param r The reader.
+ * \param entry Filled in with the record.
+ * \return 1 if a record was read, 0 if there are no more for now.
+ */
+int
+tj_log_shm_reader_next(tj_log_shm_reader *r, tj_log_shm_entry *entry);
+
+/**
+ * Skip a record that was reserved but never committed, as left by a
+ * writer which died while logging.  Only meaningful once the writer
+ * is known to be gone.
+ */
+void
+tj_log_shm_reader_skip(tj_log_shm_reader *r);
+
+/**
+ * The process id of the ring's writer.
+ */
+uint64_t
+tj_log_shm_reader_getPid(tj_log_shm_reader *r);
+
+/**
+ * The number of bytes this reader lost to being overwritten, or
+ * skipped, plus records the writer dropped as too large for the ring.
+ */
+unsigned long
+tj_log_shm_reader_getLost(tj_log_shm_reader *r);
+
+#endif // __tj_log_shm_h__
@@ -0,0 +1,492 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tj_buffer.h"
+#include "tj_template.h"
+#include "tj_log_socket.h"
+
+
+#define TJ_LOG_SOCKET_COMPONENT "tj_log_socket"
+
+// Syslog user facility, and a private enterprise number for the
+// structured data identifier, as reserved for documentation
+#define TJ_LOG_SOCKET_FACILITY 1
+#define TJ_LOG_SOCKET_SDID "tj@32473"
+
+static const int tj_log_socket_severity[] =
+  {
+    7,  // VERBOSE: debug
+    7,  // LOGIC: debug
+    6,  // COMPONENT: informational
+    3,  // CRITICAL: error
+    5,  // OUTPUT: notice
+  };
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+typedef struct tj_log_socket tj_log_socket;
+struct tj_log_socket {
+  int m_fd;
+  struct sockaddr_un m_addr;
+  tj_log_socket_format m_format;
+  char m_hostname[64];
+  int m_pid;
+
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_wake;
+  pthread_t m_thread;
+  int m_started;
+  int m_stopping;
+
+  tj_buffer *m_batch;
+  size_t *m_offsets;
+  struct mmsghdr *m_msgs;
+  struct iovec *m_iov;
+  size_t m_count;
+  size_t m_capacity;
+
+  struct timespec m_deadline;
+  unsigned int m_flushMillis;
+  unsigned long m_dropped;
+};
+
+void
+tj_log_socket_finalize(void *x);
+
+void
+tj_log_socket_log(void *data, const tj_log_site *site,
+                  tj_error *error, const char *msg);
+
+static void *
+tj_log_socket_run(void *arg);
+
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static int
+tj_log_socket_connect(tj_log_socket *x)
+{
+  if (x->m_fd != -1)
+    close(x->m_fd);
+
+  if ((x->m_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        0)) == -1)
+    return 0;
+
+  if (connect(x->m_fd, (struct sockaddr *) &x->m_addr,
+              sizeof(x->m_addr)) == -1) {
+    close(x->m_fd);
+    x->m_fd = -1;
+    return 0;
+  }
+
+  return 1;
+  // end tj_log_socket_connect
+}
+
+tj_log_outchannel *
+tj_log_socket_create(const char *path, tj_log_socket_format format,
+                     size_t batch, unsigned int flushMillis)
+{
+  tj_log_outchannel *channel;
+  tj_log_socket *x;
+  pthread_condattr_t attr;
+
+  if (path == 0)
+    path = TJ_LOG_SOCKET_DEFAULT_PATH;
+  if (batch == 0)
+    batch = 1;
+
+  if ((x = calloc(1, sizeof(tj_log_socket))) == 0) {
+    TJ_LOG_CRITICAL(TJ_LOG_SOCKET_COMPONENT,
+                    "No memory to allocate tj_log_socket.");
+    return 0;
+  }
+  x->m_fd = -1;
+  x->m_format = format;
+  x->m_capacity = batch;
+  x->m_flushMillis = flushMillis;
+  x->m_pid = getpid();
+  pthread_mutex_init(&x->m_lock, 0);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&x->m_wake, &attr);
+  pthread_condattr_destroy(&attr);
+
+  if (gethostname(x->m_hostname, sizeof(x->m_hostname)) == -1 ||
+      x->m_hostname[0] == 0)
+    strcpy(x->m_hostname, "-");
+  x->m_hostname[sizeof(x->m_hostname)-1] = 0;
+
+  if ((x->m_batch = tj_buffer_create(batch * 256)) == 0 ||
+      (x->m_offsets = calloc(batch+1, sizeof(size_t))) == 0 ||
+      (x->m_msgs = calloc(batch, sizeof(struct mmsghdr))) == 0 ||
+      (x->m_iov = calloc(batch, sizeof(struct iovec))) == 0) {
+    TJ_LOG_CRITICAL(TJ_LOG_SOCKET_COMPONENT,
+                    "No memory for tj_log_socket batch.");
+    goto error;
+  }
+
+  if (strlen(path) >= sizeof(x->m_addr.sun_path)) {
+    TJ_LOG_CRITICAL(TJ_LOG_SOCKET_COMPONENT, "Path too long: %s", path);
+    goto error;
+  }
+  x->m_addr.sun_family = AF_UNIX;
+  strcpy(x->m_addr.sun_path, path);
+
+  if (!tj_log_socket_connect(x)) {
+    TJ_LOG_ERRNO(TJ_LOG_SOCKET_COMPONENT, "Could not connect to %s", path);
+    goto error;
+  }
+
+  if (pthread_create(&x->m_thread, 0, &tj_log_socket_run, x) != 0) {
+    TJ_LOG_CRITICAL(TJ_LOG_SOCKET_COMPONENT,
+                    "Could not start tj_log_socket flusher.");
+    goto error;
+  }
+  x->m_started = 1;
+
+  if ((channel = tj_log_outchannel_createSite(x, &tj_log_socket_log,
+                                              &tj_log_socket_finalize)) != 0)
+    return channel;
+
+ error:
+  tj_log_socket_finalize(x);
+  return 0;
+  // end tj_log_socket_create
+}
+
+void
+tj_log_socket_finalize(void *data)
+{
+  tj_log_socket *x = (tj_log_socket *) data;
+
+  //-- The flusher sends whatever is left as it stops
+  if (x->m_started) {
+    pthread_mutex_lock(&x->m_lock);
+    x->m_stopping = 1;
+    pthread_cond_signal(&x->m_wake);
+    pthread_mutex_unlock(&x->m_lock);
+    pthread_join(x->m_thread, 0);
+  }
+
+  if (x->m_fd != -1)
+    close(x->m_fd);
+
+  pthread_cond_destroy(&x->m_wake);
+  pthread_mutex_destroy(&x->m_lock);
+  if (x->m_batch != 0)
+    tj_buffer_finalize(x->m_batch);
+  free(x->m_offsets);
+  free(x->m_msgs);
+  free(x->m_iov);
+  free(x);
+  // end tj_log_socket_finalize
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * Sends the batch with as few sendmmsg() calls as the socket allows.
+ * Called with the lock held; the socket never blocks.
+ */
+static void
+tj_log_socket_send(tj_log_socket *x)
+{
+  size_t i, sent = 0;
+  int n, retried = 0;
+
+  if (x->m_count == 0)
+    return;
+
+  x->m_offsets[x->m_count] = tj_buffer_getUsed(x->m_batch);
+  for (i = 0; i < x->m_count; i++) {
+    x->m_iov[i].iov_base = tj_buffer_getBytesAtIndex(x->m_batch,
+                                                     x->m_offsets[i]);
+    x->m_iov[i].iov_len = x->m_offsets[i+1] - x->m_offsets[i];
+    memset(&x->m_msgs[i], 0, sizeof(struct mmsghdr));
+    x->m_msgs[i].msg_hdr.msg_iov = &x->m_iov[i];
+    x->m_msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  while (sent < x->m_count) {
+    n = (x->m_fd == -1) ? -1 :
+      sendmmsg(x->m_fd, &x->m_msgs[sent], x->m_count - sent, MSG_DONTWAIT);
+    if (n > 0) {
+      sent += n;
+      continue;
+    }
+
+    if (n == -1 && errno == EINTR)
+      continue;
+
+    //-- The receiver may have restarted; reconnect once per batch
+    if (!retried && (x->m_fd == -1 || errno == ECONNREFUSED ||
+                     errno == ENOTCONN)) {
+      retried = 1;
+      if (tj_log_socket_connect(x))
+        continue;
+    }
+
+    x->m_dropped += x->m_count - sent;
+    break;
+  }
+
+  tj_buffer_reset(x->m_batch);
+  x->m_count = 0;
+  // end tj_log_socket_send
+}
+
+static void *
+tj_log_socket_run(void *arg)
+{
+  tj_log_socket *x = (tj_log_socket *) arg;
+  struct timespec now;
+
+  pthread_mutex_lock(&x->m_lock);
+  while (!x->m_stopping) {
+    if (x->m_count == 0) {
+      pthread_cond_wait(&x->m_wake, &x->m_lock);
+      continue;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > x->m_deadline.tv_sec ||
+        (now.tv_sec == x->m_deadline.tv_sec &&
+         now.tv_nsec >= x->m_deadline.tv_nsec))
+      tj_log_socket_send(x);
+    else
+      pthread_cond_timedwait(&x->m_wake, &x->m_lock, &x->m_deadline);
+  }
+
+  tj_log_socket_send(x);
+  pthread_mutex_unlock(&x->m_lock);
+
+  return 0;
+  // end tj_log_socket_run
+}
+
+void
+tj_log_socket_flush(tj_log_outchannel *out)
+{
+  tj_log_socket *x = (tj_log_socket *) tj_log_getData(out);
+
+  pthread_mutex_lock(&x->m_lock);
+  tj_log_socket_send(x);
+  pthread_mutex_unlock(&x->m_lock);
+  // end tj_log_socket_flush
+}
+
+unsigned long
+tj_log_socket_getDropped(tj_log_outchannel *out)
+{
+  tj_log_socket *x = (tj_log_socket *) tj_log_getData(out);
+  unsigned long n;
+
+  pthread_mutex_lock(&x->m_lock);
+  n = x->m_dropped;
+  pthread_mutex_unlock(&x->m_lock);
+
+  return n;
+  // end tj_log_socket_getDropped
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static int
+tj_log_socket_appendf(tj_buffer *b, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+
+static int
+tj_log_socket_appendf(tj_buffer *b, const char *fmt, ...)
+{
+  char text[128];
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(text, sizeof(text), fmt, ap);
+  va_end(ap);
+
+  if (n < 0)
+    return 0;
+  if (n >= sizeof(text))
+    n = sizeof(text)-1;
+
+  return tj_buffer_append(b, (tj_buffer_byte *) text, n);
+  // end tj_log_socket_appendf
+}
+
+/*
+ * Writes an RFC 5424 structured data parameter value, in which '"',
+ * '\' and ']' must be escaped.
+ */
+static int
+tj_log_socket_appendParam(tj_buffer *b, const char *s)
+{
+  const char *run;
+
+  for (run = s; *s != 0; s++) {
+    if (*s == '"' || *s == '\\' || *s == ']') {
+      if (!tj_buffer_append(b, (const tj_buffer_byte *) run, s - run) ||
+          !tj_buffer_append(b, (const tj_buffer_byte *) "\\", 1))
+        return 0;
+      run = s;
+    }
+  }
+
+  return tj_buffer_append(b, (const tj_buffer_byte *) run, s - run);
+  // end tj_log_socket_appendParam
+}
+
+/*
+ * Writes an RFC 5424 header field: printable ASCII without spaces, at
+ * most n characters, or "-" if nothing remains.
+ */
+static int
+tj_log_socket_appendName(tj_buffer *b, const char *s, size_t n)
+{
+  size_t used = 0;
+
+  for (; *s != 0 && used < n; s++) {
+    if (*s > 32 && *s < 127) {
+      if (!tj_buffer_append(b, (const tj_buffer_byte *) s, 1))
+        return 0;
+      used++;
+    }
+  }
+
+  return used > 0 || tj_buffer_append(b, (const tj_buffer_byte *) "-", 1);
+  // end tj_log_socket_appendName
+}
+
+static int
+tj_log_socket_appendJSON(tj_buffer *b, const char *key, const char *s)
+{
+  return tj_log_socket_appendf(b, ",\"%s\":\"", key) &&
+    tj_template_appendEscaped(b, TJ_TEMPLATE_ESCAPE_JSON,
+                              (const tj_buffer_byte *) s, strlen(s)) &&
+    tj_buffer_append(b, (const tj_buffer_byte *) "\"", 1);
+  // end tj_log_socket_appendJSON
+}
+
+static int
+tj_log_socket_formatRecord(tj_log_socket *x, const tj_log_site *site,
+                           tj_error *error, const char *msg)
+{
+  tj_buffer *b = x->m_batch;
+  struct timespec now;
+  struct tm timeinfo;
+  char date[48];
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  gmtime_r(&now.tv_sec, &timeinfo);
+  strftime(date, 20, "%Y-%m-%dT%H:%M:%S", &timeinfo);
+  snprintf(date + 19, sizeof(date) - 19, ".%06ldZ", now.tv_nsec / 1000);
+
+  if (x->m_format == TJ_LOG_SOCKET_JSON) {
+    return tj_log_socket_appendf(b, "{\"time\":\"%s\",\"level\":\"%s\"",
+                                 date,
+                                 tj_log_level_labels[site->m_level]) &&
+      tj_log_socket_appendJSON(b, "component", site->m_component) &&
+      tj_log_socket_appendJSON(b, "file", site->m_file) &&
+      tj_log_socket_appendJSON(b, "func", site->m_func) &&
+      tj_log_socket_appendf(b, ",\"line\":%d,\"pid\":%d",
+                            site->m_line, x->m_pid) &&
+      tj_log_socket_appendJSON(b, "msg", msg) &&
+      (error == 0 ||
+       tj_log_socket_appendJSON(b, "error", tj_error_getMessage(error))) &&
+      tj_buffer_append(b, (const tj_buffer_byte *) "}", 1);
+  }
+
+  return tj_log_socket_appendf(b, "<%d>1 %s %s ",
+                               TJ_LOG_SOCKET_FACILITY*8 +
+                               tj_log_socket_severity[site->m_level],
+                               date, x->m_hostname) &&
+    tj_log_socket_appendName(b, site->m_component, 48) &&
+    tj_log_socket_appendf(b, " %d - [" TJ_LOG_SOCKET_SDID " file=\"",
+                          x->m_pid) &&
+    tj_log_socket_appendParam(b, site->m_file) &&
+    tj_buffer_append(b, (const tj_buffer_byte *) "\" func=\"", 8) &&
+    tj_log_socket_appendParam(b, site->m_func) &&
+    tj_log_socket_appendf(b, "\" line=\"%d\"] ", site->m_line) &&
+    tj_buffer_append(b, (const tj_buffer_byte *) msg, strlen(msg)) &&
+    (error == 0 ||
+     (tj_buffer_append(b, (const tj_buffer_byte *) "\n", 1) &&
+      tj_buffer_append(b, (const tj_buffer_byte *) tj_error_getMessage(error),
+                       strlen(tj_error_getMessage(error)))));
+  // end tj_log_socket_formatRecord
+}
+
+void
+tj_log_socket_log(void *data, const tj_log_site *site,
+                  tj_error *error, const char *msg)
+{
+  tj_log_socket *x = (tj_log_socket *) data;
+  size_t start;
+
+  pthread_mutex_lock(&x->m_lock);
+
+  start = tj_buffer_getUsed(x->m_batch);
+  if (!tj_log_socket_formatRecord(x, site, error, msg)) {
+    tj_buffer_popBack(x->m_batch, tj_buffer_getUsed(x->m_batch) - start);
+    x->m_dropped++;
+    pthread_mutex_unlock(&x->m_lock);
+    return;
+  }
+  x->m_offsets[x->m_count++] = start;
+
+  //-- The first message of a batch sets when it must be sent by
+  if (x->m_count == 1) {
+    clock_gettime(CLOCK_MONOTONIC, &x->m_deadline);
+    x->m_deadline.tv_sec += x->m_flushMillis / 1000;
+    x->m_deadline.tv_nsec += (x->m_flushMillis % 1000) * 1000000;
+    if (x->m_deadline.tv_nsec >= 1000000000) {
+      x->m_deadline.tv_sec++;
+      x->m_deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_signal(&x->m_wake);
+  }
+
+  if (x->m_count == x->m_capacity)
+    tj_log_socket_send(x);
+
+  pthread_mutex_unlock(&x->m_lock);
+  // end tj_log_socket_log
+}
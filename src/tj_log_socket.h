@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __tj_log_socket_h__
+#define __tj_log_socket_h__
+
+#include "tj_log.h"
+
+typedef enum {
+  TJ_LOG_SOCKET_RFC5424,       // Syslog protocol, as for /dev/log
+  TJ_LOG_SOCKET_JSON,          // One JSON object per datagram
+} tj_log_socket_format;
+
+#define TJ_LOG_SOCKET_DEFAULT_PATH "/dev/log"
+
+/**
+ * Create a channel sending each message as a datagram to a local
+ * UNIX socket.  Messages are formatted into a batch and sent together
+ * with a single sendmmsg() when the batch fills, or when the oldest
+ * has waited for the flush interval.  The socket is non-blocking;
+ * messages the receiver has no room for are dropped and counted
+ * rather than delaying the caller.
+ *
+ * RFC 5424 messages use the user facility, the component as the
+ * application name, and carry the file, function and line as
+ * structured data.
+ *
+ * \param path The socket to send to, or null for /dev/log.
+ * \param format The framing of each message.
+ * \param batch The most messages held before sending, at least 1.
+ * \param flushMillis The longest a message is held, in milliseconds.
+ */
+tj_log_outchannel *
+tj_log_socket_create(const char *path, tj_log_socket_format format,
+                     size_t batch, unsigned int flushMillis);
+
+/**
+ * Send any messages held by a socket channel.
+ */
+void
+tj_log_socket_flush(tj_log_outchannel *out);
+
+/**
+ * The number of messages a socket channel has dropped because the
+ * receiver could not take them.
+ */
+unsigned long
+tj_log_socket_getDropped(tj_log_outchannel *out);
+
+#endif // __tj_log_socket_h__
@@ -23,10 +23,13 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <sqlite3.h>
 
 #include "tj_log.h"
+#include "tj_log_sqlite.h"
+#include "tj_trace.h"
 
 
 #define TJ_LOG_SQLITE_COMPONENT "tj_log_sqlite"
@@ -44,11 +47,27 @@ typedef struct tj_log_sqlite tj_log_sqlite;
 struct tj_log_sqlite {
   sqlite3 *m_db;
   sqlite3_stmt *m_insertStmt;
+  sqlite3_stmt *m_indexStmt;
+  unsigned int m_batch;
+  unsigned int m_pending;
 };
 
+/*
+ * The index is an external content FTS5 table over log.msg, so the
+ * text is stored once.  Rows are indexed in rowid order; the highest
+ * indexed rowid is read back from the index's own docsize table, so
+ * indexing picks up where it left off across runs and a database
+ * written without an index is caught up when first opened with one.
+ */
+#define TJ_LOG_SQLITE_INDEXED \
+  "(select coalesce(max(id), 0) from log_fts_docsize)"
+
 void
 tj_log_sqlite_finalize(void *x);
 
+static void
+tj_log_sqlite_index(tj_log_sqlite *sqlite);
+
 void
 tj_log_sqlite_log(void *data,
                   tj_log_level level, const char *component,
@@ -58,11 +77,11 @@ tj_log_sqlite_log(void *data,
 
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
-tj_log_outchannel *
-tj_log_sqlite_create(const char *dbfile)
+static tj_log_outchannel *
+tj_log_sqlite_open(const char *dbfile, unsigned int batch)
 {
 
-  tj_log_sqlite *logger = malloc(sizeof(tj_log_sqlite));
+  tj_log_sqlite *logger = calloc(1, sizeof(tj_log_sqlite));
   if (logger == 0) {
     TJ_LOG_CRITICAL(TJ_LOG_SQLITE_COMPONENT,
                     "No memory to allocate tj_log_sqlite.");
@@ -93,6 +112,29 @@ tj_log_sqlite_create(const char *dbfile)
     goto error;
   }
 
+  if (batch != 0) {
+    //-- Trigram tokens match arbitrary substrings, as LIKE does
+    if ((sqlite3_exec
+         (logger->m_db,
+          "create virtual table if not exists log_fts using "
+          "  fts5(msg, content='log', content_rowid='rowid', "
+          "       tokenize='trigram');",
+          0, 0, &errBuff) != SQLITE_OK) ||
+        sqlite3_prepare_v2(logger->m_db,
+                           "insert into log_fts(rowid, msg) "
+                           "  select rowid, msg from log "
+                           "  where rowid > " TJ_LOG_SQLITE_INDEXED ";", -1,
+                           &logger->m_indexStmt, 0)) {
+      TJ_LOG_CRITICAL(TJ_LOG_SQLITE_COMPONENT,
+                      "Could not create full text index in %s:\n%s",
+                      dbfile, sqlite3_errmsg(logger->m_db));
+      sqlite3_free(errBuff);
+      goto error;
+    }
+    logger->m_batch = batch;
+    tj_log_sqlite_index(logger);
+  }
+
   if (sqlite3_prepare_v2(logger->m_db,
                          "insert into log values (date('now'), time('now'), "
                          "                        ?1, ?2, ?3, ?4, ?5, ?6);", -1,
@@ -119,15 +161,35 @@ tj_log_sqlite_create(const char *dbfile)
 
   return 0;
 
+  // end tj_log_sqlite_open
+}
+
+tj_log_outchannel *
+tj_log_sqlite_create(const char *dbfile)
+{
+  return tj_log_sqlite_open(dbfile, 0);
   // end tj_log_sqlite_create
 }
 
+tj_log_outchannel *
+tj_log_sqlite_createIndexed(const char *dbfile, unsigned int batch)
+{
+  return tj_log_sqlite_open(dbfile, (batch == 0) ? 1 : batch);
+  // end tj_log_sqlite_createIndexed
+}
+
 //----------------------------------------------
 void
 tj_log_sqlite_finalize(void *x)
 {
   tj_log_sqlite *data = (tj_log_sqlite *) x;
 
+  if (data->m_indexStmt != 0) {
+    if (data->m_pending != 0)
+      tj_log_sqlite_index(data);
+    sqlite3_finalize(data->m_indexStmt);
+  }
+
   if (data->m_insertStmt != 0)
     sqlite3_finalize(data->m_insertStmt);
 
@@ -147,6 +209,7 @@ tj_log_sqlite_log(void *data,
                   const char *file, const char *func, int line,
                   tj_error *error, const char *msg)
 {
+  TJ_TRACE_SCOPE("tj_log_sqlite_insert");
   tj_log_sqlite *sqlite = (tj_log_sqlite *) data;
 
   // level, component, file, func, line, msg
@@ -176,5 +239,148 @@ tj_log_sqlite_log(void *data,
   }
   sqlite3_reset(sqlite->m_insertStmt);
 
+  if (sqlite->m_indexStmt != 0 && ++sqlite->m_pending >= sqlite->m_batch)
+    tj_log_sqlite_index(sqlite);
+
   // end tj_log_sqlite_log
 }
+
+//----------------------------------------------
+static void
+tj_log_sqlite_index(tj_log_sqlite *sqlite)
+{
+  int dbres = sqlite3_step(sqlite->m_indexStmt);
+  if (dbres != SQLITE_OK && dbres != SQLITE_DONE) {
+    TJ_LOG_CRITICAL(TJ_LOG_SQLITE_COMPONENT,
+                    "Could not index logs:\n%s",
+                    sqlite3_errmsg(sqlite->m_db));
+  }
+  sqlite3_reset(sqlite->m_indexStmt);
+  sqlite->m_pending = 0;
+
+  // end tj_log_sqlite_index
+}
+
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * Indexed rows are found through the index, quoted as a single FTS5
+ * phrase, and the unindexed tail by scanning it; both halves are
+ * already in rowid order so the merge and limit are cheap.  Trigrams
+ * need at least three characters, so shorter text always scans.
+ */
+#define TJ_LOG_SQLITE_COLUMNS \
+  "rowid, date, time, level, component, file, func, line, msg"
+
+static const char *tj_log_sqlite_searchIndexed =
+  "select * from ("
+  "  select " TJ_LOG_SQLITE_COLUMNS " from log where rowid in "
+  "    (select rowid from log_fts where log_fts match ?1 and rowid > ?3 "
+  "     order by rowid limit ?4) "
+  "  union all "
+  "  select " TJ_LOG_SQLITE_COLUMNS " from log "
+  "    where rowid > max(?3, " TJ_LOG_SQLITE_INDEXED ") "
+  "      and msg like ?2 escape '\\') "
+  "order by rowid limit ?4;";
+
+static const char *tj_log_sqlite_searchScan =
+  "select " TJ_LOG_SQLITE_COLUMNS " from log "
+  "  where rowid > ?3 and msg like ?2 escape '\\' "
+  "  order by rowid limit ?4;";
+
+int
+tj_log_sqlite_search(const char *dbfile, const char *text,
+                     long long after, unsigned int limit,
+                     tj_log_sqlite_searchFunction f, void *data)
+{
+  tj_log_sqlite_record record;
+  size_t len = strlen(text);
+  char *phrase = 0, *pattern = 0, *p, *q;
+  sqlite3_stmt *stmt = 0;
+  sqlite3 *db = 0;
+  const char *c;
+  int n = -1, dbres, indexed;
+
+  if (dbfile == 0)
+    dbfile = TJ_LOG_SQLITE_DEFAULT_DB_FILE;
+
+  if (sqlite3_open_v2(dbfile, &db, SQLITE_OPEN_READONLY, 0)) {
+    TJ_LOG_CRITICAL(TJ_LOG_SQLITE_COMPONENT,
+                    "Could not open sqlite3 database %s:\n%s",
+                    dbfile, sqlite3_errmsg(db));
+    goto done;
+  }
+
+  if ((phrase = malloc(2*len + 3)) == 0 ||
+      (pattern = malloc(2*len + 3)) == 0) {
+    TJ_LOG_CRITICAL(TJ_LOG_SQLITE_COMPONENT, "No memory for search.");
+    goto done;
+  }
+
+  //-- Quote the text as a phrase and as a literal LIKE pattern
+  p = phrase;
+  q = pattern;
+  *p++ = '"';
+  *q++ = '%';
+  for (c = text; *c != 0; c++) {
+    if (*c == '"')
+      *p++ = '"';
+    if (*c == '%' || *c == '_' || *c == '\\')
+      *q++ = '\\';
+    *p++ = *c;
+    *q++ = *c;
+  }
+  *p++ = '"';
+  *q++ = '%';
+  *p = *q = 0;
+
+  indexed = (len >= 3 &&
+             sqlite3_table_column_metadata(db, 0, "log_fts", "msg",
+                                           0, 0, 0, 0, 0) == SQLITE_OK);
+
+  if (sqlite3_prepare_v2(db, indexed ? tj_log_sqlite_searchIndexed :
+                         tj_log_sqlite_searchScan, -1, &stmt, 0)) {
+    TJ_LOG_CRITICAL(TJ_LOG_SQLITE_COMPONENT,
+                    "Could not prepare search statement:\n%s",
+                    sqlite3_errmsg(db));
+    goto done;
+  }
+
+  if (indexed)
+    sqlite3_bind_text(stmt, 1, phrase, -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 2, pattern, -1, SQLITE_STATIC);
+  sqlite3_bind_int64(stmt, 3, after);
+  sqlite3_bind_int64(stmt, 4, limit);
+
+  n = 0;
+  while ((dbres = sqlite3_step(stmt)) == SQLITE_ROW) {
+    record.m_id = sqlite3_column_int64(stmt, 0);
+    record.m_date = (const char *) sqlite3_column_text(stmt, 1);
+    record.m_time = (const char *) sqlite3_column_text(stmt, 2);
+    record.m_level = (const char *) sqlite3_column_text(stmt, 3);
+    record.m_component = (const char *) sqlite3_column_text(stmt, 4);
+    record.m_file = (const char *) sqlite3_column_text(stmt, 5);
+    record.m_func = (const char *) sqlite3_column_text(stmt, 6);
+    record.m_line = sqlite3_column_int(stmt, 7);
+    record.m_msg = (const char *) sqlite3_column_text(stmt, 8);
+    f(data, &record);
+    n++;
+  }
+
+  if (dbres != SQLITE_DONE) {
+    TJ_LOG_CRITICAL(TJ_LOG_SQLITE_COMPONENT,
+                    "Could not search logs:\n%s", sqlite3_errmsg(db));
+    n = -1;
+  }
+
+ done:
+  if (stmt != 0)
+    sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  free(phrase);
+  free(pattern);
+
+  return n;
+  // end tj_log_sqlite_search
+}
@@ -35,4 +35,56 @@
 tj_log_outchannel *
 tj_log_sqlite_create(const char *dbfile);
 
+/**
+ * Create a channel which also maintains a full text index over
+ * messages, for tj_log_sqlite_search.  Rows are added to the index
+ * every batch inserts and when the channel is finalized, rather than
+ * one at a time.  Requires sqlite built with FTS5.
+ *
+ * \param dbfile The name of the database file to use or create.  May
+ * be null to use default.
+ * \param batch The number of inserts between index updates.
+ */
+tj_log_outchannel *
+tj_log_sqlite_createIndexed(const char *dbfile, unsigned int batch);
+
+/**
+ * A stored log message, as passed to a tj_log_sqlite_searchFunction.
+ * The strings are only valid during the call.
+ */
+typedef struct {
+  long long m_id;
+  const char *m_date;
+  const char *m_time;
+  const char *m_level;
+  const char *m_component;
+  const char *m_file;
+  const char *m_func;
+  int m_line;
+  const char *m_msg;
+} tj_log_sqlite_record;
+
+typedef void (*tj_log_sqlite_searchFunction)(void *data,
+                                             const tj_log_sqlite_record *r);
+
+/**
+ * Find messages containing some text, case insensitively, in the
+ * order they were logged.  Uses the full text index if the database
+ * has one, and otherwise scans.  Results are paged by passing the
+ * m_id of the last record seen as after.
+ *
+ * \param dbfile The database to search.  May be null to use default.
+ * \param text The text to find, matched literally.
+ * \param after Only return records logged after the one with this id,
+ * 0 to start at the beginning.
+ * \param limit The maximum number of records to return.
+ * \param f Called for each matching record.
+ * \param data Passed to f.
+ * \return The number of records found, or -1 on error.
+ */
+int
+tj_log_sqlite_search(const char *dbfile, const char *text,
+                     long long after, unsigned int limit,
+                     tj_log_sqlite_searchFunction f, void *data);
+
 #endif // __tj_log_sqlite_h__
@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tj_error.h"
+#include "tj_heap.h"
+#include "tj_loop.h"
+
+#define TJ_LOOP_EVENTS 64
+
+#ifndef TJ_LOOP_READ_SIZE
+#define TJ_LOOP_READ_SIZE (size_t) 16384
+#endif
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+struct tj_loop_io {
+  tj_loop *m_loop;
+  int m_fd;
+  int m_events;
+  int m_removed;
+  tj_loop_ioFunction m_f;
+  void *m_data;
+  tj_loop_io *m_prev;
+  tj_loop_io *m_next;
+};
+
+struct tj_loop_timer {
+  tj_loop *m_loop;
+  uint64_t m_deadline;
+  uint64_t m_repeat;
+  int m_cancelled;
+  tj_loop_timerFunction m_f;
+  void *m_data;
+};
+
+static int
+tj_loop_timers_before(uint64_t a, uint64_t b)
+{
+  return a < b;
+}
+
+TJ_HEAP_DECL(tj_loop_timerheap, uint64_t, tj_loop_timer *,
+             tj_loop_timers_before)
+
+struct tj_loop {
+  int m_epoll;
+  int m_wake;
+  int m_stopped;
+
+  tj_loop_io *m_ios;
+  tj_loop_io *m_removed;
+  size_t m_ioCount;
+
+  tj_loop_timerheap *m_timers;
+  size_t m_timerCount;
+};
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static uint64_t
+tj_loop_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+  // end tj_loop_now
+}
+
+static uint32_t
+tj_loop_epollEvents(int events)
+{
+  uint32_t e = EPOLLET;
+  if (events & TJ_LOOP_READ)
+    e |= EPOLLIN | EPOLLRDHUP;
+  if (events & TJ_LOOP_WRITE)
+    e |= EPOLLOUT;
+  return e;
+  // end tj_loop_epollEvents
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+tj_loop *
+tj_loop_create(void)
+{
+  struct epoll_event ev;
+  tj_loop *loop;
+
+  if ((loop = calloc(1, sizeof(tj_loop))) == 0) {
+    TJ_ERROR("No memory for tj_loop.");
+    return 0;
+  }
+  loop->m_epoll = loop->m_wake = -1;
+
+  if ((loop->m_timers = tj_loop_timerheap_create(16)) == 0)
+    goto fail;
+
+  if ((loop->m_epoll = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+      (loop->m_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+    TJ_ERROR("Could not create tj_loop descriptors.");
+    goto fail;
+  }
+
+  //-- The wake descriptor is the only one registered without a watch
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.ptr = 0;
+  if (epoll_ctl(loop->m_epoll, EPOLL_CTL_ADD, loop->m_wake, &ev) == -1) {
+    TJ_ERROR("Could not watch tj_loop wake descriptor.");
+    goto fail;
+  }
+
+  return loop;
+
+ fail:
+  tj_loop_finalize(loop);
+  return 0;
+  // end tj_loop_create
+}
+
+void
+tj_loop_finalize(tj_loop *loop)
+{
+  tj_loop_timer *timer;
+  tj_loop_io *io;
+  uint64_t k;
+
+  while ((io = loop->m_ios) != 0) {
+    loop->m_ios = io->m_next;
+    free(io);
+  }
+  while ((io = loop->m_removed) != 0) {
+    loop->m_removed = io->m_next;
+    free(io);
+  }
+
+  if (loop->m_timers != 0) {
+    while (tj_loop_timerheap_pop(loop->m_timers, &k, &timer))
+      free(timer);
+    tj_loop_timerheap_finalize(loop->m_timers);
+  }
+
+  if (loop->m_wake != -1)
+    close(loop->m_wake);
+  if (loop->m_epoll != -1)
+    close(loop->m_epoll);
+  free(loop);
+  // end tj_loop_finalize
+}
+
+//----------------------------------------------------------------------
+static void
+tj_loop_dispatchTimers(tj_loop *loop)
+{
+  tj_loop_timer *timer;
+  uint64_t now, k;
+
+  now = tj_loop_now();
+  while (tj_loop_timerheap_peek(loop->m_timers, &k, &timer) && k <= now) {
+    tj_loop_timerheap_pop(loop->m_timers, &k, &timer);
+
+    if (!timer->m_cancelled) {
+      timer->m_f(loop, timer, timer->m_data);
+
+      if (!timer->m_cancelled && timer->m_repeat != 0) {
+        //-- Skip firings missed while the loop was busy
+        timer->m_deadline += timer->m_repeat;
+        if (timer->m_deadline <= now)
+          timer->m_deadline = now + timer->m_repeat;
+        if (tj_loop_timerheap_add(loop->m_timers, timer->m_deadline, timer))
+          continue;
+      }
+
+      if (!timer->m_cancelled)
+        loop->m_timerCount--;
+    }
+
+    free(timer);
+  }
+  // end tj_loop_dispatchTimers
+}
+
+static int
+tj_loop_timeout(tj_loop *loop, int timeoutMillis)
+{
+  tj_loop_timer *timer;
+  uint64_t now, k, wait;
+
+  //-- Cancelled timers are left in the heap until they come due
+  if (!tj_loop_timerheap_peek(loop->m_timers, &k, &timer))
+    return timeoutMillis;
+
+  now = tj_loop_now();
+  wait = (k > now) ? (k - now + 999999) / 1000000 : 0;
+  if (timeoutMillis >= 0 && wait > (uint64_t) timeoutMillis)
+    return timeoutMillis;
+  return (wait > INT32_MAX) ? INT32_MAX : (int) wait;
+  // end tj_loop_timeout
+}
+
+int
+tj_loop_runOnce(tj_loop *loop, int timeoutMillis)
+{
+  struct epoll_event events[TJ_LOOP_EVENTS];
+  tj_loop_io *io;
+  uint64_t count;
+  int n, i, e;
+
+  n = epoll_wait(loop->m_epoll, events, TJ_LOOP_EVENTS,
+                 tj_loop_timeout(loop, timeoutMillis));
+  if (n == -1) {
+    if (errno != EINTR) {
+      TJ_ERROR("Could not wait for events: %d.", errno);
+      return 0;
+    }
+    n = 0;
+  }
+
+  for (i = 0; i < n; i++) {
+    if ((io = events[i].data.ptr) == 0) {
+      while (read(loop->m_wake, &count, sizeof(count)) > 0)
+        ;
+      continue;
+    }
+
+    //-- Watches removed earlier in this round are not freed until after
+    if (io->m_removed)
+      continue;
+
+    e = 0;
+    if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+      e |= TJ_LOOP_READ;
+    if (events[i].events & EPOLLOUT)
+      e |= TJ_LOOP_WRITE;
+    if (events[i].events & (EPOLLERR | EPOLLHUP))
+      e |= TJ_LOOP_ERROR;
+    e &= io->m_events | TJ_LOOP_ERROR;
+
+    if (e != 0)
+      io->m_f(loop, io, e, io->m_data);
+  }
+
+  tj_loop_dispatchTimers(loop);
+
+  while ((io = loop->m_removed) != 0) {
+    loop->m_removed = io->m_next;
+    free(io);
+  }
+
+  return 1;
+  // end tj_loop_runOnce
+}
+
+int
+tj_loop_run(tj_loop *loop)
+{
+  int res = 1;
+
+  while (!__atomic_load_n(&loop->m_stopped, __ATOMIC_ACQUIRE) &&
+         (loop->m_ioCount > 0 || loop->m_timerCount > 0)) {
+    if (!(res = tj_loop_runOnce(loop, -1)))
+      break;
+  }
+
+  __atomic_store_n(&loop->m_stopped, 0, __ATOMIC_RELEASE);
+  return res;
+  // end tj_loop_run
+}
+
+void
+tj_loop_stop(tj_loop *loop)
+{
+  uint64_t one = 1;
+
+  __atomic_store_n(&loop->m_stopped, 1, __ATOMIC_RELEASE);
+  if (write(loop->m_wake, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    TJ_ERROR("Could not wake tj_loop: %d.", errno);
+  // end tj_loop_stop
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+tj_loop_io *
+tj_loop_io_add(tj_loop *loop, int fd, int events,
+               tj_loop_ioFunction f, void *data)
+{
+  struct epoll_event ev;
+  tj_loop_io *io;
+
+  if ((io = calloc(1, sizeof(tj_loop_io))) == 0) {
+    TJ_ERROR("No memory for tj_loop_io.");
+    return 0;
+  }
+
+  io->m_loop = loop;
+  io->m_fd = fd;
+  io->m_events = events;
+  io->m_f = f;
+  io->m_data = data;
+
+  ev.events = tj_loop_epollEvents(events);
+  ev.data.ptr = io;
+  if (epoll_ctl(loop->m_epoll, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    TJ_ERROR("Could not watch descriptor %d: %d.", fd, errno);
+    free(io);
+    return 0;
+  }
+
+  if ((io->m_next = loop->m_ios) != 0)
+    io->m_next->m_prev = io;
+  loop->m_ios = io;
+  loop->m_ioCount++;
+
+  return io;
+  // end tj_loop_io_add
+}
+
+int
+tj_loop_io_modify(tj_loop_io *io, int events)
+{
+  struct epoll_event ev;
+
+  ev.events = tj_loop_epollEvents(events);
+  ev.data.ptr = io;
+  if (epoll_ctl(io->m_loop->m_epoll, EPOLL_CTL_MOD, io->m_fd, &ev) == -1) {
+    TJ_ERROR("Could not modify watch on descriptor %d: %d.", io->m_fd, errno);
+    return 0;
+  }
+
+  io->m_events = events;
+  return 1;
+  // end tj_loop_io_modify
+}
+
+void
+tj_loop_io_remove(tj_loop_io *io)
+{
+  tj_loop *loop = io->m_loop;
+
+  //-- The descriptor may already have been closed, removing it from epoll
+  epoll_ctl(loop->m_epoll, EPOLL_CTL_DEL, io->m_fd, 0);
+
+  if (io->m_prev != 0)
+    io->m_prev->m_next = io->m_next;
+  else
+    loop->m_ios = io->m_next;
+  if (io->m_next != 0)
+    io->m_next->m_prev = io->m_prev;
+  loop->m_ioCount--;
+
+  //-- Events for it may still be pending in the current round
+  io->m_removed = 1;
+  io->m_next = loop->m_removed;
+  loop->m_removed = io;
+  // end tj_loop_io_remove
+}
+
+int
+tj_loop_io_getFd(tj_loop_io *io)
+{
+  return io->m_fd;
+  // end tj_loop_io_getFd
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+tj_loop_timer *
+tj_loop_timer_add(tj_loop *loop, unsigned int millis,
+                  unsigned int repeatMillis,
+                  tj_loop_timerFunction f, void *data)
+{
+  tj_loop_timer *timer;
+
+  if ((timer = calloc(1, sizeof(tj_loop_timer))) == 0) {
+    TJ_ERROR("No memory for tj_loop_timer.");
+    return 0;
+  }
+
+  timer->m_loop = loop;
+  timer->m_deadline = tj_loop_now() + (uint64_t) millis * 1000000;
+  timer->m_repeat = (uint64_t) repeatMillis * 1000000;
+  timer->m_f = f;
+  timer->m_data = data;
+
+  if (!tj_loop_timerheap_add(loop->m_timers, timer->m_deadline, timer)) {
+    free(timer);
+    return 0;
+  }
+  loop->m_timerCount++;
+
+  return timer;
+  // end tj_loop_timer_add
+}
+
+void
+tj_loop_timer_cancel(tj_loop_timer *timer)
+{
+  if (timer->m_cancelled)
+    return;
+
+  //-- Freed when it comes off the heap
+  timer->m_cancelled = 1;
+  timer->m_loop->m_timerCount--;
+  // end tj_loop_timer_cancel
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+ssize_t
+tj_loop_readBuffer(int fd, tj_buffer *b, size_t limit, int *eof)
+{
+  size_t total = 0, want, room;
+  ssize_t n;
+
+  if (eof != 0)
+    *eof = 0;
+
+  while (limit == 0 || total < limit) {
+    want = TJ_LOOP_READ_SIZE;
+    if (limit != 0 && limit - total < want)
+      want = limit - total;
+
+    //-- Grow geometrically rather than by each read
+    room = tj_buffer_getAllocated(b) - tj_buffer_getUsed(b);
+    if (room < want &&
+        !tj_buffer_reserve(b, (tj_buffer_getUsed(b) > want) ?
+                           tj_buffer_getUsed(b) : want))
+      return -1;
+
+    n = read(fd, tj_buffer_getBytesAtIndex(b, tj_buffer_getUsed(b)), want);
+    if (n > 0) {
+      tj_buffer_commit(b, n);
+      total += n;
+    } else if (n == 0) {
+      if (eof != 0)
+        *eof = 1;
+      break;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    } else if (errno != EINTR) {
+      return -1;
+    }
+  }
+
+  return total;
+  // end tj_loop_readBuffer
+}
+
+ssize_t
+tj_loop_writeBuffer(int fd, tj_buffer *b)
+{
+  size_t off = 0, used = tj_buffer_getUsed(b);
+  int sock = 1;
+  ssize_t n;
+
+  while (off < used) {
+    //-- send() avoids SIGPIPE from a closed peer, where fd is a socket
+    if (sock) {
+      n = send(fd, tj_buffer_getBytesAtIndex(b, off), used - off,
+               MSG_NOSIGNAL);
+      if (n == -1 && errno == ENOTSOCK) {
+        sock = 0;
+        continue;
+      }
+    } else {
+      n = write(fd, tj_buffer_getBytesAtIndex(b, off), used - off);
+    }
+
+    if (n > 0) {
+      off += n;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else {
+      tj_buffer_popFront(b, off);
+      return -1;
+    }
+  }
+
+  tj_buffer_popFront(b, off);
+  return off;
+  // end tj_loop_writeBuffer
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __tj_loop_h__
+#define __tj_loop_h__
+
+#include <sys/types.h>
+
+#include "tj_buffer.h"
+
+/*
+ * A tj_loop waits on file descriptors with epoll and runs timers kept
+ * in a tj_heap.  Descriptors are watched edge triggered: a callback
+ * is run once each time a descriptor becomes readable or writable,
+ * and must read or write until the kernel reports EAGAIN before it
+ * will be told again.  tj_loop_readBuffer and tj_loop_writeBuffer do
+ * exactly that, directly into and out of a tj_buffer's memory.
+ *
+ * A loop and its watches belong to the thread running it.  Only
+ * tj_loop_stop may be called from other threads.
+ */
+typedef struct tj_loop tj_loop;
+typedef struct tj_loop_io tj_loop_io;
+typedef struct tj_loop_timer tj_loop_timer;
+
+#define TJ_LOOP_READ   0x1
+#define TJ_LOOP_WRITE  0x2
+#define TJ_LOOP_ERROR  0x4     // Error or hangup, always reported
+
+typedef void (*tj_loop_ioFunction)(tj_loop *loop, tj_loop_io *io,
+                                   int events, void *data);
+
+typedef void (*tj_loop_timerFunction)(tj_loop *loop, tj_loop_timer *timer,
+                                      void *data);
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+tj_loop *
+tj_loop_create(void);
+
+/**
+ * Destroy a loop, its watches and any pending timers.  Watched file
+ * descriptors are not closed.
+ */
+void
+tj_loop_finalize(tj_loop *loop);
+
+/**
+ * Run the loop until tj_loop_stop is called or there is nothing left
+ * to watch and no timers pending.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_loop_run(tj_loop *loop);
+
+/**
+ * Wait for and dispatch one round of events and due timers.
+ *
+ * \param loop The loop to run.
+ * \param timeoutMillis The longest to wait if no timer is due sooner,
+ * or -1 to wait indefinitely.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_loop_runOnce(tj_loop *loop, int timeoutMillis);
+
+/**
+ * Make tj_loop_run return once the current round of events has been
+ * dispatched.  May be called from any thread.
+ */
+void
+tj_loop_stop(tj_loop *loop);
+
+//----------------------------------------------------------------------
+/**
+ * Watch a file descriptor, which should be non-blocking.
+ *
+ * \param loop The loop to add to.
+ * \param fd The descriptor to watch.
+ * \param events TJ_LOOP_READ and/or TJ_LOOP_WRITE.
+ * \param f Called with the events that have occurred.
+ * \param data Passed to f.
+ * \return The watch, or 0 on failure.
+ */
+tj_loop_io *
+tj_loop_io_add(tj_loop *loop, int fd, int events,
+               tj_loop_ioFunction f, void *data);
+
+/**
+ * Change the events a watch is interested in.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_loop_io_modify(tj_loop_io *io, int events);
+
+/**
+ * Stop watching a file descriptor and free the watch.  The descriptor
+ * is not closed.  Safe to call from within any callback, including
+ * the watch's own.
+ */
+void
+tj_loop_io_remove(tj_loop_io *io);
+
+int
+tj_loop_io_getFd(tj_loop_io *io);
+
+//----------------------------------------------------------------------
+/**
+ * Start a timer.
+ *
+ * \param loop The loop to add to.
+ * \param millis Milliseconds until the timer first fires.
+ * \param repeatMillis Milliseconds between later firings, or 0 for a
+ * timer that fires once.  A one shot timer is freed after its
+ * function returns and must not be cancelled after that.
+ * \param f Called when the timer fires.
+ * \param data Passed to f.
+ * \return The timer, or 0 on failure.
+ */
+tj_loop_timer *
+tj_loop_timer_add(tj_loop *loop, unsigned int millis,
+                  unsigned int repeatMillis,
+                  tj_loop_timerFunction f, void *data);
+
+/**
+ * Cancel a pending or repeating timer.  Safe to call from within any
+ * callback, including the timer's own.
+ */
+void
+tj_loop_timer_cancel(tj_loop_timer *timer);
+
+//----------------------------------------------------------------------
+/**
+ * Read from a non-blocking descriptor into the end of a buffer until
+ * the descriptor would block, is closed, or limit bytes have been
+ * read.  Data is read directly into the buffer's memory, which is
+ * grown as needed.
+ *
+ * \param fd The descriptor to read.
+ * \param b The buffer to append to.
+ * \param limit The most bytes to read, or 0 for no limit.  A reader
+ * stopped by its limit must call again before waiting for more
+ * events.
+ * \param eof Set to 1 if the peer has closed, otherwise 0.  May be 0.
+ * \return The number of bytes read, or -1 on error.
+ */
+ssize_t
+tj_loop_readBuffer(int fd, tj_buffer *b, size_t limit, int *eof);
+
+/**
+ * Write the contents of a buffer to a non-blocking descriptor until
+ * it is empty or the descriptor would block.  Written bytes are
+ * removed from the front of the buffer.
+ *
+ * \param fd The descriptor to write.
+ * \param b The buffer to drain.
+ * \return The number of bytes written, or -1 on error.
+ */
+ssize_t
+tj_loop_writeBuffer(int fd, tj_buffer *b);
+
+#endif // __tj_loop_h__
@@ -0,0 +1,758 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tj_error.h"
+#include "tj_log.h"
+#include "tj_metrics.h"
+
+
+#define TJ_METRICS_COMPONENT "tj_metrics"
+
+#define TJ_METRICS_SHARDS 16
+
+/*
+ * Histogram buckets are exact below 2^SUBBITS, and above that split
+ * each power of two into 2^SUBBITS equal buckets.
+ */
+#define TJ_METRICS_SUBBITS 5
+#define TJ_METRICS_SUB (1 << TJ_METRICS_SUBBITS)
+#define TJ_METRICS_BUCKETS ((65 - TJ_METRICS_SUBBITS) * TJ_METRICS_SUB)
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+typedef enum {
+  TJ_METRICS_COUNTER,
+  TJ_METRICS_GAUGE,
+  TJ_METRICS_HISTOGRAM,
+} tj_metrics_type;
+
+typedef struct tj_metrics_metric tj_metrics_metric;
+struct tj_metrics_metric {
+  char *m_name;
+  char *m_help;              // Escaped for Prometheus
+  tj_metrics_type m_type;
+  tj_metrics_metric *m_next;
+};
+
+typedef struct {
+  uint64_t m_value;
+} __attribute__((aligned(64))) tj_metrics_cell;
+
+struct tj_metrics_counter {
+  tj_metrics_metric m_metric;
+  tj_metrics_cell m_shards[TJ_METRICS_SHARDS];
+};
+
+struct tj_metrics_gauge {
+  tj_metrics_metric m_metric;
+  uint64_t m_bits;
+};
+
+typedef struct {
+  uint64_t m_count;
+  uint64_t m_sum;
+  uint64_t m_max;
+  uint64_t m_buckets[TJ_METRICS_BUCKETS];
+} tj_metrics_histogramShard;
+
+struct tj_metrics_histogram {
+  tj_metrics_metric m_metric;
+  tj_metrics_histogramShard *m_shards[TJ_METRICS_SHARDS];
+};
+
+static pthread_mutex_t tj_metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static tj_metrics_metric *tj_metrics_registry = 0;
+static tj_metrics_metric **tj_metrics_registryTail = &tj_metrics_registry;
+
+static unsigned int tj_metrics_nextShard = 0;
+static __thread unsigned int tj_metrics_shard = 0;
+
+//----------------------------------------------------------------------
+static unsigned int
+tj_metrics_getShard(void)
+{
+  if (tj_metrics_shard == 0)
+    tj_metrics_shard = __atomic_fetch_add(&tj_metrics_nextShard, 1,
+                                          __ATOMIC_RELAXED) %
+      TJ_METRICS_SHARDS + 1;
+  return tj_metrics_shard - 1;
+  // end tj_metrics_getShard
+}
+
+static int
+tj_metrics_validName(const char *name)
+{
+  const char *c;
+
+  if (*name == 0 || (*name >= '0' && *name <= '9'))
+    return 0;
+
+  for (c = name; *c != 0; c++) {
+    if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+          (*c >= '0' && *c <= '9') || *c == '_' || *c == ':'))
+      return 0;
+  }
+
+  return 1;
+  // end tj_metrics_validName
+}
+
+/*
+ * Finds or registers a metric of the given type and size.
+ */
+static tj_metrics_metric *
+tj_metrics_register(const char *name, const char *help,
+                    tj_metrics_type type, size_t size)
+{
+  tj_metrics_metric *m;
+  const char *c;
+  char *h;
+
+  if (!tj_metrics_validName(name)) {
+    TJ_ERROR("Invalid metric name '%s'.", name);
+    return 0;
+  }
+
+  pthread_mutex_lock(&tj_metrics_lock);
+
+  for (m = tj_metrics_registry; m != 0; m = m->m_next) {
+    if (!strcmp(m->m_name, name)) {
+      pthread_mutex_unlock(&tj_metrics_lock);
+      if (m->m_type != type) {
+        TJ_ERROR("Metric '%s' already registered as another type.", name);
+        return 0;
+      }
+      return m;
+    }
+  }
+
+  if (posix_memalign((void **) &m, 64, size) != 0) {
+    pthread_mutex_unlock(&tj_metrics_lock);
+    TJ_ERROR("No memory for metric '%s'.", name);
+    return 0;
+  }
+  memset(m, 0, size);
+
+  if ((m->m_name = strdup(name)) == 0 ||
+      (m->m_help = malloc(2*strlen(help) + 1)) == 0) {
+    pthread_mutex_unlock(&tj_metrics_lock);
+    TJ_ERROR("No memory for metric '%s'.", name);
+    free(m->m_name);
+    free(m);
+    return 0;
+  }
+
+  for (c = help, h = m->m_help; *c != 0; c++) {
+    if (*c == '\\' || *c == '\n')
+      *h++ = '\\';
+    *h++ = (*c == '\n') ? 'n' : *c;
+  }
+  *h = 0;
+
+  m->m_type = type;
+  *tj_metrics_registryTail = m;
+  tj_metrics_registryTail = &m->m_next;
+
+  pthread_mutex_unlock(&tj_metrics_lock);
+  return m;
+  // end tj_metrics_register
+}
+
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+tj_metrics_counter *
+tj_metrics_counter_create(const char *name, const char *help)
+{
+  return (tj_metrics_counter *)
+    tj_metrics_register(name, help, TJ_METRICS_COUNTER,
+                        sizeof(tj_metrics_counter));
+  // end tj_metrics_counter_create
+}
+
+void
+tj_metrics_counter_add(tj_metrics_counter *c, uint64_t n)
+{
+  __atomic_add_fetch(&c->m_shards[tj_metrics_getShard()].m_value, n,
+                     __ATOMIC_RELAXED);
+  // end tj_metrics_counter_add
+}
+
+uint64_t
+tj_metrics_counter_get(tj_metrics_counter *c)
+{
+  uint64_t n = 0;
+  int i;
+
+  for (i = 0; i < TJ_METRICS_SHARDS; i++)
+    n += __atomic_load_n(&c->m_shards[i].m_value, __ATOMIC_RELAXED);
+
+  return n;
+  // end tj_metrics_counter_get
+}
+
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+typedef union {
+  double m_value;
+  uint64_t m_bits;
+} tj_metrics_double;
+
+tj_metrics_gauge *
+tj_metrics_gauge_create(const char *name, const char *help)
+{
+  return (tj_metrics_gauge *)
+    tj_metrics_register(name, help, TJ_METRICS_GAUGE,
+                        sizeof(tj_metrics_gauge));
+  // end tj_metrics_gauge_create
+}
+
+void
+tj_metrics_gauge_set(tj_metrics_gauge *g, double v)
+{
+  tj_metrics_double d = { .m_value = v };
+  __atomic_store_n(&g->m_bits, d.m_bits, __ATOMIC_RELAXED);
+  // end tj_metrics_gauge_set
+}
+
+void
+tj_metrics_gauge_add(tj_metrics_gauge *g, double v)
+{
+  tj_metrics_double was, now;
+
+  was.m_bits = __atomic_load_n(&g->m_bits, __ATOMIC_RELAXED);
+  do {
+    now.m_value = was.m_value + v;
+  } while (!__atomic_compare_exchange_n(&g->m_bits, &was.m_bits, now.m_bits,
+                                        1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+  // end tj_metrics_gauge_add
+}
+
+double
+tj_metrics_gauge_get(tj_metrics_gauge *g)
+{
+  tj_metrics_double d;
+  d.m_bits = __atomic_load_n(&g->m_bits, __ATOMIC_RELAXED);
+  return d.m_value;
+  // end tj_metrics_gauge_get
+}
+
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static unsigned int
+tj_metrics_bucket(uint64_t v)
+{
+  unsigned int e;
+
+  if (v < TJ_METRICS_SUB)
+    return v;
+
+  e = 63 - __builtin_clzll(v);
+  return (e - TJ_METRICS_SUBBITS + 1) * TJ_METRICS_SUB +
+    (unsigned int) ((v >> (e - TJ_METRICS_SUBBITS)) - TJ_METRICS_SUB);
+  // end tj_metrics_bucket
+}
+
+/*
+ * The middle of the values falling in a bucket.
+ */
+static uint64_t
+tj_metrics_bucketValue(unsigned int i)
+{
+  unsigned int octave = i / TJ_METRICS_SUB, sub = i % TJ_METRICS_SUB;
+  uint64_t width;
+
+  if (octave == 0)
+    return sub;
+
+  width = (uint64_t) 1 << (octave - 1);
+  return ((uint64_t) (TJ_METRICS_SUB + sub) << (octave - 1)) +
+    (width - 1) / 2;
+  // end tj_metrics_bucketValue
+}
+
+tj_metrics_histogram *
+tj_metrics_histogram_create(const char *name, const char *help)
+{
+  return (tj_metrics_histogram *)
+    tj_metrics_register(name, help, TJ_METRICS_HISTOGRAM,
+                        sizeof(tj_metrics_histogram));
+  // end tj_metrics_histogram_create
+}
+
+static tj_metrics_histogramShard *
+tj_metrics_histogram_getShard(tj_metrics_histogram *h)
+{
+  tj_metrics_histogramShard **slot = &h->m_shards[tj_metrics_getShard()];
+  tj_metrics_histogramShard *s, *expected = 0;
+
+  if ((s = __atomic_load_n(slot, __ATOMIC_ACQUIRE)) != 0)
+    return s;
+
+  //-- Shards are only allocated for threads which record
+  if ((s = calloc(1, sizeof(tj_metrics_histogramShard))) == 0)
+    return 0;
+  if (!__atomic_compare_exchange_n(slot, &expected, s, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    free(s);
+    s = expected;
+  }
+
+  return s;
+  // end tj_metrics_histogram_getShard
+}
+
+static void
+tj_metrics_histogram_recordN(tj_metrics_histogramShard *s, unsigned int i,
+                             uint64_t n, uint64_t sum, uint64_t max)
+{
+  uint64_t was = __atomic_load_n(&s->m_max, __ATOMIC_RELAXED);
+
+  __atomic_add_fetch(&s->m_buckets[i], n, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&s->m_count, n, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&s->m_sum, sum, __ATOMIC_RELAXED);
+  while (max > was &&
+         !__atomic_compare_exchange_n(&s->m_max, &was, max, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  // end tj_metrics_histogram_recordN
+}
+
+void
+tj_metrics_histogram_record(tj_metrics_histogram *h, uint64_t v)
+{
+  tj_metrics_histogramShard *s;
+
+  if ((s = tj_metrics_histogram_getShard(h)) != 0)
+    tj_metrics_histogram_recordN(s, tj_metrics_bucket(v), 1, v, v);
+  // end tj_metrics_histogram_record
+}
+
+/*
+ * Merges every shard into one snapshot.
+ */
+static void
+tj_metrics_histogram_snapshot(tj_metrics_histogram *h,
+                              tj_metrics_histogramShard *snapshot)
+{
+  tj_metrics_histogramShard *s;
+  uint64_t max;
+  int i, j;
+
+  memset(snapshot, 0, sizeof(*snapshot));
+
+  for (i = 0; i < TJ_METRICS_SHARDS; i++) {
+    if ((s = __atomic_load_n(&h->m_shards[i], __ATOMIC_ACQUIRE)) == 0)
+      continue;
+    for (j = 0; j < TJ_METRICS_BUCKETS; j++)
+      snapshot->m_buckets[j] += __atomic_load_n(&s->m_buckets[j],
+                                                __ATOMIC_RELAXED);
+    snapshot->m_count += __atomic_load_n(&s->m_count, __ATOMIC_RELAXED);
+    snapshot->m_sum += __atomic_load_n(&s->m_sum, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&s->m_max, __ATOMIC_RELAXED);
+    if (max > snapshot->m_max)
+      snapshot->m_max = max;
+  }
+  // end tj_metrics_histogram_snapshot
+}
+
+static uint64_t
+tj_metrics_histogram_quantile(const tj_metrics_histogramShard *snapshot,
+                              double q)
+{
+  uint64_t count = 0, rank, v;
+  int i;
+
+  //-- Bucket counts are read separately from the total, so sum them
+  for (i = 0; i < TJ_METRICS_BUCKETS; i++)
+    count += snapshot->m_buckets[i];
+  if (count == 0)
+    return 0;
+
+  q = (q < 0) ? 0 : (q > 1) ? 1 : q;
+  rank = (uint64_t) (q * count);
+  if (rank < q * count || rank == 0)
+    rank++;
+
+  for (i = 0; i < TJ_METRICS_BUCKETS; i++) {
+    if (snapshot->m_buckets[i] >= rank)
+      break;
+    rank -= snapshot->m_buckets[i];
+  }
+
+  //-- The top bucket's estimate is the exact maximum
+  if (i == tj_metrics_bucket(snapshot->m_max))
+    return snapshot->m_max;
+  v = tj_metrics_bucketValue(i);
+  return (v > snapshot->m_max) ? snapshot->m_max : v;
+  // end tj_metrics_histogram_quantile
+}
+
+void
+tj_metrics_histogram_merge(tj_metrics_histogram *into,
+                           tj_metrics_histogram *from)
+{
+  tj_metrics_histogramShard *snapshot, *s;
+  int i, first = 1;
+
+  if ((snapshot = malloc(sizeof(tj_metrics_histogramShard))) == 0) {
+    TJ_ERROR("No memory to merge histograms.");
+    return;
+  }
+  tj_metrics_histogram_snapshot(from, snapshot);
+
+  if ((s = tj_metrics_histogram_getShard(into)) != 0) {
+    for (i = 0; i < TJ_METRICS_BUCKETS; i++) {
+      if (snapshot->m_buckets[i] == 0)
+        continue;
+      tj_metrics_histogram_recordN(s, i, snapshot->m_buckets[i],
+                                   first ? snapshot->m_sum : 0,
+                                   first ? snapshot->m_max : 0);
+      first = 0;
+    }
+  }
+
+  free(snapshot);
+  // end tj_metrics_histogram_merge
+}
+
+uint64_t
+tj_metrics_histogram_getCount(tj_metrics_histogram *h)
+{
+  tj_metrics_histogramShard *s;
+  uint64_t n = 0;
+  int i;
+
+  for (i = 0; i < TJ_METRICS_SHARDS; i++) {
+    if ((s = __atomic_load_n(&h->m_shards[i], __ATOMIC_ACQUIRE)) != 0)
+      n += __atomic_load_n(&s->m_count, __ATOMIC_RELAXED);
+  }
+
+  return n;
+  // end tj_metrics_histogram_getCount
+}
+
+uint64_t
+tj_metrics_histogram_getSum(tj_metrics_histogram *h)
+{
+  tj_metrics_histogramShard *s;
+  uint64_t n = 0;
+  int i;
+
+  for (i = 0; i < TJ_METRICS_SHARDS; i++) {
+    if ((s = __atomic_load_n(&h->m_shards[i], __ATOMIC_ACQUIRE)) != 0)
+      n += __atomic_load_n(&s->m_sum, __ATOMIC_RELAXED);
+  }
+
+  return n;
+  // end tj_metrics_histogram_getSum
+}
+
+uint64_t
+tj_metrics_histogram_getMax(tj_metrics_histogram *h)
+{
+  tj_metrics_histogramShard *s;
+  uint64_t n = 0, max;
+  int i;
+
+  for (i = 0; i < TJ_METRICS_SHARDS; i++) {
+    if ((s = __atomic_load_n(&h->m_shards[i], __ATOMIC_ACQUIRE)) != 0 &&
+        (max = __atomic_load_n(&s->m_max, __ATOMIC_RELAXED)) > n)
+      n = max;
+  }
+
+  return n;
+  // end tj_metrics_histogram_getMax
+}
+
+uint64_t
+tj_metrics_histogram_getQuantile(tj_metrics_histogram *h, double q)
+{
+  tj_metrics_histogramShard *snapshot;
+  uint64_t v;
+
+  if ((snapshot = malloc(sizeof(tj_metrics_histogramShard))) == 0) {
+    TJ_ERROR("No memory for histogram snapshot.");
+    return 0;
+  }
+
+  tj_metrics_histogram_snapshot(h, snapshot);
+  v = tj_metrics_histogram_quantile(snapshot, q);
+
+  free(snapshot);
+  return v;
+  // end tj_metrics_histogram_getQuantile
+}
+
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static const double tj_metrics_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+static const char *tj_metrics_quantileNames[] = { "p50", "p90", "p99",
+                                                  "p999" };
+#define TJ_METRICS_QUANTILES 4
+
+static int
+tj_metrics_printDouble(tj_buffer *b, double v, int json)
+{
+  if (isnan(v))
+    return tj_buffer_printf(b, json ? "null" : "NaN");
+  if (isinf(v))
+    return tj_buffer_printf(b, json ? "null" : (v > 0) ? "+Inf" : "-Inf");
+  return tj_buffer_printf(b, "%.17g", v);
+  // end tj_metrics_printDouble
+}
+
+/*
+ * Walks the registry, writing each metric in one format.  The lock is
+ * held throughout so output is not interleaved with registrations.
+ */
+static int
+tj_metrics_print(tj_buffer *b, int json)
+{
+  tj_metrics_histogramShard *snapshot;
+  tj_metrics_metric *m;
+  unsigned long long n;
+  int ok = 1, i;
+
+  if ((snapshot = malloc(sizeof(tj_metrics_histogramShard))) == 0) {
+    TJ_ERROR("No memory for histogram snapshot.");
+    return 0;
+  }
+
+  if (json)
+    ok &= tj_buffer_printf(b, "{");
+
+  pthread_mutex_lock(&tj_metrics_lock);
+  for (m = tj_metrics_registry; m != 0; m = m->m_next) {
+    if (json)
+      ok &= tj_buffer_printf(b, "%s\"%s\":", (m == tj_metrics_registry) ?
+                             "" : ",", m->m_name);
+    else
+      ok &= tj_buffer_printf(b, "# HELP %s %s\n# TYPE %s %s\n",
+                             m->m_name, m->m_help, m->m_name,
+                             (m->m_type == TJ_METRICS_COUNTER) ? "counter" :
+                             (m->m_type == TJ_METRICS_GAUGE) ? "gauge" :
+                             "summary");
+
+    switch (m->m_type) {
+    case TJ_METRICS_COUNTER:
+      n = tj_metrics_counter_get((tj_metrics_counter *) m);
+      if (json)
+        ok &= tj_buffer_printf(b, "%llu", n);
+      else
+        ok &= tj_buffer_printf(b, "%s %llu\n", m->m_name, n);
+      break;
+
+    case TJ_METRICS_GAUGE:
+      if (!json)
+        ok &= tj_buffer_printf(b, "%s ", m->m_name);
+      ok &= tj_metrics_printDouble(b, tj_metrics_gauge_get
+                                   ((tj_metrics_gauge *) m), json);
+      if (!json)
+        ok &= tj_buffer_printf(b, "\n");
+      break;
+
+    case TJ_METRICS_HISTOGRAM:
+      tj_metrics_histogram_snapshot((tj_metrics_histogram *) m, snapshot);
+      if (json)
+        ok &= tj_buffer_printf(b, "{\"count\":%llu,\"sum\":%llu,\"max\":%llu",
+                               (unsigned long long) snapshot->m_count,
+                               (unsigned long long) snapshot->m_sum,
+                               (unsigned long long) snapshot->m_max);
+      for (i = 0; i < TJ_METRICS_QUANTILES; i++) {
+        n = tj_metrics_histogram_quantile(snapshot, tj_metrics_quantiles[i]);
+        if (json)
+          ok &= tj_buffer_printf(b, ",\"%s\":%llu",
+                                 tj_metrics_quantileNames[i], n);
+        else
+          ok &= tj_buffer_printf(b, "%s{quantile=\"%g\"} %llu\n", m->m_name,
+                                 tj_metrics_quantiles[i], n);
+      }
+      if (json)
+        ok &= tj_buffer_printf(b, "}");
+      else
+        ok &= tj_buffer_printf(b, "%s_sum %llu\n%s_count %llu\n",
+                               m->m_name, (unsigned long long) snapshot->m_sum,
+                               m->m_name,
+                               (unsigned long long) snapshot->m_count);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&tj_metrics_lock);
+
+  //-- Even an empty registry leaves a string
+  ok &= tj_buffer_printf(b, json ? "}" : "");
+
+  free(snapshot);
+  return ok;
+  // end tj_metrics_print
+}
+
+int
+tj_metrics_printPrometheus(tj_buffer *b)
+{
+  return tj_metrics_print(b, 0);
+  // end tj_metrics_printPrometheus
+}
+
+int
+tj_metrics_printJSON(tj_buffer *b)
+{
+  return tj_metrics_print(b, 1);
+  // end tj_metrics_printJSON
+}
+
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+typedef struct {
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_wake;
+  pthread_t m_thread;
+  unsigned int m_periodMillis;
+  int m_stopping;
+} tj_metrics_reporter;
+
+static pthread_mutex_t tj_metrics_reporterLock = PTHREAD_MUTEX_INITIALIZER;
+static tj_metrics_reporter *tj_metrics_reporting = 0;
+
+static void *
+tj_metrics_report(void *arg)
+{
+  tj_metrics_reporter *r = arg;
+  struct timespec wake;
+  tj_buffer *b;
+
+  pthread_mutex_lock(&r->m_lock);
+  clock_gettime(CLOCK_MONOTONIC, &wake);
+  while (!r->m_stopping) {
+    wake.tv_sec += r->m_periodMillis / 1000;
+    wake.tv_nsec += (long) (r->m_periodMillis % 1000) * 1000000;
+    if (wake.tv_nsec >= 1000000000) {
+      wake.tv_sec++;
+      wake.tv_nsec -= 1000000000;
+    }
+
+    while (!r->m_stopping &&
+           pthread_cond_timedwait(&r->m_wake, &r->m_lock, &wake) == 0)
+      ;
+    if (r->m_stopping)
+      break;
+
+    pthread_mutex_unlock(&r->m_lock);
+    if ((b = tj_buffer_create(1024)) != 0) {
+      if (tj_metrics_printJSON(b))
+        TJ_LOG_OUTPUT(TJ_METRICS_COMPONENT, "%s", tj_buffer_getAsString(b));
+      tj_buffer_finalize(b);
+    }
+    pthread_mutex_lock(&r->m_lock);
+  }
+  pthread_mutex_unlock(&r->m_lock);
+
+  return 0;
+  // end tj_metrics_report
+}
+
+static void
+tj_metrics_reporter_stop(tj_metrics_reporter *r)
+{
+  if (r == 0)
+    return;
+
+  pthread_mutex_lock(&r->m_lock);
+  r->m_stopping = 1;
+  pthread_cond_signal(&r->m_wake);
+  pthread_mutex_unlock(&r->m_lock);
+  pthread_join(r->m_thread, 0);
+
+  pthread_cond_destroy(&r->m_wake);
+  pthread_mutex_destroy(&r->m_lock);
+  free(r);
+  // end tj_metrics_reporter_stop
+}
+
+int
+tj_metrics_startReporting(unsigned int periodMillis)
+{
+  tj_metrics_reporter *r, *old;
+  pthread_condattr_t attr;
+
+  if (periodMillis == 0) {
+    TJ_ERROR("Metrics reporting period must be positive.");
+    return 0;
+  }
+
+  if ((r = calloc(1, sizeof(tj_metrics_reporter))) == 0) {
+    TJ_ERROR("No memory for metrics reporting.");
+    return 0;
+  }
+  r->m_periodMillis = periodMillis;
+
+  pthread_mutex_init(&r->m_lock, 0);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&r->m_wake, &attr);
+  pthread_condattr_destroy(&attr);
+
+  if (pthread_create(&r->m_thread, 0, &tj_metrics_report, r) != 0) {
+    TJ_ERROR("Could not start metrics reporting.");
+    pthread_cond_destroy(&r->m_wake);
+    pthread_mutex_destroy(&r->m_lock);
+    free(r);
+    return 0;
+  }
+  pthread_mutex_lock(&tj_metrics_reporterLock);
+  old = tj_metrics_reporting;
+  tj_metrics_reporting = r;
+  pthread_mutex_unlock(&tj_metrics_reporterLock);
+
+  tj_metrics_reporter_stop(old);
+  return 1;
+  // end tj_metrics_startReporting
+}
+
+void
+tj_metrics_stopReporting(void)
+{
+  tj_metrics_reporter *r;
+
+  pthread_mutex_lock(&tj_metrics_reporterLock);
+  r = tj_metrics_reporting;
+  tj_metrics_reporting = 0;
+  pthread_mutex_unlock(&tj_metrics_reporterLock);
+
+  tj_metrics_reporter_stop(r);
+  // end tj_metrics_stopReporting
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __tj_metrics_h__
+#define __tj_metrics_h__
+
+#include <stdint.h>
+
+#include "tj_buffer.h"
+
+/*
+ * Metrics are registered by name in a process wide registry and live
+ * until the process exits, so pointers to them may be kept in statics
+ * without any teardown ordering.  Names must be valid Prometheus
+ * names: letters, digits, '_' and ':', not starting with a digit.
+ *
+ * Counters and histograms are sharded; each thread updates the shard
+ * it was assigned on first use, so threads rarely share a cache line,
+ * and reads sum or merge the shards.
+ */
+typedef struct tj_metrics_counter tj_metrics_counter;
+typedef struct tj_metrics_gauge tj_metrics_gauge;
+typedef struct tj_metrics_histogram tj_metrics_histogram;
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/**
+ * Register a counter, or find the one already registered under the
+ * same name.
+ *
+ * \param name The name of the counter.
+ * \param help A description of what is counted.
+ * \return The counter, or 0 on failure or if the name is taken by a
+ * metric of another type.
+ */
+tj_metrics_counter *
+tj_metrics_counter_create(const char *name, const char *help);
+
+void
+tj_metrics_counter_add(tj_metrics_counter *c, uint64_t n);
+
+uint64_t
+tj_metrics_counter_get(tj_metrics_counter *c);
+
+//----------------------------------------------------------------------
+/**
+ * Register a gauge, or find the one already registered under the
+ * same name.
+ *
+ * \param name The name of the gauge.
+ * \param help A description of what is measured.
+ * \return The gauge, or 0 on failure or if the name is taken by a
+ * metric of another type.
+ */
+tj_metrics_gauge *
+tj_metrics_gauge_create(const char *name, const char *help);
+
+void
+tj_metrics_gauge_set(tj_metrics_gauge *g, double v);
+
+void
+tj_metrics_gauge_add(tj_metrics_gauge *g, double v);
+
+double
+tj_metrics_gauge_get(tj_metrics_gauge *g);
+
+//----------------------------------------------------------------------
+/**
+ * Register a histogram, or find the one already registered under the
+ * same name.  Values are unsigned integers, such as latencies in
+ * nanoseconds.  Buckets are linear within each power of two and
+ * quantiles are within about 3% of the recorded values.
+ *
+ * \param name The name of the histogram.
+ * \param help A description of what is recorded.
+ * \return The histogram, or 0 on failure or if the name is taken by a
+ * metric of another type.
+ */
+tj_metrics_histogram *
+tj_metrics_histogram_create(const char *name, const char *help);
+
+void
+tj_metrics_histogram_record(tj_metrics_histogram *h, uint64_t v);
+
+/**
+ * Add everything recorded in one histogram into another.
+ */
+void
+tj_metrics_histogram_merge(tj_metrics_histogram *into,
+                           tj_metrics_histogram *from);
+
+uint64_t
+tj_metrics_histogram_getCount(tj_metrics_histogram *h);
+
+uint64_t
+tj_metrics_histogram_getSum(tj_metrics_histogram *h);
+
+uint64_t
+tj_metrics_histogram_getMax(tj_metrics_histogram *h);
+
+/**
+ * Estimate a quantile of the recorded values.
+ *
+ * \param h The histogram.
+ * \param q The quantile, from 0 to 1.
+ * \return The estimate, or 0 if nothing has been recorded.
+ */
+uint64_t
+tj_metrics_histogram_getQuantile(tj_metrics_histogram *h, double q);
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/**
+ * Append every registered metric to a buffer in the Prometheus text
+ * exposition format, as a string.  Histograms are written as
+ * summaries.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_metrics_printPrometheus(tj_buffer *b);
+
+/**
+ * Append every registered metric to a buffer as a JSON object keyed
+ * by name, as a string.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_metrics_printJSON(tj_buffer *b);
+
+/**
+ * Log the JSON form of every metric through tj_log, as an OUTPUT
+ * message from component "tj_metrics", every periodMillis from a
+ * background thread.  Replaces any previous reporting.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_metrics_startReporting(unsigned int periodMillis);
+
+void
+tj_metrics_stopReporting(void);
+
+#endif // __tj_metrics_h__
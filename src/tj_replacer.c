@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "tj_error.h"
+#include "tj_replacer.h"
+
+// Patterns starting with at most this many distinct bytes are found
+// with SSE2 comparisons rather than the lookup table
+#define TJ_REPLACER_SIMD 4
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+typedef struct {
+  size_t m_offset;
+  size_t m_n;
+  size_t m_replacementOffset;
+  size_t m_replacementN;
+} tj_replacer_pattern;
+
+/*
+ * The automaton is a full transition table over byte classes: bytes
+ * appearing in no pattern share class 0, and each other byte has its
+ * own, which keeps the rows short for typical pattern sets.  State 0
+ * is the root.
+ */
+struct tj_replacer {
+  tj_buffer *m_strings;
+  tj_replacer_pattern *m_patterns;
+  size_t m_count;
+  size_t m_allocated;
+
+  int32_t *m_delta;
+  int32_t *m_match;
+  uint32_t *m_depth;
+  size_t m_states;
+  size_t m_classes;
+  uint8_t m_class[256];
+
+  char m_first[256];
+  tj_buffer_byte m_firstBytes[TJ_REPLACER_SIMD];
+  int m_nFirst;
+
+  char m_compiled;
+};
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+tj_replacer *
+tj_replacer_create(void)
+{
+  tj_replacer *r;
+
+  if ((r = calloc(1, sizeof(tj_replacer))) == 0) {
+    TJ_ERROR("No memory for tj_replacer.");
+    return 0;
+  }
+
+  if ((r->m_strings = tj_buffer_create(0)) == 0) {
+    free(r);
+    return 0;
+  }
+
+  return r;
+  // end tj_replacer_create
+}
+
+void
+tj_replacer_finalize(tj_replacer *r)
+{
+  tj_buffer_finalize(r->m_strings);
+  free(r->m_patterns);
+  free(r->m_delta);
+  free(r->m_match);
+  free(r->m_depth);
+  free(r);
+  // end tj_replacer_finalize
+}
+
+int
+tj_replacer_add(tj_replacer *r, const tj_buffer_byte *pattern, size_t n,
+                const tj_buffer_byte *replacement, size_t m)
+{
+  tj_replacer_pattern *t, *p;
+  size_t used;
+
+  if (r->m_compiled) {
+    TJ_ERROR("Cannot add patterns to a compiled tj_replacer.");
+    return 0;
+  }
+
+  if (n == 0) {
+    TJ_ERROR("Cannot add an empty pattern.");
+    return 0;
+  }
+
+  if (r->m_count == r->m_allocated) {
+    r->m_allocated = r->m_allocated ? r->m_allocated*2 : 16;
+    if ((t = realloc(r->m_patterns,
+                     r->m_allocated * sizeof(tj_replacer_pattern))) == 0) {
+      TJ_ERROR("No memory for %zu patterns.", r->m_allocated);
+      r->m_allocated = r->m_count;
+      return 0;
+    }
+    r->m_patterns = t;
+  }
+
+  used = tj_buffer_getUsed(r->m_strings);
+  if (!tj_buffer_append(r->m_strings, pattern, n) ||
+      !tj_buffer_append(r->m_strings, replacement, m)) {
+    tj_buffer_popBack(r->m_strings, tj_buffer_getUsed(r->m_strings) - used);
+    return 0;
+  }
+
+  p = &r->m_patterns[r->m_count++];
+  p->m_offset = used;
+  p->m_n = n;
+  p->m_replacementOffset = used + n;
+  p->m_replacementN = m;
+
+  return 1;
+  // end tj_replacer_add
+}
+
+int
+tj_replacer_addString(tj_replacer *r, const char *pattern,
+                      const char *replacement)
+{
+  return tj_replacer_add(r, (const tj_buffer_byte *) pattern, strlen(pattern),
+                         (const tj_buffer_byte *) replacement,
+                         strlen(replacement));
+  // end tj_replacer_addString
+}
+
+//----------------------------------------------------------------------
+/*
+ * Builds the trie of the patterns into the transition table, then
+ * completes the table breadth first: a missing transition from a state
+ * is taken from its failure state, the longest proper suffix of it
+ * that is also in the trie, whose row is already complete.
+ */
+int
+tj_replacer_compile(tj_replacer *r)
+{
+  const tj_buffer_byte *strings = tj_buffer_getBytes(r->m_strings);
+  int32_t *fail = 0, *queue = 0, *t, s, c;
+  size_t i, k, total = 1, head = 0, tail = 0;
+  const tj_replacer_pattern *p;
+  char used[256] = { 0 };
+
+  if (r->m_compiled)
+    return 1;
+
+  for (i = 0; i < r->m_count; i++) {
+    p = &r->m_patterns[i];
+    total += p->m_n;
+    for (k = 0; k < p->m_n; k++)
+      used[strings[p->m_offset + k]] = 1;
+    if (!r->m_first[strings[p->m_offset]]) {
+      r->m_first[strings[p->m_offset]] = 1;
+      if (r->m_nFirst < TJ_REPLACER_SIMD)
+        r->m_firstBytes[r->m_nFirst] = strings[p->m_offset];
+      r->m_nFirst++;
+    }
+  }
+
+  r->m_classes = 1;
+  for (i = 0; i < 256; i++)
+    r->m_class[i] = used[i] ? r->m_classes++ : 0;
+
+  if (total > INT32_MAX || total > SIZE_MAX / sizeof(int32_t) / r->m_classes) {
+    TJ_ERROR("Too many pattern bytes to compile: %zu.", total);
+    return 0;
+  }
+
+  //-- Sized for a trie sharing no prefixes, and trimmed once built
+  if ((r->m_delta = malloc(total * r->m_classes * sizeof(int32_t))) == 0 ||
+      (r->m_match = malloc(total * sizeof(int32_t))) == 0 ||
+      (r->m_depth = malloc(total * sizeof(uint32_t))) == 0 ||
+      (fail = malloc(total * sizeof(int32_t))) == 0 ||
+      (queue = malloc(total * sizeof(int32_t))) == 0) {
+    TJ_ERROR("No memory to compile %zu patterns.", r->m_count);
+    goto fail;
+  }
+
+  memset(r->m_delta, 0xff, r->m_classes * sizeof(int32_t));
+  r->m_match[0] = -1;
+  r->m_depth[0] = 0;
+  r->m_states = 1;
+
+  for (i = 0; i < r->m_count; i++) {
+    p = &r->m_patterns[i];
+    for (s = 0, k = 0; k < p->m_n; k++) {
+      t = &r->m_delta[s * r->m_classes + r->m_class[strings[p->m_offset + k]]];
+      if (*t < 0) {
+        *t = r->m_states++;
+        memset(&r->m_delta[*t * r->m_classes], 0xff,
+               r->m_classes * sizeof(int32_t));
+        r->m_match[*t] = -1;
+        r->m_depth[*t] = r->m_depth[s] + 1;
+      }
+      s = *t;
+    }
+    if (r->m_match[s] < 0)
+      r->m_match[s] = i;
+  }
+
+  for (c = 0; c < r->m_classes; c++) {
+    if ((s = r->m_delta[c]) < 0) {
+      r->m_delta[c] = 0;
+    } else {
+      fail[s] = 0;
+      queue[tail++] = s;
+    }
+  }
+
+  while (head < tail) {
+    s = queue[head++];
+    //-- A state's own pattern is longer than any of its suffixes'
+    if (r->m_match[s] < 0)
+      r->m_match[s] = r->m_match[fail[s]];
+
+    for (c = 0; c < r->m_classes; c++) {
+      t = &r->m_delta[s * r->m_classes + c];
+      if (*t < 0) {
+        *t = r->m_delta[fail[s] * r->m_classes + c];
+      } else {
+        fail[*t] = r->m_delta[fail[s] * r->m_classes + c];
+        queue[tail++] = *t;
+      }
+    }
+  }
+
+  free(fail);
+  free(queue);
+
+  if ((t = realloc(r->m_delta,
+                   r->m_states * r->m_classes * sizeof(int32_t))) != 0)
+    r->m_delta = t;
+
+  TJ_LOG("Compiled %zu patterns into %zu states of %zu classes.",
+         r->m_count, r->m_states, r->m_classes);
+  r->m_compiled = 1;
+  return 1;
+
+ fail:
+  free(r->m_delta);
+  free(r->m_match);
+  free(r->m_depth);
+  free(fail);
+  free(queue);
+  r->m_delta = r->m_match = 0;
+  r->m_depth = 0;
+  return 0;
+  // end tj_replacer_compile
+}
+
+//----------------------------------------------------------------------
+/*
+ * Finds the next byte from j which may begin a match.
+ */
+static size_t
+tj_replacer_skip(const tj_replacer *r, const tj_buffer_byte *src,
+                 size_t j, size_t n)
+{
+#ifdef __SSE2__
+  __m128i b[TJ_REPLACER_SIMD], v, m;
+  int i, bits;
+
+  if (r->m_nFirst > 0 && r->m_nFirst <= TJ_REPLACER_SIMD) {
+    for (i = 0; i < TJ_REPLACER_SIMD; i++)
+      b[i] = _mm_set1_epi8(r->m_firstBytes[i < r->m_nFirst ? i : 0]);
+
+    for (; j+16 <= n; j += 16) {
+      v = _mm_loadu_si128((const __m128i *) &src[j]);
+      m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, b[0]),
+                                    _mm_cmpeq_epi8(v, b[1])),
+                       _mm_or_si128(_mm_cmpeq_epi8(v, b[2]),
+                                    _mm_cmpeq_epi8(v, b[3])));
+      if ((bits = _mm_movemask_epi8(m)) != 0)
+        return j + __builtin_ctz(bits);
+    }
+  }
+#endif
+
+  for (; j < n; j++) {
+    if (r->m_first[src[j]])
+      return j;
+  }
+
+  return n;
+  // end tj_replacer_skip
+}
+
+/*
+ * The scan keeps the best match found so far, leftmost and then
+ * longest.  Once the automaton's state is shallower than the distance
+ * back to that match's start, no match beginning at or before it is
+ * still in progress, so it is replaced and the scan restarted from the
+ * root just after it.
+ */
+int
+tj_replacer_applyBytes(tj_replacer *r, tj_buffer *dest,
+                       const tj_buffer_byte *src, size_t n, size_t *count)
+{
+  const tj_buffer_byte *strings = tj_buffer_getBytes(r->m_strings);
+  size_t i = 0, j = 0, start = 0, end = 0, found = 0;
+  const tj_replacer_pattern *p;
+  int32_t s = 0, m, best = -1;
+
+  if (!r->m_compiled) {
+    TJ_ERROR("tj_replacer must be compiled before it is applied.");
+    return 0;
+  }
+
+  //-- Typically the output is about the size of the input
+  if (!tj_buffer_reserve(dest, n))
+    return 0;
+
+  for (;;) {
+    if (s == 0 && (j = tj_replacer_skip(r, src, j, n)) == n)
+      break;
+
+    if (j < n) {
+      s = r->m_delta[s * r->m_classes + r->m_class[src[j++]]];
+      if ((m = r->m_match[s]) >= 0 &&
+          (best < 0 || j - r->m_patterns[m].m_n <= start)) {
+        best = m;
+        start = j - r->m_patterns[m].m_n;
+        end = j;
+      }
+      if (best < 0 || r->m_depth[s] >= j - start)
+        continue;
+    } else if (best < 0) {
+      break;
+    }
+
+    p = &r->m_patterns[best];
+    if ((start > i && !tj_buffer_append(dest, src + i, start - i)) ||
+        (p->m_replacementN > 0 &&
+         !tj_buffer_append(dest, strings + p->m_replacementOffset,
+                           p->m_replacementN)))
+      return 0;
+
+    found++;
+    i = j = end;
+    s = 0;
+    best = -1;
+  }
+
+  if (n > i && !tj_buffer_append(dest, src + i, n - i))
+    return 0;
+
+  if (count != 0)
+    *count = found;
+  return 1;
+  // end tj_replacer_applyBytes
+}
+
+int
+tj_replacer_apply(tj_replacer *r, tj_buffer *dest, tj_buffer *src,
+                  size_t *count)
+{
+  return tj_replacer_applyBytes(r, dest, tj_buffer_getBytes(src),
+                                tj_buffer_getUsed(src), count);
+  // end tj_replacer_apply
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __tj_replacer_h__
+#define __tj_replacer_h__
+
+#include "tj_buffer.h"
+
+/*
+ * A tj_replacer substitutes many literal patterns at once.  The
+ * patterns are compiled into an Aho-Corasick automaton, so a buffer
+ * is rewritten in a single pass whatever the number of patterns.
+ * Where several patterns match, the leftmost match is replaced, and of
+ * those starting there the longest; the scan resumes after it, so
+ * replacements never overlap and are not themselves rescanned.
+ *
+ * Runs of bytes that cannot begin a match are skipped with SSE2 where
+ * the patterns begin with only a few distinct bytes, and otherwise
+ * with a lookup table.
+ */
+typedef struct tj_replacer tj_replacer;
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/**
+ * Create an empty pattern set.
+ *
+ * \return The replacer, or 0 on failure.
+ */
+tj_replacer *
+tj_replacer_create(void);
+
+void
+tj_replacer_finalize(tj_replacer *r);
+
+/**
+ * Add a pattern.  Patterns may only be added before the set is
+ * compiled.  If a pattern is added twice, the first replacement is
+ * used.
+ *
+ * \param r The replacer.
+ * \param pattern The bytes to replace, at least one.
+ * \param n The length of the pattern.
+ * \param replacement The bytes to substitute; copied.
+ * \param m The length of the replacement.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_replacer_add(tj_replacer *r, const tj_buffer_byte *pattern, size_t n,
+                const tj_buffer_byte *replacement, size_t m);
+
+int
+tj_replacer_addString(tj_replacer *r, const char *pattern,
+                      const char *replacement);
+
+/**
+ * Build the automaton for the patterns added.  A compiled replacer is
+ * not modified by applying it, and may be applied concurrently from
+ * several threads.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_replacer_compile(tj_replacer *r);
+
+//----------------------------------------------------------------------
+/**
+ * Append data to a buffer with every pattern replaced.
+ *
+ * \param r The compiled replacer.
+ * \param dest The buffer to append to.
+ * \param src A byte array of at least length n.
+ * \param n The number of bytes to rewrite.
+ * \param count If not 0, set to the number of replacements made.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_replacer_applyBytes(tj_replacer *r, tj_buffer *dest,
+                       const tj_buffer_byte *src, size_t n, size_t *count);
+
+/**
+ * Append the contents of one buffer to another with every pattern
+ * replaced.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_replacer_apply(tj_replacer *r, tj_buffer *dest, tj_buffer *src,
+                  size_t *count);
+
+#endif // __tj_replacer_h__
@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tj_error.h"
+#include "tj_rope.h"
+
+// Chunks joined into no more than this many bytes are copied together
+#ifndef TJ_ROPE_SMALL
+#define TJ_ROPE_SMALL 256
+#endif
+
+#define TJ_ROPE_IOV 64
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * A leaf has no children and views m_length bytes of m_shared from
+ * m_offset; the empty rope is a leaf without a shared buffer.  Other
+ * nodes are the concatenation of their children, whose heights differ
+ * by at most one.
+ */
+struct tj_rope {
+  int m_refs;
+  int m_height;
+  size_t m_length;
+  tj_rope *m_left;
+  tj_rope *m_right;
+  tj_buffer_shared *m_shared;
+  size_t m_offset;
+};
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static tj_rope *
+tj_rope_leaf(tj_buffer_shared *s, size_t offset, size_t n)
+{
+  tj_rope *r;
+
+  if ((r = calloc(1, sizeof(tj_rope))) == 0) {
+    TJ_ERROR("No memory for tj_rope.");
+    return 0;
+  }
+
+  r->m_refs = 1;
+  r->m_length = n;
+  r->m_offset = offset;
+  if ((r->m_shared = s) != 0)
+    tj_buffer_shared_retain(s);
+
+  return r;
+  // end tj_rope_leaf
+}
+
+static const tj_buffer_byte *
+tj_rope_leafBytes(const tj_rope *r)
+{
+  return tj_buffer_shared_getBytes(r->m_shared) + r->m_offset;
+  // end tj_rope_leafBytes
+}
+
+/*
+ * A new node joining two ropes as they are, regardless of balance.
+ */
+static tj_rope *
+tj_rope_node(tj_rope *a, tj_rope *b)
+{
+  tj_rope *r;
+
+  if ((r = calloc(1, sizeof(tj_rope))) == 0) {
+    TJ_ERROR("No memory for tj_rope.");
+    return 0;
+  }
+
+  r->m_refs = 1;
+  r->m_height = 1 + ((a->m_height > b->m_height) ? a->m_height : b->m_height);
+  r->m_length = a->m_length + b->m_length;
+  r->m_left = tj_rope_retain(a);
+  r->m_right = tj_rope_retain(b);
+
+  return r;
+  // end tj_rope_node
+}
+
+/*
+ * Build a node from a rope and a new node of two others, releasing
+ * the intermediate node.
+ */
+static tj_rope *
+tj_rope_node3(tj_rope *a, tj_rope *b, tj_rope *c, int leftFirst)
+{
+  tj_rope *x, *r;
+
+  if ((x = leftFirst ? tj_rope_node(a, b) : tj_rope_node(b, c)) == 0)
+    return 0;
+  r = leftFirst ? tj_rope_node(x, c) : tj_rope_node(a, x);
+  tj_rope_release(x);
+  return r;
+  // end tj_rope_node3
+}
+
+static tj_rope *
+tj_rope_copyLeaves(tj_rope *a, tj_rope *b)
+{
+  tj_buffer_shared *s;
+  tj_buffer *buff;
+  tj_rope *r;
+
+  if ((buff = tj_buffer_create(a->m_length + b->m_length)) == 0)
+    return 0;
+  tj_buffer_append(buff, tj_rope_leafBytes(a), a->m_length);
+  tj_buffer_append(buff, tj_rope_leafBytes(b), b->m_length);
+
+  if ((s = tj_buffer_freeze(buff)) == 0) {
+    tj_buffer_finalize(buff);
+    return 0;
+  }
+  r = tj_rope_leaf(s, 0, a->m_length + b->m_length);
+  tj_buffer_shared_release(s);
+  return r;
+  // end tj_rope_copyLeaves
+}
+
+/*
+ * Join two balanced ropes into a balanced rope.  The taller rope is
+ * descended along its inner edge to a subtree near the other's
+ * height, and the nodes on the way back up rebuilt, with a rotation
+ * where the join left them unbalanced.
+ */
+static tj_rope *
+tj_rope_join(tj_rope *a, tj_rope *b)
+{
+  tj_rope *t, *r, *x, *y;
+
+  if (a->m_length == 0)
+    return tj_rope_retain(b);
+  if (b->m_length == 0)
+    return tj_rope_retain(a);
+
+  if (a->m_height == 0 && b->m_height == 0 &&
+      a->m_length + b->m_length <= TJ_ROPE_SMALL)
+    return tj_rope_copyLeaves(a, b);
+
+  if (a->m_height > b->m_height + 1) {
+    x = a->m_left;
+    if ((t = tj_rope_join(a->m_right, b)) == 0)
+      return 0;
+
+    if (t->m_height <= x->m_height + 1)
+      r = tj_rope_node(x, t);
+    else if (t->m_left->m_height <= t->m_right->m_height)
+      r = tj_rope_node3(x, t->m_left, t->m_right, 1);
+    else {
+      y = t->m_left;
+      if ((x = tj_rope_node(x, y->m_left)) == 0) {
+        r = 0;
+      } else {
+        r = tj_rope_node3(x, y->m_right, t->m_right, 0);
+        tj_rope_release(x);
+      }
+    }
+
+    tj_rope_release(t);
+    return r;
+  }
+
+  if (b->m_height > a->m_height + 1) {
+    x = b->m_right;
+    if ((t = tj_rope_join(a, b->m_left)) == 0)
+      return 0;
+
+    if (t->m_height <= x->m_height + 1)
+      r = tj_rope_node(t, x);
+    else if (t->m_right->m_height <= t->m_left->m_height)
+      r = tj_rope_node3(t->m_left, t->m_right, x, 0);
+    else {
+      y = t->m_right;
+      if ((x = tj_rope_node(y->m_right, x)) == 0) {
+        r = 0;
+      } else {
+        r = tj_rope_node3(t->m_left, y->m_left, x, 1);
+        tj_rope_release(x);
+      }
+    }
+
+    tj_rope_release(t);
+    return r;
+  }
+
+  return tj_rope_node(a, b);
+  // end tj_rope_join
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+tj_rope *
+tj_rope_create(void)
+{
+  return tj_rope_leaf(0, 0, 0);
+  // end tj_rope_create
+}
+
+tj_rope *
+tj_rope_createBytes(const tj_buffer_byte *data, size_t n)
+{
+  tj_buffer_shared *s;
+  tj_buffer *buff;
+  tj_rope *r;
+
+  if (n == 0)
+    return tj_rope_create();
+
+  if ((buff = tj_buffer_create(n)) == 0)
+    return 0;
+  tj_buffer_append(buff, data, n);
+
+  if ((s = tj_buffer_freeze(buff)) == 0) {
+    tj_buffer_finalize(buff);
+    return 0;
+  }
+  r = tj_rope_leaf(s, 0, n);
+  tj_buffer_shared_release(s);
+  return r;
+  // end tj_rope_createBytes
+}
+
+tj_rope *
+tj_rope_createShared(tj_buffer_shared *s)
+{
+  if (tj_buffer_shared_getUsed(s) == 0)
+    return tj_rope_create();
+  return tj_rope_leaf(s, 0, tj_buffer_shared_getUsed(s));
+  // end tj_rope_createShared
+}
+
+tj_rope *
+tj_rope_retain(tj_rope *r)
+{
+  __atomic_add_fetch(&r->m_refs, 1, __ATOMIC_RELAXED);
+  return r;
+  // end tj_rope_retain
+}
+
+void
+tj_rope_release(tj_rope *r)
+{
+  if (__atomic_sub_fetch(&r->m_refs, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+
+  if (r->m_shared != 0)
+    tj_buffer_shared_release(r->m_shared);
+  if (r->m_left != 0) {
+    tj_rope_release(r->m_left);
+    tj_rope_release(r->m_right);
+  }
+  free(r);
+  // end tj_rope_release
+}
+
+size_t
+tj_rope_getLength(const tj_rope *r)
+{
+  return r->m_length;
+  // end tj_rope_getLength
+}
+
+int
+tj_rope_getHeight(const tj_rope *r)
+{
+  return r->m_height;
+  // end tj_rope_getHeight
+}
+
+//----------------------------------------------------------------------
+tj_rope *
+tj_rope_concat(tj_rope *a, tj_rope *b)
+{
+  return tj_rope_join(a, b);
+  // end tj_rope_concat
+}
+
+tj_rope *
+tj_rope_slice(tj_rope *r, size_t i, size_t n)
+{
+  tj_rope *a, *b, *res;
+  size_t left;
+
+  if (i > r->m_length)
+    i = r->m_length;
+  if (n > r->m_length - i)
+    n = r->m_length - i;
+
+  if (i == 0 && n == r->m_length)
+    return tj_rope_retain(r);
+  if (n == 0)
+    return tj_rope_create();
+
+  if (r->m_left == 0)
+    return tj_rope_leaf(r->m_shared, r->m_offset + i, n);
+
+  left = r->m_left->m_length;
+  if (i + n <= left)
+    return tj_rope_slice(r->m_left, i, n);
+  if (i >= left)
+    return tj_rope_slice(r->m_right, i - left, n);
+
+  if ((a = tj_rope_slice(r->m_left, i, left - i)) == 0)
+    return 0;
+  if ((b = tj_rope_slice(r->m_right, 0, n - (left - i))) == 0) {
+    tj_rope_release(a);
+    return 0;
+  }
+
+  res = tj_rope_join(a, b);
+  tj_rope_release(a);
+  tj_rope_release(b);
+  return res;
+  // end tj_rope_slice
+}
+
+tj_rope *
+tj_rope_insert(tj_rope *r, size_t i, tj_rope *s)
+{
+  tj_rope *a = 0, *b = 0, *x = 0, *res = 0;
+
+  if ((a = tj_rope_slice(r, 0, i)) == 0 ||
+      (b = tj_rope_slice(r, i, r->m_length)) == 0 ||
+      (x = tj_rope_join(a, s)) == 0)
+    goto done;
+  res = tj_rope_join(x, b);
+
+ done:
+  if (a != 0)
+    tj_rope_release(a);
+  if (b != 0)
+    tj_rope_release(b);
+  if (x != 0)
+    tj_rope_release(x);
+  return res;
+  // end tj_rope_insert
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static void
+tj_rope_appendLeaves(tj_rope *r, tj_buffer *b)
+{
+  if (r->m_left != 0) {
+    tj_rope_appendLeaves(r->m_left, b);
+    tj_rope_appendLeaves(r->m_right, b);
+  } else if (r->m_length > 0) {
+    tj_buffer_append(b, tj_rope_leafBytes(r), r->m_length);
+  }
+  // end tj_rope_appendLeaves
+}
+
+int
+tj_rope_appendTo(tj_rope *r, tj_buffer *b)
+{
+  //-- Reserved once, so the appends below cannot fail
+  if (!tj_buffer_reserve(b, r->m_length))
+    return 0;
+  tj_rope_appendLeaves(r, b);
+  return 1;
+  // end tj_rope_appendTo
+}
+
+int
+tj_rope_getIovecs(tj_rope *r, size_t offset, struct iovec *iov, int n)
+{
+  int count;
+
+  if (n <= 0 || offset >= r->m_length)
+    return 0;
+
+  if (r->m_left == 0) {
+    iov->iov_base = (void *) (tj_rope_leafBytes(r) + offset);
+    iov->iov_len = r->m_length - offset;
+    return 1;
+  }
+
+  if (offset >= r->m_left->m_length)
+    return tj_rope_getIovecs(r->m_right, offset - r->m_left->m_length, iov, n);
+
+  count = tj_rope_getIovecs(r->m_left, offset, iov, n);
+  return count + tj_rope_getIovecs(r->m_right, 0, iov + count, n - count);
+  // end tj_rope_getIovecs
+}
+
+ssize_t
+tj_rope_write(tj_rope *r, int fd)
+{
+  struct iovec iov[TJ_ROPE_IOV];
+  size_t done = 0;
+  ssize_t n;
+  int count;
+
+  while (done < r->m_length) {
+    count = tj_rope_getIovecs(r, done, iov, TJ_ROPE_IOV);
+    if ((n = writev(fd, iov, count)) > 0) {
+      done += n;
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      TJ_ERROR("Could not write tj_rope: %d.", errno);
+      return -1;
+    }
+  }
+
+  return done;
+  // end tj_rope_write
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __tj_rope_h__
+#define __tj_rope_h__
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "tj_buffer.h"
+
+/*
+ * A tj_rope is an immutable sequence of bytes held as a balanced tree
+ * of chunks, each a range of a tj_buffer_shared.  Concatenating,
+ * slicing and inserting build new ropes sharing the chunks and most of
+ * the tree of their arguments, in time logarithmic in their size,
+ * without copying any bytes.  Contents are copied only when flattened
+ * into a tj_buffer, or written straight from the chunks with writev().
+ *
+ * Ropes are reference counted.  Every function returning a rope
+ * returns a new reference, which the caller must release; arguments
+ * are only borrowed.  Ropes may be shared and released across
+ * threads.
+ */
+typedef struct tj_rope tj_rope;
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/**
+ * Create an empty rope.
+ *
+ * \return The rope, or 0 on failure.
+ */
+tj_rope *
+tj_rope_create(void);
+
+/**
+ * Create a rope holding a copy of some bytes.
+ *
+ * \param data A byte array of at least length n.
+ * \param n The number of bytes.
+ * \return The rope, or 0 on failure.
+ */
+tj_rope *
+tj_rope_createBytes(const tj_buffer_byte *data, size_t n);
+
+/**
+ * Create a rope holding a shared buffer, without copying it.
+ *
+ * \param s The shared buffer, which the rope retains.
+ * \return The rope, or 0 on failure.
+ */
+tj_rope *
+tj_rope_createShared(tj_buffer_shared *s);
+
+tj_rope *
+tj_rope_retain(tj_rope *r);
+
+void
+tj_rope_release(tj_rope *r);
+
+size_t
+tj_rope_getLength(const tj_rope *r);
+
+/**
+ * The height of the rope's tree, 0 for a single chunk.
+ */
+int
+tj_rope_getHeight(const tj_rope *r);
+
+//----------------------------------------------------------------------
+/**
+ * Join two ropes.  Small chunks are copied together rather than
+ * joined, so ropes built from many tiny pieces stay compact.
+ *
+ * \return The joined rope, or 0 on failure.
+ */
+tj_rope *
+tj_rope_concat(tj_rope *a, tj_rope *b);
+
+/**
+ * Take part of a rope.
+ *
+ * \param r The rope.
+ * \param i The start of the part; clipped to the rope's length.
+ * \param n The length of the part; clipped to the rope's length.
+ * \return The part, or 0 on failure.
+ */
+tj_rope *
+tj_rope_slice(tj_rope *r, size_t i, size_t n);
+
+/**
+ * Insert one rope into another.
+ *
+ * \param r The rope to insert into.
+ * \param i Where to insert; clipped to the rope's length.
+ * \param s The rope to insert.
+ * \return The result, or 0 on failure.
+ */
+tj_rope *
+tj_rope_insert(tj_rope *r, size_t i, tj_rope *s);
+
+//----------------------------------------------------------------------
+/**
+ * Append the contents of a rope to a buffer.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_rope_appendTo(tj_rope *r, tj_buffer *b);
+
+/**
+ * Describe the chunks of a rope, from an offset, as iovecs.
+ *
+ * \param r The rope.
+ * \param offset The first byte to describe.
+ * \param iov Filled in with the chunks.
+ * \param n The most iovecs to fill in.
+ * \return The number of iovecs filled in.
+ */
+int
+tj_rope_getIovecs(tj_rope *r, size_t offset, struct iovec *iov, int n);
+
+/**
+ * Write a rope to a descriptor with writev() until it is written or,
+ * for a non-blocking descriptor, until it would block.  The rest can
+ * be written later by slicing off what was written.
+ *
+ * \return The number of bytes written, or -1 on error.
+ */
+ssize_t
+tj_rope_write(tj_rope *r, int fd);
+
+#endif // __tj_rope_h__
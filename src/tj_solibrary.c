@@ -31,6 +31,7 @@
 #include <utlist.h>
 
 #include "tj_solibrary.h"
+#include "tj_trace.h"
 
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
@@ -114,6 +115,7 @@ tj_solibrary_getNext(tj_solibrary *x, tj_solibrary_entry *e)
 tj_solibrary_entry *
 tj_solibrary_load(tj_solibrary *x, const char *fn)
 {
+  TJ_TRACE_SCOPE("tj_solibrary_load");
   const char *error;
 
   tj_solibrary_entry *e;
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tj_sort.h"
+
+#define TJ_SORT_MAX_THREADS 256
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+typedef struct tj_sort_job tj_sort_job;
+struct tj_sort_job {
+  const tj_sort_ops *m_ops;
+  char *m_a;
+  char *m_tmp;
+  size_t m_n;
+  int m_threads;
+
+  void (*m_phase)(tj_sort_job *job, int t);
+  uint64_t *m_diffs;
+  size_t (*m_counts)[256];
+  size_t m_runs[257];
+  int m_shift;
+  int m_nextRun;
+};
+
+typedef struct {
+  tj_sort_job *m_job;
+  int m_index;
+} tj_sort_worker;
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static size_t
+tj_sort_from(const tj_sort_job *job, int t)
+{
+  return job->m_n / job->m_threads * t +
+    (job->m_n % job->m_threads) * t / job->m_threads;
+  // end tj_sort_from
+}
+
+static void
+tj_sort_diffPhase(tj_sort_job *job, int t)
+{
+  job->m_ops->m_diff(job->m_a, tj_sort_from(job, t), tj_sort_from(job, t+1),
+                     &job->m_diffs[t]);
+  // end tj_sort_diffPhase
+}
+
+static void
+tj_sort_countPhase(tj_sort_job *job, int t)
+{
+  job->m_ops->m_count(job->m_a, tj_sort_from(job, t), tj_sort_from(job, t+1),
+                      job->m_shift, job->m_counts[t]);
+  // end tj_sort_countPhase
+}
+
+static void
+tj_sort_scatterPhase(tj_sort_job *job, int t)
+{
+  job->m_ops->m_scatter(job->m_a, job->m_tmp, tj_sort_from(job, t),
+                        tj_sort_from(job, t+1), job->m_shift,
+                        job->m_counts[t]);
+  // end tj_sort_scatterPhase
+}
+
+static void
+tj_sort_runPhase(tj_sort_job *job, int t)
+{
+  size_t size = job->m_ops->m_size, from;
+  int r;
+
+  //-- Runs are claimed one at a time, so uneven runs balance out
+  while ((r = __atomic_fetch_add(&job->m_nextRun, 1, __ATOMIC_RELAXED)) < 256) {
+    from = job->m_runs[r];
+    if (job->m_runs[r+1] > from)
+      job->m_ops->m_sortRun(job->m_tmp + from*size, job->m_a + from*size,
+                            job->m_runs[r+1] - from, job->m_shift);
+  }
+  // end tj_sort_runPhase
+}
+
+static void *
+tj_sort_thread(void *arg)
+{
+  tj_sort_worker *w = arg;
+  w->m_job->m_phase(w->m_job, w->m_index);
+  return 0;
+  // end tj_sort_thread
+}
+
+/*
+ * Run a phase on every slice, the first on the calling thread.  Slices
+ * whose thread cannot be started are run on the calling thread too.
+ */
+static void
+tj_sort_run(tj_sort_job *job, void (*phase)(tj_sort_job *job, int t))
+{
+  tj_sort_worker workers[TJ_SORT_MAX_THREADS];
+  pthread_t threads[TJ_SORT_MAX_THREADS];
+  char started[TJ_SORT_MAX_THREADS];
+  int t;
+
+  job->m_phase = phase;
+  for (t = 1; t < job->m_threads; t++) {
+    workers[t].m_job = job;
+    workers[t].m_index = t;
+    started[t] = pthread_create(&threads[t], 0, &tj_sort_thread,
+                                &workers[t]) == 0;
+  }
+
+  phase(job, 0);
+  for (t = 1; t < job->m_threads; t++) {
+    if (started[t])
+      pthread_join(threads[t], 0);
+    else
+      phase(job, t);
+  }
+  // end tj_sort_run
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+int
+tj_sort_parallel(const tj_sort_ops *ops, void *a, size_t n, int threads)
+{
+  size_t sum, c;
+  uint64_t diff = 0;
+  tj_sort_job job;
+  int t, b;
+
+  if (n == 0)
+    return 1;
+
+  memset(&job, 0, sizeof(job));
+  job.m_ops = ops;
+  job.m_a = a;
+  job.m_n = n;
+  job.m_threads = (threads > TJ_SORT_MAX_THREADS) ? TJ_SORT_MAX_THREADS :
+    threads;
+
+  if (n > SIZE_MAX / ops->m_size ||
+      (job.m_tmp = tj_alloc_malloc(n * ops->m_size, 0)) == 0 ||
+      (job.m_diffs = calloc(job.m_threads, sizeof(uint64_t))) == 0 ||
+      (job.m_counts = calloc(job.m_threads, sizeof(size_t[256]))) == 0) {
+    TJ_ERROR("No memory to sort %zu elements.", n);
+    tj_alloc_free(job.m_tmp);
+    free(job.m_diffs);
+    return 0;
+  }
+
+  //-- Bytes above the highest that differs are common to every key
+  tj_sort_run(&job, &tj_sort_diffPhase);
+  for (t = 0; t < job.m_threads; t++)
+    diff |= job.m_diffs[t];
+  if (diff == 0)
+    goto done;
+  job.m_shift = (63 - __builtin_clzll(diff)) / 8 * 8;
+
+  //-- Each slice scatters to just after the slices before it
+  tj_sort_run(&job, &tj_sort_countPhase);
+  for (b = 0, sum = 0; b < 256; b++) {
+    job.m_runs[b] = sum;
+    for (t = 0; t < job.m_threads; t++) {
+      c = job.m_counts[t][b];
+      job.m_counts[t][b] = sum;
+      sum += c;
+    }
+  }
+  job.m_runs[256] = n;
+
+  tj_sort_run(&job, &tj_sort_scatterPhase);
+  tj_sort_run(&job, &tj_sort_runPhase);
+
+ done:
+  TJ_LOG("Sorted %zu elements in %d threads from bit %d.", n,
+         job.m_threads, job.m_shift + 8);
+  tj_alloc_free(job.m_tmp);
+  free(job.m_diffs);
+  free(job.m_counts);
+  return 1;
+  // end tj_sort_parallel
+}
@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __tj_sort_h__
+#define __tj_sort_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tj_alloc.h"
+#include "tj_error.h"
+
+/*
+ * Radix sorts generated per element type, in the manner of
+ * TJ_HEAP_DECL.  Each pass distributes elements by one byte of their
+ * key rather than comparing them, so sorting takes time linear in the
+ * number of elements and the key's width.
+ *
+ * TJ_SORT_DECL(name, type, keytype, keyfunc) sorts arrays of type by
+ * an unsigned integer key, extracted by keytype keyfunc(const type *),
+ * generating:
+ *
+ *   int name_radix(type *a, size_t n)
+ *     Stable, least significant byte first, using a second array of
+ *     n elements.  Passes over bytes all elements share are skipped.
+ *
+ *   void name_radixInPlace(type *a, size_t n)
+ *     Unstable, most significant byte first, needing no memory.
+ *
+ *   int name_radixThreaded(type *a, size_t n, int threads)
+ *     As name_radix, with the work split across threads.
+ *
+ *   int name_keyIndex(type *a, size_t n, size_t range)
+ *     Stable, in a single pass, for keys all less than a small range.
+ *
+ * TJ_SORT_BYTES_DECL(name, type, bytesfunc, width) sorts arrays of
+ * type by fixed width byte strings, extracted by const unsigned char
+ * *bytesfunc(const type *), in the order of memcmp(), generating
+ * name_radixInPlace.
+ *
+ * Functions returning int return 0 on failure, when memory cannot be
+ * allocated or a key is out of range, leaving the array unchanged, and
+ * 1 otherwise.  Signed and floating point keys are sorted through the
+ * conversions below, which preserve their order.
+ */
+
+// Runs shorter than this are insertion sorted
+#ifndef TJ_SORT_INSERTION
+#define TJ_SORT_INSERTION 32
+#endif
+
+// Arrays shorter than this are not worth sorting in several threads
+#ifndef TJ_SORT_PARALLEL_MIN
+#define TJ_SORT_PARALLEL_MIN 65536
+#endif
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static inline uint32_t
+tj_sort_int32Key(int32_t x)
+{
+  return (uint32_t) x ^ 0x80000000U;
+}
+
+static inline uint64_t
+tj_sort_int64Key(int64_t x)
+{
+  return (uint64_t) x ^ 0x8000000000000000ULL;
+}
+
+/*
+ * Negative floats order backwards as integers, so are inverted; others
+ * just move above them.  NaNs sort to the ends.
+ */
+static inline uint32_t
+tj_sort_floatKey(float x)
+{
+  uint32_t u;
+  memcpy(&u, &x, sizeof(u));
+  return (u & 0x80000000U) ? ~u : u | 0x80000000U;
+}
+
+static inline uint64_t
+tj_sort_doubleKey(double x)
+{
+  uint64_t u;
+  memcpy(&u, &x, sizeof(u));
+  return (u & 0x8000000000000000ULL) ? ~u : u | 0x8000000000000000ULL;
+}
+
+//----------------------------------------------------------------------
+/*
+ * The threaded sort, shared by every type, which calls back into the
+ * generated kernels.  It finds the highest byte in which keys differ,
+ * counts and distributes elements by that byte into a second array in
+ * parallel, and then sorts the 256 runs by their remaining bytes in
+ * parallel, back into the original.
+ */
+typedef struct {
+  size_t m_size;
+  void (*m_diff)(const void *a, size_t from, size_t to, uint64_t *diff);
+  void (*m_count)(const void *a, size_t from, size_t to, int shift,
+                  size_t *count);
+  void (*m_scatter)(const void *a, void *dest, size_t from, size_t to,
+                    int shift, size_t *offsets);
+  void (*m_sortRun)(void *src, void *dest, size_t n, int shift);
+} tj_sort_ops;
+
+int
+tj_sort_parallel(const tj_sort_ops *ops, void *a, size_t n, int threads);
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * The most significant byte first sort, given name##_digit(e, d) for
+ * byte d of a key from the most significant and name##_less(a, b).
+ */
+#define TJ_SORT_MSD_DECL(name, type, digits)                            \
+  static __attribute__((unused)) void                                   \
+  name##_insertion(type *a, size_t n)                                   \
+  {                                                                     \
+    size_t i, j;                                                        \
+    type x;                                                             \
+    for (i = 1; i < n; i++) {                                           \
+      x = a[i];                                                         \
+      for (j = i; j > 0 && name##_less(&x, &a[j-1]); j--)               \
+        a[j] = a[j-1];                                                  \
+      a[j] = x;                                                         \
+    }                                                                   \
+  }                                                                     \
+  static __attribute__((unused)) void                                   \
+  name##_msd(type *a, size_t n, size_t d)                               \
+  {                                                                     \
+    size_t count[256], next[256], end, i;                               \
+    unsigned b, c;                                                      \
+    type x, y;                                                          \
+    for (;;) {                                                          \
+      if (n < TJ_SORT_INSERTION) {                                      \
+        name##_insertion(a, n);                                         \
+        return;                                                         \
+      }                                                                 \
+      memset(count, 0, sizeof(count));                                  \
+      for (i = 0; i < n; i++)                                           \
+        count[name##_digit(&a[i], d)]++;                                \
+      if (count[name##_digit(&a[0], d)] != n)                           \
+        break;                                                          \
+      if (++d == (digits))                                              \
+        return;                                                         \
+    }                                                                   \
+    for (b = 0, end = 0; b < 256; b++) {                                \
+      next[b] = end;                                                    \
+      end += count[b];                                                  \
+    }                                                                   \
+    for (b = 0, end = 0; b < 256; b++) {                                \
+      end += count[b];                                                  \
+      while (next[b] < end) {                                           \
+        x = a[next[b]];                                                 \
+        while ((c = name##_digit(&x, d)) != b) {                        \
+          y = a[next[c]];                                               \
+          a[next[c]++] = x;                                             \
+          x = y;                                                        \
+        }                                                               \
+        a[next[b]++] = x;                                               \
+      }                                                                 \
+    }                                                                   \
+    if (d + 1 == (digits))                                              \
+      return;                                                           \
+    for (b = 0, i = 0; b < 256; i += count[b++]) {                      \
+      if (count[b] > 1)                                                 \
+        name##_msd(a + i, count[b], d + 1);                             \
+    }                                                                   \
+  }                                                                     \
+  static __attribute__((unused)) void                                   \
+  name##_radixInPlace(type *a, size_t n)                                \
+  {                                                                     \
+    name##_msd(a, n, 0);                                                \
+  }
+
+//----------------------------------------------------------------------
+#define TJ_SORT_DECL(name, type, keytype, keyfunc)                      \
+  static inline unsigned                                                \
+  name##_digit(const type *e, size_t d)                                 \
+  {                                                                     \
+    return (keyfunc(e) >> (8 * (sizeof(keytype) - 1 - d))) & 0xff;     \
+  }                                                                     \
+  static inline int                                                     \
+  name##_less(const type *a, const type *b)                             \
+  {                                                                     \
+    return keyfunc(a) < keyfunc(b);                                     \
+  }                                                                     \
+  TJ_SORT_MSD_DECL(name, type, sizeof(keytype))                         \
+  /* Sorts by the key bits below shift, least significant byte first,  \
+     ping-ponging between src and scratch, and returns which holds      \
+     the result. */                                                     \
+  static __attribute__((unused)) type *                                 \
+  name##_lsd(type *src, type *scratch, size_t n, int shift)             \
+  {                                                                     \
+    size_t count[sizeof(keytype)][256], i, sum, c;                      \
+    int d, digits = shift / 8;                                          \
+    keytype key_;                                                       \
+    type *t;                                                            \
+    if (n < TJ_SORT_INSERTION) {                                        \
+      name##_insertion(src, n);                                         \
+      return src;                                                       \
+    }                                                                   \
+    memset(count, 0, sizeof(count));                                    \
+    for (i = 0; i < n; i++) {                                           \
+      key_ = keyfunc(&src[i]);                                          \
+      for (d = 0; d < digits; d++)                                      \
+        count[d][(key_ >> (8 * d)) & 0xff]++;                           \
+    }                                                                   \
+    for (d = 0; d < digits; d++) {                                      \
+      if (count[d][(keyfunc(&src[0]) >> (8 * d)) & 0xff] == n)          \
+        continue;                                                       \
+      for (c = 0, sum = 0; c < 256; c++) {                              \
+        i = count[d][c];                                                \
+        count[d][c] = sum;                                              \
+        sum += i;                                                       \
+      }                                                                 \
+      for (i = 0; i < n; i++)                                           \
+        scratch[count[d][(keyfunc(&src[i]) >> (8 * d)) & 0xff]++] =     \
+          src[i];                                                       \
+      t = src;                                                          \
+      src = scratch;                                                    \
+      scratch = t;                                                      \
+    }                                                                   \
+    return src;                                                         \
+  }                                                                     \
+  static __attribute__((unused)) int                                    \
+  name##_radix(type *a, size_t n)                                       \
+  {                                                                     \
+    type *tmp, *r;                                                      \
+    if (n < TJ_SORT_INSERTION) {                                        \
+      name##_insertion(a, n);                                           \
+      return 1;                                                         \
+    }                                                                   \
+    if (n > SIZE_MAX / sizeof(type) ||                                  \
+        (tmp = tj_alloc_malloc(n * sizeof(type), 0)) == 0) {            \
+      TJ_ERROR("No memory to sort %zu " #type ".", n);                  \
+      return 0;                                                         \
+    }                                                                   \
+    if ((r = name##_lsd(a, tmp, n, 8 * sizeof(keytype))) != a)          \
+      memcpy(a, r, n * sizeof(type));                                   \
+    tj_alloc_free(tmp);                                                 \
+    return 1;                                                           \
+  }                                                                     \
+  static __attribute__((unused)) int                                    \
+  name##_keyIndex(type *a, size_t n, size_t range)                      \
+  {                                                                     \
+    size_t *count, i;                                                   \
+    type *tmp;                                                          \
+    if ((count = calloc(range + 1, sizeof(size_t))) == 0) {             \
+      TJ_ERROR("No memory to sort %zu " #type ".", n);                  \
+      return 0;                                                         \
+    }                                                                   \
+    for (i = 0; i < n; i++) {                                           \
+      if (keyfunc(&a[i]) >= range) {                                    \
+        TJ_ERROR("Key %zu of " #type " not below %zu.", i, range);      \
+        free(count);                                                    \
+        return 0;                                                       \
+      }                                                                 \
+      count[keyfunc(&a[i]) + 1]++;                                      \
+    }                                                                   \
+    if (n > SIZE_MAX / sizeof(type) ||                                  \
+        (tmp = tj_alloc_malloc(n * sizeof(type), 0)) == 0) {            \
+      TJ_ERROR("No memory to sort %zu " #type ".", n);                  \
+      free(count);                                                      \
+      return 0;                                                         \
+    }                                                                   \
+    for (i = 1; i < range; i++)                                         \
+      count[i] += count[i-1];                                           \
+    for (i = 0; i < n; i++)                                             \
+      tmp[count[keyfunc(&a[i])]++] = a[i];                              \
+    if (n > 0)                                                          \
+      memcpy(a, tmp, n * sizeof(type));                                 \
+    tj_alloc_free(tmp);                                                 \
+    free(count);                                                        \
+    return 1;                                                           \
+  }                                                                     \
+  static void                                                           \
+  name##_opDiff(const void *a, size_t from, size_t to, uint64_t *diff)  \
+  {                                                                     \
+    const type *e = a;                                                  \
+    uint64_t first = keyfunc(&e[0]), x = 0;                             \
+    size_t i;                                                           \
+    for (i = from; i < to; i++)                                         \
+      x |= keyfunc(&e[i]) ^ first;                                      \
+    *diff = x;                                                          \
+  }                                                                     \
+  static void                                                           \
+  name##_opCount(const void *a, size_t from, size_t to, int shift,      \
+                 size_t *count)                                         \
+  {                                                                     \
+    const type *e = a;                                                  \
+    size_t i;                                                           \
+    for (i = from; i < to; i++)                                         \
+      count[(keyfunc(&e[i]) >> shift) & 0xff]++;                        \
+  }                                                                     \
+  static void                                                           \
+  name##_opScatter(const void *a, void *dest, size_t from, size_t to,   \
+                   int shift, size_t *offsets)                          \
+  {                                                                     \
+    const type *e = a;                                                  \
+    type *t = dest;                                                     \
+    size_t i;                                                           \
+    for (i = from; i < to; i++)                                         \
+      t[offsets[(keyfunc(&e[i]) >> shift) & 0xff]++] = e[i];            \
+  }                                                                     \
+  static void                                                           \
+  name##_opSortRun(void *src, void *dest, size_t n, int shift)          \
+  {                                                                     \
+    type *r = name##_lsd(src, dest, n, shift);                          \
+    if (r != dest)                                                      \
+      memcpy(dest, r, n * sizeof(type));                                \
+  }                                                                     \
+  static __attribute__((unused)) const tj_sort_ops name##_ops = {      \
+    sizeof(type), &name##_opDiff, &name##_opCount, &name##_opScatter,   \
+    &name##_opSortRun                                                   \
+  };                                                                    \
+  static __attribute__((unused)) int                                    \
+  name##_radixThreaded(type *a, size_t n, int threads)                  \
+  {                                                                     \
+    if (threads <= 1 || n < TJ_SORT_PARALLEL_MIN)                       \
+      return name##_radix(a, n);                                        \
+    return tj_sort_parallel(&name##_ops, a, n, threads);                \
+  }
+
+//----------------------------------------------------------------------
+#define TJ_SORT_BYTES_DECL(name, type, bytesfunc, width)                \
+  static inline unsigned                                                \
+  name##_digit(const type *e, size_t d)                                 \
+  {                                                                     \
+    return bytesfunc(e)[d];                                             \
+  }                                                                     \
+  static inline int                                                     \
+  name##_less(const type *a, const type *b)                             \
+  {                                                                     \
+    return memcmp(bytesfunc(a), bytesfunc(b), (width)) < 0;             \
+  }                                                                     \
+  TJ_SORT_MSD_DECL(name, type, (width))
+
+#endif // __tj_sort_h__
@@ -22,10 +22,23 @@
  * SOFTWARE.
  */
 
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <uthash.h>
+
+#include "tj_array.h"
 #include "tj_template.h"
+#include "tj_trace.h"
 
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
@@ -59,12 +72,15 @@ typedef struct tj_template_variable tj_template_variable;
 struct tj_template_variable {
   char *m_label;
   tj_buffer *m_substitution;
+  tj_array *m_items;
   tj_template_variable *m_next;
-  char m_tracking;
+  tj_template_escape m_escape;
   char m_recurse;
+  char m_shared;
 };
 
 struct tj_template_variables {
+  tj_template_variables *m_parent;
   tj_template_variable *m_variables;
 };
 
@@ -77,6 +93,44 @@ tj_template_variable_finalize(tj_template_variable *x);
 tj_template_variable *
 tj_template_variables_find(tj_template_variables *vars, const char *label);
 
+tj_template_variable *
+tj_template_variables_findN(tj_template_variables *vars,
+                            const char *label, size_t n);
+
+tj_template_variable *
+tj_template_variables_define(tj_template_variables *vars, const char *label);
+
+tj_template_variable *
+tj_template_variables_inherit(tj_template_variables *vars, const char *label);
+
+//----------------------------------
+typedef enum {
+  TJ_TEMPLATE_OP_MARK,         // a: offset of '$', b: end of segment
+  TJ_TEMPLATE_OP_ESCAPE,       // a: offset of "$$"
+  TJ_TEMPLATE_OP_FLUSH,        // a: end of literal text
+  TJ_TEMPLATE_OP_SECTION,      // a: label offset, b: label length, c: end
+  TJ_TEMPLATE_OP_INVERTED,     // a: label offset, b: label length, c: end
+  TJ_TEMPLATE_OP_END,          // a: opening instruction, b: resume offset
+} tj_template_opcode;
+
+typedef struct tj_template_instruction tj_template_instruction;
+struct tj_template_instruction {
+  uint32_t m_op;
+  uint32_t m_a;
+  uint32_t m_b;
+  uint32_t m_c;
+};
+
+struct tj_template {
+  tj_buffer_byte *m_source;
+  size_t m_sourceLen;
+
+  tj_template_instruction *m_code;
+  size_t m_count;
+
+  char m_own;
+};
+
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
 tj_template_variables *
@@ -87,11 +141,23 @@ tj_template_variables_create(void)
     TJ_ERROR("No memory for tj_template_variables.");
     return 0;
   }
+  vars->m_parent = 0;
   vars->m_variables = 0;
   return vars;
   // end tj_template_variables
 }
 
+tj_template_variables *
+tj_template_variables_createChild(tj_template_variables *parent)
+{
+  tj_template_variables *vars;
+  if ((vars = tj_template_variables_create()) == 0)
+    return 0;
+  vars->m_parent = parent;
+  return vars;
+  // end tj_template_variables_createChild
+}
+
 void
 tj_template_variables_finalize(tj_template_variables *vars)
 {
@@ -127,7 +193,10 @@ tj_template_variable_create(const char *label)
     return 0;
   }
 
+  v->m_items = 0;
+  v->m_escape = TJ_TEMPLATE_ESCAPE_NONE;
   v->m_recurse = 0;
+  v->m_shared = 0;
   v->m_next = 0;
 
   return v;
@@ -137,7 +206,16 @@ tj_template_variable_create(const char *label)
 void
 tj_template_variable_finalize(tj_template_variable *x)
 {
-  tj_buffer_finalize(x->m_substitution);
+  size_t i;
+  if (!x->m_shared) {
+    if (x->m_items != 0) {
+      for (i = 0; i < tj_array_count(x->m_items); i++)
+        tj_template_variables_finalize(tj_array_get(x->m_items, i));
+      tj_array_finalize(x->m_items);
+    }
+
+    tj_buffer_finalize(x->m_substitution);
+  }
   free(x->m_label);
   free(x);
   // end tj_template_variable_finalize
@@ -154,33 +232,119 @@ tj_template_variables_find(tj_template_variables *vars, const char *label)
   // end tj_template_variables_find
 }
 
+tj_template_variable *
+tj_template_variables_findN(tj_template_variables *vars,
+                            const char *label, size_t n)
+{
+  tj_template_variable *v = vars->m_variables;
+  while (v != 0 && (strncmp(v->m_label, label, n) || v->m_label[n] != 0)) {
+    v = v->m_next;
+  }
+  return v;
+  // end tj_template_variables_findN
+}
+
+/*
+ * A child's variable may share the substitution and items of the
+ * definition it shadows, copying nothing until it is set.  Both of
+ * the following return a variable owned by vars itself, inheriting
+ * any settings of the definition it shadows.
+ */
+tj_template_variable *
+tj_template_variables_define(tj_template_variables *vars, const char *label)
+{
+  tj_template_variable *p = 0, *v = tj_template_variables_find(vars, label);
+  tj_template_variables *t;
+  tj_buffer *b;
+
+  if (v == 0) {
+    if ((v = tj_template_variable_create(label)) == 0) {
+      return 0;
+    }
+    for (t = vars->m_parent; t != 0 && p == 0; t = t->m_parent)
+      p = tj_template_variables_find(t, label);
+    if (p != 0) {
+      v->m_escape = p->m_escape;
+      v->m_recurse = p->m_recurse;
+    }
+    v->m_next = vars->m_variables;
+    vars->m_variables = v;
+    // end v==0
+  } else if (v->m_shared) {
+    if ((b = tj_buffer_create(0)) == 0) {
+      TJ_ERROR("No memory for tj_buffer.");
+      return 0;
+    }
+    v->m_substitution = b;
+    v->m_items = 0;
+    v->m_shared = 0;
+  } else
+    tj_buffer_reset(v->m_substitution);
+
+  return v;
+  // end tj_template_variables_define
+}
+
+tj_template_variable *
+tj_template_variables_inherit(tj_template_variables *vars, const char *label)
+{
+  tj_template_variable *p = 0, *v = tj_template_variables_find(vars, label);
+  tj_template_variables *t;
+
+  if (v != 0)
+    return v;
+
+  for (t = vars->m_parent; t != 0 && p == 0; t = t->m_parent)
+    p = tj_template_variables_find(t, label);
+  if (p == 0)
+    return 0;
+
+  if ((v = tj_template_variable_create(label)) == 0) {
+    return 0;
+  }
+  tj_buffer_finalize(v->m_substitution);
+  v->m_substitution = p->m_substitution;
+  v->m_items = p->m_items;
+  v->m_escape = p->m_escape;
+  v->m_recurse = p->m_recurse;
+  v->m_shared = 1;
+  v->m_next = vars->m_variables;
+  vars->m_variables = v;
+
+  return v;
+  // end tj_template_variables_inherit
+}
+
 void
 tj_template_variables_setRecurse(tj_template_variables *vars,
                                  const char *label, char recurse)
 {
-  tj_template_variable *v = tj_template_variables_find(vars, label);
+  tj_template_variable *v = tj_template_variables_inherit(vars, label);
   if (v != 0)
     v->m_recurse = recurse;
   // end tj_template_variables_setRecurse
 }
 
+void
+tj_template_variables_setEscape(tj_template_variables *vars,
+                                const char *label, tj_template_escape escape)
+{
+  tj_template_variable *v = tj_template_variables_inherit(vars, label);
+  if (v != 0)
+    v->m_escape = escape;
+  // end tj_template_variables_setEscape
+}
+
 //----------------------------------------------
 int
 tj_template_variables_setFromString(tj_template_variables *vars,
                                     const char *label,
                                     const char *substitution)
 {
-  tj_template_variable *v = tj_template_variables_find(vars, label);
+  tj_template_variable *v = tj_template_variables_define(vars, label);
 
-  if (v == 0) {
-    if ((v = tj_template_variable_create(label)) == 0) {
-      return 0;
-    }
-    v->m_next = vars->m_variables;
-    vars->m_variables = v;
-    // end v==0
-  } else
-    tj_buffer_reset(v->m_substitution);
+  if (v == 0)
+    return 0;
 
   if (!tj_buffer_append(v->m_substitution,
                         (tj_buffer_byte *) substitution,
@@ -197,18 +361,10 @@ int
 tj_template_variables_setFromFileStream(tj_template_variables *vars,
                                         const char *label, FILE *substitution)
 {
-  tj_template_variable *v = tj_template_variables_find(vars, label);
+  tj_template_variable *v = tj_template_variables_define(vars, label);
 
-  if (v == 0) {
-    if ((v = tj_template_variable_create(label)) == 0) {
-      return 0;
-    }
-    v->m_next = vars->m_variables;
-    vars->m_variables = v;
-    // end v==0
-  }
-  else
-    tj_buffer_reset(v->m_substitution);
+  if (v == 0)
+    return 0;
 
   if (!tj_buffer_appendFileStream(v->m_substitution, substitution)) {
     TJ_ERROR("Could not append file stream to template variable.");
@@ -240,110 +396,1371 @@ tj_template_variables_setFromFile(tj_template_variables *vars,
   // end tj_template_variables_setFromFile
 }
 
-//--------------------------------------------------------------
-typedef enum {
-  SCAN,
-  MARK,
-  TRACK
-} tmpl_scan_mode;
+tj_template_variables *
+tj_template_variables_addItem(tj_template_variables *vars, const char *label)
+{
+  tj_template_variables *item;
+  tj_template_variable *v = tj_template_variables_find(vars, label);
+
+  if ((v == 0 || v->m_shared) &&
+      (v = tj_template_variables_define(vars, label)) == 0)
+    return 0;
+
+  if (v->m_items == 0 && (v->m_items = tj_array_create(0)) == 0) {
+    TJ_ERROR("No memory for template variable items.");
+    return 0;
+  }
+
+  if ((item = tj_template_variables_create()) == 0) {
+    return 0;
+  }
+
+  if (!tj_array_append(v->m_items, item)) {
+    TJ_ERROR("Could not append template variable item.");
+    tj_template_variables_finalize(item);
+    return 0;
+  }
+
+  return item;
+  // end tj_template_variables_addItem
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * Escaping scans for the next byte needing replacement, 16 bytes at
+ * a time where SSE2 is available, and copies the runs between them
+ * directly into the destination.  The destination is sized exactly,
+ * by a counting scan, before anything is written.
+ */
+static const unsigned char k_tj_template_escape_special[][256] =
+  {
+    [TJ_TEMPLATE_ESCAPE_HTML] = {
+      ['&'] = 1, ['<'] = 1, ['>'] = 1, ['"'] = 1, ['\''] = 1,
+    },
+    [TJ_TEMPLATE_ESCAPE_JSON] = {
+      [0 ... 0x1f] = 1, ['"'] = 1, ['\\'] = 1,
+    },
+    [TJ_TEMPLATE_ESCAPE_SHELL] = {
+      ['\''] = 1,
+    },
+  };
+
+static size_t
+tj_template_escape_scan(tj_template_escape escape,
+                        const tj_buffer_byte *in, size_t n)
+{
+  const unsigned char *special = k_tj_template_escape_special[escape];
+  size_t i = 0;
+
+#ifdef __SSE2__
+  const __m128i amp = _mm_set1_epi8('&'), lt = _mm_set1_epi8('<');
+  const __m128i gt = _mm_set1_epi8('>'), quot = _mm_set1_epi8('"');
+  const __m128i apos = _mm_set1_epi8('\''), bslash = _mm_set1_epi8('\\');
+  const __m128i ctrl = _mm_set1_epi8(0x1f);
+  __m128i v, m;
+  int bits;
+
+  for (; i+16 <= n; i += 16) {
+    v = _mm_loadu_si128((const __m128i *) &in[i]);
+    switch (escape) {
+    case TJ_TEMPLATE_ESCAPE_HTML:
+      m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, amp),
+                                    _mm_cmpeq_epi8(v, lt)),
+                       _mm_or_si128(_mm_cmpeq_epi8(v, gt),
+                                    _mm_or_si128(_mm_cmpeq_epi8(v, quot),
+                                                 _mm_cmpeq_epi8(v, apos))));
+      break;
+    case TJ_TEMPLATE_ESCAPE_JSON:
+      m = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl),
+                       _mm_or_si128(_mm_cmpeq_epi8(v, quot),
+                                    _mm_cmpeq_epi8(v, bslash)));
+      break;
+    case TJ_TEMPLATE_ESCAPE_SHELL:
+      m = _mm_cmpeq_epi8(v, apos);
+      break;
+    default:
+      return n;
+    }
+
+    if ((bits = _mm_movemask_epi8(m)) != 0)
+      return i + __builtin_ctz(bits);
+  }
+#endif
+
+  for (; i < n; i++) {
+    if (special[in[i]])
+      return i;
+  }
+
+  return n;
+  // end tj_template_escape_scan
+}
+
+/*
+ * Writes the replacement for one special byte, returning its length.
+ * If out is 0 only the length is returned.
+ */
+static size_t
+tj_template_escape_byte(tj_template_escape escape, tj_buffer_byte c,
+                        tj_buffer_byte *out)
+{
+  static const char hex[] = "0123456789abcdef";
+  const char *rep = 0;
+  char u[7];
+
+  switch (escape) {
+  case TJ_TEMPLATE_ESCAPE_HTML:
+    switch (c) {
+    case '&': rep = "&amp;"; break;
+    case '<': rep = "&lt;"; break;
+    case '>': rep = "&gt;"; break;
+    case '"': rep = "&quot;"; break;
+    default: rep = "&#39;"; break;
+    }
+    break;
+
+  case TJ_TEMPLATE_ESCAPE_JSON:
+    switch (c) {
+    case '"': rep = "\\\""; break;
+    case '\\': rep = "\\\\"; break;
+    case '\b': rep = "\\b"; break;
+    case '\f': rep = "\\f"; break;
+    case '\n': rep = "\\n"; break;
+    case '\r': rep = "\\r"; break;
+    case '\t': rep = "\\t"; break;
+    default:
+      memcpy(u, "\\u00", 4);
+      u[4] = hex[c >> 4];
+      u[5] = hex[c & 0xf];
+      u[6] = 0;
+      rep = u;
+      break;
+    }
+    break;
+
+  default:
+    rep = "'\\''";
+    break;
+  }
+
+  if (out != 0)
+    memcpy(out, rep, strlen(rep));
+  return strlen(rep);
+  // end tj_template_escape_byte
+}
+
+static size_t
+tj_template_escape_length(tj_template_escape escape,
+                          const tj_buffer_byte *in, size_t n)
+{
+  size_t i = 0, j, len;
+
+  if (escape == TJ_TEMPLATE_ESCAPE_NONE)
+    return n;
+
+  len = (escape == TJ_TEMPLATE_ESCAPE_SHELL) ? n+2 : n;
+  while ((j = i + tj_template_escape_scan(escape, &in[i], n-i)) < n) {
+    len += tj_template_escape_byte(escape, in[j], 0) - 1;
+    i = j+1;
+  }
+
+  return len;
+  // end tj_template_escape_length
+}
+
+static size_t
+tj_template_escape_write(tj_template_escape escape, tj_buffer_byte *out,
+                         const tj_buffer_byte *in, size_t n)
+{
+  tj_buffer_byte *o = out;
+  size_t i = 0, j;
+
+  if (escape == TJ_TEMPLATE_ESCAPE_SHELL)
+    *o++ = '\'';
+
+  while (1) {
+    j = i + tj_template_escape_scan(escape, &in[i], n-i);
+    memcpy(o, &in[i], j-i);
+    o += j-i;
+    if (j == n)
+      break;
+    o += tj_template_escape_byte(escape, in[j], o);
+    i = j+1;
+  }
+
+  if (escape == TJ_TEMPLATE_ESCAPE_SHELL)
+    *o++ = '\'';
+
+  return o-out;
+  // end tj_template_escape_write
+}
 
 int
-tj_template_variables_apply(tj_template_variables *variables,
-                            tj_buffer *dest,
-                            tj_buffer *src)
+tj_template_appendEscaped(tj_buffer *dest, tj_template_escape escape,
+                          const tj_buffer_byte *data, size_t n)
 {
-  int tmplIndex = 0;
-  int start = 0, end = 0;
-  tmpl_scan_mode mode = SCAN;
-  int varScanLen = 0;
+  size_t len;
 
-  tj_buffer_byte *template = tj_buffer_getBytes(src);
-  tj_template_variable *v;
+  if (escape == TJ_TEMPLATE_ESCAPE_NONE)
+    return tj_buffer_append(dest, data, n);
 
-  while (tmplIndex < tj_buffer_getUsed(src)) {
-    if (template[tmplIndex] == '$') {
-      if (mode == SCAN) {
-	mode = MARK;
-      } else if (mode == MARK) {
-        if (!tj_buffer_append(dest, &template[start], tmplIndex-start)) {
-          TJ_ERROR("Could not append text before mark.");
-          goto error;
-        }
-	mode = SCAN;
-	start = tmplIndex+1;
-	// end mode == MARK
-      }
-    } else {
-      if (mode == MARK) {
-        for (v = variables->m_variables; v != 0; v = v->m_next) {
-          v->m_tracking = 1;
+  len = tj_template_escape_length(escape, data, n);
+  if (!tj_buffer_reserve(dest, len)) {
+    TJ_ERROR("Could not reserve %zu bytes for escaped text.", len);
+    return 0;
+  }
+
+  tj_buffer_commit(dest,
+                   tj_template_escape_write(escape,
+                                            tj_buffer_getBytesAtIndex(dest, tj_buffer_getUsed(dest)),
+                                            data, n));
+  return 1;
+  // end tj_template_appendEscaped
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * Matching a $label against the text following the '$' is done as it
+ * always has been: '$' characters are skipped over, the shortest
+ * label which is followed by at least one more character wins, and a
+ * failed match leaves the text it tracked over inert.  Only the
+ * innermost scope with a match is used, a child's own variables
+ * being searched before its parent's.  Nothing here modifies the
+ * variables, so many threads may expand the same container.
+ *
+ * If term is set, the end of text also terminates a label.  On
+ * return, consumed is the number of bytes of text used by the match,
+ * or the number which should be emitted verbatim if there was none.
+ */
+static int
+tj_template_variable_prefix(const tj_template_variable *v,
+                            const tj_buffer_byte *text, size_t n, int term,
+                            size_t *at)
+{
+  const char *l = v->m_label;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    if (text[i] == '$')
+      continue;
+    if (*l == 0) {
+      *at = i;
+      return 1;
+    }
+    if (*l != (char) text[i]) {
+      *at = i+1;
+      return 0;
+    }
+    l++;
+  }
+
+  *at = n;
+  return (term && *l == 0);
+  // end tj_template_variable_prefix
+}
+
+static tj_template_variable *
+tj_template_match(tj_template_variables **scopes, size_t depth,
+                  const tj_buffer_byte *text, size_t n, int term,
+                  size_t *consumed)
+{
+  tj_template_variables *t;
+  tj_template_variable *v, *best;
+  size_t at, bestAt, skip = (n > 0) ? 1 : 0;
+
+  while (depth-- > 0) {
+    for (t = scopes[depth]; t != 0; t = t->m_parent) {
+      best = 0;
+      bestAt = 0;
+      for (v = t->m_variables; v != 0; v = v->m_next) {
+        if (tj_template_variable_prefix(v, text, n, term, &at)) {
+          if (best == 0 || at < bestAt) {
+            best = v;
+            bestAt = at;
+          }
+        } else if (at > skip) {
+          skip = at;
         }
-	varScanLen = 0;
-	end = tmplIndex-1; // Cannot happen before tmplIndex==1, so safe
-	mode = TRACK;
       }
 
-      if (mode == TRACK) {
-	char alive = 0;
-
-        for (v = variables->m_variables; v != 0; v = v->m_next) {
-	  if (v->m_tracking) {
-
-	    if (v->m_label[varScanLen] == 0) {
-	      alive = 0;
-
-              if (!tj_buffer_append(dest, &template[start], end-start)) {
-                TJ_ERROR("Could not append pre-substitution text.");
-                goto error;
-              }
-
-              if (v->m_recurse) {
-                if (!tj_template_variables_apply(variables,
-                                                 dest,
-                                                 v->m_substitution)) {
-                  TJ_ERROR("Could not recurse substitution.");
-                  goto error;
-                }
-              } else {
-                if (!tj_buffer_appendBuffer(dest, v->m_substitution)) {
-                  TJ_ERROR("Could not append substitution.");
-                  goto error;
-                }
-              }
-	      start = tmplIndex;
-
-	      break;
-	    } else if (v->m_label[varScanLen] != template[tmplIndex]) {
-	      v->m_tracking = 0;
-	    } else {
-              alive = 1;
-            }
-	  }
-
-	  // end looping vars
-	}
-
-	if (alive) {
-	  varScanLen++;
-	} else {
-	  mode = SCAN;
-	}
-	// end track
+      if (best != 0) {
+        *consumed = bestAt;
+        return best;
       }
     }
+  }
+
+  *consumed = skip;
+  return 0;
+  // end tj_template_match
+}
+
+static tj_template_variable *
+tj_template_lookup(tj_template_variables **scopes, size_t depth,
+                   const char *label, size_t n)
+{
+  tj_template_variables *t;
+  tj_template_variable *v;
+  while (depth-- > 0) {
+    for (t = scopes[depth]; t != 0; t = t->m_parent) {
+      if ((v = tj_template_variables_findN(t, label, n)) != 0)
+        return v;
+    }
+  }
+  return 0;
+  // end tj_template_lookup
+}
+
+/*
+ * A run of bytes the expansion writes, either from the source or from
+ * a substitution, and the escaping it is written with.
+ */
+typedef struct {
+  const tj_buffer_byte *m_data;
+  size_t m_n;
+  tj_template_escape m_escape;
+} tj_template_span;
+
+#define TJ_TEMPLATE_SPANS_SMALL 32
+
+/*
+ * Expansion writes through an output which either only counts, if
+ * m_out is 0, or writes into m_n bytes at m_out.  Running the same
+ * expansion once each way gives the exact size, so the destination
+ * can be allocated once and then filled without reallocating.
+ *
+ * If m_spans is set while counting, each run written is also recorded
+ * there, so the writing pass can copy the runs without matching again.
+ */
+typedef struct {
+  tj_buffer_byte *m_out;
+  size_t m_used;
+  size_t m_n;
+  tj_template_span *m_spans;
+  size_t m_count;
+  size_t m_capacity;
+} tj_template_output;
+
+static int
+tj_template_output_record(tj_template_output *out, tj_template_escape escape,
+                          const tj_buffer_byte *data, size_t n)
+{
+  tj_template_span *ot = out->m_spans;
+
+  //-- Spans start in TJ_TEMPLATE_SPANS_SMALL on the caller's stack
+  if (out->m_count == out->m_capacity) {
+    out->m_capacity *= 2;
+    if (out->m_count == TJ_TEMPLATE_SPANS_SMALL) {
+      if ((out->m_spans = malloc(sizeof(tj_template_span) *
+                                 out->m_capacity)) != 0)
+        memcpy(out->m_spans, ot, sizeof(tj_template_span) * out->m_count);
+    } else if ((out->m_spans = realloc(ot, sizeof(tj_template_span) *
+                                       out->m_capacity)) == 0) {
+      free(ot);
+    }
+    if (out->m_spans == 0) {
+      TJ_ERROR("Could not grow expansion spans to %zu.", out->m_capacity);
+      return 0;
+    }
+  }
+
+  out->m_spans[out->m_count].m_data = data;
+  out->m_spans[out->m_count].m_n = n;
+  out->m_spans[out->m_count].m_escape = escape;
+  out->m_count++;
+  return 1;
+  // end tj_template_output_record
+}
+
+static int
+tj_template_output_write(tj_template_output *out, tj_template_escape escape,
+                         const tj_buffer_byte *data, size_t n)
+{
+  size_t len;
 
-    tmplIndex++;
-    // end looping over template
+  if (out->m_out == 0) {
+    if (out->m_spans != 0 && n > 0 &&
+        !tj_template_output_record(out, escape, data, n))
+      return 0;
+    out->m_used += tj_template_escape_length(escape, data, n);
+    return 1;
   }
 
-  if (!tj_buffer_append(dest, &template[start], tmplIndex-start)) {
-    TJ_ERROR("Could not append final chunk.");
-    goto error;
+  if (escape == TJ_TEMPLATE_ESCAPE_NONE) {
+    if (n > out->m_n - out->m_used) {
+      TJ_ERROR("Expansion exceeds %zu bytes of output.", out->m_n);
+      return 0;
+    }
+    memcpy(&out->m_out[out->m_used], data, n);
+    out->m_used += n;
+    return 1;
   }
 
+  // Every escape is at most 6 bytes, so only count if it might not fit
+  if (n*6+2 > out->m_n - out->m_used &&
+      (len = tj_template_escape_length(escape, data, n)) >
+      out->m_n - out->m_used) {
+    TJ_ERROR("Expansion exceeds %zu bytes of output.", out->m_n);
+    return 0;
+  }
+
+  out->m_used += tj_template_escape_write(escape, &out->m_out[out->m_used],
+                                          data, n);
   return 1;
+  // end tj_template_output_write
+}
 
- error:
-  return 0;
+static int
+tj_template_expand(tj_template_variables **scopes, size_t depth,
+                   tj_template_output *out, tj_template_escape escape,
+                   const tj_buffer_byte *text, size_t n);
+
+static int
+tj_template_substitute(tj_template_variables **scopes, size_t depth,
+                       tj_template_output *out, tj_template_escape escape,
+                       tj_template_variable *v)
+{
+  if (v->m_escape != TJ_TEMPLATE_ESCAPE_NONE)
+    escape = v->m_escape;
+
+  if (v->m_recurse)
+    return tj_template_expand(scopes, depth, out, escape,
+                              tj_buffer_getBytes(v->m_substitution),
+                              tj_buffer_getUsed(v->m_substitution));
+
+  return tj_template_output_write(out, escape,
+                                  tj_buffer_getBytes(v->m_substitution),
+                                  tj_buffer_getUsed(v->m_substitution));
+  // end tj_template_substitute
+}
+
+static int
+tj_template_expand(tj_template_variables **scopes, size_t depth,
+                   tj_template_output *out, tj_template_escape escape,
+                   const tj_buffer_byte *text, size_t n)
+{
+  size_t start = 0, i = 0, consumed;
+  const tj_buffer_byte *mark;
+  tj_template_variable *v;
+
+  while (i < n &&
+         (mark = memchr(&text[i], '$', n-i)) != 0) {
+    i = mark - text;
+
+    if (i+1 < n && text[i+1] == '$') {
+      if (!tj_template_output_write(out, escape, &text[start], i+1-start))
+        return 0;
+      start = i = i+2;
+      continue;
+    }
+
+    v = tj_template_match(scopes, depth, &text[i+1], n-i-1, 0, &consumed);
+    if (v != 0) {
+      if (!tj_template_output_write(out, escape, &text[start], i-start) ||
+          !tj_template_substitute(scopes, depth, out, escape, v))
+        return 0;
+      start = i+1+consumed;
+    }
+    i += 1+consumed;
+    // end looping over marks
+  }
+
+  return tj_template_output_write(out, escape, &text[start], n-start);
   // end tj_template_expand
 }
+
+int
+tj_template_variables_measure(tj_template_variables *variables,
+                              tj_buffer *src, size_t *n)
+{
+  tj_template_output out = { 0, 0, 0 };
+
+  if (!tj_template_expand(&variables, 1, &out, TJ_TEMPLATE_ESCAPE_NONE,
+                          tj_buffer_getBytes(src), tj_buffer_getUsed(src)))
+    return 0;
+
+  *n = out.m_used;
+  return 1;
+  // end tj_template_variables_measure
+}
+
+int
+tj_template_variables_apply(tj_template_variables *variables,
+                            tj_buffer *dest,
+                            tj_buffer *src)
+{
+  TJ_TRACE_SCOPE("tj_template_variables_apply");
+  tj_template_span small[TJ_TEMPLATE_SPANS_SMALL];
+  tj_template_output out = { 0, 0, 0, small, 0, TJ_TEMPLATE_SPANS_SMALL };
+  size_t i;
+  int r = 0;
+
+  //-- Matched once, recording the runs which the write pass copies
+  if (!tj_template_expand(&variables, 1, &out, TJ_TEMPLATE_ESCAPE_NONE,
+                          tj_buffer_getBytes(src), tj_buffer_getUsed(src)))
+    goto done;
+
+  if (!tj_buffer_reserve(dest, out.m_used)) {
+    TJ_ERROR("Could not reserve %zu bytes for expansion.", out.m_used);
+    goto done;
+  }
+
+  out.m_out = tj_buffer_getBytesAtIndex(dest, tj_buffer_getUsed(dest));
+  out.m_n = out.m_used;
+  out.m_used = 0;
+  for (i = 0; i < out.m_count; i++) {
+    if (!tj_template_output_write(&out, out.m_spans[i].m_escape,
+                                  out.m_spans[i].m_data, out.m_spans[i].m_n))
+      goto done;
+  }
+
+  tj_buffer_commit(dest, out.m_used);
+  r = 1;
+
+ done:
+  if (out.m_spans != small)
+    free(out.m_spans);
+  return r;
+  // end tj_template_variables_apply
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static int
+tj_template_emit(tj_template *x, size_t *n,
+                 uint32_t op, size_t a, size_t b, size_t c)
+{
+  tj_template_instruction *ot;
+  if (x->m_count == *n) {
+    *n = (*n) ? (*n)*2 : 16;
+    if ((x->m_code = realloc(ot=x->m_code,
+                             sizeof(tj_template_instruction) * (*n))) == 0) {
+      TJ_ERROR("Could not grow template code to %zu.", *n);
+      x->m_code = ot;
+      return 0;
+    }
+  }
+
+  x->m_code[x->m_count].m_op = op;
+  x->m_code[x->m_count].m_a = a;
+  x->m_code[x->m_count].m_b = b;
+  x->m_code[x->m_count].m_c = c;
+  x->m_count++;
+  return 1;
+  // end tj_template_emit
+}
+
+/*
+ * A directive is '$', one of '#', '^' or '/', a label of at least one
+ * character which is neither '$' nor whitespace, and a closing '$'.
+ * Returns the label length, or 0 if there is no directive at i.
+ */
+static size_t
+tj_template_directive(const tj_buffer_byte *src, size_t n, size_t i)
+{
+  size_t j;
+
+  if (i+2 >= n || (src[i+1] != '#' && src[i+1] != '^' && src[i+1] != '/'))
+    return 0;
+
+  for (j = i+2; j < n && src[j] != '$'; j++) {
+    if (src[j] == ' ' || src[j] == '\t' || src[j] == '\n' || src[j] == '\r')
+      return 0;
+  }
+
+  return (j < n) ? j-(i+2) : 0;
+  // end tj_template_directive
+}
+
+tj_template *
+tj_template_compile(tj_buffer *src)
+{
+  tj_template *x;
+  const tj_buffer_byte *text = tj_buffer_getBytes(src);
+  size_t n = tj_buffer_getUsed(src);
+  size_t allocated = 0, i = 0, segment = 0, len, k;
+  size_t open[TJ_TEMPLATE_MAXDEPTH];
+  size_t depth = 0;
+  const tj_buffer_byte *mark;
+
+  if (n > UINT32_MAX) {
+    TJ_ERROR("Template of %zu bytes is too large to compile.", n);
+    return 0;
+  }
+
+  if ((x = malloc(sizeof(tj_template))) == 0) {
+    TJ_ERROR("No memory for tj_template.");
+    return 0;
+  }
+
+  x->m_code = 0;
+  x->m_count = 0;
+  x->m_own = 1;
+  x->m_sourceLen = n;
+  if ((x->m_source = malloc(n ? n : 1)) == 0) {
+    TJ_ERROR("No memory for template source [%zu bytes].", n);
+    goto error;
+  }
+  if (n)
+    memcpy(x->m_source, text, n);
+
+  while (i < n &&
+         (mark = memchr(&text[i], '$', n-i)) != 0) {
+    i = mark - text;
+
+    if (i+1 < n && text[i+1] == '$') {
+      if (!tj_template_emit(x, &allocated, TJ_TEMPLATE_OP_ESCAPE, i, 0, 0))
+        goto error;
+      i += 2;
+      continue;
+    }
+
+    if ((len = tj_template_directive(text, n, i)) == 0) {
+      // Segment end is patched once the next directive is found
+      if (!tj_template_emit(x, &allocated, TJ_TEMPLATE_OP_MARK, i, n, 0))
+        goto error;
+      i++;
+      continue;
+    }
+
+    //-- Close off the current segment of text and substitutions
+    for (k = segment; k < x->m_count; k++) {
+      if (x->m_code[k].m_op == TJ_TEMPLATE_OP_MARK)
+        x->m_code[k].m_b = i;
+    }
+    if (!tj_template_emit(x, &allocated, TJ_TEMPLATE_OP_FLUSH, i, 0, 0))
+      goto error;
+
+    if (text[i+1] == '/') {
+      if (depth == 0 ||
+          x->m_code[open[depth-1]].m_b != len ||
+          memcmp(&text[x->m_code[open[depth-1]].m_a], &text[i+2], len)) {
+        TJ_ERROR("Unbalanced block end $/%.*s$ at %zu.",
+                 (int) len, &text[i+2], i);
+        goto error;
+      }
+      depth--;
+      x->m_code[open[depth]].m_c = x->m_count;
+      if (!tj_template_emit(x, &allocated, TJ_TEMPLATE_OP_END,
+                            open[depth], i+len+3, 0))
+        goto error;
+    } else {
+      if (depth == TJ_TEMPLATE_MAXDEPTH) {
+        TJ_ERROR("Blocks nested deeper than %d at %zu.",
+                 TJ_TEMPLATE_MAXDEPTH, i);
+        goto error;
+      }
+      open[depth++] = x->m_count;
+      if (!tj_template_emit(x, &allocated,
+                            (text[i+1] == '#') ?
+                            TJ_TEMPLATE_OP_SECTION : TJ_TEMPLATE_OP_INVERTED,
+                            i+2, len, 0))
+        goto error;
+    }
+
+    i += len+3;
+    segment = x->m_count;
+    // end looping over marks
+  }
+
+  if (depth != 0) {
+    TJ_ERROR("Block $%c%.*s$ is not closed.",
+             text[x->m_code[open[depth-1]].m_a-1],
+             (int) x->m_code[open[depth-1]].m_b,
+             &text[x->m_code[open[depth-1]].m_a]);
+    goto error;
+  }
+
+  if (!tj_template_emit(x, &allocated, TJ_TEMPLATE_OP_FLUSH, n, 0, 0))
+    goto error;
+
+  TJ_LOG("Compiled %zu byte template to %zu instructions.", n, x->m_count);
+  return x;
+
+ error:
+  tj_template_finalize(x);
+  return 0;
+  // end tj_template_compile
+}
+
+void
+tj_template_finalize(tj_template *tmpl)
+{
+  if (!tmpl->m_own)
+    return;
+
+  free(tmpl->m_code);
+  free(tmpl->m_source);
+  free(tmpl);
+  // end tj_template_finalize
+}
+
+//--------------------------------------------------------------
+typedef struct {
+  tj_array *m_items;
+  size_t m_item;
+} tj_template_frame;
+
+static int
+tj_template_variable_truthy(tj_template_variable *v)
+{
+  if (v == 0)
+    return 0;
+  if (v->m_items != 0)
+    return tj_array_count(v->m_items) > 0;
+  return tj_buffer_getUsed(v->m_substitution) > 0;
+  // end tj_template_variable_truthy
+}
+
+static int
+tj_template_run(tj_template *tmpl, tj_template_variables *vars,
+                tj_template_output *out)
+{
+  tj_template_variables *scopes[TJ_TEMPLATE_MAXDEPTH+1];
+  tj_template_frame frames[TJ_TEMPLATE_MAXDEPTH];
+  size_t depth = 1, nframes = 0;
+  size_t ip, start = 0, inert = 0, consumed;
+  const tj_buffer_byte *src = tmpl->m_source;
+  const tj_template_instruction *ins;
+  tj_template_variable *v;
+  tj_template_frame *f;
+
+  scopes[0] = vars;
+
+  for (ip = 0; ip < tmpl->m_count; ip++) {
+    ins = &tmpl->m_code[ip];
+    switch (ins->m_op) {
+    case TJ_TEMPLATE_OP_MARK:
+      if (ins->m_a < inert)
+        break;
+      v = tj_template_match(scopes, depth, &src[ins->m_a+1],
+                            ins->m_b-ins->m_a-1,
+                            ins->m_b != tmpl->m_sourceLen, &consumed);
+      if (v != 0) {
+        if (!tj_template_output_write(out, TJ_TEMPLATE_ESCAPE_NONE,
+                                      &src[start], ins->m_a-start) ||
+            !tj_template_substitute(scopes, depth, out,
+                                    TJ_TEMPLATE_ESCAPE_NONE, v))
+          return 0;
+        start = ins->m_a+1+consumed;
+      }
+      inert = ins->m_a+1+consumed;
+      break;
+
+    case TJ_TEMPLATE_OP_ESCAPE:
+      if (ins->m_a < inert)
+        break;
+      if (!tj_template_output_write(out, TJ_TEMPLATE_ESCAPE_NONE,
+                                    &src[start], ins->m_a+1-start))
+        return 0;
+      start = inert = ins->m_a+2;
+      break;
+
+    case TJ_TEMPLATE_OP_FLUSH:
+      if (!tj_template_output_write(out, TJ_TEMPLATE_ESCAPE_NONE,
+                                    &src[start], ins->m_a-start))
+        return 0;
+      start = inert = ins->m_a;
+      break;
+
+    case TJ_TEMPLATE_OP_SECTION:
+    case TJ_TEMPLATE_OP_INVERTED:
+      v = tj_template_lookup(scopes, depth,
+                             (const char *) &src[ins->m_a], ins->m_b);
+      if (tj_template_variable_truthy(v) ==
+          (ins->m_op == TJ_TEMPLATE_OP_SECTION)) {
+        f = &frames[nframes++];
+        f->m_items = (ins->m_op == TJ_TEMPLATE_OP_SECTION) ? v->m_items : 0;
+        f->m_item = 0;
+        if (f->m_items != 0)
+          scopes[depth++] = tj_array_get(f->m_items, 0);
+        start = inert = ins->m_a+ins->m_b+1;
+      } else {
+        ip = ins->m_c;
+        start = inert = tmpl->m_code[ip].m_b;
+      }
+      break;
+
+    case TJ_TEMPLATE_OP_END:
+      f = &frames[nframes-1];
+      if (f->m_items != 0 && ++f->m_item < tj_array_count(f->m_items)) {
+        scopes[depth-1] = tj_array_get(f->m_items, f->m_item);
+        ip = ins->m_a;
+        start = inert = tmpl->m_code[ip].m_a+tmpl->m_code[ip].m_b+1;
+        break;
+      }
+      if (f->m_items != 0)
+        depth--;
+      nframes--;
+      start = inert = ins->m_b;
+      break;
+    }
+    // end looping over instructions
+  }
+
+  return 1;
+  // end tj_template_run
+}
+
+int
+tj_template_measure(tj_template *tmpl, tj_template_variables *vars,
+                    size_t *n)
+{
+  tj_template_output out = { 0, 0, 0 };
+
+  if (!tj_template_run(tmpl, vars, &out))
+    return 0;
+
+  *n = out.m_used;
+  return 1;
+  // end tj_template_measure
+}
+
+int
+tj_template_render(tj_template *tmpl, tj_template_variables *vars,
+                   tj_buffer_byte *dest, size_t n, size_t *used)
+{
+  tj_template_output out = { dest, 0, n };
+
+  if (!tj_template_run(tmpl, vars, &out))
+    return 0;
+
+  *used = out.m_used;
+  return 1;
+  // end tj_template_render
+}
+
+int
+tj_template_apply(tj_template *tmpl,
+                  tj_template_variables *vars,
+                  tj_buffer *dest)
+{
+  TJ_TRACE_SCOPE("tj_template_apply");
+  size_t n, used;
+
+  if (!tj_template_measure(tmpl, vars, &n))
+    return 0;
+
+  if (!tj_buffer_reserve(dest, n)) {
+    TJ_ERROR("Could not reserve %zu bytes for expansion.", n);
+    return 0;
+  }
+
+  if (!tj_template_render(tmpl, vars,
+                          tj_buffer_getBytesAtIndex(dest, tj_buffer_getUsed(dest)),
+                          n, &used))
+    return 0;
+
+  tj_buffer_commit(dest, used);
+  return 1;
+  // end tj_template_apply
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+/*
+ * A snapshot is laid out as follows, in native byte order, with all
+ * offsets relative to the start of the snapshot and every section
+ * aligned to 8 bytes:
+ *
+ *   tj_template_snapshot_header
+ *   tj_template_snapshot_template[m_templateCount]
+ *   tj_template_snapshot_variable[m_variableCount]
+ *   Per template: instructions, then source bytes
+ *   Per variable: substitution bytes
+ *   String table: null terminated names and labels, each stored once
+ *
+ * Strings are referred to by their offset within the string table.
+ * Nothing needs to be decoded to use a snapshot; compiled templates
+ * run directly over its instructions and source.
+ */
+#define TJ_TEMPLATE_SNAPSHOT_MAGIC "tjtmplsn"
+#define TJ_TEMPLATE_SNAPSHOT_VERSION 1
+#define TJ_TEMPLATE_SNAPSHOT_BYTEORDER 0x01020304
+
+typedef struct {
+  char m_magic[8];
+  uint32_t m_version;
+  uint32_t m_byteOrder;
+  uint32_t m_templateCount;
+  uint32_t m_variableCount;
+  uint64_t m_templates;
+  uint64_t m_variables;
+  uint64_t m_strings;
+  uint64_t m_stringsLen;
+  uint64_t m_size;
+} tj_template_snapshot_header;
+
+typedef struct {
+  uint32_t m_name;
+  uint32_t m_codeCount;
+  uint64_t m_code;
+  uint64_t m_source;
+  uint64_t m_sourceLen;
+} tj_template_snapshot_template;
+
+typedef struct {
+  uint32_t m_label;
+  uint32_t m_escape;
+  uint32_t m_recurse;
+  uint32_t m_reserved;
+  uint64_t m_value;
+  uint64_t m_valueLen;
+} tj_template_snapshot_variable;
+
+struct tj_template_snapshot {
+  const tj_buffer_byte *m_bytes;
+  size_t m_size;
+  int m_mapped;
+
+  const tj_template_snapshot_header *m_header;
+  const char *m_strings;
+  tj_template *m_templates;
+};
+
+typedef struct tj_template_snapshot_string tj_template_snapshot_string;
+struct tj_template_snapshot_string {
+  const char *m_key;
+  uint32_t m_offset;
+  UT_hash_handle hh;
+};
+
+//--------------------------------------------------------------
+static int
+tj_template_snapshot_pad(tj_buffer *b, size_t base)
+{
+  static const tj_buffer_byte zero[8] = { 0 };
+  size_t n = (tj_buffer_getUsed(b) - base) % 8;
+  return (n == 0) || tj_buffer_append(b, zero, 8-n);
+  // end tj_template_snapshot_pad
+}
+
+static int
+tj_template_snapshot_intern(tj_template_snapshot_string **table,
+                            tj_buffer *strings, const char *str,
+                            uint32_t *offset)
+{
+  tj_template_snapshot_string *e;
+
+  HASH_FIND_STR(*table, str, e);
+  if (e == 0) {
+    if ((e = malloc(sizeof(tj_template_snapshot_string))) == 0) {
+      TJ_ERROR("No memory for snapshot string.");
+      return 0;
+    }
+    e->m_key = str;
+    e->m_offset = tj_buffer_getUsed(strings);
+    if (!tj_buffer_append(strings, (const tj_buffer_byte *) str,
+                          strlen(str)+1)) {
+      free(e);
+      return 0;
+    }
+    HASH_ADD_KEYPTR(hh, *table, e->m_key, strlen(e->m_key), e);
+  }
+
+  *offset = e->m_offset;
+  return 1;
+  // end tj_template_snapshot_intern
+}
+
+int
+tj_template_snapshot_write(tj_buffer *dest,
+                           const char **names, tj_template **templates,
+                           size_t n, tj_template_variables *vars)
+{
+  tj_template_snapshot_header header;
+  tj_template_snapshot_template *trecs = 0;
+  tj_template_snapshot_variable *vrecs = 0;
+  tj_template_snapshot_string *table = 0, *e, *et;
+  tj_buffer *strings = 0;
+  tj_template_variables *t;
+  tj_template_variable *v, **flat = 0;
+  size_t base = tj_buffer_getUsed(dest), nvars = 0, i, k;
+  int res = 0;
+
+  //-- Collect the variables visible through vars, nearest first
+  for (t = vars; t != 0; t = t->m_parent) {
+    for (v = t->m_variables; v != 0; v = v->m_next)
+      nvars++;
+  }
+
+  if ((trecs = calloc(n ? n : 1, sizeof(*trecs))) == 0 ||
+      (vrecs = calloc(nvars ? nvars : 1, sizeof(*vrecs))) == 0 ||
+      (flat = calloc(nvars ? nvars : 1, sizeof(*flat))) == 0 ||
+      (strings = tj_buffer_create(0)) == 0) {
+    TJ_ERROR("No memory for snapshot records.");
+    goto done;
+  }
+
+  nvars = 0;
+  for (t = vars; t != 0; t = t->m_parent) {
+    for (v = t->m_variables; v != 0; v = v->m_next) {
+      for (k = 0; k < nvars && strcmp(flat[k]->m_label, v->m_label); k++)
+        ;
+      if (k == nvars)
+        flat[nvars++] = v;
+    }
+  }
+
+  //-- Records are filled in as the data is laid out behind them
+  memset(&header, 0, sizeof(header));
+  memcpy(header.m_magic, TJ_TEMPLATE_SNAPSHOT_MAGIC, 8);
+  header.m_version = TJ_TEMPLATE_SNAPSHOT_VERSION;
+  header.m_byteOrder = TJ_TEMPLATE_SNAPSHOT_BYTEORDER;
+  header.m_templateCount = n;
+  header.m_variableCount = nvars;
+  header.m_templates = sizeof(header);
+  header.m_variables = header.m_templates + n*sizeof(*trecs);
+
+  if (!tj_buffer_append(dest, (tj_buffer_byte *) &header, sizeof(header)) ||
+      !tj_buffer_append(dest, (tj_buffer_byte *) trecs, n*sizeof(*trecs)) ||
+      !tj_buffer_append(dest, (tj_buffer_byte *) vrecs,
+                        nvars*sizeof(*vrecs)))
+    goto error;
+
+  for (i = 0; i < n; i++) {
+    if (!tj_template_snapshot_intern(&table, strings, names[i],
+                                     &trecs[i].m_name))
+      goto error;
+    trecs[i].m_codeCount = templates[i]->m_count;
+    trecs[i].m_code = tj_buffer_getUsed(dest) - base;
+    if (!tj_buffer_append(dest, (tj_buffer_byte *) templates[i]->m_code,
+                          templates[i]->m_count *
+                          sizeof(tj_template_instruction)))
+      goto error;
+    trecs[i].m_source = tj_buffer_getUsed(dest) - base;
+    trecs[i].m_sourceLen = templates[i]->m_sourceLen;
+    if (!tj_buffer_append(dest, templates[i]->m_source,
+                          templates[i]->m_sourceLen) ||
+        !tj_template_snapshot_pad(dest, base))
+      goto error;
+  }
+
+  for (i = 0; i < nvars; i++) {
+    if (!tj_template_snapshot_intern(&table, strings, flat[i]->m_label,
+                                     &vrecs[i].m_label))
+      goto error;
+    vrecs[i].m_escape = flat[i]->m_escape;
+    vrecs[i].m_recurse = flat[i]->m_recurse;
+    vrecs[i].m_value = tj_buffer_getUsed(dest) - base;
+    vrecs[i].m_valueLen = tj_buffer_getUsed(flat[i]->m_substitution);
+    if (!tj_buffer_appendBuffer(dest, flat[i]->m_substitution) ||
+        !tj_template_snapshot_pad(dest, base))
+      goto error;
+  }
+
+  header.m_strings = tj_buffer_getUsed(dest) - base;
+  header.m_stringsLen = tj_buffer_getUsed(strings);
+  if (!tj_buffer_appendBuffer(dest, strings) ||
+      !tj_template_snapshot_pad(dest, base))
+    goto error;
+  header.m_size = tj_buffer_getUsed(dest) - base;
+
+  memcpy(tj_buffer_getBytesAtIndex(dest, base), &header, sizeof(header));
+  memcpy(tj_buffer_getBytesAtIndex(dest, base + header.m_templates),
+         trecs, n*sizeof(*trecs));
+  memcpy(tj_buffer_getBytesAtIndex(dest, base + header.m_variables),
+         vrecs, nvars*sizeof(*vrecs));
+
+  res = 1;
+  goto done;
+
+ error:
+  TJ_ERROR("Could not write template snapshot.");
+  tj_buffer_popBack(dest, tj_buffer_getUsed(dest) - base);
+
+ done:
+  HASH_ITER(hh, table, e, et) {
+    HASH_DEL(table, e);
+    free(e);
+  }
+  if (strings != 0)
+    tj_buffer_finalize(strings);
+  free(flat);
+  free(vrecs);
+  free(trecs);
+  return res;
+  // end tj_template_snapshot_write
+}
+
+//--------------------------------------------------------------
+static int
+tj_template_snapshot_span(const tj_template_snapshot_header *h,
+                          uint64_t offset, uint64_t n)
+{
+  return offset <= h->m_size && n <= h->m_size - offset;
+  // end tj_template_snapshot_span
+}
+
+/*
+ * Checks that every offset, and every instruction operand, stays
+ * within the snapshot, such that a damaged file cannot make the
+ * interpreter read outside of it.  Blocks must nest properly, and text
+ * offsets only move forward through the code, as the interpreter
+ * relies on both.  Source text is not touched.
+ */
+static int
+tj_template_snapshot_validate(tj_template_snapshot *x)
+{
+  const tj_template_snapshot_header *h = x->m_header;
+  const tj_template_snapshot_template *trecs;
+  const tj_template_snapshot_variable *vrecs;
+  const tj_template_instruction *code;
+  uint32_t open[TJ_TEMPLATE_MAXDEPTH];
+  uint32_t i, k, depth;
+  uint64_t pos, reach;
+
+  if (x->m_size < sizeof(*h) ||
+      memcmp(h->m_magic, TJ_TEMPLATE_SNAPSHOT_MAGIC, 8) ||
+      h->m_version != TJ_TEMPLATE_SNAPSHOT_VERSION ||
+      h->m_byteOrder != TJ_TEMPLATE_SNAPSHOT_BYTEORDER ||
+      h->m_size > x->m_size ||
+      !tj_template_snapshot_span(h, h->m_templates,
+                                 (uint64_t) h->m_templateCount *
+                                 sizeof(*trecs)) ||
+      !tj_template_snapshot_span(h, h->m_variables,
+                                 (uint64_t) h->m_variableCount *
+                                 sizeof(*vrecs)) ||
+      !tj_template_snapshot_span(h, h->m_strings, h->m_stringsLen) ||
+      h->m_templates % 8 || h->m_variables % 8 ||
+      (h->m_stringsLen > 0 &&
+       x->m_bytes[h->m_strings + h->m_stringsLen - 1] != 0)) {
+    TJ_ERROR("Template snapshot header is not valid.");
+    return 0;
+  }
+
+  trecs = (const void *) &x->m_bytes[h->m_templates];
+  for (i = 0; i < h->m_templateCount; i++) {
+    if (trecs[i].m_name >= h->m_stringsLen || trecs[i].m_code % 4 ||
+        !tj_template_snapshot_span(h, trecs[i].m_code,
+                                   (uint64_t) trecs[i].m_codeCount *
+                                   sizeof(*code)) ||
+        !tj_template_snapshot_span(h, trecs[i].m_source,
+                                   trecs[i].m_sourceLen) ||
+        trecs[i].m_sourceLen > UINT32_MAX) {
+      TJ_ERROR("Template snapshot record %u is not valid.", i);
+      return 0;
+    }
+
+    code = (const void *) &x->m_bytes[trecs[i].m_code];
+    depth = 0;
+    pos = reach = 0;
+    for (k = 0; k < trecs[i].m_codeCount; k++) {
+      switch (code[k].m_op) {
+      case TJ_TEMPLATE_OP_MARK:
+        if (code[k].m_a < pos ||
+            code[k].m_a >= code[k].m_b || code[k].m_b > trecs[i].m_sourceLen)
+          goto invalid;
+        pos = code[k].m_a+1;
+        if (code[k].m_b > reach)
+          reach = code[k].m_b;
+        break;
+      case TJ_TEMPLATE_OP_ESCAPE:
+        if (code[k].m_a < pos ||
+            (uint64_t) code[k].m_a+2 > trecs[i].m_sourceLen)
+          goto invalid;
+        pos = code[k].m_a+2;
+        break;
+      case TJ_TEMPLATE_OP_FLUSH:
+        if (code[k].m_a < pos || code[k].m_a < reach ||
+            code[k].m_a > trecs[i].m_sourceLen)
+          goto invalid;
+        pos = reach = code[k].m_a;
+        break;
+      case TJ_TEMPLATE_OP_SECTION:
+      case TJ_TEMPLATE_OP_INVERTED:
+        if (depth == TJ_TEMPLATE_MAXDEPTH ||
+            code[k].m_a < pos || code[k].m_a < reach ||
+            (uint64_t) code[k].m_a+code[k].m_b+1 > trecs[i].m_sourceLen ||
+            code[k].m_c <= k || code[k].m_c >= trecs[i].m_codeCount ||
+            code[code[k].m_c].m_op != TJ_TEMPLATE_OP_END ||
+            code[code[k].m_c].m_a != k)
+          goto invalid;
+        open[depth++] = k;
+        pos = reach = code[k].m_a+code[k].m_b+1;
+        break;
+      case TJ_TEMPLATE_OP_END:
+        //-- Blocks must nest, or a frame would be reused out of turn
+        if (depth == 0 || code[k].m_a != open[depth-1] ||
+            code[code[k].m_a].m_c != k ||
+            code[k].m_b < pos || code[k].m_b < reach ||
+            code[k].m_b > trecs[i].m_sourceLen)
+          goto invalid;
+        depth--;
+        pos = reach = code[k].m_b;
+        break;
+      default:
+        goto invalid;
+      }
+    }
+    if (depth != 0)
+      goto invalid;
+  }
+
+  vrecs = (const void *) &x->m_bytes[h->m_variables];
+  for (i = 0; i < h->m_variableCount; i++) {
+    if (vrecs[i].m_label >= h->m_stringsLen ||
+        vrecs[i].m_escape > TJ_TEMPLATE_ESCAPE_SHELL ||
+        !tj_template_snapshot_span(h, vrecs[i].m_value,
+                                   vrecs[i].m_valueLen)) {
+      TJ_ERROR("Template snapshot variable %u is not valid.", i);
+      return 0;
+    }
+  }
+
+  return 1;
+
+ invalid:
+  TJ_ERROR("Template snapshot code of template %u is not valid.", i);
+  return 0;
+  // end tj_template_snapshot_validate
+}
+
+tj_template_snapshot *
+tj_template_snapshot_openBytes(const tj_buffer_byte *data, size_t n)
+{
+  const tj_template_snapshot_template *trecs;
+  tj_template_snapshot *x;
+  uint32_t i;
+
+  if ((x = malloc(sizeof(tj_template_snapshot))) == 0) {
+    TJ_ERROR("No memory for tj_template_snapshot.");
+    return 0;
+  }
+
+  x->m_bytes = data;
+  x->m_size = n;
+  x->m_mapped = 0;
+  x->m_header = (const void *) data;
+  x->m_templates = 0;
+
+  if (((uintptr_t) data) % 8 || !tj_template_snapshot_validate(x))
+    goto error;
+
+  x->m_strings = (const char *) &data[x->m_header->m_strings];
+
+  //-- Templates are used in place; only their handles are allocated
+  if ((x->m_templates = calloc(x->m_header->m_templateCount + 1,
+                               sizeof(tj_template))) == 0) {
+    TJ_ERROR("No memory for snapshot templates.");
+    goto error;
+  }
+
+  trecs = (const void *) &data[x->m_header->m_templates];
+  for (i = 0; i < x->m_header->m_templateCount; i++) {
+    x->m_templates[i].m_source = (tj_buffer_byte *) &data[trecs[i].m_source];
+    x->m_templates[i].m_sourceLen = trecs[i].m_sourceLen;
+    x->m_templates[i].m_code = (tj_template_instruction *)
+      &data[trecs[i].m_code];
+    x->m_templates[i].m_count = trecs[i].m_codeCount;
+    x->m_templates[i].m_own = 0;
+  }
+
+  return x;
+
+ error:
+  free(x->m_templates);
+  free(x);
+  return 0;
+  // end tj_template_snapshot_openBytes
+}
+
+tj_template_snapshot *
+tj_template_snapshot_open(const char *filename)
+{
+  tj_template_snapshot *x;
+  struct stat st;
+  void *data;
+  int fd;
+
+  if ((fd = open(filename, O_RDONLY)) == -1) {
+    TJ_ERROR("Could not open template snapshot %s.", filename);
+    return 0;
+  }
+
+  if (fstat(fd, &st) == -1 || st.st_size == 0) {
+    TJ_ERROR("Could not stat template snapshot %s.", filename);
+    close(fd);
+    return 0;
+  }
+
+  data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    TJ_ERROR("Could not map template snapshot %s.", filename);
+    return 0;
+  }
+
+  if ((x = tj_template_snapshot_openBytes(data, st.st_size)) == 0) {
+    munmap(data, st.st_size);
+    return 0;
+  }
+
+  x->m_mapped = 1;
+  return x;
+  // end tj_template_snapshot_open
+}
+
+void
+tj_template_snapshot_finalize(tj_template_snapshot *x)
+{
+  if (x->m_mapped)
+    munmap((void *) x->m_bytes, x->m_size);
+  free(x->m_templates);
+  free(x);
+  // end tj_template_snapshot_finalize
+}
+
+tj_template *
+tj_template_snapshot_getTemplate(tj_template_snapshot *x, const char *name)
+{
+  const tj_template_snapshot_template *trecs =
+    (const void *) &x->m_bytes[x->m_header->m_templates];
+  uint32_t i;
+
+  for (i = 0; i < x->m_header->m_templateCount; i++) {
+    if (!strcmp(&x->m_strings[trecs[i].m_name], name))
+      return &x->m_templates[i];
+  }
+
+  return 0;
+  // end tj_template_snapshot_getTemplate
+}
+
+tj_template_variables *
+tj_template_snapshot_createVariables(tj_template_snapshot *x)
+{
+  const tj_template_snapshot_variable *vrecs =
+    (const void *) &x->m_bytes[x->m_header->m_variables];
+  tj_template_variables *vars;
+  tj_template_variable *v;
+  uint32_t i;
+
+  if ((vars = tj_template_variables_create()) == 0)
+    return 0;
+
+  // Added in reverse such that the list keeps the written order
+  for (i = x->m_header->m_variableCount; i-- > 0; ) {
+    if ((v = tj_template_variable_create(&x->m_strings[vrecs[i].m_label]))
+        == 0)
+      goto error;
+    if (!tj_buffer_append(v->m_substitution, &x->m_bytes[vrecs[i].m_value],
+                          vrecs[i].m_valueLen)) {
+      tj_template_variable_finalize(v);
+      goto error;
+    }
+    v->m_escape = vrecs[i].m_escape;
+    v->m_recurse = vrecs[i].m_recurse;
+    v->m_next = vars->m_variables;
+    vars->m_variables = v;
+  }
+
+  return vars;
+
+ error:
+  tj_template_variables_finalize(vars);
+  return 0;
+  // end tj_template_snapshot_createVariables
+}
@@ -29,6 +29,30 @@
 
 //----------------------------------------------------------------------
 typedef struct tj_template_variables tj_template_variables;
+typedef struct tj_template tj_template;
+
+/**
+ * Escaping applied to a substitution as it is expanded.
+ *
+ * TJ_TEMPLATE_ESCAPE_HTML replaces &, <, >, " and ' with entities.
+ * TJ_TEMPLATE_ESCAPE_JSON backslash escapes " and \ and control
+ * characters for use within a JSON string.
+ * TJ_TEMPLATE_ESCAPE_SHELL single quotes the value, such that it is
+ * one word to a POSIX shell.
+ */
+typedef enum {
+  TJ_TEMPLATE_ESCAPE_NONE,
+  TJ_TEMPLATE_ESCAPE_HTML,
+  TJ_TEMPLATE_ESCAPE_JSON,
+  TJ_TEMPLATE_ESCAPE_SHELL,
+} tj_template_escape;
+
+/**
+ * The maximum nesting depth of blocks within a compiled template.
+ */
+#ifndef TJ_TEMPLATE_MAXDEPTH
+#define TJ_TEMPLATE_MAXDEPTH 32
+#endif
 
 /**
  * Create a tj_template_variables object.  It will initially contain
@@ -37,6 +61,26 @@ typedef struct tj_template_variables tj_template_variables;
 tj_template_variables *
 tj_template_variables_create(void);
 
+/**
+ * Create a tj_template_variables object layered over another.  A
+ * variable not defined in the child is looked up in its parent, and
+ * so on up the chain, so a child costs only its own overrides.
+ * Variables set in a child shadow those of its parents, keeping their
+ * recursion and escaping settings.  Changing only the settings of an
+ * inherited variable shares the parent's substitution rather than
+ * copying it.  Items added to a child start a new list, shadowing
+ * rather than extending any inherited one.
+ *
+ * The parent is never modified through the child, and expansion does
+ * not modify any variables, so many children in many threads may
+ * share one parent.  The parent must outlive its children and must
+ * not be changed while they are in use.
+ *
+ * \param parent The variables to fall back to.
+ */
+tj_template_variables *
+tj_template_variables_createChild(tj_template_variables *parent);
+
 /**
  * Destroy a tj_template_variables object, deallocating it and any
  * substitutions that have been added to it.
@@ -58,6 +102,22 @@ void
 tj_template_variables_setRecurse(tj_template_variables *vars,
                                  const char *label, char recurse);
 
+/**
+ * Set how a variable is escaped when it is expanded.  Escaping is
+ * done as the substitution is written into the destination, rather
+ * than as a separate pass.  The text of a recursive variable is
+ * escaped, and variables expanded within it are escaped using their
+ * own mode or, if they have none, the recursive variable's.  The
+ * default is TJ_TEMPLATE_ESCAPE_NONE.
+ *
+ * \param vars The substitution container.
+ * \param label The variable in question.
+ * \param escape The escaping to apply.
+ */
+void
+tj_template_variables_setEscape(tj_template_variables *vars,
+                                const char *label, tj_template_escape escape);
+
 /**
  * Define a substitution as a string.  The caller maintains ownership
  * of the variable and substitution memory.  If a value was already
@@ -104,10 +164,39 @@ int
 tj_template_variables_setFromFile(tj_template_variables *vars,
                                   const char *label, const char *filename);
 
+/**
+ * Append an item to a list variable, creating the variable if it is
+ * not yet defined.  The returned container is owned by vars and
+ * holds the substitutions for that one item; its variables shadow
+ * those of the enclosing containers while the item is expanded by
+ * a $#label$ block in a compiled template.  Items are expanded in
+ * the order they are added.
+ *
+ * \param vars The substitution container.
+ * \param label The list variable to extend.
+ * \return The new item's substitutions, or 0 on failure.
+ */
+tj_template_variables *
+tj_template_variables_addItem(tj_template_variables *vars, const char *label);
+
+/**
+ * Compute the exact number of bytes tj_template_variables_apply()
+ * would append for a template, without writing anything.
+ *
+ * \param vars The substitutions to apply.
+ * \param src Buffer containing the template to expand.
+ * \param n Set to the length of the expansion.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_template_variables_measure(tj_template_variables *variables,
+                              tj_buffer *src, size_t *n);
+
 /**
  * Expand a set of substitutions into a buffer, using another buffer
- * as the template guiding substitution.  Caller maintains ownership
- * of all objects.
+ * as the template guiding substitution.  The expansion is measured
+ * first, such that dest is grown at most once.  Caller maintains
+ * ownership of all objects.
  *
  * \param vars The substitutions to apply.
  * \param dest The buffer into which the expansion is conducted.
@@ -119,4 +208,175 @@ tj_template_variables_apply(tj_template_variables *variables,
                             tj_buffer *dest,
                             tj_buffer *src);
 
+/**
+ * Append data to a buffer, escaping it as it is written.  This is the
+ * same escaping done by template expansion, for text produced outside
+ * of a template.
+ *
+ * \param dest The buffer to append to.
+ * \param escape The escaping to apply.
+ * \param data The bytes to escape.
+ * \param n The number of bytes in data.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_template_appendEscaped(tj_buffer *dest, tj_template_escape escape,
+                          const tj_buffer_byte *data, size_t n);
+
+//----------------------------------------------------------------------
+/**
+ * Compile a template into a form which can be expanded repeatedly
+ * without rescanning it.  In addition to $label substitutions,
+ * compiled templates support blocks:
+ *
+ *   $#label$ ... $/label$  Expanded once for each item of the list
+ *                          variable label, or once if label is a
+ *                          non-empty substitution, otherwise skipped.
+ *   $^label$ ... $/label$  Expanded once if label is undefined, empty,
+ *                          or a list with no items, otherwise skipped.
+ *
+ * Blocks nest up to TJ_TEMPLATE_MAXDEPTH deep.  A substitution
+ * immediately before a block directive is terminated by it, e.g.,
+ * "$name$/label$".  Templates without block directives expand exactly
+ * as with tj_template_variables_apply().  The source buffer is copied
+ * and the caller maintains ownership of it.
+ *
+ * \param src Buffer containing the template to compile.
+ * \return The compiled template, or 0 on failure or unbalanced blocks.
+ */
+tj_template *
+tj_template_compile(tj_buffer *src);
+
+/**
+ * Destroy a compiled template.
+ */
+void
+tj_template_finalize(tj_template *tmpl);
+
+/**
+ * Compute the exact number of bytes an expansion of a compiled
+ * template would produce, without writing anything.  This may be used
+ * to allocate memory for tj_template_render().
+ *
+ * \param tmpl The compiled template to measure.
+ * \param vars The substitutions to apply.
+ * \param n Set to the length of the expansion.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_template_measure(tj_template *tmpl, tj_template_variables *vars,
+                    size_t *n);
+
+/**
+ * Expand a compiled template into caller provided memory.  The
+ * expansion fails, leaving the contents of dest undefined, if it
+ * does not fit within n bytes.  No null terminator is written.
+ *
+ * \param tmpl The compiled template to expand.
+ * \param vars The substitutions to apply.
+ * \param dest Memory of at least n bytes to expand into.
+ * \param n The size of dest.
+ * \param used Set to the number of bytes written.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_template_render(tj_template *tmpl, tj_template_variables *vars,
+                   tj_buffer_byte *dest, size_t n, size_t *used);
+
+/**
+ * Expand a compiled template into a buffer.  The expansion is
+ * measured with tj_template_measure() and dest grown once, before it
+ * is written in a single pass.  The template is not modified and may
+ * be applied concurrently from several threads.  Caller maintains
+ * ownership of all objects.
+ *
+ * \param tmpl The compiled template to expand.
+ * \param vars The substitutions to apply.
+ * \param dest The buffer into which the expansion is conducted.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_template_apply(tj_template *tmpl,
+                  tj_template_variables *vars,
+                  tj_buffer *dest);
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+typedef struct tj_template_snapshot tj_template_snapshot;
+
+/**
+ * Serialize compiled templates and a set of variables into a snapshot
+ * that may later be mapped and used in place, without recompiling.
+ * The snapshot is appended to dest.  It uses native byte order and
+ * is only portable between hosts of the same architecture.
+ *
+ * Variables are flattened: those visible through vars, including its
+ * parents, are written once, nearest definition first.  List items
+ * added with tj_template_variables_addItem() are not written.
+ *
+ * \param dest The buffer to append the snapshot to.
+ * \param names Names by which the templates will be looked up.
+ * \param templates The compiled templates to write.
+ * \param n The number of names and templates.
+ * \param vars Variables to write, or 0 for none.
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_template_snapshot_write(tj_buffer *dest,
+                           const char **names, tj_template **templates,
+                           size_t n, tj_template_variables *vars);
+
+/**
+ * Map a snapshot file read only and validate it.  A snapshot with a
+ * different version or byte order, or whose records point outside of
+ * the file, is rejected.
+ *
+ * \param filename The snapshot file to open.
+ * \return The snapshot, or 0 on failure.
+ */
+tj_template_snapshot *
+tj_template_snapshot_open(const char *filename);
+
+/**
+ * Validate and use a snapshot held in memory, without copying it.
+ * The memory must be 8 byte aligned and outlive the snapshot.
+ *
+ * \param data The snapshot bytes.
+ * \param n The number of bytes.
+ * \return The snapshot, or 0 on failure.
+ */
+tj_template_snapshot *
+tj_template_snapshot_openBytes(const tj_buffer_byte *data, size_t n);
+
+/**
+ * Destroy a snapshot, unmapping it if it was opened from a file.  All
+ * templates obtained from it become invalid.
+ */
+void
+tj_template_snapshot_finalize(tj_template_snapshot *snapshot);
+
+/**
+ * Look up a template within a snapshot.  The template is owned by the
+ * snapshot and runs directly over its memory; calling
+ * tj_template_finalize() on it has no effect.
+ *
+ * \param snapshot The snapshot to search.
+ * \param name The name the template was written under.
+ * \return The template, or 0 if there is none by that name.
+ */
+tj_template *
+tj_template_snapshot_getTemplate(tj_template_snapshot *snapshot,
+                                 const char *name);
+
+/**
+ * Create a set of variables holding those written to a snapshot.  The
+ * caller owns the result, which may be modified or used as the parent
+ * of per-request variables.
+ *
+ * \param snapshot The snapshot to read.
+ * \return The variables, or 0 on failure.
+ */
+tj_template_variables *
+tj_template_snapshot_createVariables(tj_template_snapshot *snapshot);
+
 #endif // __tj_template_h__
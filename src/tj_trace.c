@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tj_error.h"
+#include "tj_trace.h"
+
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+typedef struct {
+  uint64_t m_time;
+  const char *m_name;
+  uint64_t m_phase;
+} tj_trace_record;
+
+/*
+ * Only the owning thread writes a ring's events and m_head; readers
+ * copy events out and then discard any the owner may have overwritten
+ * meanwhile.
+ */
+typedef struct tj_trace_ring tj_trace_ring;
+struct tj_trace_ring {
+  uint64_t m_head;
+  uint64_t m_cleared;
+  uint32_t m_tid;
+  int m_exited;
+  tj_trace_ring *m_next;
+  tj_trace_record m_events[TJ_TRACE_EVENTS];
+};
+
+volatile int tj_trace_enabled = 0;
+
+static pthread_mutex_t tj_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tj_trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tj_trace_key;
+static tj_trace_ring *tj_trace_rings = 0;
+static __thread tj_trace_ring *tj_trace_ring__ = 0;
+
+//----------------------------------------------------------------------
+static void
+tj_trace_exited(void *ring)
+{
+  __atomic_store_n(&((tj_trace_ring *) ring)->m_exited, 1, __ATOMIC_RELEASE);
+  // end tj_trace_exited
+}
+
+static void
+tj_trace_init(void)
+{
+  if (pthread_key_create(&tj_trace_key, &tj_trace_exited) != 0)
+    TJ_ERROR("Could not create trace thread key.");
+  // end tj_trace_init
+}
+
+static tj_trace_ring *
+tj_trace_getRing(void)
+{
+  tj_trace_ring *r;
+
+  if ((r = tj_trace_ring__) != 0)
+    return r;
+
+  if ((r = calloc(1, sizeof(tj_trace_ring))) == 0) {
+    TJ_ERROR("No memory for trace ring.");
+    return 0;
+  }
+  r->m_tid = syscall(SYS_gettid);
+
+  pthread_once(&tj_trace_once, &tj_trace_init);
+  pthread_setspecific(tj_trace_key, r);
+
+  pthread_mutex_lock(&tj_trace_lock);
+  r->m_next = tj_trace_rings;
+  tj_trace_rings = r;
+  pthread_mutex_unlock(&tj_trace_lock);
+
+  return (tj_trace_ring__ = r);
+  // end tj_trace_getRing
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+void
+tj_trace_setEnabled(int enabled)
+{
+  tj_trace_enabled = enabled;
+  // end tj_trace_setEnabled
+}
+
+void
+tj_trace_event(const char *name, char phase)
+{
+  tj_trace_ring *r;
+  tj_trace_record *e;
+  struct timespec now;
+  uint64_t i;
+
+  if ((r = tj_trace_getRing()) == 0)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  i = r->m_head;
+  e = &r->m_events[i % TJ_TRACE_EVENTS];
+  __atomic_store_n(&e->m_time,
+                   (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&e->m_name, name, __ATOMIC_RELAXED);
+  __atomic_store_n(&e->m_phase, phase, __ATOMIC_RELAXED);
+  __atomic_store_n(&r->m_head, i + 1, __ATOMIC_RELEASE);
+  // end tj_trace_event
+}
+
+const char *
+tj_trace_beginScope(const char *name)
+{
+  tj_trace_event(name, 'B');
+  return name;
+  // end tj_trace_beginScope
+}
+
+void
+tj_trace_endScope(const char **name)
+{
+  //-- Only spans which began are ended, even if tracing was toggled
+  if (*name != 0)
+    tj_trace_event(*name, 'E');
+  // end tj_trace_endScope
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static int
+tj_trace_writeName(tj_buffer *b, const char *name)
+{
+  const char *c;
+  int ok = 1;
+
+  for (c = name; *c != 0 && ok; c++) {
+    if (*c == '"' || *c == '\\')
+      ok = tj_buffer_printf(b, "\\%c", *c);
+    else if ((unsigned char) *c < 0x20)
+      ok = tj_buffer_printf(b, "\\u%04x", *c);
+    else
+      ok = tj_buffer_printf(b, "%c", *c);
+  }
+
+  return ok;
+  // end tj_trace_writeName
+}
+
+/*
+ * Copies out the events a ring still holds, returning the index of
+ * the first one and setting n to how many are intact.  The oldest is
+ * only trusted if its owner cannot be part way through replacing it,
+ * because it is the caller or has exited.
+ */
+static uint64_t
+tj_trace_copy(tj_trace_ring *r, tj_trace_record *events, size_t *n)
+{
+  uint64_t head, start, first, i, busy;
+
+  head = __atomic_load_n(&r->m_head, __ATOMIC_ACQUIRE);
+  start = __atomic_load_n(&r->m_cleared, __ATOMIC_RELAXED);
+  if (head > TJ_TRACE_EVENTS && head - TJ_TRACE_EVENTS > start)
+    start = head - TJ_TRACE_EVENTS;
+
+  for (i = start; i < head; i++) {
+    events[i - start].m_time =
+      __atomic_load_n(&r->m_events[i % TJ_TRACE_EVENTS].m_time,
+                      __ATOMIC_RELAXED);
+    events[i - start].m_name =
+      __atomic_load_n(&r->m_events[i % TJ_TRACE_EVENTS].m_name,
+                      __ATOMIC_RELAXED);
+    events[i - start].m_phase =
+      __atomic_load_n(&r->m_events[i % TJ_TRACE_EVENTS].m_phase,
+                      __ATOMIC_RELAXED);
+  }
+
+  //-- Anything the owner may since have reached is suspect
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  busy = (r != tj_trace_ring__ &&
+          !__atomic_load_n(&r->m_exited, __ATOMIC_ACQUIRE));
+  first = __atomic_load_n(&r->m_head, __ATOMIC_RELAXED) + busy;
+  first = (first > TJ_TRACE_EVENTS) ? first - TJ_TRACE_EVENTS : 0;
+  if (first < start)
+    first = start;
+
+  *n = (first < head) ? head - first : 0;
+  return first - start;
+  // end tj_trace_copy
+}
+
+int
+tj_trace_write(tj_buffer *b)
+{
+  tj_trace_record *events;
+  tj_trace_ring *r;
+  size_t i, n, first;
+  int ok = 1, comma = 0;
+  pid_t pid = getpid();
+
+  if ((events = malloc(TJ_TRACE_EVENTS * sizeof(tj_trace_record))) == 0) {
+    TJ_ERROR("No memory to copy trace events.");
+    return 0;
+  }
+
+  ok &= tj_buffer_printf(b, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+  pthread_mutex_lock(&tj_trace_lock);
+  for (r = tj_trace_rings; r != 0 && ok; r = r->m_next) {
+    first = tj_trace_copy(r, events, &n);
+    for (i = first; i < first + n && ok; i++) {
+      ok &= tj_buffer_printf(b, "%s{\"name\":\"", comma ? "," : "");
+      ok &= tj_trace_writeName(b, events[i].m_name);
+      ok &= tj_buffer_printf(b, "\",\"ph\":\"%c\",\"ts\":%llu.%03u,"
+                             "\"pid\":%d,\"tid\":%u}",
+                             (char) events[i].m_phase,
+                             (unsigned long long) events[i].m_time / 1000,
+                             (unsigned) (events[i].m_time % 1000),
+                             (int) pid, r->m_tid);
+      comma = 1;
+    }
+  }
+  pthread_mutex_unlock(&tj_trace_lock);
+
+  ok &= tj_buffer_printf(b, "]}");
+
+  free(events);
+  return ok;
+  // end tj_trace_write
+}
+
+void
+tj_trace_clear(void)
+{
+  tj_trace_ring *r, **prev;
+
+  pthread_mutex_lock(&tj_trace_lock);
+  for (prev = &tj_trace_rings; (r = *prev) != 0; ) {
+    if (__atomic_load_n(&r->m_exited, __ATOMIC_ACQUIRE)) {
+      *prev = r->m_next;
+      free(r);
+      continue;
+    }
+    __atomic_store_n(&r->m_cleared,
+                     __atomic_load_n(&r->m_head, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELAXED);
+    prev = &r->m_next;
+  }
+  pthread_mutex_unlock(&tj_trace_lock);
+  // end tj_trace_clear
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __tj_trace_h__
+#define __tj_trace_h__
+
+#include "tj_buffer.h"
+
+/*
+ * Spans are recorded as begin and end events, each a monotonic
+ * timestamp and a static name, into a ring owned by the calling
+ * thread.  Recording takes no lock and makes no system call; once a
+ * ring is full the oldest events are overwritten.  Tracing is off
+ * until enabled, costing one test of a global per macro, and the
+ * macros compile to nothing if TJ_TRACE_DISABLE is defined.
+ *
+ * Names must be string literals or otherwise outlive the trace.
+ */
+#ifndef TJ_TRACE_EVENTS
+#define TJ_TRACE_EVENTS 8192       // Per thread
+#endif
+
+extern volatile int tj_trace_enabled;
+
+#ifndef TJ_TRACE_DISABLE
+
+#ifndef TJ_TRACE_BEGIN
+#define TJ_TRACE_BEGIN(name)                                           \
+  do { if (tj_trace_enabled) tj_trace_event(name, 'B'); } while (0)
+#endif
+
+#ifndef TJ_TRACE_END
+#define TJ_TRACE_END(name)                                             \
+  do { if (tj_trace_enabled) tj_trace_event(name, 'E'); } while (0)
+#endif
+
+/**
+ * Trace the rest of the enclosing block as a span, ending it however
+ * the block is left.
+ */
+#ifndef TJ_TRACE_SCOPE
+#define TJ_TRACE_SCOPE(name)                                           \
+  const char *tj_trace_scope__                                         \
+    __attribute__((cleanup(tj_trace_endScope), unused)) =              \
+    (tj_trace_enabled ? tj_trace_beginScope(name) : 0)
+#endif
+
+#else // TJ_TRACE_DISABLE
+
+#define TJ_TRACE_BEGIN(name) do { } while (0)
+#define TJ_TRACE_END(name) do { } while (0)
+#define TJ_TRACE_SCOPE(name) do { } while (0)
+
+#endif // TJ_TRACE_DISABLE
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+void
+tj_trace_setEnabled(int enabled);
+
+/**
+ * Record an event for the calling thread.  Normally used through the
+ * macros.
+ *
+ * \param name The name of the span.
+ * \param phase 'B' to begin it, 'E' to end it.
+ */
+void
+tj_trace_event(const char *name, char phase);
+
+const char *
+tj_trace_beginScope(const char *name);
+
+void
+tj_trace_endScope(const char **name);
+
+/**
+ * Append the events still held by every thread to a buffer, as a
+ * string of Chrome trace event JSON.  This loads directly into
+ * chrome://tracing and the Perfetto UI.  Events are written per
+ * thread in the order recorded, which is all those viewers need.
+ *
+ * \return 0 on failure, 1 otherwise.
+ */
+int
+tj_trace_write(tj_buffer *b);
+
+/**
+ * Discard every recorded event, and free the rings of threads which
+ * have exited.
+ */
+void
+tj_trace_clear(void);
+
+#endif // __tj_trace_h__
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cmocka.h"
+
+#include "tj_alloc.h"
+#include "tj_array.h"
+#include "tj_buffer.h"
+
+#define MB ((size_t) 1 << 20)
+
+static int resident(void *p, size_t n) {
+    size_t page = sysconf(_SC_PAGESIZE), i, pages = (n + page - 1) / page;
+    unsigned char *vec = malloc(pages);
+    int res = 1;
+
+    assert_non_null(vec);
+    assert_int_equal(mincore(p, n, vec), 0);
+    for (i = 0; i < pages; i++)
+        res &= vec[i] & 1;
+    free(vec);
+    return res;
+}
+
+static void fill(unsigned char *p, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i += 4093)
+        p[i] = i / 4093;
+}
+
+static int check(unsigned char *p, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i += 4093)
+        if (p[i] != (unsigned char) (i / 4093))
+            return 0;
+    return 1;
+}
+
+static void test_small(void **state) {
+    tj_alloc_policy policy = { MB, TJ_ALLOC_PAGES_HUGE };
+    unsigned char *p;
+
+    //-- Below the threshold, or without a policy, is plain malloc
+    assert_non_null(p = tj_alloc_malloc(1000, &policy));
+    assert_false(tj_alloc_isMapped(p));
+    assert_non_null(p = tj_alloc_realloc(p, 10 * MB, NULL));
+    assert_false(tj_alloc_isMapped(p));
+    tj_alloc_free(p);
+
+    assert_non_null(p = malloc(4096));
+    assert_false(tj_alloc_isMapped(p));
+    tj_alloc_free(p);
+}
+
+static void test_large(void **state) {
+    tj_alloc_policy policy = { MB, TJ_ALLOC_PAGES_HUGE,
+                               TJ_ALLOC_NODE_INTERLEAVE, 4 };
+    unsigned char *p;
+
+    assert_non_null(p = tj_alloc_malloc(64 * MB, &policy));
+    assert_true(tj_alloc_isMapped(p));
+    assert_int_equal((uintptr_t) p % sysconf(_SC_PAGESIZE), 0);
+    //-- Only the start of a mapping is known, inside or outside its range
+    assert_false(tj_alloc_isMapped(p + sysconf(_SC_PAGESIZE)));
+    assert_false(tj_alloc_isMapped(p + 64 * MB));
+
+    //-- Faulted in up front by the touch threads
+    assert_true(resident(p, 64 * MB));
+    fill(p, 64 * MB);
+
+    assert_non_null(p = tj_alloc_realloc(p, 200 * MB, &policy));
+    assert_true(tj_alloc_isMapped(p));
+    assert_true(check(p, 64 * MB));
+    assert_true(resident(p, 200 * MB));
+
+    //-- Shrinking keeps the mapping
+    assert_non_null(p = tj_alloc_realloc(p, 100, &policy));
+    assert_true(tj_alloc_isMapped(p));
+    assert_true(check(p, 100));
+    tj_alloc_free(p);
+    assert_false(tj_alloc_isMapped(p));
+}
+
+static void test_cross(void **state) {
+    tj_alloc_policy policy = { MB, TJ_ALLOC_PAGES_HUGETLB,
+                               TJ_ALLOC_NODE_LOCAL, 0 };
+    unsigned char *p;
+
+    //-- Moved into a mapping once past the threshold
+    assert_non_null(p = tj_alloc_malloc(100000, &policy));
+    assert_false(tj_alloc_isMapped(p));
+    fill(p, 100000);
+    assert_non_null(p = tj_alloc_realloc(p, 3 * MB, &policy));
+    assert_true(tj_alloc_isMapped(p));
+    assert_true(check(p, 100000));
+    fill(p, 3 * MB);
+    assert_non_null(p = tj_alloc_realloc(p, 30 * MB, &policy));
+    assert_true(check(p, 3 * MB));
+    tj_alloc_free(p);
+}
+
+static void test_containers(void **state) {
+    tj_alloc_policy policy = { MB, TJ_ALLOC_PAGES_HUGE };
+    tj_buffer *b;
+    tj_array *a;
+    unsigned char page[4096];
+    size_t i;
+
+    memset(page, 'x', sizeof(page));
+
+    //-- The default policy applies to buffers without their own
+    tj_alloc_setDefaultPolicy(&policy);
+    b = tj_buffer_create(0);
+    for (i = 0; i < 1024; i++)
+        assert_true(tj_buffer_append(b, page, sizeof(page)));
+    assert_true(tj_alloc_isMapped(tj_buffer_getBytes(b)));
+    assert_int_equal(tj_buffer_getUsed(b), 4 * MB);
+    assert_int_equal(tj_buffer_getBytes(b)[4 * MB - 1], 'x');
+    tj_buffer_finalize(b);
+    tj_alloc_setDefaultPolicy(NULL);
+
+    b = tj_buffer_create(0);
+    tj_buffer_setAllocPolicy(b, &policy);
+    for (i = 0; i < 512; i++)
+        assert_true(tj_buffer_append(b, page, sizeof(page)));
+    assert_true(tj_alloc_isMapped(tj_buffer_getBytes(b)));
+    tj_buffer_finalize(b);
+
+    a = tj_array_create(0);
+    tj_array_setAllocPolicy(a, &policy);
+    for (i = 0; i < 500000; i++)
+        assert_true(tj_array_append(a, (void *) i));
+    assert_int_equal(tj_array_get(a, 499999), (void *) 499999);
+    tj_array_finalize(a);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test(test_small),
+        unit_test(test_large),
+        unit_test(test_cross),
+        unit_test(test_containers),
+    };
+
+    return run_tests(tests);
+}
@@ -357,6 +357,31 @@ static void test_array_clear2(void **state) {
     assert_int_equal(tj_array_count(array), 0);
 }
 
+static uint64_t int_key(const void *item) {
+    return *(const int*)item;
+}
+
+static void test_array_sort(void **state) {
+    struct tj_array *array = *state;
+    int values[200];
+    size_t i;
+
+    for (i = 0; i < 200; i++) {
+        values[i] = (i * 37) % 50;
+        assert_true(tj_array_append(array, &values[i]));
+    }
+
+    assert_true(tj_array_sortByKey(array, &int_key, 1));
+    for (i = 1; i < 200; i++) {
+        int *x = tj_array_get(array, i-1), *y = tj_array_get(array, i);
+        assert_true(*x <= *y);
+        /* Equal keys keep their order. */
+        if (*x == *y) {
+            assert_true(x < y);
+        }
+    }
+}
+
 int main(int argc, char **argv) {
     const UnitTest tests[] = {
         unit_test(test_array_empty),
@@ -380,6 +405,7 @@ int main(int argc, char **argv) {
         unit_test_setup_teardown(test_array_find5, setup, teardown),
         unit_test_setup_teardown(test_array_clear1, setup, teardown),
         unit_test_setup_teardown(test_array_clear2, setup, teardown),
+        unit_test_setup_teardown(test_array_sort, setup, teardown),
     };
 
     return run_tests(tests);
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdarg.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmocka.h"
+
+#include "tj_bitset.h"
+
+#define SIZE 100003
+
+static void test_bits(void **state) {
+    tj_bitset *b;
+    size_t i;
+
+    assert_non_null(b = tj_bitset_create(SIZE));
+    assert_int_equal(tj_bitset_getSize(b), SIZE);
+    assert_int_equal(tj_bitset_count(b), 0);
+    assert_int_equal(tj_bitset_findNext(b, 0), SIZE);
+
+    tj_bitset_set(b, 0);
+    tj_bitset_set(b, 63);
+    tj_bitset_set(b, 64);
+    tj_bitset_set(b, SIZE - 1);
+    assert_true(tj_bitset_test(b, 63));
+    assert_false(tj_bitset_test(b, 62));
+    assert_int_equal(tj_bitset_count(b), 4);
+    assert_int_equal(tj_bitset_findNext(b, 1), 63);
+    assert_int_equal(tj_bitset_findNext(b, 65), SIZE - 1);
+    tj_bitset_clear(b, 63);
+    assert_int_equal(tj_bitset_findNext(b, 1), 64);
+
+    //-- Ranges within a word and across several
+    tj_bitset_setRange(b, 100, 10);
+    assert_int_equal(tj_bitset_count(b), 13);
+    tj_bitset_setRange(b, 1000, 5000);
+    assert_int_equal(tj_bitset_count(b), 5013);
+    assert_false(tj_bitset_test(b, 999));
+    assert_true(tj_bitset_test(b, 5999));
+    assert_false(tj_bitset_test(b, 6000));
+    tj_bitset_clearRange(b, 1001, 4998);
+    assert_int_equal(tj_bitset_count(b), 15);
+    tj_bitset_setRange(b, 0, SIZE);
+    assert_int_equal(tj_bitset_count(b), SIZE);
+    tj_bitset_clearRange(b, 0, SIZE);
+    assert_int_equal(tj_bitset_count(b), 0);
+
+    //-- Shrinking drops bits, growing adds clear ones
+    tj_bitset_setRange(b, 0, SIZE);
+    assert_true(tj_bitset_resize(b, 70));
+    assert_int_equal(tj_bitset_count(b), 70);
+    assert_true(tj_bitset_resize(b, 200));
+    assert_int_equal(tj_bitset_count(b), 70);
+    assert_int_equal(tj_bitset_findNext(b, 70), 200);
+    assert_true(tj_bitset_resize(b, 0));
+    assert_int_equal(tj_bitset_count(b), 0);
+    assert_true(tj_bitset_resize(b, 10));
+    assert_int_equal(tj_bitset_count(b), 0);
+
+    for (i = 0; i < 10; i++)
+        assert_false(tj_bitset_test(b, i));
+    tj_bitset_finalize(b);
+}
+
+static void test_ops(void **state) {
+    tj_bitset *a, *b, *c, *d;
+    size_t i;
+
+    a = tj_bitset_create(SIZE);
+    b = tj_bitset_create(SIZE);
+    c = tj_bitset_create(SIZE);
+    d = tj_bitset_create(SIZE + 1);
+
+    for (i = 0; i < SIZE; i++) {
+        if (i % 2 == 0)
+            tj_bitset_set(a, i);
+        if (i % 3 == 0)
+            tj_bitset_set(b, i);
+    }
+
+    assert_true(tj_bitset_or(c, a));
+    assert_true(tj_bitset_and(c, b));
+    assert_int_equal(tj_bitset_count(c), (SIZE - 1) / 6 + 1);
+    assert_true(tj_bitset_xor(c, a));
+    assert_true(tj_bitset_andNot(c, b));
+    for (i = 0; i < SIZE; i++)
+        assert_int_equal(tj_bitset_test(c, i), i % 2 == 0 && i % 3 != 0);
+
+    assert_false(tj_bitset_or(d, a));
+
+    tj_bitset_finalize(a);
+    tj_bitset_finalize(b);
+    tj_bitset_finalize(c);
+    tj_bitset_finalize(d);
+}
+
+static void test_rank(void **state) {
+    tj_bitset *b = tj_bitset_create(SIZE);
+    size_t i, k, r, pos, out[100], n, from, total;
+    char *expect = calloc(SIZE, 1);
+
+    srand(5);
+    for (k = 0; k < SIZE / 10; k++) {
+        i = rand() % SIZE;
+        tj_bitset_set(b, i);
+        expect[i] = 1;
+    }
+    //-- A dense stretch and a long empty one
+    tj_bitset_setRange(b, 50000, 9000);
+    memset(expect + 50000, 1, 9000);
+    tj_bitset_clearRange(b, 70000, 20000);
+    memset(expect + 70000, 0, 20000);
+
+    for (i = 0, r = 0; i < SIZE; i++) {
+        assert_int_equal(tj_bitset_rank(b, i), r);
+        if (expect[i]) {
+            assert_true(tj_bitset_select(b, r, &pos));
+            assert_int_equal(pos, i);
+            r++;
+        }
+    }
+    total = r;
+    assert_int_equal(tj_bitset_rank(b, SIZE), total);
+    assert_int_equal(tj_bitset_count(b), total);
+    assert_false(tj_bitset_select(b, total, &pos));
+
+    //-- The index is rebuilt after a change
+    tj_bitset_clear(b, tj_bitset_findNext(b, 0));
+    assert_int_equal(tj_bitset_rank(b, SIZE), total - 1);
+
+    //-- Bulk iteration visits the same bits as findNext
+    for (from = 0, i = tj_bitset_findNext(b, 0), r = 0;
+         (n = tj_bitset_getSetBits(b, &from, out, 100)) > 0; ) {
+        for (k = 0; k < n; k++, r++) {
+            assert_int_equal(out[k], i);
+            i = tj_bitset_findNext(b, i + 1);
+        }
+    }
+    assert_int_equal(r, total - 1);
+    assert_int_equal(i, SIZE);
+
+    free(expect);
+    tj_bitset_finalize(b);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test(test_bits),
+        unit_test(test_ops),
+        unit_test(test_rank),
+    };
+
+    return run_tests(tests);
+}
@@ -22,6 +22,7 @@
  * SOFTWARE.
  */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
@@ -437,6 +438,254 @@ static void test_escape4(void **state) {
   assert_string_equal(tj_buffer_getBytes(buff), "Hello \\@Hello\\\" Hello");
 }
 
+static void test_insert1(void **state) {
+  tj_buffer *buff = *state;
+
+  assert_true(tj_buffer_append(buff, (tj_buffer_byte *) "Hello World", 11));
+  assert_true(tj_buffer_insert(buff, 5, (tj_buffer_byte *) ",", 1));
+  assert_true(tj_buffer_insert(buff, 100, (tj_buffer_byte *) "!", 1));
+  assert_true(tj_buffer_replaceRange(buff, 7, 5,
+                                     (tj_buffer_byte *) "There", 5));
+  assert_true(tj_buffer_replaceRange(buff, 0, 5,
+                                     (tj_buffer_byte *) "Oh", 2));
+  assert_int_equal(tj_buffer_getUsed(buff), 10);
+  assert_memory_equal(tj_buffer_getBytes(buff), "Oh, There!", 10);
+
+  tj_buffer_erase(buff, 2, 7);
+  tj_buffer_erase(buff, 2, 100);
+  assert_int_equal(tj_buffer_getUsed(buff), 2);
+  assert_memory_equal(tj_buffer_getBytes(buff), "Oh", 2);
+}
+
+static void test_insert2(void **state) {
+  tj_buffer *buff = *state;
+  int i;
+
+  tj_buffer_setGapMode(buff, 1);
+  assert_true(tj_buffer_appendString(buff, "ace"));
+  assert_true(tj_buffer_insert(buff, 1, (tj_buffer_byte *) "b", 1));
+  assert_true(tj_buffer_insert(buff, 3, (tj_buffer_byte *) "d", 1));
+  assert_true(tj_buffer_insert(buff, 5, (tj_buffer_byte *) "fgh", 3));
+  tj_buffer_erase(buff, 6, 1);
+  assert_string_equal(tj_buffer_getAsString(buff), "abcdefh");
+
+  //-- Appends close the gap first
+  assert_true(tj_buffer_insert(buff, 0, (tj_buffer_byte *) ">", 1));
+  assert_true(tj_buffer_appendAsString(buff, "<"));
+  assert_string_equal(tj_buffer_getAsString(buff), ">abcdefh<");
+
+  //-- Clustered edits in a large buffer
+  tj_buffer_reset(buff);
+  for (i = 0; i < 10000; i++)
+    assert_true(tj_buffer_append(buff, (tj_buffer_byte *) "-", 1));
+  for (i = 0; i < 1000; i++)
+    assert_true(tj_buffer_replaceRange(buff, 5000 + i, 1,
+                                       (tj_buffer_byte *) "ab", 2));
+  assert_int_equal(tj_buffer_getUsed(buff), 11000);
+  assert_memory_equal(tj_buffer_getBytesAtIndex(buff, 4999), "-aaa", 4);
+  assert_memory_equal(tj_buffer_getBytesAtIndex(buff, 5998), "aab-", 4);
+
+  tj_buffer_setGapMode(buff, 0);
+}
+
+static void test_insert3(void **state) {
+  tj_buffer *gap = tj_buffer_create(0), *plain = tj_buffer_create(0);
+  tj_buffer_byte data[16];
+  size_t i, n, len, at;
+
+  //-- Gap mode gives the same results as moving every time
+  tj_buffer_setGapMode(gap, 1);
+  srand(7);
+  for (i = 0; i < 5000; i++) {
+    at = tj_buffer_getUsed(plain) ? rand() % (tj_buffer_getUsed(plain) + 1) : 0;
+    len = rand() % 6;
+    n = rand() % 16;
+    memset(data, 'a' + i % 26, n);
+    assert_true(tj_buffer_replaceRange(gap, at, len, data, n));
+    assert_true(tj_buffer_replaceRange(plain, at, len, data, n));
+    assert_int_equal(tj_buffer_getUsed(gap), tj_buffer_getUsed(plain));
+    if (i % 100 == 0)
+      assert_memory_equal(tj_buffer_getBytes(gap), tj_buffer_getBytes(plain),
+                          tj_buffer_getUsed(plain));
+  }
+  assert_memory_equal(tj_buffer_getBytes(gap), tj_buffer_getBytes(plain),
+                      tj_buffer_getUsed(plain));
+
+  tj_buffer_finalize(gap);
+  tj_buffer_finalize(plain);
+}
+
+static void test_freeze1(void **state) {
+  tj_buffer *buff = tj_buffer_create(0);
+  tj_buffer_shared *s, *v, *w;
+  const tj_buffer_byte *bytes;
+
+  assert_true(tj_buffer_appendString(buff, "Hello World"));
+  bytes = tj_buffer_getBytes(buff);
+  assert_non_null(s = tj_buffer_freeze(buff));
+
+  //-- The memory is taken over rather than copied
+  assert_true(tj_buffer_shared_getBytes(s) == bytes);
+  assert_int_equal(tj_buffer_shared_getUsed(s), 12);
+
+  assert_non_null(v = tj_buffer_shared_slice(s, 6, 100));
+  assert_int_equal(tj_buffer_shared_getUsed(v), 6);
+  assert_string_equal(tj_buffer_shared_getBytes(v), "World");
+  assert_non_null(w = tj_buffer_shared_slice(v, 1, 2));
+  assert_memory_equal(tj_buffer_shared_getBytes(w), "or", 2);
+
+  //-- Slices keep the memory alive after the original is released
+  assert_true(tj_buffer_shared_retain(s) == s);
+  tj_buffer_shared_release(s);
+  tj_buffer_shared_release(s);
+  tj_buffer_shared_release(v);
+  assert_memory_equal(tj_buffer_shared_getBytes(w), "or", 2);
+  tj_buffer_shared_release(w);
+}
+
+static void test_freeze2(void **state) {
+  tj_buffer *buff = tj_buffer_create(0);
+  tj_buffer_shared *s;
+  tj_buffer_byte *bytes;
+
+  //-- Memory the buffer does not own is copied
+  assert_true(tj_buffer_appendString(buff, "Hello"));
+  tj_buffer_setOwnership(buff, 0);
+  bytes = tj_buffer_getBytes(buff);
+  assert_non_null(s = tj_buffer_freeze(buff));
+  assert_true(tj_buffer_shared_getBytes(s) != bytes);
+  free(bytes);
+  assert_string_equal(tj_buffer_shared_getBytes(s), "Hello");
+  tj_buffer_shared_release(s);
+
+  assert_non_null(s = tj_buffer_freeze(tj_buffer_create(0)));
+  assert_int_equal(tj_buffer_shared_getUsed(s), 0);
+  tj_buffer_shared_release(s);
+}
+
+static void *release_thread(void *arg) {
+  tj_buffer_shared *s = arg;
+  tj_buffer_shared *v;
+  int i;
+
+  for (i = 0; i < 10000; i++) {
+    v = tj_buffer_shared_slice(tj_buffer_shared_retain(s), i % 16, 4);
+    tj_buffer_shared_release(s);
+    tj_buffer_shared_release(v);
+  }
+  tj_buffer_shared_release(s);
+  return NULL;
+}
+
+static void test_freeze3(void **state) {
+  tj_buffer *buff = tj_buffer_create(0);
+  tj_buffer_shared *s;
+  pthread_t threads[4];
+  int i;
+
+  assert_true(tj_buffer_appendString(buff, "0123456789abcdefghij"));
+  assert_non_null(s = tj_buffer_freeze(buff));
+
+  //-- Each thread is handed a reference, and the last frees it
+  for (i = 0; i < 4; i++)
+    assert_false(pthread_create(&threads[i], NULL, &release_thread,
+                                tj_buffer_shared_retain(s)));
+  tj_buffer_shared_release(s);
+  for (i = 0; i < 4; i++)
+    pthread_join(threads[i], NULL);
+}
+
+static void test_pool1(void **state) {
+  tj_buffer *b;
+  tj_buffer_byte *bytes;
+
+  tj_buffer_pool_enable(1 << 20);
+
+  assert_non_null(b = tj_buffer_create(1000));
+  assert_int_equal(tj_buffer_getAllocated(b), 1024);
+  assert_true(tj_buffer_append(b, (tj_buffer_byte *) "Hello", 5));
+  bytes = tj_buffer_getBytes(b);
+  tj_buffer_finalize(b);
+  assert_int_equal(tj_buffer_pool_getCached(), 1024);
+
+  //-- Handed back out, empty, for any request it can hold
+  assert_non_null(b = tj_buffer_create(700));
+  assert_true(tj_buffer_getBytes(b) == bytes);
+  assert_int_equal(tj_buffer_getUsed(b), 0);
+  assert_int_equal(tj_buffer_getAllocated(b), 1024);
+  assert_int_equal(tj_buffer_pool_getCached(), 0);
+  tj_buffer_finalize(b);
+
+  assert_non_null(b = tj_buffer_create(2000));
+  assert_true(tj_buffer_getBytes(b) != bytes);
+  tj_buffer_finalize(b);
+
+  tj_buffer_pool_trim();
+  assert_int_equal(tj_buffer_pool_getCached(), 0);
+
+  //-- Disabled, sizes are exact and nothing is kept
+  tj_buffer_pool_enable(0);
+  assert_non_null(b = tj_buffer_create(1000));
+  assert_int_equal(tj_buffer_getAllocated(b), 1000);
+  tj_buffer_finalize(b);
+  assert_int_equal(tj_buffer_pool_getCached(), 0);
+}
+
+static void test_pool2(void **state) {
+  tj_buffer *b[4];
+  int i;
+
+  tj_buffer_pool_enable(2048);
+
+  for (i = 0; i < 4; i++)
+    assert_non_null(b[i] = tj_buffer_create(1024));
+  for (i = 0; i < 4; i++)
+    tj_buffer_finalize(b[i]);
+  assert_int_equal(tj_buffer_pool_getCached(), 2048);
+
+  //-- Too large for the pool
+  assert_non_null(b[0] = tj_buffer_create(64 << 20));
+  tj_buffer_finalize(b[0]);
+  assert_int_equal(tj_buffer_pool_getCached(), 2048);
+
+  tj_buffer_pool_enable(0);
+  assert_int_equal(tj_buffer_pool_getCached(), 0);
+}
+
+static void *pool_thread(void *arg) {
+  tj_buffer *b[16];
+  int i, j;
+
+  for (i = 0; i < 1000; i++) {
+    for (j = 0; j < 16; j++) {
+      b[j] = tj_buffer_create(100 + j * 50);
+      assert_non_null(b[j]);
+      assert_true(tj_buffer_getAllocated(b[j]) >= 100 + j * 50);
+      memset(tj_buffer_getBytes(b[j]), j, 100 + j * 50);
+    }
+    for (j = 0; j < 16; j++)
+      tj_buffer_finalize(b[j]);
+  }
+  return NULL;
+}
+
+static void test_pool3(void **state) {
+  pthread_t threads[4];
+  int i;
+
+  tj_buffer_pool_enable(1 << 20);
+
+  //-- Buffers cached by exited threads are handed to the shared pool
+  for (i = 0; i < 4; i++)
+    assert_false(pthread_create(&threads[i], NULL, &pool_thread, NULL));
+  for (i = 0; i < 4; i++)
+    pthread_join(threads[i], NULL);
+  assert_true(tj_buffer_pool_getCached() > 0);
+
+  tj_buffer_pool_enable(0);
+  assert_int_equal(tj_buffer_pool_getCached(), 0);
+}
+
 
 int main(int argc, char *argv[]) {
     if (argc > 0) {
@@ -487,6 +736,18 @@ int main(int argc, char *argv[]) {
         unit_test_setup_teardown(test_escape2, setup, teardown),
         unit_test_setup_teardown(test_escape3, setup, teardown),
         unit_test_setup_teardown(test_escape4, setup, teardown),
+
+        unit_test_setup_teardown(test_insert1, setup, teardown),
+        unit_test_setup_teardown(test_insert2, setup, teardown),
+        unit_test(test_insert3),
+
+        unit_test(test_freeze1),
+        unit_test(test_freeze2),
+        unit_test(test_freeze3),
+
+        unit_test(test_pool1),
+        unit_test(test_pool2),
+        unit_test(test_pool3),
     };
 
     return run_tests(tests);
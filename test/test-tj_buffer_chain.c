@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cmocka.h"
+
+#include "tj_buffer.h"
+#include "tj_buffer_chain.h"
+
+#define SIZE (1024*1024)
+
+struct data {
+    char path[64];
+    char out[64];
+    tj_buffer *expected;
+};
+
+static void setup(void **state) {
+    struct data *data = malloc(sizeof(*data));
+    tj_buffer *content;
+    FILE *fp;
+    int i;
+
+    assert_non_null(data);
+    snprintf(data->path, sizeof(data->path),
+             "/tmp/test-tj_buffer_chain.%d", getpid());
+    snprintf(data->out, sizeof(data->out),
+             "/tmp/test-tj_buffer_chain.%d.out", getpid());
+
+    content = tj_buffer_create(SIZE);
+    for (i = 0; i < SIZE; i++)
+        tj_buffer_getBytes(content)[i] = i * 13;
+    tj_buffer_commit(content, SIZE);
+
+    assert_non_null(fp = fopen(data->path, "wb"));
+    assert_int_equal(fwrite(tj_buffer_getBytes(content), 1, SIZE, fp), SIZE);
+    fclose(fp);
+
+    //-- The chains below are a header, the file, and a trailer
+    data->expected = tj_buffer_create(0);
+    assert_true(tj_buffer_append(data->expected,
+                                 (tj_buffer_byte *) "header\n", 7));
+    assert_true(tj_buffer_appendBuffer(data->expected, content));
+    assert_true(tj_buffer_append(data->expected,
+                                 (tj_buffer_byte *) "trailer\n", 8));
+    tj_buffer_finalize(content);
+
+    *state = data;
+}
+
+static void teardown(void **state) {
+    struct data *data = *state;
+
+    unlink(data->path);
+    unlink(data->out);
+    tj_buffer_finalize(data->expected);
+    free(data);
+}
+
+static tj_buffer_chain *build(struct data *data) {
+    tj_buffer_chain *c;
+    tj_buffer *b;
+
+    assert_non_null(c = tj_buffer_chain_create());
+
+    b = tj_buffer_create(0);
+    assert_true(tj_buffer_append(b, (tj_buffer_byte *) "header\n", 7));
+    assert_true(tj_buffer_chain_appendBuffer(c, b, 1));
+    assert_true(tj_buffer_chain_appendBuffer(c, tj_buffer_create(0), 1));
+    assert_true(tj_buffer_chain_appendFile(c, data->path));
+
+    b = tj_buffer_create(0);
+    assert_true(tj_buffer_append(b, (tj_buffer_byte *) "trailer\n", 8));
+    assert_true(tj_buffer_chain_appendBuffer(c, b, 1));
+
+    assert_int_equal(tj_buffer_chain_getLength(c), SIZE + 15);
+    return c;
+}
+
+static void test_file(void **state) {
+    struct data *data = *state;
+    tj_buffer_chain *c;
+    tj_buffer *b;
+    int fd;
+
+    c = build(data);
+
+    b = tj_buffer_create(0);
+    assert_true(tj_buffer_chain_appendTo(c, b));
+    assert_int_equal(tj_buffer_getUsed(b), SIZE + 15);
+    assert_memory_equal(tj_buffer_getBytes(b),
+                        tj_buffer_getBytes(data->expected), SIZE + 15);
+    tj_buffer_finalize(b);
+
+    fd = open(data->out, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    assert_true(fd != -1);
+    assert_int_equal(tj_buffer_chain_write(c, fd), SIZE + 15);
+    assert_int_equal(tj_buffer_chain_getLength(c), 0);
+    close(fd);
+    tj_buffer_chain_finalize(c);
+
+    b = tj_buffer_create(0);
+    assert_true(tj_buffer_appendFile(b, data->out));
+    assert_int_equal(tj_buffer_getUsed(b), SIZE + 15);
+    assert_memory_equal(tj_buffer_getBytes(b),
+                        tj_buffer_getBytes(data->expected), SIZE + 15);
+    tj_buffer_finalize(b);
+}
+
+static void test_socket(void **state) {
+    struct data *data = *state;
+    tj_buffer_chain *c;
+    tj_buffer *b;
+    int fds[2], fd, writes = 0;
+    ssize_t n;
+
+    assert_false(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+    c = build(data);
+
+    //-- A range of a descriptor the chain does not own
+    fd = open(data->path, O_RDONLY);
+    assert_true(fd != -1);
+    assert_true(tj_buffer_chain_appendFileRange(c, fd, 10, 100));
+
+    b = tj_buffer_create(0);
+    while (tj_buffer_chain_getLength(c) > 0) {
+        assert_true(tj_buffer_chain_write(c, fds[0]) >= 0);
+        writes++;
+        for (;;) {
+            assert_true(tj_buffer_reserve(b, 65536));
+            n = read(fds[1], tj_buffer_getBytesAtIndex(b, tj_buffer_getUsed(b)),
+                     65536);
+            if (n <= 0)
+                break;
+            tj_buffer_commit(b, n);
+        }
+    }
+
+    //-- The socket could not take it all at once
+    assert_true(writes > 1);
+    assert_int_equal(tj_buffer_getUsed(b), SIZE + 15 + 100);
+    assert_memory_equal(tj_buffer_getBytes(b),
+                        tj_buffer_getBytes(data->expected), SIZE + 15);
+    assert_memory_equal(tj_buffer_getBytesAtIndex(b, SIZE + 15),
+                        tj_buffer_getBytesAtIndex(data->expected, 7 + 10),
+                        100);
+
+    //-- The unowned descriptor is left open
+    assert_true(fcntl(fd, F_GETFD) != -1);
+    close(fd);
+
+    tj_buffer_finalize(b);
+    tj_buffer_chain_finalize(c);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void test_shared(void **state) {
+    tj_buffer_chain *c;
+    tj_buffer_shared *s, *v;
+    tj_buffer *b;
+
+    b = tj_buffer_create(0);
+    assert_true(tj_buffer_append(b, (tj_buffer_byte *) "shared ", 7));
+    assert_non_null(s = tj_buffer_freeze(b));
+    assert_non_null(v = tj_buffer_shared_slice(s, 0, 3));
+
+    assert_non_null(c = tj_buffer_chain_create());
+    assert_true(tj_buffer_chain_appendShared(c, s));
+    assert_true(tj_buffer_chain_appendShared(c, s));
+    assert_true(tj_buffer_chain_appendShared(c, v));
+
+    //-- The chain holds its own references
+    tj_buffer_shared_release(s);
+    tj_buffer_shared_release(v);
+
+    b = tj_buffer_create(0);
+    assert_true(tj_buffer_chain_appendTo(c, b));
+    assert_int_equal(tj_buffer_getUsed(b), 17);
+    assert_memory_equal(tj_buffer_getBytes(b), "shared shared sha", 17);
+    tj_buffer_finalize(b);
+    tj_buffer_chain_finalize(c);
+}
+
+static void test_unwritten(void **state) {
+    struct data *data = *state;
+    tj_buffer_chain *c;
+
+    //-- Owned segments are released even if never written
+    c = build(data);
+    assert_false(tj_buffer_chain_appendFile(c, "/nonexistent/file"));
+    assert_int_equal(tj_buffer_chain_getLength(c), SIZE + 15);
+    tj_buffer_chain_finalize(c);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(test_file, setup, teardown),
+        unit_test_setup_teardown(test_socket, setup, teardown),
+        unit_test(test_shared),
+        unit_test_setup_teardown(test_unwritten, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdarg.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cmocka.h"
+
+#include "tj_filter.h"
+#include "tj_hash.h"
+
+#define KEYS 100000
+
+static void test_sizing(void **state) {
+    //-- The estimate falls with more bits, near an unblocked filter's
+    assert_true(tj_filter_bloom_estimate(10) < 0.012);
+    assert_true(tj_filter_bloom_estimate(10) > 0.008);
+    assert_true(tj_filter_bloom_estimate(16) < tj_filter_bloom_estimate(10));
+
+    assert_true(tj_filter_bloom_sizeFor(KEYS, 0.01) >= KEYS * 10 / 8);
+    assert_true(tj_filter_bloom_sizeFor(KEYS, 0.01) <= KEYS * 12 / 8);
+    assert_true(tj_filter_bloom_sizeFor(KEYS, 0.001) >
+                tj_filter_bloom_sizeFor(KEYS, 0.01));
+    assert_int_equal(tj_filter_bloom_sizeFor(0, 0.01), 64);
+    assert_int_equal(tj_filter_bloom_sizeFor(KEYS, 0) % 64, 0);
+
+    assert_int_equal(tj_filter_cuckoo_sizeFor(1), 8);
+    assert_int_equal(tj_filter_cuckoo_sizeFor(4), 16);
+    assert_int_equal(tj_filter_cuckoo_sizeFor(KEYS), 32768 * 8);
+}
+
+static void test_bloom(void **state) {
+    tj_filter_bloom *f;
+    size_t i, fp = 0;
+    char key[32];
+
+    assert_non_null(f = tj_filter_bloom_create(KEYS, 0.01));
+    for (i = 0; i < KEYS; i++) {
+        snprintf(key, sizeof(key), "key-%zu", i);
+        tj_filter_bloom_add(f, key, strlen(key));
+    }
+
+    for (i = 0; i < KEYS; i++) {
+        snprintf(key, sizeof(key), "key-%zu", i);
+        assert_true(tj_filter_bloom_contains(f, key, strlen(key)));
+        snprintf(key, sizeof(key), "other-%zu", i);
+        fp += tj_filter_bloom_contains(f, key, strlen(key));
+    }
+    assert_in_range(fp, KEYS / 200, KEYS / 50);
+
+    assert_true(tj_filter_bloom_containsHash(f, tj_hash_string("key-7")));
+    tj_filter_bloom_finalize(f);
+}
+
+static void test_cuckoo(void **state) {
+    tj_filter_cuckoo *f;
+    size_t i, fp = 0;
+    char key[32];
+
+    assert_non_null(f = tj_filter_cuckoo_create(KEYS));
+    for (i = 0; i < KEYS; i++) {
+        snprintf(key, sizeof(key), "key-%zu", i);
+        assert_true(tj_filter_cuckoo_add(f, key, strlen(key)));
+    }
+    assert_int_equal(tj_filter_cuckoo_getCount(f), KEYS);
+
+    for (i = 0; i < KEYS; i++) {
+        snprintf(key, sizeof(key), "key-%zu", i);
+        assert_true(tj_filter_cuckoo_contains(f, key, strlen(key)));
+        snprintf(key, sizeof(key), "other-%zu", i);
+        fp += tj_filter_cuckoo_contains(f, key, strlen(key));
+    }
+    assert_true(fp < KEYS / 1000);
+
+    //-- Removing half leaves the rest
+    for (i = 0; i < KEYS; i += 2) {
+        snprintf(key, sizeof(key), "key-%zu", i);
+        assert_true(tj_filter_cuckoo_remove(f, key, strlen(key)));
+    }
+    assert_int_equal(tj_filter_cuckoo_getCount(f), KEYS / 2);
+    for (i = 1; i < KEYS; i += 2) {
+        snprintf(key, sizeof(key), "key-%zu", i);
+        assert_true(tj_filter_cuckoo_contains(f, key, strlen(key)));
+    }
+    for (i = 0, fp = 0; i < KEYS; i += 2) {
+        snprintf(key, sizeof(key), "key-%zu", i);
+        fp += tj_filter_cuckoo_contains(f, key, strlen(key));
+    }
+    assert_true(fp < KEYS / 1000);
+
+    //-- Keys are counted
+    assert_true(tj_filter_cuckoo_add(f, "twice", 5));
+    assert_true(tj_filter_cuckoo_add(f, "twice", 5));
+    assert_true(tj_filter_cuckoo_remove(f, "twice", 5));
+    assert_true(tj_filter_cuckoo_contains(f, "twice", 5));
+    assert_true(tj_filter_cuckoo_remove(f, "twice", 5));
+    assert_false(tj_filter_cuckoo_contains(f, "twice", 5));
+    assert_false(tj_filter_cuckoo_remove(f, "twice", 5));
+
+    tj_filter_cuckoo_finalize(f);
+}
+
+static void test_full(void **state) {
+    tj_filter_cuckoo *f;
+    uint64_t i, n;
+
+    //-- Fills well past the sizing load before refusing keys
+    assert_non_null(f = tj_filter_cuckoo_create(1000));
+    for (n = 0; tj_filter_cuckoo_addHash(f, tj_hash_uint64(n)); n++)
+        ;
+    assert_true(n * 8 > tj_filter_cuckoo_getSize(f) * 4 * 9 / 10);
+    assert_int_equal(tj_filter_cuckoo_getCount(f), n);
+    for (i = 0; i < n; i++)
+        assert_true(tj_filter_cuckoo_containsHash(f, tj_hash_uint64(i)));
+
+    //-- Removing a key makes room again, keeping every other
+    assert_true(tj_filter_cuckoo_removeHash(f, tj_hash_uint64(0)));
+    assert_true(tj_filter_cuckoo_addHash(f, tj_hash_uint64(n)));
+    for (i = 1; i <= n; i++)
+        assert_true(tj_filter_cuckoo_containsHash(f, tj_hash_uint64(i)));
+
+    tj_filter_cuckoo_finalize(f);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test(test_sizing),
+        unit_test(test_bloom),
+        unit_test(test_cuckoo),
+        unit_test(test_full),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdarg.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cmocka.h"
+
+#include "tj_hash.h"
+
+static void test_bytes(void **state) {
+    const char *s = "the quick brown fox jumps over the lazy dog";
+    char copy[64];
+    size_t n;
+
+    //-- Independent of alignment, and of bytes past the end
+    memset(copy, 'x', sizeof(copy));
+    memcpy(copy + 3, s, strlen(s));
+    assert_true(tj_hash_bytes(copy + 3, strlen(s), 0) == tj_hash_string(s));
+    assert_true(tj_hash_bytes(s, 5, 0) == tj_hash_bytes(copy + 3, 5, 0));
+
+    //-- Every prefix, and every seed, hashes differently
+    for (n = 1; n <= strlen(s); n++) {
+        assert_true(tj_hash_bytes(s, n, 0) != tj_hash_bytes(s, n - 1, 0));
+        assert_true(tj_hash_bytes(s, n, 0) != tj_hash_bytes(s, n, 1));
+    }
+
+    //-- Trailing zero bytes still change the hash
+    memset(copy, 0, sizeof(copy));
+    assert_true(tj_hash_bytes(copy, 3, 0) != tj_hash_bytes(copy, 4, 0));
+    assert_true(tj_hash_bytes(copy, 8, 0) != tj_hash_bytes(copy, 9, 0));
+}
+
+static void test_avalanche(void **state) {
+    uint64_t key, h, flipped;
+    int bit, changed = 0, trials = 0;
+
+    //-- Flipping any input bit flips about half the output bits
+    for (key = 1; key < 1000; key++) {
+        h = tj_hash_bytes(&key, sizeof(key), 0);
+        for (bit = 0; bit < 64; bit++) {
+            flipped = key ^ (1ULL << bit);
+            changed += __builtin_popcountll(
+                h ^ tj_hash_bytes(&flipped, sizeof(flipped), 0));
+            trials++;
+        }
+        assert_true(tj_hash_uint64(key) != tj_hash_uint64(key + 1));
+    }
+
+    assert_in_range(changed * 100 / trials, 3100, 3300);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test(test_bytes),
+        unit_test(test_avalanche),
+    };
+
+    return run_tests(tests);
+}
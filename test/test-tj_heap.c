@@ -153,6 +153,23 @@ static void test_int_find(void **state) {
     assert_false(intheap_pop(heap, &k, &v));
 }
 
+static void test_int_interleaved(void **state) {
+    intheap *heap = *state;
+    int i, k, last = -1;
+    char *v;
+
+    //-- Mixing adds and pops, as a merge does, keeps pops in order
+    srand(7);
+    for (i = 0; i < 64; i++)
+        assert_true(intheap_add(heap, rand() % 1000, "x"));
+    for (i = 0; i < 2000; i++) {
+        assert_true(intheap_pop(heap, &k, &v));
+        assert_true(k >= last);
+        last = k;
+        assert_true(intheap_add(heap, last + rand() % 1000, "x"));
+    }
+}
+
 static void test_float_max(void **state) {
     floatheap *heap = *state;
 
@@ -179,6 +196,8 @@ int main(int argc, char *argv[0]) {
     const UnitTest tests[] = {
         unit_test_setup_teardown(test_int_min, int_setup, int_teardown),
         unit_test_setup_teardown(test_int_find, int_setup, int_teardown),
+        unit_test_setup_teardown(test_int_interleaved, int_setup,
+                int_teardown),
         unit_test_setup_teardown(test_float_max, float_setup, float_teardown),
     };
 
@@ -22,11 +22,15 @@
  * SOFTWARE.
  */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "cmocka.h"
 
@@ -40,6 +44,8 @@
 // Defines an option log output channel
 #include "tj_log_sqlite.h"
 
+TJ_LOG_SITES_REGISTER()
+
 struct args {
     tj_log_level level;
     char *component;
@@ -89,11 +95,320 @@ static void test_1(void **state) {
     free(args.file);
     free(args.func);
     free(args.msg);
+
+    tj_log_removeOutChannel(out);
+}
+
+struct site_args {
+    const tj_log_site *site;
+    int count;
+    char msg[64];
+};
+
+static void site_func(void *data, const tj_log_site *site, tj_error *error,
+        const char *msg) {
+    struct site_args *args = data;
+
+    args->site = site;
+    args->count++;
+    strncpy(args->msg, msg, sizeof(args->msg)-1);
+}
+
+static void log_site(int i) {
+    TJ_LOG_SITE_OUTPUT(TAG, "Site: %d", i);
+}
+
+static void test_sites(void **state) {
+    struct site_args args;
+    const tj_log_site *site;
+    tj_log_site *s;
+    int found = 0, tagged = 0;
+
+    memset(&args, 0, sizeof(args));
+
+    tj_log_outchannel *out = tj_log_outchannel_createSite(&args,
+            &site_func, NULL);
+    assert_non_null(out);
+    assert_false(tj_log_addOutChannel(out));
+    assert_true(tj_log_removePrintfChannel() == 0);
+
+    log_site(1);
+    assert_int_equal(args.count, 1);
+    assert_string_equal(args.msg, "Site: 1");
+    site = args.site;
+    assert_non_null(site);
+    assert_int_equal(site->m_level, TJ_LOG_LEVEL_OUTPUT);
+    assert_string_equal(site->m_component, TAG);
+    assert_string_equal(site->m_func, "log_site");
+    assert_string_equal(site->m_format, "Site: %d");
+    assert_true(site->m_id != 0);
+
+    //-- The same site is passed on every call
+    log_site(2);
+    assert_int_equal(args.count, 2);
+    assert_true(args.site == site);
+
+    //-- Every site in this executable is known before it logs
+    for (s = tj_log_getSites(); s != 0; s = s->m_next) {
+        if (s == site)
+            found++;
+        if (!strcmp(s->m_func, "test_sites"))
+            found++;
+        if (!strcmp(s->m_component, TAG))
+            tagged++;
+    }
+    assert_int_equal(found, 2);
+
+    assert_int_equal(tj_log_setSitesEnabled(TAG, TJ_LOG_LEVEL_OUTPUT, 0),
+                     tagged);
+    log_site(3);
+    assert_int_equal(args.count, 2);
+    assert_int_equal(tj_log_setSitesEnabled(TAG, TJ_LOG_LEVEL_OUTPUT, 1),
+                     tagged);
+
+    //-- Plain logging takes runtime values, through a transient site
+    {
+        char component[] = "runtime";
+        tj_log_level level = TJ_LOG_LEVEL_OUTPUT;
+        TJ_LOG_LOG(level, component, 0, "Runtime: %d", 4);
+    }
+    assert_int_equal(args.count, 3);
+    assert_string_equal(args.msg, "Runtime: 4");
+    assert_true(args.site != site);
+
+    TJ_LOG_SITE_CRITICAL(TAG, "Registered before it first logs.");
+    tj_log_removeOutChannel(out);
+}
+
+static void slow_func(void *data, const tj_log_site *site, tj_error *error,
+        const char *msg) {
+    struct site_args *args = data;
+
+    usleep(2000);
+    args->site = site;
+    args->count++;
+    strncpy(args->msg, msg, sizeof(args->msg)-1);
+}
+
+static void test_queue(void **state) {
+    struct site_args slow, fast;
+    tj_log_outchannel *outSlow, *outFast;
+    int i;
+
+    memset(&slow, 0, sizeof(slow));
+    memset(&fast, 0, sizeof(fast));
+
+    outSlow = tj_log_outchannel_createSite(&slow, &slow_func, NULL);
+    assert_non_null(outSlow);
+    assert_false(tj_log_outchannel_setQueue(outSlow, 2,
+                                            TJ_LOG_QUEUE_DROPNEWEST));
+    outFast = tj_log_outchannel_createSite(&fast, &site_func, NULL);
+    assert_non_null(outFast);
+
+    assert_false(tj_log_addOutChannel(outSlow));
+    assert_false(tj_log_addOutChannel(outFast));
+
+    //-- The fast channel sees every message, the slow one drops some
+    for (i = 0; i < 20; i++)
+        TJ_LOG_LOG(TJ_LOG_LEVEL_OUTPUT, TAG, 0, "Queued: %d", i);
+    assert_int_equal(fast.count, 20);
+    assert_string_equal(fast.msg, "Queued: 19");
+
+    tj_log_outchannel_flush(outSlow);
+    assert_true(tj_log_outchannel_getDropped(outSlow) > 0);
+    assert_int_equal(slow.count + tj_log_outchannel_getDropped(outSlow), 20);
+
+    tj_log_removeOutChannel(outFast);
+    tj_log_removeOutChannel(outSlow);
+
+    //-- Blocking loses nothing, and copies transient metadata
+    memset(&slow, 0, sizeof(slow));
+    outSlow = tj_log_outchannel_create(&slow, &log_func, NULL);
+    assert_non_null(outSlow);
+    assert_false(tj_log_outchannel_setQueue(outSlow, 1, TJ_LOG_QUEUE_BLOCK));
+    assert_false(tj_log_addOutChannel(outSlow));
+
+    struct args args;
+    memset(&args, 0, sizeof(args));
+    tj_log_setData(outSlow, &args);
+    {
+        char component[] = "transient";
+        tj_log_log(TJ_LOG_LEVEL_CRITICAL, component, "f.c", "fn", 7, NULL,
+                   "Blocked: %d", 1);
+        memset(component, 0, sizeof(component));
+    }
+    tj_log_outchannel_flush(outSlow);
+    assert_string_equal(args.component, "transient");
+    assert_string_equal(args.msg, "Blocked: 1");
+    assert_int_equal(args.line, 7);
+    assert_int_equal(tj_log_outchannel_getDropped(outSlow), 0);
+
+    free(args.component);
+    free(args.file);
+    free(args.func);
+    free(args.msg);
+    tj_log_removeOutChannel(outSlow);
+}
+
+static void nested_func(void *data, const tj_log_site *site,
+        tj_error *error, const char *msg) {
+    struct site_args *args = data;
+
+    if (!strncmp(msg, "Nested", 6))
+        return;
+    args->count++;
+    TJ_LOG_LOG(TJ_LOG_LEVEL_CRITICAL, TAG, 0, "Nested: %s", msg);
+    TJ_LOG_LOG(TJ_LOG_LEVEL_CRITICAL, TAG, 0, "Nested again: %s", msg);
+}
+
+static void test_queue_nested(void **state) {
+    struct site_args args;
+    tj_log_outchannel *out;
+    int i;
+
+    //-- The second message from the sink finds its own queue full
+    memset(&args, 0, sizeof(args));
+    out = tj_log_outchannel_createSite(&args, &nested_func, NULL);
+    assert_non_null(out);
+    assert_false(tj_log_outchannel_setQueue(out, 1, TJ_LOG_QUEUE_BLOCK));
+    assert_false(tj_log_addOutChannel(out));
+
+    for (i = 0; i < 4; i++)
+        TJ_LOG_LOG(TJ_LOG_LEVEL_OUTPUT, TAG, 0, "Outer: %d", i);
+    tj_log_outchannel_flush(out);
+
+    assert_int_equal(args.count, 4);
+    assert_true(tj_log_outchannel_getDropped(out) > 0);
+    tj_log_removeOutChannel(out);
+}
+
+static void test_unregister(void **state) {
+    static tj_log_site sites[2] = {
+        { TJ_LOG_LEVEL_OUTPUT, "plugin", "plugin.c", "plugin_fn", 1,
+          "Plugin: %d", 1, 0, 0 },
+        { TJ_LOG_LEVEL_OUTPUT, "plugin", "plugin.c", "plugin_fn", 2,
+          "Plugin: %d", 1, 0, 0 },
+    };
+    struct site_args slow;
+    tj_log_outchannel *out;
+    tj_log_site *s;
+    int found = 0;
+
+    memset(&slow, 0, sizeof(slow));
+    out = tj_log_outchannel_createSite(&slow, &slow_func, NULL);
+    assert_non_null(out);
+    assert_false(tj_log_outchannel_setQueue(out, 4, TJ_LOG_QUEUE_BLOCK));
+    assert_false(tj_log_addOutChannel(out));
+
+    tj_log_registerSites(sites, sites+2);
+    for (s = tj_log_getSites(); s != 0; s = s->m_next)
+        found += (s == &sites[0] || s == &sites[1]);
+    assert_int_equal(found, 2);
+
+    //-- Records still queued are delivered before the sites go away
+    tj_log_logSite(&sites[0], NULL, "Plugin: %d", 1);
+    tj_log_logSite(&sites[1], NULL, "Plugin: %d", 2);
+    tj_log_unregisterSites(sites, sites+2);
+    assert_int_equal(slow.count, 2);
+    assert_true(slow.site == &sites[1]);
+    assert_string_equal(slow.msg, "Plugin: 2");
+
+    for (s = tj_log_getSites(); s != 0; s = s->m_next)
+        assert_true(s != &sites[0] && s != &sites[1]);
+    assert_int_equal(tj_log_setSitesEnabled("plugin", TJ_LOG_LEVEL_OUTPUT,
+                                            0), 0);
+
+    tj_log_removeOutChannel(out);
+}
+
+#define MERGE_THREADS 4
+#define MERGE_COUNT 200
+
+struct merge_args {
+    int count;
+    int last[MERGE_THREADS];
+    int misordered;
+};
+
+static void merge_func(void *data, const tj_log_site *site, tj_error *error,
+        const char *msg) {
+    struct merge_args *args = data;
+    int t, i;
+
+    assert_int_equal(sscanf(msg, "Merged: %d %d", &t, &i), 2);
+    if (i != args->last[t] + 1)
+        args->misordered++;
+    args->last[t] = i;
+    args->count++;
+}
+
+static void *merge_thread(void *arg) {
+    int t = (int) (intptr_t) arg, i;
+
+    for (i = 0; i < MERGE_COUNT; i++) {
+        TJ_LOG_LOG(TJ_LOG_LEVEL_OUTPUT, TAG, 0, "Merged: %d %d", t, i);
+        if (i % 50 == 0)
+            usleep(1000);
+    }
+
+    return NULL;
+}
+
+static void test_threads(void **state) {
+    struct merge_args args;
+    tj_log_outchannel *out;
+    pthread_t threads[MERGE_THREADS];
+    int i;
+
+    memset(&args, 0, sizeof(args));
+    for (i = 0; i < MERGE_THREADS; i++)
+        args.last[i] = -1;
+
+    out = tj_log_outchannel_createSite(&args, &merge_func, NULL);
+    assert_non_null(out);
+    assert_false(tj_log_outchannel_setThreadBuffers(out, 65536, 5));
+    assert_true(tj_log_outchannel_setQueue(out, 4, TJ_LOG_QUEUE_BLOCK));
+    assert_false(tj_log_addOutChannel(out));
+
+    for (i = 0; i < MERGE_THREADS; i++)
+        assert_false(pthread_create(&threads[i], NULL, &merge_thread,
+                                    (void *) (intptr_t) i));
+    for (i = 0; i < MERGE_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    //-- Each thread's messages arrive whole and in their own order
+    tj_log_outchannel_flush(out);
+    assert_int_equal(args.count, MERGE_THREADS * MERGE_COUNT);
+    assert_int_equal(args.misordered, 0);
+    assert_int_equal(tj_log_outchannel_getDropped(out), 0);
+
+    //-- A ring too small for the burst drops rather than blocks
+    memset(&args, 0, sizeof(args));
+    tj_log_removeOutChannel(out);
+    out = tj_log_outchannel_createSite(&args, &merge_func, NULL);
+    assert_non_null(out);
+    assert_false(tj_log_outchannel_setThreadBuffers(out, 4096, 60000));
+    assert_false(tj_log_addOutChannel(out));
+
+    for (i = 0; i < MERGE_COUNT; i++)
+        TJ_LOG_LOG(TJ_LOG_LEVEL_OUTPUT, TAG, 0, "Merged: %d %d", 0, i);
+    assert_int_equal(args.count, 0);
+    tj_log_outchannel_flush(out);
+    assert_true(tj_log_outchannel_getDropped(out) > 0);
+    assert_int_equal(args.count + tj_log_outchannel_getDropped(out),
+                     MERGE_COUNT);
+
+    tj_log_removeOutChannel(out);
 }
 
 int main(int argc, char **argv) {
     const UnitTest tests[] = {
         unit_test(test_1),
+        unit_test(test_sites),
+        unit_test(test_queue),
+        unit_test(test_queue_nested),
+        unit_test(test_unregister),
+        unit_test(test_threads),
     };
 
     return run_tests(tests);
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cmocka.h"
+
+#define TAG "test-tj_log_segment"
+#include "tj_log_segment.h"
+
+TJ_LOG_SITES_REGISTER()
+
+#define THREADS 4
+#define COUNT 500
+
+static char base[64];
+
+static char *segment(int sequence) {
+    static char path[80];
+    snprintf(path, sizeof(path), "%s.%06d", base, sequence);
+    return path;
+}
+
+static void setup(void **state) {
+    snprintf(base, sizeof(base), "/tmp/test-tj_log_segment.%d", getpid());
+    tj_log_removePrintfChannel();
+}
+
+static void teardown(void **state) {
+    int i;
+
+    for (i = 0; unlink(segment(i)) == 0; i++)
+        ;
+}
+
+static void test_roundtrip(void **state) {
+    tj_log_segment_reader *r;
+    tj_log_segment_entry e;
+    tj_log_outchannel *out;
+    int i;
+
+    out = tj_log_segment_create(base, 1 << 16);
+    assert_non_null(out);
+    assert_false(tj_log_addOutChannel(out));
+
+    r = tj_log_segment_reader_open(segment(0));
+    assert_non_null(r);
+    assert_false(tj_log_segment_reader_next(r, &e));
+
+    for (i = 0; i < 2; i++)
+        TJ_LOG_SITE_OUTPUT(TAG, "Hello: %d", i);
+    tj_log_log(TJ_LOG_LEVEL_CRITICAL, "dynamic", "f.c", "fn", 7, NULL,
+               "Inline");
+
+    //-- Interned and inline sites read back the same
+    for (i = 0; i < 2; i++) {
+        assert_true(tj_log_segment_reader_next(r, &e));
+        assert_int_equal(e.m_level, TJ_LOG_LEVEL_OUTPUT);
+        assert_int_equal(e.m_pid, getpid());
+        assert_string_equal(e.m_component, TAG);
+        assert_string_equal(e.m_func, "test_roundtrip");
+        assert_string_equal(e.m_msg, i ? "Hello: 1" : "Hello: 0");
+        assert_true(e.m_time > 0);
+    }
+
+    assert_true(tj_log_segment_reader_next(r, &e));
+    assert_int_equal(e.m_level, TJ_LOG_LEVEL_CRITICAL);
+    assert_string_equal(e.m_component, "dynamic");
+    assert_string_equal(e.m_file, "f.c");
+    assert_string_equal(e.m_func, "fn");
+    assert_int_equal(e.m_line, 7);
+    assert_string_equal(e.m_msg, "Inline");
+    assert_false(tj_log_segment_reader_next(r, &e));
+
+    tj_log_removeOutChannel(out);
+    assert_false(tj_log_segment_reader_next(r, &e));
+    assert_int_equal(tj_log_segment_reader_getLost(r), 0);
+    tj_log_segment_reader_finalize(r);
+
+    //-- A new channel keeps the earlier segment
+    out = tj_log_segment_create(base, 4096);
+    assert_non_null(out);
+    assert_false(tj_log_addOutChannel(out));
+    tj_log_removeOutChannel(out);
+    assert_int_equal(access(segment(1), R_OK), 0);
+
+    assert_null(tj_log_segment_reader_open("/tmp/no-sequence"));
+}
+
+static void *log_thread(void *arg) {
+    int t = (int) (intptr_t) arg, i;
+
+    for (i = 0; i < COUNT; i++)
+        OUTPUT("Thread %d %d", t, i);
+
+    return NULL;
+}
+
+static void test_follow(void **state) {
+    pthread_t threads[THREADS];
+    int last[THREADS], count = 0, t, i;
+    tj_log_segment_reader *r;
+    tj_log_segment_entry e;
+    tj_log_outchannel *out;
+    tj_log_segment_header h;
+    struct stat st;
+    int fd;
+
+    out = tj_log_segment_create(base, 4096);
+    assert_non_null(out);
+    assert_false(tj_log_addOutChannel(out));
+
+    r = tj_log_segment_reader_open(segment(0));
+    assert_non_null(r);
+
+    for (t = 0; t < THREADS; t++) {
+        last[t] = -1;
+        assert_false(pthread_create(&threads[t], NULL, &log_thread,
+                                    (void *) (intptr_t) t));
+    }
+
+    //-- Read alongside the writers, across many small segments
+    while (count < THREADS * COUNT) {
+        if (!tj_log_segment_reader_next(r, &e)) {
+            usleep(100);
+            continue;
+        }
+        assert_int_equal(sscanf(e.m_msg, "Thread %d %d", &t, &i), 2);
+        assert_int_equal(i, last[t] + 1);
+        last[t] = i;
+        count++;
+    }
+
+    for (t = 0; t < THREADS; t++)
+        pthread_join(threads[t], NULL);
+    tj_log_removeOutChannel(out);
+
+    assert_false(tj_log_segment_reader_next(r, &e));
+    assert_int_equal(tj_log_segment_reader_getLost(r), 0);
+    assert_string_not_equal(tj_log_segment_reader_getPath(r), segment(0));
+    tj_log_segment_reader_finalize(r);
+
+    //-- Finished segments are cut down to what was written
+    assert_int_equal(stat(segment(1), &st), 0);
+    for (i = 0; (fd = open(segment(i), O_RDONLY)) != -1; i++) {
+        assert_int_equal(fstat(fd, &st), 0);
+        assert_int_equal(pread(fd, &h, sizeof(h), 0), sizeof(h));
+        close(fd);
+        assert_int_equal(h.m_sealed, 1);
+        assert_int_equal(st.st_size, sizeof(h) + h.m_write);
+    }
+}
+
+static void test_writers(void **state) {
+    tj_log_segment_reader *r;
+    tj_log_segment_entry e;
+    tj_log_outchannel *out;
+
+    out = tj_log_segment_create(base, 4096);
+    assert_non_null(out);
+    assert_false(tj_log_addOutChannel(out));
+    OUTPUT("First writer");
+    tj_log_removeOutChannel(out);
+
+    //-- A second writer on the same base takes the following segment
+    out = tj_log_segment_create(base, 4096);
+    assert_non_null(out);
+    assert_false(tj_log_addOutChannel(out));
+    OUTPUT("Second writer");
+    tj_log_removeOutChannel(out);
+
+    r = tj_log_segment_reader_open(segment(0));
+    assert_non_null(r);
+    assert_true(tj_log_segment_reader_next(r, &e));
+    assert_string_equal(e.m_msg, "First writer");
+    assert_false(tj_log_segment_reader_next(r, &e));
+    assert_true(tj_log_segment_reader_isStopped(r));
+    assert_string_equal(tj_log_segment_reader_getPath(r), segment(0));
+    tj_log_segment_reader_finalize(r);
+
+    r = tj_log_segment_reader_open(segment(1));
+    assert_non_null(r);
+    assert_true(tj_log_segment_reader_next(r, &e));
+    assert_string_equal(e.m_msg, "Second writer");
+    assert_false(tj_log_segment_reader_isStopped(r));
+    tj_log_segment_reader_finalize(r);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(test_roundtrip, setup, teardown),
+        unit_test_setup_teardown(test_follow, setup, teardown),
+        unit_test_setup_teardown(test_writers, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
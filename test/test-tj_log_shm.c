@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cmocka.h"
+
+#define TAG "test-tj_log_shm"
+#include "tj_log_shm.h"
+
+static char ring[64];
+
+static void setup(void **state) {
+    snprintf(ring, sizeof(ring), "/test-tj_log_shm.%d", getpid());
+    tj_log_removePrintfChannel();
+}
+
+static void teardown(void **state) {
+    shm_unlink(ring);
+}
+
+static void test_roundtrip(void **state) {
+    tj_log_shm_reader *r;
+    tj_log_shm_entry e;
+    tj_log_outchannel *out;
+
+    out = tj_log_shm_create(ring, 1 << 16);
+    assert_non_null(out);
+    assert_false(tj_log_addOutChannel(out));
+
+    r = tj_log_shm_reader_open(ring);
+    assert_non_null(r);
+    assert_int_equal(tj_log_shm_reader_getPid(r), getpid());
+    assert_false(tj_log_shm_reader_next(r, &e));
+
+    OUTPUT("Hello: %s", "World");
+    CRITICAL("Second");
+
+    assert_true(tj_log_shm_reader_next(r, &e));
+    assert_int_equal(e.m_level, TJ_LOG_LEVEL_OUTPUT);
+    assert_int_equal(e.m_pid, getpid());
+    assert_string_equal(e.m_component, TAG);
+    assert_string_equal(e.m_func, "test_roundtrip");
+    assert_string_equal(e.m_msg, "Hello: World");
+    assert_true(e.m_time > 0);
+
+    assert_true(tj_log_shm_reader_next(r, &e));
+    assert_int_equal(e.m_level, TJ_LOG_LEVEL_CRITICAL);
+    assert_string_equal(e.m_msg, "Second");
+    assert_false(tj_log_shm_reader_next(r, &e));
+    assert_int_equal(tj_log_shm_reader_getLost(r), 0);
+
+    tj_log_removeOutChannel(out);
+    tj_log_shm_reader_finalize(r);
+}
+
+static void test_wrap(void **state) {
+    tj_log_shm_reader *r, *late;
+    tj_log_shm_entry e;
+    tj_log_outchannel *out;
+    char expect[32];
+    int i, next;
+
+    out = tj_log_shm_create(ring, 4096);
+    assert_non_null(out);
+    assert_false(tj_log_addOutChannel(out));
+
+    r = tj_log_shm_reader_open(ring);
+    assert_non_null(r);
+
+    //-- A reader keeping up sees every record across many wraps
+    for (i = 0; i < 1000; i++) {
+        OUTPUT("Record %d", i);
+        snprintf(expect, sizeof(expect), "Record %d", i);
+        assert_true(tj_log_shm_reader_next(r, &e));
+        assert_string_equal(e.m_msg, expect);
+    }
+    assert_int_equal(tj_log_shm_reader_getLost(r), 0);
+
+    //-- One falling behind loses the oldest, then resumes in order
+    for (i = 0; i < 1000; i++)
+        OUTPUT("Record %d", i);
+    assert_true(tj_log_shm_reader_next(r, &e));
+    assert_true(tj_log_shm_reader_getLost(r) > 0);
+    assert_int_equal(sscanf(e.m_msg, "Record %d", &next), 1);
+    assert_true(next > 900);
+    while (tj_log_shm_reader_next(r, &e)) {
+        snprintf(expect, sizeof(expect), "Record %d", ++next);
+        assert_string_equal(e.m_msg, expect);
+    }
+    assert_int_equal(next, 999);
+
+    //-- The ring outlives its writer
+    tj_log_removeOutChannel(out);
+    late = tj_log_shm_reader_open(ring);
+    assert_non_null(late);
+    next = -1;
+    while (tj_log_shm_reader_next(late, &e))
+        assert_int_equal(sscanf(e.m_msg, "Record %d", &next), 1);
+    assert_int_equal(next, 999);
+
+    tj_log_shm_reader_finalize(late);
+    tj_log_shm_reader_finalize(r);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(test_roundtrip, setup, teardown),
+        unit_test_setup_teardown(test_wrap, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
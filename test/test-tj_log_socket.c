@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cmocka.h"
+
+#define TAG "test-tj_log_socket"
+#include "tj_log_socket.h"
+
+struct data {
+    struct sockaddr_un addr;
+    int fd;
+};
+
+static void setup(void **state) {
+    struct data *data = malloc(sizeof(*data));
+    assert_non_null(data);
+
+    memset(&data->addr, 0, sizeof(data->addr));
+    data->addr.sun_family = AF_UNIX;
+    snprintf(data->addr.sun_path, sizeof(data->addr.sun_path),
+             "/tmp/test-tj_log_socket.%d", getpid());
+    unlink(data->addr.sun_path);
+
+    data->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    assert_true(data->fd != -1);
+    assert_int_equal(bind(data->fd, (struct sockaddr *) &data->addr,
+                          sizeof(data->addr)), 0);
+
+    tj_log_removePrintfChannel();
+    *state = data;
+}
+
+static void teardown(void **state) {
+    struct data *data = *state;
+
+    close(data->fd);
+    unlink(data->addr.sun_path);
+    free(data);
+}
+
+static int receive(struct data *data, char *buf, size_t n) {
+    ssize_t got = recv(data->fd, buf, n-1, MSG_DONTWAIT);
+    if (got < 0)
+        return 0;
+    buf[got] = 0;
+    return 1;
+}
+
+static void test_rfc5424(void **state) {
+    struct data *data = *state;
+    tj_log_outchannel *out;
+    char buf[1024];
+    int i;
+
+    out = tj_log_socket_create(data->addr.sun_path, TJ_LOG_SOCKET_RFC5424,
+                               4, 10000);
+    assert_non_null(out);
+    assert_false(tj_log_addOutChannel(out));
+
+    //-- Nothing is sent until the batch fills
+    for (i = 0; i < 3; i++)
+        OUTPUT("Message %d", i);
+    assert_false(receive(data, buf, sizeof(buf)));
+
+    CRITICAL("Quote \" ] here");
+    for (i = 0; i < 3; i++) {
+        assert_true(receive(data, buf, sizeof(buf)));
+        assert_true(strncmp(buf, "<13>1 ", 6) == 0);
+        assert_non_null(strstr(buf, " " TAG " "));
+        assert_non_null(strstr(buf, "func=\"test_rfc5424\""));
+    }
+    assert_true(strstr(buf, "] Message 2") != 0);
+
+    assert_true(receive(data, buf, sizeof(buf)));
+    assert_true(strncmp(buf, "<11>1 ", 6) == 0);
+    assert_non_null(strstr(buf, "] Quote \" ] here"));
+
+    //-- Removing the channel sends what it holds
+    OUTPUT("Last");
+    assert_false(receive(data, buf, sizeof(buf)));
+    tj_log_removeOutChannel(out);
+    assert_true(receive(data, buf, sizeof(buf)));
+    assert_non_null(strstr(buf, "] Last"));
+}
+
+static void test_json(void **state) {
+    struct data *data = *state;
+    tj_log_outchannel *out;
+    char buf[1024];
+    int i;
+
+    out = tj_log_socket_create(data->addr.sun_path, TJ_LOG_SOCKET_JSON,
+                               64, 20);
+    assert_non_null(out);
+    assert_false(tj_log_addOutChannel(out));
+
+    OUTPUT("Say \"hi\"\n");
+    for (i = 0; i < 100 && !receive(data, buf, sizeof(buf)); i++)
+        usleep(10000);
+    assert_true(i < 100);
+    assert_true(strncmp(buf, "{\"time\":\"", 9) == 0);
+    assert_non_null(strstr(buf, "\"level\":\"OUTPUT\""));
+    assert_non_null(strstr(buf, "\"component\":\"" TAG "\""));
+    assert_non_null(strstr(buf, "\"msg\":\"Say \\\"hi\\\"\\n\"}"));
+
+    //-- A full receiver drops rather than blocks
+    for (i = 0; i < 10000; i++)
+        OUTPUT("Flood %d", i);
+    tj_log_socket_flush(out);
+    assert_true(tj_log_socket_getDropped(out) > 0);
+
+    tj_log_removeOutChannel(out);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(test_rfc5424, setup, teardown),
+        unit_test_setup_teardown(test_json, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmocka.h"
+
+#include "tj_log.h"
+#include "tj_log_sqlite.h"
+
+struct found {
+    int count;
+    long long last;
+    char msg[64];
+};
+
+static void found_func(void *data, const tj_log_sqlite_record *r) {
+    struct found *found = data;
+
+    assert_true(r->m_id > found->last);
+    found->last = r->m_id;
+    found->count++;
+    strncpy(found->msg, r->m_msg, sizeof(found->msg)-1);
+}
+
+static int search(const char *dbfile, const char *text, long long after,
+        unsigned int limit, struct found *found) {
+    memset(found, 0, sizeof(*found));
+    found->last = after;
+    return tj_log_sqlite_search(dbfile, text, after, limit, &found_func,
+            found);
+}
+
+static void log_messages(tj_log_outchannel *out, int from, int to) {
+    int i;
+
+    assert_false(tj_log_addOutChannel(out));
+    for (i = from; i < to; i++)
+        tj_log_log(TJ_LOG_LEVEL_OUTPUT, "test", "test-tj_log_sqlite.c",
+                "log_messages", i, NULL, "Request %d %s", i,
+                (i % 10 == 0) ? "failed: 50% done_x" : "ok");
+}
+
+static void test_search(void **state) {
+    char dbfile[] = "/tmp/test-tj_log_sqlite.XXXXXX";
+    struct found found;
+    tj_log_outchannel *out;
+    int fd;
+
+    assert_true((fd = mkstemp(dbfile)) >= 0);
+    close(fd);
+    tj_log_removePrintfChannel();
+
+    //-- A plain database is searched by scanning
+    out = tj_log_sqlite_create(dbfile);
+    assert_non_null(out);
+    log_messages(out, 0, 50);
+    tj_log_removeOutChannel(out);
+
+    assert_int_equal(search(dbfile, "FAILED", 0, 100, &found), 5);
+    assert_string_equal(found.msg, "Request 40 failed: 50% done_x");
+
+    //-- Opening it indexed catches up, later rows are batched
+    out = tj_log_sqlite_createIndexed(dbfile, 16);
+    assert_non_null(out);
+    log_messages(out, 50, 100);
+
+    //-- Rows not yet indexed are still found
+    assert_int_equal(search(dbfile, "failed", 0, 100, &found), 10);
+    assert_int_equal(search(dbfile, "Request 99 ", 0, 100, &found), 1);
+    tj_log_removeOutChannel(out);
+
+    assert_int_equal(search(dbfile, "failed", 0, 100, &found), 10);
+    assert_string_equal(found.msg, "Request 90 failed: 50% done_x");
+
+    //-- Wildcards and quotes are literal
+    assert_int_equal(search(dbfile, "50% done_x", 0, 100, &found), 10);
+    assert_int_equal(search(dbfile, "50%_done", 0, 100, &found), 0);
+    assert_int_equal(search(dbfile, "\"failed", 0, 100, &found), 0);
+    assert_int_equal(search(dbfile, "ok", 0, 100, &found), 90);
+
+    //-- Pages pick up after the last record seen
+    assert_int_equal(search(dbfile, "failed", 0, 4, &found), 4);
+    assert_string_equal(found.msg, "Request 30 failed: 50% done_x");
+    assert_int_equal(search(dbfile, "failed", found.last, 4, &found), 4);
+    assert_string_equal(found.msg, "Request 70 failed: 50% done_x");
+    assert_int_equal(search(dbfile, "failed", found.last, 4, &found), 2);
+    assert_int_equal(search(dbfile, "failed", found.last, 4, &found), 0);
+
+    assert_int_equal(search("/nonexistent/tj_log.db", "x", 0, 1, &found), -1);
+
+    unlink(dbfile);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test(test_search),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cmocka.h"
+
+#include "tj_buffer.h"
+#include "tj_loop.h"
+
+#define SIZE (1024*1024)
+
+struct transfer {
+    tj_buffer *out;
+    tj_buffer *in;
+    int fds[2];
+    int eof;
+    int writes;
+};
+
+static void write_ready(tj_loop *loop, tj_loop_io *io, int events,
+                        void *data) {
+    struct transfer *t = data;
+
+    t->writes++;
+    assert_true(tj_loop_writeBuffer(tj_loop_io_getFd(io), t->out) >= 0);
+    if (tj_buffer_getUsed(t->out) == 0) {
+        shutdown(tj_loop_io_getFd(io), SHUT_WR);
+        tj_loop_io_remove(io);
+    }
+}
+
+static void read_ready(tj_loop *loop, tj_loop_io *io, int events,
+                       void *data) {
+    struct transfer *t = data;
+
+    assert_true(tj_loop_readBuffer(tj_loop_io_getFd(io), t->in, 0,
+                                   &t->eof) >= 0);
+    if (t->eof)
+        tj_loop_io_remove(io);
+}
+
+static void test_transfer(void **state) {
+    struct transfer t;
+    tj_loop *loop;
+    int i;
+
+    memset(&t, 0, sizeof(t));
+    assert_false(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, t.fds));
+
+    t.out = tj_buffer_create(SIZE);
+    t.in = tj_buffer_create(0);
+    for (i = 0; i < SIZE; i++)
+        tj_buffer_getBytes(t.out)[i] = i * 7;
+    tj_buffer_commit(t.out, SIZE);
+
+    loop = tj_loop_create();
+    assert_non_null(loop);
+    assert_non_null(tj_loop_io_add(loop, t.fds[0], TJ_LOOP_WRITE,
+                                   &write_ready, &t));
+    assert_non_null(tj_loop_io_add(loop, t.fds[1], TJ_LOOP_READ,
+                                   &read_ready, &t));
+
+    //-- Returns once both watches have removed themselves
+    assert_true(tj_loop_run(loop));
+
+    assert_true(t.eof);
+    assert_true(t.writes > 1);
+    assert_int_equal(tj_buffer_getUsed(t.in), SIZE);
+    for (i = 0; i < SIZE; i++)
+        assert_int_equal(tj_buffer_getBytes(t.in)[i], (unsigned char) (i * 7));
+
+    tj_loop_finalize(loop);
+    tj_buffer_finalize(t.out);
+    tj_buffer_finalize(t.in);
+    close(t.fds[0]);
+    close(t.fds[1]);
+}
+
+static void test_limit(void **state) {
+    tj_buffer *b;
+    int fds[2], eof;
+
+    assert_false(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+    b = tj_buffer_create(0);
+
+    assert_int_equal(write(fds[0], "abcdef", 6), 6);
+    assert_int_equal(tj_loop_readBuffer(fds[1], b, 4, &eof), 4);
+    assert_false(eof);
+    assert_int_equal(tj_loop_readBuffer(fds[1], b, 4, &eof), 2);
+    assert_false(eof);
+    assert_int_equal(tj_loop_readBuffer(fds[1], b, 0, &eof), 0);
+    assert_false(eof);
+    assert_memory_equal(tj_buffer_getBytes(b), "abcdef", 6);
+
+    close(fds[0]);
+    assert_int_equal(tj_loop_readBuffer(fds[1], b, 0, &eof), 0);
+    assert_true(eof);
+
+    //-- Writing to a closed peer fails rather than raising SIGPIPE
+    assert_int_equal(tj_loop_writeBuffer(fds[1], b), -1);
+    assert_int_equal(tj_buffer_getUsed(b), 6);
+
+    tj_buffer_finalize(b);
+    close(fds[1]);
+}
+
+struct timers {
+    int once;
+    int repeats;
+    int never;
+    tj_loop_timer *never_timer;
+};
+
+static void fire_once(tj_loop *loop, tj_loop_timer *timer, void *data) {
+    struct timers *t = data;
+    t->once++;
+    tj_loop_timer_cancel(t->never_timer);
+}
+
+static void fire_repeat(tj_loop *loop, tj_loop_timer *timer, void *data) {
+    struct timers *t = data;
+    if (++t->repeats == 3)
+        tj_loop_timer_cancel(timer);
+}
+
+static void fire_never(tj_loop *loop, tj_loop_timer *timer, void *data) {
+    struct timers *t = data;
+    t->never++;
+}
+
+static void test_timers(void **state) {
+    struct timers t;
+    tj_loop *loop;
+
+    memset(&t, 0, sizeof(t));
+    loop = tj_loop_create();
+    assert_non_null(loop);
+
+    assert_non_null(tj_loop_timer_add(loop, 10, 0, &fire_once, &t));
+    assert_non_null(tj_loop_timer_add(loop, 1, 5, &fire_repeat, &t));
+    assert_non_null(t.never_timer =
+                    tj_loop_timer_add(loop, 50, 0, &fire_never, &t));
+
+    //-- Returns once the repeating timer is cancelled, not waiting for
+    //-- the cancelled one to come due
+    assert_true(tj_loop_run(loop));
+    assert_int_equal(t.once, 1);
+    assert_int_equal(t.repeats, 3);
+    assert_int_equal(t.never, 0);
+
+    tj_loop_finalize(loop);
+}
+
+static void *stop_thread(void *arg) {
+    usleep(20000);
+    tj_loop_stop(arg);
+    return NULL;
+}
+
+static void test_stop(void **state) {
+    struct timers t;
+    pthread_t thread;
+    tj_loop *loop;
+
+    memset(&t, 0, sizeof(t));
+    loop = tj_loop_create();
+    assert_non_null(loop);
+    assert_non_null(tj_loop_timer_add(loop, 60000, 60000, &fire_never, &t));
+
+    assert_false(pthread_create(&thread, NULL, &stop_thread, loop));
+    assert_true(tj_loop_run(loop));
+    pthread_join(thread, NULL);
+    assert_int_equal(t.never, 0);
+
+    //-- The pending timer is freed with the loop
+    tj_loop_finalize(loop);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test(test_transfer),
+        unit_test(test_limit),
+        unit_test(test_timers),
+        unit_test(test_stop),
+    };
+
+    return run_tests(tests);
+}
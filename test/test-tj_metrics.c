@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmocka.h"
+
+#include "tj_log.h"
+#include "tj_metrics.h"
+
+#define THREADS 4
+#define COUNT 10000
+
+static void *count_thread(void *arg) {
+    tj_metrics_counter *c = tj_metrics_counter_create("test_counts", "");
+    tj_metrics_histogram *h = arg;
+    int i;
+
+    for (i = 1; i <= COUNT; i++) {
+        tj_metrics_counter_add(c, 1);
+        tj_metrics_histogram_record(h, i);
+    }
+
+    return NULL;
+}
+
+static void test_counter(void **state) {
+    tj_metrics_counter *c;
+    tj_metrics_histogram *h;
+    pthread_t threads[THREADS];
+    int i;
+
+    c = tj_metrics_counter_create("test_counts", "Counted things.");
+    assert_non_null(c);
+    h = tj_metrics_histogram_create("test_values", "Recorded values.");
+    assert_non_null(h);
+
+    //-- Names are shared, but not across types
+    assert_true(tj_metrics_counter_create("test_counts", "") == c);
+    assert_null(tj_metrics_gauge_create("test_counts", ""));
+    assert_null(tj_metrics_counter_create("9lives", ""));
+    assert_null(tj_metrics_counter_create("has space", ""));
+
+    for (i = 0; i < THREADS; i++)
+        assert_false(pthread_create(&threads[i], NULL, &count_thread, h));
+    for (i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    assert_int_equal(tj_metrics_counter_get(c), THREADS * COUNT);
+    assert_int_equal(tj_metrics_histogram_getCount(h), THREADS * COUNT);
+    assert_int_equal(tj_metrics_histogram_getSum(h),
+                     THREADS * ((uint64_t) COUNT * (COUNT + 1) / 2));
+    assert_int_equal(tj_metrics_histogram_getMax(h), COUNT);
+}
+
+static void test_histogram(void **state) {
+    tj_metrics_histogram *h, *m;
+    uint64_t v, q;
+
+    h = tj_metrics_histogram_create("test_latency", "Latency.");
+    assert_non_null(h);
+    assert_int_equal(tj_metrics_histogram_getQuantile(h, 0.5), 0);
+
+    //-- Small values are exact, large ones within a few percent
+    for (v = 0; v < 32; v++)
+        tj_metrics_histogram_record(h, v);
+    assert_int_equal(tj_metrics_histogram_getQuantile(h, 0), 0);
+    assert_int_equal(tj_metrics_histogram_getQuantile(h, 0.5), 15);
+    assert_int_equal(tj_metrics_histogram_getQuantile(h, 1), 31);
+
+    for (v = 1; v <= 100000; v++)
+        tj_metrics_histogram_record(h, v * 1000);
+    q = tj_metrics_histogram_getQuantile(h, 0.99);
+    assert_in_range(q, 99000000 * 0.97, 99000000 * 1.03);
+    assert_int_equal(tj_metrics_histogram_getQuantile(h, 1), 100000000);
+
+    tj_metrics_histogram_record(h, UINT64_MAX);
+    assert_true(tj_metrics_histogram_getMax(h) == UINT64_MAX);
+    assert_true(tj_metrics_histogram_getQuantile(h, 1) == UINT64_MAX);
+
+    m = tj_metrics_histogram_create("test_merged", "Merged.");
+    assert_non_null(m);
+    tj_metrics_histogram_record(m, 5);
+    tj_metrics_histogram_merge(m, h);
+    assert_int_equal(tj_metrics_histogram_getCount(m),
+                     tj_metrics_histogram_getCount(h) + 1);
+    assert_true(tj_metrics_histogram_getMax(m) == UINT64_MAX);
+    assert_true(tj_metrics_histogram_getSum(m) ==
+                tj_metrics_histogram_getSum(h) + 5);
+}
+
+static void test_export(void **state) {
+    tj_metrics_gauge *g;
+    tj_metrics_histogram *h;
+    tj_buffer *b;
+    const char *s;
+
+    g = tj_metrics_gauge_create("test_temperature", "Degrees\nCelsius.");
+    assert_non_null(g);
+    tj_metrics_gauge_set(g, 20);
+    tj_metrics_gauge_add(g, 1.5);
+    assert_true(tj_metrics_gauge_get(g) == 21.5);
+
+    h = tj_metrics_histogram_create("test_export_latency", "Latency.");
+    assert_non_null(h);
+    tj_metrics_histogram_record(h, 7);
+
+    b = tj_buffer_create(0);
+    assert_non_null(b);
+    assert_true(tj_metrics_printPrometheus(b));
+    s = tj_buffer_getAsString(b);
+    assert_non_null(strstr(s, "# HELP test_temperature Degrees\\nCelsius.\n"
+                           "# TYPE test_temperature gauge\n"
+                           "test_temperature 21.5\n"));
+    assert_non_null(strstr(s, "# TYPE test_export_latency summary\n"
+                           "test_export_latency{quantile=\"0.5\"} 7\n"));
+    assert_non_null(strstr(s, "test_export_latency_count 1\n"));
+    assert_non_null(strstr(s, "# TYPE tj_log_messages_total counter\n"));
+
+    tj_buffer_reset(b);
+    assert_true(tj_metrics_printJSON(b));
+    s = tj_buffer_getAsString(b);
+    assert_int_equal(s[0], '{');
+    assert_int_equal(s[strlen(s)-1], '}');
+    assert_non_null(strstr(s, "\"test_temperature\":21.5"));
+    assert_non_null(strstr(s, "\"test_export_latency\":{\"count\":1,"
+                           "\"sum\":7,\"max\":7,\"p50\":7"));
+
+    tj_buffer_finalize(b);
+}
+
+struct report_args {
+    int count;
+    char msg[64];
+};
+
+static void report_func(void *data, const tj_log_site *site, tj_error *error,
+        const char *msg) {
+    struct report_args *args = data;
+
+    if (strcmp(site->m_component, "tj_metrics"))
+        return;
+    __atomic_add_fetch(&args->count, 1, __ATOMIC_RELAXED);
+}
+
+static void test_reporting(void **state) {
+    struct report_args args;
+    tj_metrics_counter *c;
+    tj_log_outchannel *out;
+    uint64_t before;
+
+    memset(&args, 0, sizeof(args));
+    out = tj_log_outchannel_createSite(&args, &report_func, NULL);
+    assert_non_null(out);
+    assert_false(tj_log_addOutChannel(out));
+
+    //-- tj_log publishes its own counts
+    c = tj_metrics_counter_create("tj_log_messages_total", "");
+    assert_non_null(c);
+    before = tj_metrics_counter_get(c);
+
+    assert_false(tj_metrics_startReporting(0));
+    assert_true(tj_metrics_startReporting(10));
+    while (__atomic_load_n(&args.count, __ATOMIC_RELAXED) < 2)
+        usleep(1000);
+    tj_metrics_stopReporting();
+    assert_true(tj_metrics_counter_get(c) >= before + 2);
+
+    args.count = 0;
+    usleep(30000);
+    assert_int_equal(args.count, 0);
+    tj_metrics_stopReporting();
+
+    tj_log_removeOutChannel(out);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test(test_counter),
+        unit_test(test_histogram),
+        unit_test(test_export),
+        unit_test(test_reporting),
+    };
+
+    return run_tests(tests);
+}
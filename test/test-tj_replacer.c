@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdarg.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmocka.h"
+
+#include "tj_buffer.h"
+#include "tj_replacer.h"
+
+static void assert_replaced(tj_replacer *r, const char *in,
+                            const char *expected, size_t n) {
+    tj_buffer *b = tj_buffer_create(0);
+    size_t count;
+
+    assert_true(tj_replacer_applyBytes(r, b, (const tj_buffer_byte *) in,
+                                       strlen(in), &count));
+    assert_true(tj_buffer_appendString(b, ""));
+    assert_string_equal(tj_buffer_getAsString(b), expected);
+    assert_int_equal(count, n);
+    tj_buffer_finalize(b);
+}
+
+static void test_basic(void **state) {
+    tj_replacer *r;
+
+    //-- Leftmost first, then longest
+    assert_non_null(r = tj_replacer_create());
+    assert_true(tj_replacer_addString(r, "he", "HE"));
+    assert_true(tj_replacer_addString(r, "she", "SHE"));
+    assert_true(tj_replacer_addString(r, "his", "HIS"));
+    assert_true(tj_replacer_addString(r, "hers", "HERS"));
+    assert_true(tj_replacer_compile(r));
+    assert_replaced(r, "ushers", "uSHErs", 1);
+    assert_replaced(r, "hershey his", "HERSHEy HIS", 3);
+    assert_replaced(r, "nothing", "nothing", 0);
+    assert_replaced(r, "", "", 0);
+    assert_false(tj_replacer_addString(r, "x", "y"));
+    tj_replacer_finalize(r);
+
+    assert_non_null(r = tj_replacer_create());
+    assert_true(tj_replacer_addString(r, "abc", "1"));
+    assert_true(tj_replacer_addString(r, "abcde", "2"));
+    assert_true(tj_replacer_addString(r, "bcd", "3"));
+    assert_true(tj_replacer_addString(r, "abc", "4"));
+    assert_true(tj_replacer_addString(r, "x", ""));
+    assert_false(tj_replacer_addString(r, "", "5"));
+    assert_true(tj_replacer_compile(r));
+    assert_replaced(r, "abcdef", "2f", 1);
+    assert_replaced(r, "abcdxabcd", "1d1d", 3);
+    assert_replaced(r, "abcab", "1ab", 1);
+    tj_replacer_finalize(r);
+}
+
+static void test_rescan(void **state) {
+    tj_replacer *r;
+    tj_buffer *b;
+
+    //-- A match found while seeking a longer one is not lost
+    assert_non_null(r = tj_replacer_create());
+    assert_true(tj_replacer_addString(r, "abcdz", "[ABCDZ]"));
+    assert_true(tj_replacer_addString(r, "bc", "[BC]"));
+    assert_true(tj_replacer_addString(r, "de", "[DE]"));
+
+    b = tj_buffer_create(0);
+    assert_false(tj_replacer_applyBytes(r, b, (const tj_buffer_byte *) "x",
+                                        1, 0));
+    tj_buffer_finalize(b);
+
+    assert_true(tj_replacer_compile(r));
+    assert_replaced(r, "abcdef", "a[BC][DE]f", 2);
+    assert_replaced(r, "abcdzabcd", "[ABCDZ]a[BC]d", 2);
+    tj_replacer_finalize(r);
+}
+
+/*
+ * Leftmost-longest replacement done the slow way.
+ */
+static void naive(char **patterns, char **replacements, int np,
+                  const char *in, tj_buffer *out, size_t *count) {
+    size_t i = 0, n = strlen(in), len, bestLen;
+    int k, best;
+
+    *count = 0;
+    while (i < n) {
+        best = -1;
+        bestLen = 0;
+        for (k = 0; k < np; k++) {
+            len = strlen(patterns[k]);
+            if (len > bestLen && !strncmp(in + i, patterns[k], len)) {
+                best = k;
+                bestLen = len;
+            }
+        }
+        if (best < 0) {
+            tj_buffer_append(out, (const tj_buffer_byte *) in + i++, 1);
+        } else {
+            tj_buffer_append(out, (const tj_buffer_byte *) replacements[best],
+                             strlen(replacements[best]));
+            i += bestLen;
+            (*count)++;
+        }
+    }
+}
+
+static void check_random(int np, int alphabet, int maxLen, size_t n) {
+    char *patterns[np], *replacements[np], *in;
+    tj_buffer *expected = tj_buffer_create(0), *b = tj_buffer_create(0);
+    size_t count, naiveCount;
+    tj_replacer *r;
+    int k, i, len;
+
+    assert_non_null(r = tj_replacer_create());
+    for (k = 0; k < np; k++) {
+        len = 1 + rand() % maxLen;
+        patterns[k] = malloc(len + 1);
+        for (i = 0; i < len; i++)
+            patterns[k][i] = 'a' + rand() % alphabet;
+        patterns[k][len] = 0;
+        replacements[k] = malloc(16);
+        snprintf(replacements[k], 16, "<%d>", k);
+        assert_true(tj_replacer_addString(r, patterns[k], replacements[k]));
+    }
+    assert_true(tj_replacer_compile(r));
+
+    //-- Mostly bytes outside the patterns, so the prefilter has work
+    in = malloc(n + 1);
+    for (i = 0; i < n; i++)
+        in[i] = (rand() % 4) ? 'a' + rand() % alphabet : ' ' + rand() % 10;
+    in[n] = 0;
+
+    naive(patterns, replacements, np, in, expected, &naiveCount);
+    assert_true(tj_replacer_applyBytes(r, b, (const tj_buffer_byte *) in, n,
+                                       &count));
+    assert_int_equal(count, naiveCount);
+    assert_int_equal(tj_buffer_getUsed(b), tj_buffer_getUsed(expected));
+    assert_memory_equal(tj_buffer_getBytes(b), tj_buffer_getBytes(expected),
+                        tj_buffer_getUsed(b));
+
+    for (k = 0; k < np; k++) {
+        free(patterns[k]);
+        free(replacements[k]);
+    }
+    free(in);
+    tj_replacer_finalize(r);
+    tj_buffer_finalize(b);
+    tj_buffer_finalize(expected);
+}
+
+static void test_random(void **state) {
+    srand(11);
+    check_random(3, 3, 4, 100000);
+    check_random(20, 4, 6, 100000);
+    check_random(200, 12, 8, 20000);
+    check_random(2000, 26, 5, 5000);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test(test_basic),
+        unit_test(test_rescan),
+        unit_test(test_random),
+    };
+
+    return run_tests(tests);
+}
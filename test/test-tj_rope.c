@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdarg.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cmocka.h"
+
+#include "tj_buffer.h"
+#include "tj_rope.h"
+
+static void assert_rope_equal(tj_rope *r, tj_buffer *expected) {
+    tj_buffer *b = tj_buffer_create(0);
+
+    assert_int_equal(tj_rope_getLength(r), tj_buffer_getUsed(expected));
+    assert_true(tj_rope_appendTo(r, b));
+    assert_int_equal(tj_buffer_getUsed(b), tj_buffer_getUsed(expected));
+    if (tj_buffer_getUsed(b) > 0)
+        assert_memory_equal(tj_buffer_getBytes(b),
+                            tj_buffer_getBytes(expected),
+                            tj_buffer_getUsed(b));
+    tj_buffer_finalize(b);
+}
+
+static tj_rope *append(tj_rope *r, const char *s) {
+    tj_rope *x, *res;
+
+    x = tj_rope_createBytes((const tj_buffer_byte *) s, strlen(s));
+    res = tj_rope_concat(r, x);
+    tj_rope_release(x);
+    tj_rope_release(r);
+    return res;
+}
+
+static void test_concat(void **state) {
+    tj_buffer *expected = tj_buffer_create(0);
+    tj_rope *r = tj_rope_create(), *piece;
+    char s[512];
+    int i;
+
+    //-- Small pieces are copied together into a single chunk
+    for (i = 0; i < 10; i++) {
+        r = append(r, "ab");
+        tj_buffer_append(expected, (const tj_buffer_byte *) "ab", 2);
+    }
+    assert_int_equal(tj_rope_getHeight(r), 0);
+    assert_rope_equal(r, expected);
+
+    //-- Large pieces are shared, and the tree kept balanced
+    memset(s, 'x', sizeof(s) - 1);
+    s[sizeof(s) - 1] = 0;
+    for (i = 0; i < 1000; i++) {
+        s[0] = 'a' + i % 26;
+        r = append(r, s);
+        tj_buffer_append(expected, (const tj_buffer_byte *) s, strlen(s));
+    }
+    assert_rope_equal(r, expected);
+    assert_true(tj_rope_getHeight(r) <= 15);
+
+    //-- Prepending balances the same way
+    piece = tj_rope_createBytes((const tj_buffer_byte *) s, strlen(s));
+    for (i = 0; i < 1000; i++) {
+        tj_rope *x = tj_rope_concat(piece, r);
+        tj_rope_release(r);
+        r = x;
+    }
+    assert_int_equal(tj_rope_getLength(r),
+                     tj_buffer_getUsed(expected) + 1000 * strlen(s));
+    assert_true(tj_rope_getHeight(r) <= 16);
+
+    tj_rope_release(piece);
+    tj_rope_release(r);
+    tj_buffer_finalize(expected);
+}
+
+static void test_slice(void **state) {
+    tj_buffer *expected = tj_buffer_create(0), *b;
+    tj_rope *r = tj_rope_create(), *s, *t;
+    char piece[400];
+    int i;
+
+    for (i = 0; i < 100; i++) {
+        memset(piece, '0' + i % 10, sizeof(piece) - 1);
+        piece[sizeof(piece) - 1] = 0;
+        r = append(r, piece);
+        tj_buffer_append(expected, (const tj_buffer_byte *) piece,
+                         strlen(piece));
+    }
+
+    //-- Across chunk boundaries, and clipped at the end
+    s = tj_rope_slice(r, 390, 820);
+    assert_int_equal(tj_rope_getLength(s), 820);
+    b = tj_buffer_create(0);
+    tj_buffer_append(b, tj_buffer_getBytesAtIndex(expected, 390), 820);
+    assert_rope_equal(s, b);
+    tj_rope_release(s);
+
+    s = tj_rope_slice(r, tj_buffer_getUsed(expected) - 10, 100);
+    assert_int_equal(tj_rope_getLength(s), 10);
+    tj_rope_release(s);
+    s = tj_rope_slice(r, tj_buffer_getUsed(expected) + 10, 100);
+    assert_int_equal(tj_rope_getLength(s), 0);
+    tj_rope_release(s);
+
+    //-- The original is unchanged by ropes built from it
+    s = tj_rope_slice(r, 0, 5);
+    t = tj_rope_insert(r, 399, s);
+    tj_rope_release(s);
+    assert_rope_equal(r, expected);
+    tj_buffer_insert(expected, 399, (const tj_buffer_byte *) "00000", 5);
+    assert_rope_equal(t, expected);
+
+    tj_rope_release(t);
+    tj_rope_release(r);
+    tj_buffer_finalize(b);
+    tj_buffer_finalize(expected);
+}
+
+static void test_random(void **state) {
+    tj_buffer *expected = tj_buffer_create(0);
+    tj_rope *r = tj_rope_create(), *s, *t;
+    tj_buffer_byte piece[1000];
+    size_t i, n;
+    int k;
+
+    srand(7);
+    for (k = 0; k < 2000; k++) {
+        i = tj_buffer_getUsed(expected) ?
+            rand() % (tj_buffer_getUsed(expected) + 1) : 0;
+        switch (rand() % 3) {
+        case 0:
+            n = 1 + rand() % sizeof(piece);
+            memset(piece, 'a' + k % 26, n);
+            s = tj_rope_createBytes(piece, n);
+            t = tj_rope_insert(r, i, s);
+            tj_rope_release(s);
+            tj_buffer_insert(expected, i, piece, n);
+            break;
+
+        case 1:
+            n = rand() % 2000;
+            t = tj_rope_slice(r, 0, i);
+            s = tj_rope_slice(r, i + n, tj_rope_getLength(r));
+            tj_rope_release(r);
+            r = t;
+            t = tj_rope_concat(r, s);
+            tj_rope_release(s);
+            if (n > tj_buffer_getUsed(expected) - i)
+                n = tj_buffer_getUsed(expected) - i;
+            tj_buffer_erase(expected, i, n);
+            break;
+
+        default:
+            n = rand() % 500;
+            s = tj_rope_slice(r, i, n);
+            t = tj_rope_insert(r, rand() % (tj_rope_getLength(r) + 1), s);
+            tj_rope_release(t);
+            t = tj_rope_retain(r);
+            tj_rope_release(s);
+            break;
+        }
+        tj_rope_release(r);
+        r = t;
+        assert_int_equal(tj_rope_getLength(r), tj_buffer_getUsed(expected));
+    }
+
+    assert_rope_equal(r, expected);
+    tj_rope_release(r);
+    tj_buffer_finalize(expected);
+}
+
+static void test_write(void **state) {
+    tj_buffer *expected = tj_buffer_create(0), *b = tj_buffer_create(0);
+    tj_rope *r = tj_rope_create();
+    struct iovec iov[4];
+    tj_buffer_byte chunk[4096];
+    char piece[300];
+    int fds[2], i, status;
+    pid_t pid;
+    ssize_t n;
+
+    for (i = 0; i < 200; i++) {
+        memset(piece, 'a' + i % 26, sizeof(piece) - 1);
+        piece[sizeof(piece) - 1] = 0;
+        r = append(r, piece);
+        tj_buffer_append(expected, (const tj_buffer_byte *) piece,
+                         strlen(piece));
+    }
+
+    //-- Chunks are described in order, from within the first
+    assert_int_equal(tj_rope_getIovecs(r, 10, iov, 4), 4);
+    assert_int_equal(iov[0].iov_len, 289);
+    assert_memory_equal(iov[1].iov_base, "bbb", 3);
+
+    //-- More than fits in a pipe at once, so the reader drains as it goes
+    assert_int_equal(pipe(fds), 0);
+    if ((pid = fork()) == 0) {
+        close(fds[0]);
+        _exit(tj_rope_write(r, fds[1]) == tj_rope_getLength(r) ? 0 : 1);
+    }
+    close(fds[1]);
+    while ((n = read(fds[0], chunk, sizeof(chunk))) > 0)
+        tj_buffer_append(b, chunk, n);
+    close(fds[0]);
+    assert_int_equal(waitpid(pid, &status, 0), pid);
+    assert_int_equal(status, 0);
+    assert_int_equal(tj_buffer_getUsed(b), tj_buffer_getUsed(expected));
+    assert_memory_equal(tj_buffer_getBytes(b), tj_buffer_getBytes(expected),
+                        tj_buffer_getUsed(b));
+
+    tj_rope_release(r);
+    tj_buffer_finalize(b);
+    tj_buffer_finalize(expected);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test(test_concat),
+        unit_test(test_slice),
+        unit_test(test_random),
+        unit_test(test_write),
+    };
+
+    return run_tests(tests);
+}
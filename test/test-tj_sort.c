@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmocka.h"
+
+#include "tj_sort.h"
+
+#define SIZE 300000
+
+typedef struct {
+    uint64_t key;
+    uint32_t seq;
+} record;
+
+static uint64_t recordKey(const record *r) { return r->key; }
+TJ_SORT_DECL(recordsort, record, uint64_t, recordKey)
+
+static uint32_t smallKey(const uint16_t *x) { return *x; }
+TJ_SORT_DECL(smallsort, uint16_t, uint32_t, smallKey)
+
+static uint64_t doubleKey(const double *x) { return tj_sort_doubleKey(*x); }
+TJ_SORT_DECL(doublesort, double, uint64_t, doubleKey)
+
+static uint32_t intKey(const int32_t *x) { return tj_sort_int32Key(*x); }
+TJ_SORT_DECL(intsort, int32_t, uint32_t, intKey)
+
+typedef struct {
+    char name[12];
+} label;
+
+static const unsigned char *labelBytes(const label *l) {
+    return (const unsigned char *) l->name;
+}
+TJ_SORT_BYTES_DECL(labelsort, label, labelBytes, sizeof(((label *) 0)->name))
+
+static uint64_t random64(void) {
+    return ((uint64_t) rand() << 42) ^ ((uint64_t) rand() << 21) ^ rand();
+}
+
+static int compareRecords(const void *a, const void *b) {
+    const record *x = a, *y = b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/*
+ * Fills records with keys from a generator, numbered in order so a
+ * stable sort matches qsort() ordering by key and then number.
+ */
+static record *fill(size_t n, uint64_t mask, record **expected) {
+    record *a = malloc(n * sizeof(record));
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        a[i].key = random64() & mask;
+        a[i].seq = i;
+    }
+    *expected = malloc(n * sizeof(record));
+    memcpy(*expected, a, n * sizeof(record));
+    qsort(*expected, n, sizeof(record), &compareRecords);
+    return a;
+}
+
+static void test_radix(void **state) {
+    uint64_t masks[] = { ~0ULL, 0xffff, 0xff00ff0000ULL, 0 };
+    size_t sizes[] = { 0, 1, 31, 1000, SIZE };
+    record *a, *expected;
+    size_t m, s, i;
+
+    srand(3);
+    for (m = 0; m < sizeof(masks) / sizeof(masks[0]); m++) {
+        for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            a = fill(sizes[s], masks[m], &expected);
+            assert_true(recordsort_radix(a, sizes[s]));
+            assert_memory_equal(a, expected, sizes[s] * sizeof(record));
+            free(a);
+            free(expected);
+
+            //-- Threaded sorts are stable too
+            a = fill(sizes[s], masks[m], &expected);
+            assert_true(recordsort_radixThreaded(a, sizes[s], 4));
+            assert_memory_equal(a, expected, sizes[s] * sizeof(record));
+            free(a);
+            free(expected);
+
+            //-- In place sorts only order keys
+            a = fill(sizes[s], masks[m], &expected);
+            recordsort_radixInPlace(a, sizes[s]);
+            for (i = 0; i < sizes[s]; i++)
+                assert_true(a[i].key == expected[i].key);
+            free(a);
+            free(expected);
+        }
+    }
+}
+
+static void test_keys(void **state) {
+    double *d = malloc(SIZE * sizeof(double));
+    int32_t x[1000];
+    uint16_t small[1000];
+    size_t i;
+
+    srand(9);
+    for (i = 0; i < SIZE; i++)
+        d[i] = (rand() - RAND_MAX / 2) / 1000.0;
+    d[0] = -0.0;
+    d[1] = 1e300;
+    d[2] = -1e300;
+    assert_true(doublesort_radixThreaded(d, SIZE, 3));
+    for (i = 1; i < SIZE; i++)
+        assert_true(d[i-1] <= d[i]);
+    free(d);
+
+    for (i = 0; i < 1000; i++)
+        x[i] = rand() - RAND_MAX / 2;
+    x[0] = INT32_MIN;
+    x[1] = INT32_MAX;
+    intsort_radixInPlace(x, 1000);
+    assert_int_equal(x[0], INT32_MIN);
+    assert_int_equal(x[999], INT32_MAX);
+    for (i = 1; i < 1000; i++)
+        assert_true(x[i-1] <= x[i]);
+
+    //-- Keys from a small range are counted directly
+    for (i = 0; i < 1000; i++)
+        small[i] = rand() % 100;
+    assert_true(smallsort_keyIndex(small, 1000, 100));
+    for (i = 1; i < 1000; i++)
+        assert_true(small[i-1] <= small[i]);
+    small[0] = 100;
+    assert_false(smallsort_keyIndex(small, 1000, 100));
+    assert_int_equal(small[0], 100);
+}
+
+static void test_bytes(void **state) {
+    label *l = malloc(SIZE * sizeof(label));
+    size_t i;
+    int k;
+
+    srand(13);
+    for (i = 0; i < SIZE; i++) {
+        //-- Long shared prefixes, and some short names
+        memset(l[i].name, 0, sizeof(l[i].name));
+        for (k = 0; k < 11 && (k < 6 || rand() % 4); k++)
+            l[i].name[k] = (k < 4) ? 'a' + i % 2 : 'a' + rand() % 26;
+    }
+
+    labelsort_radixInPlace(l, SIZE);
+    for (i = 1; i < SIZE; i++)
+        assert_true(memcmp(l[i-1].name, l[i].name, sizeof(l[i].name)) <= 0);
+    free(l);
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test(test_radix),
+        unit_test(test_keys),
+        unit_test(test_bytes),
+    };
+
+    return run_tests(tests);
+}
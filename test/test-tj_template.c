@@ -25,8 +25,10 @@
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "cmocka.h"
 
@@ -134,12 +136,432 @@ static void test_4(void **state) {
                 "mushi mushi mushi");
 }
 
+static void compile_apply(struct data *data, const char *src) {
+    tj_template *tmpl;
+
+    tj_buffer_reset(data->source);
+    tj_buffer_reset(data->target);
+    assert_true(tj_buffer_appendString(data->source, src));
+
+    tmpl = tj_template_compile(data->source);
+    assert_non_null(tmpl);
+    assert_true(tj_template_apply(tmpl, data->vars, data->target));
+    tj_template_finalize(tmpl);
+}
+
+static void test_compile_plain(void **state) {
+    struct data *data = *state;
+    const char *templates[] = {
+        "HEL$XLO!",
+        "A $MAN, a $PLAN, a $CANAL, Panama!",
+        "$$X costs $$$X, $X$",
+        "$MA$N and $MANE $Q$X $",
+        "$MUSHI",
+    };
+    tj_buffer *expected = tj_buffer_create(0);
+    size_t i;
+
+    assert_non_null(expected);
+    assert_true(tj_template_variables_setFromString(data->vars, "X", "mushi"));
+    assert_true(tj_template_variables_setFromString(data->vars, "MAN", "man"));
+    assert_true(tj_template_variables_setFromString(data->vars, "MANE", "-"));
+    assert_true(tj_template_variables_setFromString(data->vars, "CANAL", "c"));
+    assert_true(tj_template_variables_setFromFile(
+                data->vars, "MUSHI", "test/data/mushi2"));
+    tj_template_variables_setRecurse(data->vars, "MUSHI", 1);
+
+    for (i = 0; i < sizeof(templates)/sizeof(templates[0]); i++) {
+        tj_buffer_reset(expected);
+        tj_buffer_reset(data->source);
+        assert_true(tj_buffer_appendString(data->source, templates[i]));
+        assert_true(tj_template_variables_apply(
+                    data->vars, expected, data->source));
+
+        compile_apply(data, templates[i]);
+        assert_int_equal(tj_buffer_getUsed(data->target),
+                         tj_buffer_getUsed(expected));
+        assert_memory_equal(tj_buffer_getBytes(data->target),
+                            tj_buffer_getBytes(expected),
+                            tj_buffer_getUsed(expected));
+    }
+
+    tj_buffer_finalize(expected);
+}
+
+static void test_compile_section(void **state) {
+    struct data *data = *state;
+
+    assert_true(tj_template_variables_setFromString(data->vars, "ON", "1"));
+    assert_true(tj_template_variables_setFromString(data->vars, "OFF", ""));
+    assert_true(tj_template_variables_setFromString(data->vars, "X", "x"));
+
+    compile_apply(data, "[$#ON$a$X$/ON$][$#OFF$b$/OFF$][$#NONE$c$/NONE$]");
+    assert_string_equal(tj_buffer_getAsString(data->target), "[ax][][]");
+
+    compile_apply(data, "[$^ON$a$/ON$][$^OFF$b$/OFF$][$^NONE$c$/NONE$]");
+    assert_string_equal(tj_buffer_getAsString(data->target), "[][b][c]");
+}
+
+static void test_compile_list(void **state) {
+    struct data *data = *state;
+    tj_template_variables *item;
+    const char *names[] = { "ann", "bob", "cy" };
+    size_t i;
+
+    assert_true(tj_template_variables_setFromString(data->vars, "SEP", ","));
+    for (i = 0; i < 3; i++) {
+        item = tj_template_variables_addItem(data->vars, "PEOPLE");
+        assert_non_null(item);
+        assert_true(tj_template_variables_setFromString(item, "NAME", names[i]));
+        if (i == 1) {
+            assert_non_null(tj_template_variables_addItem(item, "TAGS"));
+            assert_non_null(tj_template_variables_addItem(item, "TAGS"));
+        }
+    }
+
+    compile_apply(data, "<$#PEOPLE$$NAME$#TAGS$*$/TAGS$$SEP$/PEOPLE$>");
+    assert_string_equal(tj_buffer_getAsString(data->target),
+                        "<ann,bob**,cy,>");
+
+    compile_apply(data, "<$#EMPTY$x$/EMPTY$$^EMPTY$none$/EMPTY$>");
+    assert_string_equal(tj_buffer_getAsString(data->target), "<none>");
+}
+
+static void test_compile_unbalanced(void **state) {
+    struct data *data = *state;
+
+    assert_true(tj_buffer_appendString(data->source, "$#A$ $/B$"));
+    assert_null(tj_template_compile(data->source));
+
+    tj_buffer_reset(data->source);
+    assert_true(tj_buffer_appendString(data->source, "$#A$ $#B$ $/B$"));
+    assert_null(tj_template_compile(data->source));
+
+    tj_buffer_reset(data->source);
+    assert_true(tj_buffer_appendString(data->source, "$/A$"));
+    assert_null(tj_template_compile(data->source));
+}
+
+static void test_escape(void **state) {
+    struct data *data = *state;
+
+    assert_true(tj_buffer_appendString(
+                data->source, "<p>$HTML</p> {\"v\": \"$JSON\"} echo $SHELL."));
+    assert_true(tj_template_variables_setFromString(
+                data->vars, "HTML", "Tom & \"Jerry's\" <cheese> is tasty"));
+    assert_true(tj_template_variables_setFromString(
+                data->vars, "JSON", "a \"quoted\"\\path\n\x01 line"));
+    assert_true(tj_template_variables_setFromString(
+                data->vars, "SHELL", "it's $(rm -rf)"));
+    tj_template_variables_setEscape(data->vars, "HTML",
+                                    TJ_TEMPLATE_ESCAPE_HTML);
+    tj_template_variables_setEscape(data->vars, "JSON",
+                                    TJ_TEMPLATE_ESCAPE_JSON);
+    tj_template_variables_setEscape(data->vars, "SHELL",
+                                    TJ_TEMPLATE_ESCAPE_SHELL);
+
+    assert_true(tj_template_variables_apply(
+                data->vars, data->target, data->source));
+
+    assert_string_equal(tj_buffer_getAsString(data->target),
+                "<p>Tom &amp; &quot;Jerry&#39;s&quot; &lt;cheese&gt; is tasty"
+                "</p> {\"v\": \"a \\\"quoted\\\"\\\\path\\n\\u0001 line\"}"
+                " echo 'it'\\''s $(rm -rf)'.");
+}
+
+static void test_escape_recurse(void **state) {
+    struct data *data = *state;
+
+    assert_true(tj_buffer_appendString(data->source, "$OUTER"));
+    assert_true(tj_template_variables_setFromString(
+                data->vars, "OUTER", "<b>$INNER</b>$RAW."));
+    assert_true(tj_template_variables_setFromString(
+                data->vars, "INNER", "a&b"));
+    assert_true(tj_template_variables_setFromString(
+                data->vars, "RAW", "\""));
+    tj_template_variables_setRecurse(data->vars, "OUTER", 1);
+    tj_template_variables_setEscape(data->vars, "OUTER",
+                                    TJ_TEMPLATE_ESCAPE_HTML);
+    tj_template_variables_setEscape(data->vars, "RAW",
+                                    TJ_TEMPLATE_ESCAPE_JSON);
+
+    compile_apply(data, "$OUTER");
+    assert_string_equal(tj_buffer_getAsString(data->target),
+                "&lt;b&gt;a&amp;b&lt;/b&gt;\\\".");
+}
+
+static void test_measure(void **state) {
+    struct data *data = *state;
+    tj_template_variables *item;
+    tj_template *tmpl;
+    tj_buffer_byte out[64];
+    size_t n, used;
+    int i;
+
+    assert_true(tj_template_variables_setFromString(data->vars, "X", "<&>"));
+    tj_template_variables_setEscape(data->vars, "X", TJ_TEMPLATE_ESCAPE_HTML);
+    item = tj_template_variables_addItem(data->vars, "L");
+    assert_non_null(item);
+    assert_true(tj_template_variables_setFromString(item, "Y", "yy"));
+    assert_non_null(tj_template_variables_addItem(data->vars, "L"));
+
+    assert_true(tj_buffer_appendString(data->source, "a$X b$#L$[$Y]$/L$"));
+    assert_true(tj_template_variables_measure(data->vars, data->source, &n));
+    assert_int_equal(n, 29);
+
+    assert_true(tj_buffer_appendString(data->target, "x"));
+    assert_true(tj_template_variables_apply(
+                data->vars, data->target, data->source));
+    assert_int_equal(tj_buffer_getUsed(data->target), 31);
+    assert_int_equal(tj_buffer_getAllocated(data->target), 31);
+    assert_memory_equal(tj_buffer_getBytesAtIndex(data->target, 2),
+                        "a&lt;&amp;&gt; b$#L$[$Y]$/L$", 29);
+
+    //-- More runs than start on the stack, through a recursive variable
+    assert_true(tj_template_variables_setFromString(data->vars, "R", "($X)"));
+    tj_template_variables_setRecurse(data->vars, "R", 1);
+    tj_buffer_reset(data->source);
+    tj_buffer_reset(data->target);
+    for (i = 0; i < 40; i++)
+      assert_true(tj_buffer_append(data->source,
+                                   (const tj_buffer_byte *) "-$R.$$", 6));
+    assert_true(tj_template_variables_measure(data->vars, data->source, &n));
+    assert_int_equal(n, 40 * 18);
+    assert_true(tj_template_variables_apply(
+                data->vars, data->target, data->source));
+    assert_int_equal(tj_buffer_getUsed(data->target), n);
+    for (i = 0; i < 40; i++)
+      assert_memory_equal(tj_buffer_getBytes(data->target) + i * 18,
+                          "-(&lt;&amp;&gt;).$", 18);
+    tj_buffer_reset(data->source);
+    assert_true(tj_buffer_appendString(data->source, "a$X b$#L$[$Y]$/L$"));
+
+    tmpl = tj_template_compile(data->source);
+    assert_non_null(tmpl);
+    assert_true(tj_template_measure(tmpl, data->vars, &n));
+    assert_int_equal(n, 25);
+
+    assert_true(tj_template_render(tmpl, data->vars, out, n, &used));
+    assert_int_equal(used, n);
+    assert_memory_equal(out, "a&lt;&amp;&gt; b[yy][$Y]", n);
+
+    assert_false(tj_template_render(tmpl, data->vars, out, n-1, &used));
+    tj_template_finalize(tmpl);
+}
+
+static void test_child(void **state) {
+    struct data *data = *state;
+    tj_template_variables *child, *grandchild;
+    tj_template *tmpl;
+
+    assert_true(tj_template_variables_setFromString(data->vars, "A", "a"));
+    assert_true(tj_template_variables_setFromString(data->vars, "B", "<b>"));
+    assert_true(tj_template_variables_setFromString(data->vars, "C", "[$A]"));
+    assert_non_null(tj_template_variables_addItem(data->vars, "L"));
+    tj_template_variables_setEscape(data->vars, "B", TJ_TEMPLATE_ESCAPE_HTML);
+
+    child = tj_template_variables_createChild(data->vars);
+    assert_non_null(child);
+    assert_true(tj_template_variables_setFromString(child, "B", "<B>"));
+    tj_template_variables_setRecurse(child, "C", 1);
+
+    grandchild = tj_template_variables_createChild(child);
+    assert_non_null(grandchild);
+    assert_true(tj_template_variables_setFromString(grandchild, "A", "g"));
+
+    assert_true(tj_buffer_appendString(data->source,
+                                       "$A $B $C $#L$l$/L$"));
+    tmpl = tj_template_compile(data->source);
+    assert_non_null(tmpl);
+
+    assert_true(tj_template_apply(tmpl, data->vars, data->target));
+    assert_string_equal(tj_buffer_getAsString(data->target),
+                        "a &lt;b&gt; [$A] l");
+
+    tj_buffer_reset(data->target);
+    assert_true(tj_template_apply(tmpl, child, data->target));
+    assert_string_equal(tj_buffer_getAsString(data->target),
+                        "a &lt;B&gt; [a] l");
+
+    tj_buffer_reset(data->target);
+    assert_true(tj_template_variables_apply(grandchild, data->target,
+                                            data->source));
+    assert_string_equal(tj_buffer_getAsString(data->target),
+                        "g &lt;B&gt; [g] $#L$l$/L$");
+
+    tj_template_finalize(tmpl);
+    tj_template_variables_finalize(grandchild);
+    tj_template_variables_finalize(child);
+
+    tj_buffer_reset(data->target);
+    assert_true(tj_template_variables_apply(data->vars, data->target,
+                                            data->source));
+    assert_string_equal(tj_buffer_getAsString(data->target),
+                        "a &lt;b&gt; [$A] $#L$l$/L$");
+}
+
+static void test_snapshot(void **state) {
+    struct data *data = *state;
+    char filename[] = "/tmp/test-tj_template-XXXXXX";
+    const char *names[] = { "page", "list" };
+    tj_template *tmpls[2], *tmpl;
+    tj_template_variables *child, *vars;
+    tj_template_snapshot *snap;
+    tj_buffer *snapshot;
+    FILE *fh;
+    int fd;
+
+    assert_true(tj_template_variables_setFromString(data->vars, "A", "a"));
+    assert_true(tj_template_variables_setFromString(data->vars, "B", "<b>"));
+    tj_template_variables_setEscape(data->vars, "B", TJ_TEMPLATE_ESCAPE_HTML);
+    child = tj_template_variables_createChild(data->vars);
+    assert_non_null(child);
+    assert_true(tj_template_variables_setFromString(child, "A", "[$B]"));
+    tj_template_variables_setRecurse(child, "A", 1);
+
+    assert_true(tj_buffer_appendString(data->source, "$A $B $$"));
+    tmpls[0] = tj_template_compile(data->source);
+    assert_non_null(tmpls[0]);
+    tj_buffer_reset(data->source);
+    assert_true(tj_buffer_appendString(data->source, "$#L$x$/L$$^L$none$/L$"));
+    tmpls[1] = tj_template_compile(data->source);
+    assert_non_null(tmpls[1]);
+
+    snapshot = tj_buffer_create(0);
+    assert_non_null(snapshot);
+    assert_true(tj_template_snapshot_write(snapshot, names, tmpls, 2, child));
+    tj_template_finalize(tmpls[0]);
+    tj_template_finalize(tmpls[1]);
+    tj_template_variables_finalize(child);
+
+    fd = mkstemp(filename);
+    assert_true(fd != -1);
+    fh = fdopen(fd, "w");
+    assert_non_null(fh);
+    assert_int_equal(fwrite(tj_buffer_getBytes(snapshot), 1,
+                            tj_buffer_getUsed(snapshot), fh),
+                     tj_buffer_getUsed(snapshot));
+    fclose(fh);
+
+    snap = tj_template_snapshot_open(filename);
+    unlink(filename);
+    assert_non_null(snap);
+    assert_null(tj_template_snapshot_getTemplate(snap, "missing"));
+
+    vars = tj_template_snapshot_createVariables(snap);
+    assert_non_null(vars);
+
+    tmpl = tj_template_snapshot_getTemplate(snap, "page");
+    assert_non_null(tmpl);
+    assert_true(tj_template_apply(tmpl, vars, data->target));
+    assert_string_equal(tj_buffer_getAsString(data->target),
+                        "[&lt;b&gt;] &lt;b&gt; $");
+    tj_template_finalize(tmpl);
+
+    tmpl = tj_template_snapshot_getTemplate(snap, "list");
+    assert_non_null(tmpl);
+    tj_buffer_reset(data->target);
+    assert_true(tj_template_apply(tmpl, vars, data->target));
+    assert_string_equal(tj_buffer_getAsString(data->target), "none");
+
+    tj_template_variables_finalize(vars);
+    tj_template_snapshot_finalize(snap);
+
+    //-- Damaged snapshots are refused
+    tj_buffer_getBytes(snapshot)[0] ^= 1;
+    assert_null(tj_template_snapshot_openBytes(tj_buffer_getBytes(snapshot),
+                                               tj_buffer_getUsed(snapshot)));
+    tj_buffer_getBytes(snapshot)[0] ^= 1;
+    assert_null(tj_template_snapshot_openBytes(tj_buffer_getBytes(snapshot),
+                                               64));
+    snap = tj_template_snapshot_openBytes(tj_buffer_getBytes(snapshot),
+                                          tj_buffer_getUsed(snapshot));
+    assert_non_null(snap);
+    tj_template_snapshot_finalize(snap);
+
+    tj_buffer_finalize(snapshot);
+}
+
+/*
+ * Finds the compiled code of "$#L$$#M$y$/M$$/L$" within a snapshot,
+ * by way of its first section instruction: op, label offset and
+ * length, and closing instruction.
+ */
+static uint32_t *find_code(tj_buffer *snapshot) {
+    const uint32_t section[4] = { 3, 2, 1, 7 };
+    tj_buffer_byte *bytes = tj_buffer_getBytes(snapshot);
+    size_t i;
+
+    for (i = 16; i+16 <= tj_buffer_getUsed(snapshot); i += 4) {
+        if (!memcmp(&bytes[i], section, 16))
+            return (uint32_t *) &bytes[i-16];
+    }
+    return 0;
+}
+
+static void test_snapshot_damaged(void **state) {
+    struct data *data = *state;
+    const char *names[] = { "nested" };
+    tj_template *tmpl;
+    tj_template_snapshot *snap;
+    tj_buffer *snapshot;
+    uint32_t *code;
+
+    assert_true(tj_buffer_appendString(data->source, "$#L$$#M$y$/M$$/L$"));
+    tmpl = tj_template_compile(data->source);
+    assert_non_null(tmpl);
+    snapshot = tj_buffer_create(0);
+    assert_non_null(snapshot);
+    assert_true(tj_template_snapshot_write(snapshot, names, &tmpl, 1,
+                                           data->vars));
+    tj_template_finalize(tmpl);
+
+    code = find_code(snapshot);
+    assert_non_null(code);
+    snap = tj_template_snapshot_openBytes(tj_buffer_getBytes(snapshot),
+                                          tj_buffer_getUsed(snapshot));
+    assert_non_null(snap);
+    tj_template_snapshot_finalize(snap);
+
+    //-- Blocks closed out of order
+    assert_int_equal(code[4*1+3], 7);
+    assert_int_equal(code[4*3+3], 5);
+    code[4*1+3] = 5;
+    code[4*3+3] = 7;
+    code[4*5+1] = 1;
+    code[4*7+1] = 3;
+    assert_null(tj_template_snapshot_openBytes(tj_buffer_getBytes(snapshot),
+                                               tj_buffer_getUsed(snapshot)));
+    code[4*1+3] = 7;
+    code[4*3+3] = 5;
+    code[4*5+1] = 3;
+    code[4*7+1] = 1;
+
+    //-- Text flushed from before the end of a block
+    assert_int_equal(code[4*8], 2);
+    code[4*8+1] = 0;
+    assert_null(tj_template_snapshot_openBytes(tj_buffer_getBytes(snapshot),
+                                               tj_buffer_getUsed(snapshot)));
+
+    tj_buffer_finalize(snapshot);
+}
+
 int main(int argc, char *argv[]) {
     const UnitTest tests[] = {
         unit_test_setup_teardown(test_1, setup, teardown),
         unit_test_setup_teardown(test_2, setup, teardown),
         unit_test_setup_teardown(test_3, setup, teardown),
         unit_test_setup_teardown(test_4, setup, teardown),
+        unit_test_setup_teardown(test_compile_plain, setup, teardown),
+        unit_test_setup_teardown(test_compile_section, setup, teardown),
+        unit_test_setup_teardown(test_compile_list, setup, teardown),
+        unit_test_setup_teardown(test_compile_unbalanced, setup, teardown),
+        unit_test_setup_teardown(test_escape, setup, teardown),
+        unit_test_setup_teardown(test_escape_recurse, setup, teardown),
+        unit_test_setup_teardown(test_measure, setup, teardown),
+        unit_test_setup_teardown(test_child, setup, teardown),
+        unit_test_setup_teardown(test_snapshot, setup, teardown),
+        unit_test_setup_teardown(test_snapshot_damaged, setup, teardown),
     };
 
     return run_tests(tests);
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmocka.h"
+
+#include "tj_trace.h"
+
+static int count(const char *s, const char *needle) {
+    int n = 0;
+
+    while ((s = strstr(s, needle)) != NULL) {
+        n++;
+        s += strlen(needle);
+    }
+
+    return n;
+}
+
+static int scoped(int fail) {
+    TJ_TRACE_SCOPE("scoped");
+
+    if (fail)
+        return 0;
+
+    TJ_TRACE_BEGIN("inner");
+    TJ_TRACE_END("inner");
+    return 1;
+}
+
+static void *span_thread(void *arg) {
+    int i;
+
+    for (i = 0; i < 10; i++)
+        scoped(i % 2);
+
+    return NULL;
+}
+
+static void test_spans(void **state) {
+    pthread_t thread;
+    tj_buffer *b;
+    const char *s;
+
+    tj_trace_clear();
+
+    //-- Nothing is recorded until enabled
+    scoped(0);
+    tj_trace_setEnabled(1);
+
+    assert_false(pthread_create(&thread, NULL, &span_thread, NULL));
+    pthread_join(thread, NULL);
+    scoped(0);
+    scoped(1);
+
+    b = tj_buffer_create(0);
+    assert_non_null(b);
+    assert_true(tj_trace_write(b));
+    s = tj_buffer_getAsString(b);
+
+    assert_int_equal(strncmp(s, "{\"displayTimeUnit\":\"ns\","
+                             "\"traceEvents\":[{\"name\":\"", 47), 0);
+    assert_int_equal(s[strlen(s)-1], '}');
+    assert_int_equal(count(s, "\"name\":\"scoped\",\"ph\":\"B\""), 12);
+    assert_int_equal(count(s, "\"name\":\"scoped\",\"ph\":\"E\""), 12);
+    assert_int_equal(count(s, "\"name\":\"inner\",\"ph\":\"B\""), 6);
+    assert_int_equal(count(s, "\"name\":\"inner\",\"ph\":\"E\""), 6);
+    assert_non_null(strstr(s, "\"ts\":"));
+
+    //-- Clearing drops everything, and exited threads' rings
+    tj_trace_clear();
+    tj_buffer_reset(b);
+    assert_true(tj_trace_write(b));
+    assert_string_equal(tj_buffer_getAsString(b),
+                        "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[]}");
+
+    tj_trace_setEnabled(0);
+    tj_buffer_finalize(b);
+}
+
+static void test_wrap(void **state) {
+    tj_buffer *b;
+    int i;
+
+    tj_trace_clear();
+    tj_trace_setEnabled(1);
+
+    //-- Only the most recent events are kept
+    TJ_TRACE_BEGIN("old");
+    for (i = 0; i < TJ_TRACE_EVENTS; i++)
+        TJ_TRACE_BEGIN("new");
+    tj_trace_setEnabled(0);
+
+    b = tj_buffer_create(0);
+    assert_non_null(b);
+    assert_true(tj_trace_write(b));
+    assert_null(strstr(tj_buffer_getAsString(b), "\"old\""));
+    assert_int_equal(count(tj_buffer_getAsString(b), "\"new\""),
+                     TJ_TRACE_EVENTS);
+
+    tj_buffer_finalize(b);
+    tj_trace_clear();
+}
+
+static void test_instrumented(void **state) {
+    tj_buffer *b, *file;
+
+    tj_trace_clear();
+    tj_trace_setEnabled(1);
+
+    file = tj_buffer_create(0);
+    assert_non_null(file);
+    assert_true(tj_buffer_appendFile(file, "wscript"));
+    assert_false(tj_buffer_appendFile(file, "/nonexistent/file"));
+    tj_buffer_finalize(file);
+    tj_trace_setEnabled(0);
+
+    b = tj_buffer_create(0);
+    assert_non_null(b);
+    assert_true(tj_trace_write(b));
+    assert_int_equal(count(tj_buffer_getAsString(b),
+                           "\"tj_buffer_appendFile\",\"ph\":\"E\""), 2);
+
+    tj_buffer_finalize(b);
+    tj_trace_clear();
+}
+
+int main(int argc, char **argv) {
+    const UnitTest tests[] = {
+        unit_test(test_spans),
+        unit_test(test_wrap),
+        unit_test(test_instrumented),
+    };
+
+    return run_tests(tests);
+}
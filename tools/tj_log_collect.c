@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * tj_log_collect drains the shared memory log rings written by
+ * tj_log_shm channels, merging their records by time.
+ *
+ *   tj_log_collect [-f] [-u] [-p prefix] [-d dbfile]
+ *
+ *   -f  Keep polling for new records and rings.
+ *   -u  Remove rings once drained, if their writer has exited.
+ *   -p  Collect rings in /dev/shm whose names start with prefix,
+ *       "tj_log." by default.
+ *   -d  Write records to a tj_log_sqlite database instead of stdout.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <uthash.h>
+
+#include "tj_log_shm.h"
+#ifdef TJ_LOG_COLLECT_SQLITE
+#include "tj_log_sqlite.h"
+#endif
+
+#define TJ_LOG_COLLECT_POLL_US 100000
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+typedef struct {
+  char *m_name;
+  tj_log_shm_reader *m_reader;
+  int m_seen;
+  UT_hash_handle hh;
+} tj_log_collect_ring;
+
+typedef struct {
+  tj_log_shm_entry m_entry;
+  char *m_strings;
+} tj_log_collect_entry;
+
+static tj_log_collect_ring *g_rings = 0;
+static tj_log_collect_entry *g_entries = 0;
+static size_t g_count = 0, g_allocated = 0;
+
+//----------------------------------------------------------------------
+static int
+tj_log_collect_keep(const tj_log_shm_entry *e)
+{
+  size_t nc = strlen(e->m_component)+1, nf = strlen(e->m_file)+1,
+    nu = strlen(e->m_func)+1, nm = strlen(e->m_msg)+1;
+  tj_log_collect_entry *x, *t;
+  char *s;
+
+  if (g_count == g_allocated) {
+    g_allocated = g_allocated ? g_allocated*2 : 256;
+    if ((t = realloc(g_entries, g_allocated * sizeof(*t))) == 0) {
+      fprintf(stderr, "No memory for collected records.\n");
+      return 0;
+    }
+    g_entries = t;
+  }
+
+  if ((s = malloc(nc + nf + nu + nm)) == 0) {
+    fprintf(stderr, "No memory for collected records.\n");
+    return 0;
+  }
+
+  x = &g_entries[g_count++];
+  x->m_entry = *e;
+  x->m_strings = s;
+  x->m_entry.m_component = memcpy(s, e->m_component, nc);
+  x->m_entry.m_file = memcpy(s += nc, e->m_file, nf);
+  x->m_entry.m_func = memcpy(s += nf, e->m_func, nu);
+  x->m_entry.m_msg = memcpy(s += nu, e->m_msg, nm);
+
+  return 1;
+  // end tj_log_collect_keep
+}
+
+static int
+tj_log_collect_compare(const void *a, const void *b)
+{
+  const tj_log_shm_entry *x = a, *y = b;
+  return (x->m_time > y->m_time) - (x->m_time < y->m_time);
+  // end tj_log_collect_compare
+}
+
+static void
+tj_log_collect_emit(int useLog)
+{
+  tj_log_shm_entry *e;
+  struct tm timeinfo;
+  time_t secs;
+  char date[20];
+  size_t i;
+
+  qsort(g_entries, g_count, sizeof(*g_entries), &tj_log_collect_compare);
+
+  for (i = 0; i < g_count; i++) {
+    e = &g_entries[i].m_entry;
+    if (useLog) {
+      tj_log_log(e->m_level, e->m_component, e->m_file, e->m_func,
+                 e->m_line, 0, "%s", e->m_msg);
+    } else {
+      secs = e->m_time / 1000000000;
+      localtime_r(&secs, &timeinfo);
+      strftime(date, sizeof(date), "%Y/%m/%d %H:%M:%S", &timeinfo);
+      printf("%s.%06u %u/%u [%s] %s %s:%s:%d: %s\n", date,
+             (unsigned) (e->m_time % 1000000000 / 1000),
+             e->m_pid, e->m_tid, tj_log_level_labels[e->m_level],
+             e->m_component, e->m_file, e->m_func, e->m_line, e->m_msg);
+    }
+    free(g_entries[i].m_strings);
+  }
+
+  g_count = 0;
+  fflush(stdout);
+  // end tj_log_collect_emit
+}
+
+//----------------------------------------------------------------------
+static void
+tj_log_collect_scan(const char *prefix)
+{
+  tj_log_collect_ring *ring;
+  struct dirent *ent;
+  char name[NAME_MAX+2];
+  DIR *dir;
+
+  if ((dir = opendir("/dev/shm")) == 0) {
+    fprintf(stderr, "Could not list /dev/shm: %s\n", strerror(errno));
+    return;
+  }
+
+  for (ring = g_rings; ring != 0; ring = ring->hh.next)
+    ring->m_seen = 0;
+
+  while ((ent = readdir(dir)) != 0) {
+    if (strncmp(ent->d_name, prefix, strlen(prefix)))
+      continue;
+    snprintf(name, sizeof(name), "/%s", ent->d_name);
+
+    HASH_FIND_STR(g_rings, name, ring);
+    if (ring == 0) {
+      if ((ring = calloc(1, sizeof(*ring))) == 0 ||
+          (ring->m_name = strdup(name)) == 0 ||
+          (ring->m_reader = tj_log_shm_reader_open(name)) == 0) {
+        if (ring != 0)
+          free(ring->m_name);
+        free(ring);
+        continue;
+      }
+      HASH_ADD_KEYPTR(hh, g_rings, ring->m_name, strlen(ring->m_name), ring);
+    }
+    ring->m_seen = 1;
+  }
+
+  closedir(dir);
+  // end tj_log_collect_scan
+}
+
+static void
+tj_log_collect_drain(int unlinkDead)
+{
+  tj_log_collect_ring *ring, *tmp;
+  tj_log_shm_entry e;
+  int alive;
+
+  HASH_ITER(hh, g_rings, ring, tmp) {
+    alive = (kill(tj_log_shm_reader_getPid(ring->m_reader), 0) == 0 ||
+             errno == EPERM);
+
+    for (;;) {
+      while (tj_log_shm_reader_next(ring->m_reader, &e)) {
+        if (!tj_log_collect_keep(&e))
+          break;
+      }
+
+      //-- A dead writer may have left a record reserved but unwritten
+      if (alive)
+        break;
+      tj_log_shm_reader_skip(ring->m_reader);
+      if (!tj_log_shm_reader_next(ring->m_reader, &e))
+        break;
+      tj_log_collect_keep(&e);
+    }
+
+    if (!ring->m_seen || (!alive && unlinkDead)) {
+      if (ring->m_seen)
+        shm_unlink(ring->m_name);
+      HASH_DEL(g_rings, ring);
+      tj_log_shm_reader_finalize(ring->m_reader);
+      free(ring->m_name);
+      free(ring);
+    }
+  }
+  // end tj_log_collect_drain
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+int
+main(int argc, char *argv[])
+{
+  const char *prefix = "tj_log.", *dbfile = 0;
+  int follow = 0, unlinkDead = 0, c;
+
+  while ((c = getopt(argc, argv, "fup:d:")) != -1) {
+    switch (c) {
+    case 'f': follow = 1; break;
+    case 'u': unlinkDead = 1; break;
+    case 'p': prefix = optarg; break;
+    case 'd': dbfile = optarg; break;
+    default:
+      fprintf(stderr,
+              "Usage: %s [-f] [-u] [-p prefix] [-d dbfile]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (dbfile != 0) {
+#ifdef TJ_LOG_COLLECT_SQLITE
+    tj_log_outchannel *out;
+    if ((out = tj_log_sqlite_create(dbfile)) == 0)
+      return 1;
+    tj_log_removePrintfChannel();
+    tj_log_addOutChannel(out);
+#else
+    fprintf(stderr, "Built without sqlite support.\n");
+    return 1;
+#endif
+  }
+
+  do {
+    tj_log_collect_scan(prefix);
+    tj_log_collect_drain(unlinkDead);
+    tj_log_collect_emit(dbfile != 0);
+    if (follow)
+      usleep(TJ_LOG_COLLECT_POLL_US);
+  } while (follow);
+
+  return 0;
+  // end main
+}
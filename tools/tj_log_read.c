@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2013 Joe Kopena <tjkopena@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * tj_log_read decodes the segment files written by tj_log_segment
+ * channels, starting from the given segment and moving on through
+ * the ones after it.
+ *
+ *   tj_log_read [-f] segment
+ *
+ *   -f  Keep following the segments as they are written.
+ *
+ * Reading stops at a segment from another writer sharing the name.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tj_log_segment.h"
+
+#define TJ_LOG_READ_POLL_US 100000
+
+static volatile sig_atomic_t g_stop = 0;
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+static void
+tj_log_read_stop(int sig)
+{
+  g_stop = 1;
+  // end tj_log_read_stop
+}
+
+static void
+tj_log_read_print(const tj_log_segment_entry *e)
+{
+  struct tm timeinfo;
+  time_t secs;
+  char date[20];
+
+  secs = e->m_time / 1000000000;
+  localtime_r(&secs, &timeinfo);
+  strftime(date, sizeof(date), "%Y/%m/%d %H:%M:%S", &timeinfo);
+  printf("%s.%06u %u [%s] %s %s:%s:%d: %s\n", date,
+         (unsigned) (e->m_time % 1000000000 / 1000), (unsigned) e->m_pid,
+         tj_log_level_labels[e->m_level], e->m_component, e->m_file,
+         e->m_func, e->m_line, e->m_msg);
+  // end tj_log_read_print
+}
+
+//----------------------------------------------------------------------
+//----------------------------------------------------------------------
+int
+main(int argc, char *argv[])
+{
+  tj_log_segment_reader *reader;
+  tj_log_segment_entry e;
+  int follow = 0, stopped, c;
+
+  while ((c = getopt(argc, argv, "f")) != -1) {
+    switch (c) {
+    case 'f': follow = 1; break;
+    default:
+      optind = argc;
+      break;
+    }
+  }
+
+  if (optind != argc - 1) {
+    fprintf(stderr, "Usage: %s [-f] segment\n", argv[0]);
+    return 1;
+  }
+
+  if ((reader = tj_log_segment_reader_open(argv[optind])) == 0)
+    return 1;
+
+  signal(SIGINT, &tj_log_read_stop);
+  signal(SIGTERM, &tj_log_read_stop);
+
+  do {
+    while (tj_log_segment_reader_next(reader, &e))
+      tj_log_read_print(&e);
+    fflush(stdout);
+    if (follow)
+      usleep(TJ_LOG_READ_POLL_US);
+  } while (follow && !g_stop && !tj_log_segment_reader_isStopped(reader));
+
+  if (tj_log_segment_reader_getLost(reader) != 0)
+    fprintf(stderr, "%lu records lost.\n",
+            tj_log_segment_reader_getLost(reader));
+
+  stopped = tj_log_segment_reader_isStopped(reader);
+  tj_log_segment_reader_finalize(reader);
+  return stopped;
+  // end main
+}